@@ -24,8 +24,15 @@
 #include "util/common.h"
 #include <botan/loadstor.h>
 #include <botan/rotate.h>
+#include <algorithm>
+#include <limits>
 #include <stdexcept>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHACHA_SIMD_X86
+#include <immintrin.h>
+#endif
+
 using namespace QSS;
 using namespace Botan;
 
@@ -41,16 +48,251 @@ static inline void chacha_quarter_round(uint32_t &a,
     c += d; b ^= c; b = rotate_left(b, 7);
 }
 
+// Generates one 64-byte block of key stream (the scalar fallback)
+void chacha_block(const uint32_t *input, unsigned char *output)
+{
+    uint32_t x00 = input[ 0], x01 = input[ 1], x02 = input[ 2], x03 = input[ 3],
+             x04 = input[ 4], x05 = input[ 5], x06 = input[ 6], x07 = input[ 7],
+             x08 = input[ 8], x09 = input[ 9], x10 = input[10], x11 = input[11],
+             x12 = input[12], x13 = input[13], x14 = input[14], x15 = input[15];
+    for (uint32_t i = 0; i != 10; ++i) {
+        chacha_quarter_round(x00, x04, x08, x12);
+        chacha_quarter_round(x01, x05, x09, x13);
+        chacha_quarter_round(x02, x06, x10, x14);
+        chacha_quarter_round(x03, x07, x11, x15);
+
+        chacha_quarter_round(x00, x05, x10, x15);
+        chacha_quarter_round(x01, x06, x11, x12);
+        chacha_quarter_round(x02, x07, x08, x13);
+        chacha_quarter_round(x03, x04, x09, x14);
+    }
+
+     store_le(x00 + input[ 0], output + 4 *  0);
+     store_le(x01 + input[ 1], output + 4 *  1);
+     store_le(x02 + input[ 2], output + 4 *  2);
+     store_le(x03 + input[ 3], output + 4 *  3);
+     store_le(x04 + input[ 4], output + 4 *  4);
+     store_le(x05 + input[ 5], output + 4 *  5);
+     store_le(x06 + input[ 6], output + 4 *  6);
+     store_le(x07 + input[ 7], output + 4 *  7);
+     store_le(x08 + input[ 8], output + 4 *  8);
+     store_le(x09 + input[ 9], output + 4 *  9);
+     store_le(x10 + input[10], output + 4 * 10);
+     store_le(x11 + input[11], output + 4 * 11);
+     store_le(x12 + input[12], output + 4 * 12);
+     store_le(x13 + input[13], output + 4 * 13);
+     store_le(x14 + input[14], output + 4 * 14);
+     store_le(x15 + input[15], output + 4 * 15);
+}
+
+#ifdef CHACHA_SIMD_X86
+/*
+ * The SIMD kernels below process 4, 8 or 16 blocks in parallel, with each
+ * vector holding the same state word of all blocks. The block counters
+ * (word 12) are state[12] + lane index. The caller makes sure the counter
+ * doesn't wrap around inside a batch so that word 13 is the same for all.
+ *
+ * If in isn't nullptr, the key stream is XORed with it on its way to
+ * output, so that whole batches of data don't go through a buffer.
+ *
+ * Lambdas and inline functions don't inherit the target attribute,
+ * hence the quarter round and the store are written as macros.
+ */
+#define CHACHA_SIMD_QUARTER_ROUND(ADD, XOR, ROTL16, ROTL12, ROTL8, ROTL7, a, b, c, d) \
+    a = ADD(a, b); d = XOR(d, a); d = ROTL16(d); \
+    c = ADD(c, d); b = XOR(b, c); b = ROTL12(b); \
+    a = ADD(a, b); d = XOR(d, a); d = ROTL8(d); \
+    c = ADD(c, d); b = XOR(b, c); b = ROTL7(b);
+
+// Stores 16 bytes of key stream v at offset, XORed with in if there's any
+#define CHACHA_SIMD_STORE(in, out, offset, v) \
+    _mm_storeu_si128(reinterpret_cast<__m128i*>((out) + (offset)), (in) \
+        ? _mm_xor_si128((v), _mm_loadu_si128(reinterpret_cast<const __m128i*>((in) + (offset)))) \
+        : (v))
+
+#define CHACHA_SIMD_DOUBLE_ROUNDS(QR, x) \
+    for (int i = 0; i != 10; ++i) { \
+        QR(x[0], x[4], x[8],  x[12]) \
+        QR(x[1], x[5], x[9],  x[13]) \
+        QR(x[2], x[6], x[10], x[14]) \
+        QR(x[3], x[7], x[11], x[15]) \
+        QR(x[0], x[5], x[10], x[15]) \
+        QR(x[1], x[6], x[11], x[12]) \
+        QR(x[2], x[7], x[8],  x[13]) \
+        QR(x[3], x[4], x[9],  x[14]) \
+    }
+
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - n))
+#define SSE2_ROTL16(v) SSE2_ROTL(v, 16)
+#define SSE2_ROTL12(v) SSE2_ROTL(v, 12)
+#define SSE2_ROTL8(v) SSE2_ROTL(v, 8)
+#define SSE2_ROTL7(v) SSE2_ROTL(v, 7)
+#define SSE2_QR(a, b, c, d) CHACHA_SIMD_QUARTER_ROUND(_mm_add_epi32, _mm_xor_si128, \
+    SSE2_ROTL16, SSE2_ROTL12, SSE2_ROTL8, SSE2_ROTL7, a, b, c, d)
+
+__attribute__((target("sse2")))
+void chacha_sse2_x4(const uint32_t *input, const unsigned char *in, unsigned char *output)
+{
+    __m128i x[16], s[16];
+    for (int i = 0; i < 16; ++i) {
+        s[i] = _mm_set1_epi32(static_cast<int>(input[i]));
+    }
+    s[12] = _mm_add_epi32(s[12], _mm_setr_epi32(0, 1, 2, 3));
+    for (int i = 0; i < 16; ++i) {
+        x[i] = s[i];
+    }
+
+    CHACHA_SIMD_DOUBLE_ROUNDS(SSE2_QR, x)
+
+    for (int g = 0; g < 4; ++g) {
+        // Transpose 4 words of 4 blocks so each vector holds 16 bytes of one block
+        const __m128i a0 = _mm_add_epi32(x[4 * g + 0], s[4 * g + 0]);
+        const __m128i a1 = _mm_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+        const __m128i a2 = _mm_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+        const __m128i a3 = _mm_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+        const __m128i u0 = _mm_unpacklo_epi32(a0, a1);
+        const __m128i u1 = _mm_unpackhi_epi32(a0, a1);
+        const __m128i u2 = _mm_unpacklo_epi32(a2, a3);
+        const __m128i u3 = _mm_unpackhi_epi32(a2, a3);
+        const unsigned char *data = in ? in + 16 * g : nullptr;
+        unsigned char *out = output + 16 * g;
+        CHACHA_SIMD_STORE(data, out, 64 * 0, _mm_unpacklo_epi64(u0, u2));
+        CHACHA_SIMD_STORE(data, out, 64 * 1, _mm_unpackhi_epi64(u0, u2));
+        CHACHA_SIMD_STORE(data, out, 64 * 2, _mm_unpacklo_epi64(u1, u3));
+        CHACHA_SIMD_STORE(data, out, 64 * 3, _mm_unpackhi_epi64(u1, u3));
+    }
+}
+
+#define AVX2_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - n))
+#define AVX2_ROTL16(v) _mm256_shuffle_epi8(v, rot16)
+#define AVX2_ROTL12(v) AVX2_ROTL(v, 12)
+#define AVX2_ROTL8(v) _mm256_shuffle_epi8(v, rot8)
+#define AVX2_ROTL7(v) AVX2_ROTL(v, 7)
+#define AVX2_QR(a, b, c, d) CHACHA_SIMD_QUARTER_ROUND(_mm256_add_epi32, _mm256_xor_si256, \
+    AVX2_ROTL16, AVX2_ROTL12, AVX2_ROTL8, AVX2_ROTL7, a, b, c, d)
+
+__attribute__((target("avx2")))
+void chacha_avx2_x8(const uint32_t *input, const unsigned char *in, unsigned char *output)
+{
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    __m256i x[16], s[16];
+    for (int i = 0; i < 16; ++i) {
+        s[i] = _mm256_set1_epi32(static_cast<int>(input[i]));
+    }
+    s[12] = _mm256_add_epi32(s[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    for (int i = 0; i < 16; ++i) {
+        x[i] = s[i];
+    }
+
+    CHACHA_SIMD_DOUBLE_ROUNDS(AVX2_QR, x)
+
+    for (int g = 0; g < 4; ++g) {
+        // Transpose within each 128-bit lane: the low lane holds blocks 0-3
+        // and the high lane holds blocks 4-7
+        const __m256i a0 = _mm256_add_epi32(x[4 * g + 0], s[4 * g + 0]);
+        const __m256i a1 = _mm256_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+        const __m256i a2 = _mm256_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+        const __m256i a3 = _mm256_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+        const __m256i u0 = _mm256_unpacklo_epi32(a0, a1);
+        const __m256i u1 = _mm256_unpackhi_epi32(a0, a1);
+        const __m256i u2 = _mm256_unpacklo_epi32(a2, a3);
+        const __m256i u3 = _mm256_unpackhi_epi32(a2, a3);
+        const __m256i r[4] = {
+            _mm256_unpacklo_epi64(u0, u2),
+            _mm256_unpackhi_epi64(u0, u2),
+            _mm256_unpacklo_epi64(u1, u3),
+            _mm256_unpackhi_epi64(u1, u3)
+        };
+        const unsigned char *data = in ? in + 16 * g : nullptr;
+        unsigned char *out = output + 16 * g;
+        for (int b = 0; b < 4; ++b) {
+            CHACHA_SIMD_STORE(data, out, 64 * b, _mm256_castsi256_si128(r[b]));
+            CHACHA_SIMD_STORE(data, out, 64 * (b + 4), _mm256_extracti128_si256(r[b], 1));
+        }
+    }
+}
+
+#define AVX512_ROTL16(v) _mm512_rol_epi32(v, 16)
+#define AVX512_ROTL12(v) _mm512_rol_epi32(v, 12)
+#define AVX512_ROTL8(v) _mm512_rol_epi32(v, 8)
+#define AVX512_ROTL7(v) _mm512_rol_epi32(v, 7)
+#define AVX512_QR(a, b, c, d) CHACHA_SIMD_QUARTER_ROUND(_mm512_add_epi32, _mm512_xor_si512, \
+    AVX512_ROTL16, AVX512_ROTL12, AVX512_ROTL8, AVX512_ROTL7, a, b, c, d)
+
+__attribute__((target("avx512f")))
+void chacha_avx512_x16(const uint32_t *input, const unsigned char *in, unsigned char *output)
+{
+    __m512i x[16], s[16];
+    for (int i = 0; i < 16; ++i) {
+        s[i] = _mm512_set1_epi32(static_cast<int>(input[i]));
+    }
+    s[12] = _mm512_add_epi32(s[12], _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                                      8, 9, 10, 11, 12, 13, 14, 15));
+    for (int i = 0; i < 16; ++i) {
+        x[i] = s[i];
+    }
+
+    CHACHA_SIMD_DOUBLE_ROUNDS(AVX512_QR, x)
+
+    for (int g = 0; g < 4; ++g) {
+        // Transpose within each 128-bit lane: lane k holds blocks 4k to 4k+3
+        const __m512i a0 = _mm512_add_epi32(x[4 * g + 0], s[4 * g + 0]);
+        const __m512i a1 = _mm512_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+        const __m512i a2 = _mm512_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+        const __m512i a3 = _mm512_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+        const __m512i u0 = _mm512_unpacklo_epi32(a0, a1);
+        const __m512i u1 = _mm512_unpackhi_epi32(a0, a1);
+        const __m512i u2 = _mm512_unpacklo_epi32(a2, a3);
+        const __m512i u3 = _mm512_unpackhi_epi32(a2, a3);
+        const __m512i r[4] = {
+            _mm512_unpacklo_epi64(u0, u2),
+            _mm512_unpackhi_epi64(u0, u2),
+            _mm512_unpacklo_epi64(u1, u3),
+            _mm512_unpackhi_epi64(u1, u3)
+        };
+        const unsigned char *data = in ? in + 16 * g : nullptr;
+        unsigned char *out = output + 16 * g;
+        for (int b = 0; b < 4; ++b) {
+            CHACHA_SIMD_STORE(data, out, 64 * b, _mm512_extracti32x4_epi32(r[b], 0));
+            CHACHA_SIMD_STORE(data, out, 64 * (b + 4), _mm512_extracti32x4_epi32(r[b], 1));
+            CHACHA_SIMD_STORE(data, out, 64 * (b + 8), _mm512_extracti32x4_epi32(r[b], 2));
+            CHACHA_SIMD_STORE(data, out, 64 * (b + 12), _mm512_extracti32x4_epi32(r[b], 3));
+        }
+    }
+}
+#endif
+
+// The number of blocks generated by each generate() call
+size_t blocksPerCall(ChaCha::Implementation impl)
+{
+    switch (impl) {
+    case ChaCha::SSE2:
+        return 4;
+    case ChaCha::AVX2:
+        return 8;
+    case ChaCha::AVX512:
+        return 16;
+    default:
+        return 1;
+    }
+}
+
 }
 
-ChaCha::ChaCha(const std::string &_key, const std::string &_iv) :
-    m_position(0)
+ChaCha::ChaCha(const std::string &_key,
+               const std::string &_iv,
+               Implementation impl) :
+    m_position(0),
+    m_impl(isSupported(impl) ? impl : SCALAR)
 {
     const unsigned char *key =
             reinterpret_cast<const unsigned char*>(_key.data());
 
     m_state.resize(16);
-    m_buffer.resize(64);
+    m_buffer.resize(64 * blocksPerCall(m_impl));
 
     m_state[0] = 0x61707865;
     m_state[1] = 0x3320646e;
@@ -66,21 +308,57 @@ ChaCha::ChaCha(const std::string &_key, const std::string &_iv) :
     m_state[10] = load_le<uint32_t>(key, 6);
     m_state[11] = load_le<uint32_t>(key, 7);
 
-    setIV(_iv);
+    setIV(reinterpret_cast<const uint8_t*>(_iv.data()), _iv.length());
 }
 
-void ChaCha::setIV(const std::string &_iv)
+bool ChaCha::isSupported(Implementation impl)
 {
-    const unsigned char *iv =
-            reinterpret_cast<const unsigned char*>(_iv.data());
+#ifdef CHACHA_SIMD_X86
+    __builtin_cpu_init();
+    switch (impl) {
+    case SCALAR:
+        return true;
+    case SSE2:
+        return __builtin_cpu_supports("sse2");
+    case AVX2:
+        return __builtin_cpu_supports("avx2");
+    case AVX512:
+        return __builtin_cpu_supports("avx512f");
+    }
+    return false;
+#else
+    return impl == SCALAR;
+#endif
+}
 
+ChaCha::Implementation ChaCha::bestImplementation()
+{
+    // CPUID is only queried once
+    static const Implementation best = []() {
+        for (Implementation impl : {AVX512, AVX2, SSE2}) {
+            if (isSupported(impl)) {
+                return impl;
+            }
+        }
+        return SCALAR;
+    }();
+    return best;
+}
+
+ChaCha::Implementation ChaCha::implementation() const
+{
+    return m_impl;
+}
+
+void ChaCha::setIV(const uint8_t *iv, size_t length)
+{
     m_state[12] = 0;
     m_state[13] = 0;
 
-    if (_iv.length() == 8) {
+    if (length == 8) {
         m_state[14] = load_le<uint32_t>(iv, 0);
         m_state[15] = load_le<uint32_t>(iv, 1);
-    } else if (_iv.length() == 12) {
+    } else if (length == 12) {
         m_state[13] = load_le<uint32_t>(iv, 0);
         m_state[14] = load_le<uint32_t>(iv, 1);
         m_state[15] = load_le<uint32_t>(iv, 2);
@@ -88,71 +366,81 @@ void ChaCha::setIV(const std::string &_iv)
         throw std::length_error("The IV length for ChaCha20 is invalid");
     }
 
-    chacha();
+    // The next batch is generated on demand
+    m_position = m_buffer.size();
 }
 
-void ChaCha::chacha()
+void ChaCha::generate(const uint8_t *in, uint8_t *output)
 {
-    unsigned char *output = m_buffer.data();
-    const uint32_t *input = m_state.data();
-    uint32_t x00 = input[ 0], x01 = input[ 1], x02 = input[ 2], x03 = input[ 3],
-             x04 = input[ 4], x05 = input[ 5], x06 = input[ 6], x07 = input[ 7],
-             x08 = input[ 8], x09 = input[ 9], x10 = input[10], x11 = input[11],
-             x12 = input[12], x13 = input[13], x14 = input[14], x15 = input[15];
-    for (uint32_t i = 0; i != 10; ++i) {
-        chacha_quarter_round(x00, x04, x08, x12);
-        chacha_quarter_round(x01, x05, x09, x13);
-        chacha_quarter_round(x02, x06, x10, x14);
-        chacha_quarter_round(x03, x07, x11, x15);
+    const uint32_t blocks = m_buffer.size() / 64;
 
-        chacha_quarter_round(x00, x05, x10, x15);
-        chacha_quarter_round(x01, x06, x11, x12);
-        chacha_quarter_round(x02, x07, x08, x13);
-        chacha_quarter_round(x03, x04, x09, x14);
+    // Fall back to the scalar path if the 32-bit counter wraps in this batch
+    if (m_impl == SCALAR
+            || m_state[12] > std::numeric_limits<uint32_t>::max() - (blocks - 1)) {
+        // A block goes through ks first when XORing, as output may be in
+        unsigned char ks[64];
+        for (uint32_t i = 0; i < blocks; ++i) {
+            if (in) {
+                chacha_block(m_state.data(), ks);
+                Common::exclusive_or(ks, in + 64 * i, output + 64 * i, 64);
+            } else {
+                chacha_block(m_state.data(), output + 64 * i);
+            }
+            ++m_state[12];
+            m_state[13] += (m_state[12] == 0);
+        }
+        return;
     }
 
-     store_le(x00 + input[ 0], output + 4 *  0);
-     store_le(x01 + input[ 1], output + 4 *  1);
-     store_le(x02 + input[ 2], output + 4 *  2);
-     store_le(x03 + input[ 3], output + 4 *  3);
-     store_le(x04 + input[ 4], output + 4 *  4);
-     store_le(x05 + input[ 5], output + 4 *  5);
-     store_le(x06 + input[ 6], output + 4 *  6);
-     store_le(x07 + input[ 7], output + 4 *  7);
-     store_le(x08 + input[ 8], output + 4 *  8);
-     store_le(x09 + input[ 9], output + 4 *  9);
-     store_le(x10 + input[10], output + 4 * 10);
-     store_le(x11 + input[11], output + 4 * 11);
-     store_le(x12 + input[12], output + 4 * 12);
-     store_le(x13 + input[13], output + 4 * 13);
-     store_le(x14 + input[14], output + 4 * 14);
-     store_le(x15 + input[15], output + 4 * 15);
-
-     ++m_state[12];
-     m_state[13] += (m_state[12] == 0);
-     m_position = 0;
+#ifdef CHACHA_SIMD_X86
+    switch (m_impl) {
+    case SSE2:
+        chacha_sse2_x4(m_state.data(), in, output);
+        break;
+    case AVX2:
+        chacha_avx2_x8(m_state.data(), in, output);
+        break;
+    case AVX512:
+        chacha_avx512_x16(m_state.data(), in, output);
+        break;
+    default:
+        break;
+    }
+#endif
+    m_state[12] += blocks;
+    m_state[13] += (m_state[12] == 0);
 }
 
 std::string ChaCha::update(const uint8_t *in, size_t length)
 {
     std::string output;
     output.resize(length);
-    unsigned char *out = reinterpret_cast<unsigned char*>(&output[0]);
+    update(in, length, reinterpret_cast<uint8_t*>(&output[0]));
+    return output;
+}
+
+void ChaCha::update(const uint8_t *in, size_t length, uint8_t *out)
+{
+    const uint32_t buf_size = m_buffer.size();
 
-    uint32_t buf_size = m_buffer.size();
-    for (uint32_t delta = buf_size - m_position;
-         length >= delta;
-         delta = buf_size - m_position) {
-        Common::exclusive_or(m_buffer.data() + m_position, in, out, delta);
-        length -= delta;
-        in += delta;
-        out += delta;
-        chacha();
+    // Use up the key stream left over from the last call
+    const size_t left = std::min<size_t>(buf_size - m_position, length);
+    Common::exclusive_or(m_buffer.data() + m_position, in, out, left);
+    m_position += left;
+    length -= left;
+    in += left;
+    out += left;
+
+    // Whole batches are XORed inside the generator without buffering
+    for (; length >= buf_size; length -= buf_size, in += buf_size, out += buf_size) {
+        generate(in, out);
     }
 
-    Common::exclusive_or(m_buffer.data() + m_position, in, out, length);
-    m_position += length;
-    return output;
+    if (length > 0) {
+        generate(nullptr, m_buffer.data());
+        Common::exclusive_or(m_buffer.data(), in, out, length);
+        m_position = length;
+    }
 }
 
 std::string ChaCha::update(const std::string &input)
@@ -34,12 +34,20 @@ namespace QSS {
 class QSS_EXPORT ChaCha
 {
 public:
+    /*
+     * The key stream generators. SIMD implementations generate 4 (SSE2),
+     * 8 (AVX2) or 16 (AVX-512) blocks per call.
+     */
+    enum Implementation { SCALAR, SSE2, AVX2, AVX512 };
+
     /*
      * Key length must be 32 (16 is dropped)
      * IV length must be 8 or 12
+     * If impl is not supported by the CPU, the scalar implementation is used.
      */
     ChaCha(const std::string &_key,
-           const std::string &_iv);
+           const std::string &_iv,
+           Implementation impl = bestImplementation());
 
     ChaCha(const ChaCha &) = delete;
 
@@ -47,13 +55,31 @@ public:
     std::string update(const uint8_t *input, size_t length);
     std::string update(const std::string &input);
 
+    // output must hold at least length bytes. output may be the same as input
+    void update(const uint8_t *input, size_t length, uint8_t *output);
+
+    // Restarts the key stream from block 0 with a new IV (8 or 12 bytes)
+    void setIV(const uint8_t *iv, size_t length);
+
+    Implementation implementation() const;
+
+    // Whether the CPU supports the implementation
+    static bool isSupported(Implementation impl);
+    // The fastest implementation supported by the CPU (detected at runtime)
+    static Implementation bestImplementation();
+
 private:
     std::vector<uint32_t> m_state;
     std::vector<unsigned char> m_buffer;
     uint32_t m_position;
+    const Implementation m_impl;
 
-    void chacha();
-    void setIV(const std::string &_iv);
+    /*
+     * Generates the next batch of key stream blocks into output. If in isn't
+     * nullptr, output receives in XOR the key stream instead.
+     * output may be the same as in.
+     */
+    void generate(const uint8_t *in, uint8_t *output);
 };
 
 }
@@ -0,0 +1,421 @@
+/*
+ * chacha20poly1305.cpp - the source file of ChaCha20Poly1305 class
+ *
+ * The scalar Poly1305 is based on poly1305-donna (26-bit limbs)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "chacha20poly1305.h"
+#include <botan/loadstor.h>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define POLY1305_SIMD_X86
+#include <immintrin.h>
+#endif
+
+using namespace QSS;
+using namespace Botan;
+
+namespace {
+
+const size_t CHUNK_SIZE_LEN = 2;
+const uint16_t CHUNK_SIZE_MASK = 0x3FFF;
+const uint32_t LIMB_MASK = 0x3ffffff;
+
+// The 4-way SIMD Poly1305 is only worth its setup from this many blocks
+const size_t SIMD_MIN_BLOCKS = 16;
+// Messages up to this length are encrypted by the scalar ChaCha
+const size_t SHORT_MESSAGE_LENGTH = 128;
+
+// Increments a little-endian nonce, the same as Cipher::incrementIv()
+void nonceIncrement(uint8_t *nonce)
+{
+    for (size_t i = 0; i < ChaCha20Poly1305::NONCE_LENGTH && ++nonce[i] == 0; ++i) {
+    }
+}
+
+// h = h * r (mod 2^130 - 5), leaving h partially reduced
+void poly1305_multiply(uint32_t *h, const uint32_t *r)
+{
+    const uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+    const uint64_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+
+    uint64_t d0 = h0 * r[0] + h1 * s4 + h2 * s3 + h3 * s2 + h4 * s1;
+    uint64_t d1 = h0 * r[1] + h1 * r[0] + h2 * s4 + h3 * s3 + h4 * s2;
+    uint64_t d2 = h0 * r[2] + h1 * r[1] + h2 * r[0] + h3 * s4 + h4 * s3;
+    uint64_t d3 = h0 * r[3] + h1 * r[2] + h2 * r[1] + h3 * r[0] + h4 * s4;
+    uint64_t d4 = h0 * r[4] + h1 * r[3] + h2 * r[2] + h3 * r[1] + h4 * r[0];
+
+    uint32_t c;
+    c = static_cast<uint32_t>(d0 >> 26); h[0] = static_cast<uint32_t>(d0) & LIMB_MASK;
+    d1 += c; c = static_cast<uint32_t>(d1 >> 26); h[1] = static_cast<uint32_t>(d1) & LIMB_MASK;
+    d2 += c; c = static_cast<uint32_t>(d2 >> 26); h[2] = static_cast<uint32_t>(d2) & LIMB_MASK;
+    d3 += c; c = static_cast<uint32_t>(d3 >> 26); h[3] = static_cast<uint32_t>(d3) & LIMB_MASK;
+    d4 += c; c = static_cast<uint32_t>(d4 >> 26); h[4] = static_cast<uint32_t>(d4) & LIMB_MASK;
+    h[0] += c * 5; c = h[0] >> 26; h[0] &= LIMB_MASK;
+    h[1] += c;
+}
+
+#ifdef POLY1305_SIMD_X86
+/*
+ * 4-way Poly1305 with AVX2. Each 64-bit lane accumulates every 4th block:
+ * h_i = (h_i + m) * r^4, and the lanes are multiplied by r^4, r^3, r^2, r^1
+ * respectively before they are summed up at the end.
+ */
+__attribute__((target("avx2")))
+inline void poly1305_multiply_avx2(__m256i *h, const __m256i *r, const __m256i *s)
+{
+    const __m256i mask = _mm256_set1_epi64x(LIMB_MASK);
+    __m256i d0 = _mm256_mul_epu32(h[0], r[0]);
+    __m256i d1 = _mm256_mul_epu32(h[0], r[1]);
+    __m256i d2 = _mm256_mul_epu32(h[0], r[2]);
+    __m256i d3 = _mm256_mul_epu32(h[0], r[3]);
+    __m256i d4 = _mm256_mul_epu32(h[0], r[4]);
+
+    d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[1], s[4]));
+    d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[1], r[0]));
+    d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[1], r[1]));
+    d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[1], r[2]));
+    d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[1], r[3]));
+
+    d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[2], s[3]));
+    d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[2], s[4]));
+    d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[2], r[0]));
+    d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[2], r[1]));
+    d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[2], r[2]));
+
+    d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[3], s[2]));
+    d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[3], s[3]));
+    d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[3], s[4]));
+    d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[3], r[0]));
+    d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[3], r[1]));
+
+    d0 = _mm256_add_epi64(d0, _mm256_mul_epu32(h[4], s[1]));
+    d1 = _mm256_add_epi64(d1, _mm256_mul_epu32(h[4], s[2]));
+    d2 = _mm256_add_epi64(d2, _mm256_mul_epu32(h[4], s[3]));
+    d3 = _mm256_add_epi64(d3, _mm256_mul_epu32(h[4], s[4]));
+    d4 = _mm256_add_epi64(d4, _mm256_mul_epu32(h[4], r[0]));
+
+    __m256i c;
+    c = _mm256_srli_epi64(d0, 26); h[0] = _mm256_and_si256(d0, mask);
+    d1 = _mm256_add_epi64(d1, c); c = _mm256_srli_epi64(d1, 26); h[1] = _mm256_and_si256(d1, mask);
+    d2 = _mm256_add_epi64(d2, c); c = _mm256_srli_epi64(d2, 26); h[2] = _mm256_and_si256(d2, mask);
+    d3 = _mm256_add_epi64(d3, c); c = _mm256_srli_epi64(d3, 26); h[3] = _mm256_and_si256(d3, mask);
+    d4 = _mm256_add_epi64(d4, c); c = _mm256_srli_epi64(d4, 26); h[4] = _mm256_and_si256(d4, mask);
+    h[0] = _mm256_add_epi64(h[0], _mm256_add_epi64(c, _mm256_slli_epi64(c, 2)));
+    c = _mm256_srli_epi64(h[0], 26); h[0] = _mm256_and_si256(h[0], mask);
+    h[1] = _mm256_add_epi64(h[1], c);
+}
+
+// Adds 4 consecutive message blocks to the lanes of h
+__attribute__((target("avx2")))
+inline void poly1305_add_blocks_avx2(__m256i *h, const uint8_t *m)
+{
+    const __m256i mask = _mm256_set1_epi64x(LIMB_MASK);
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m));
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m + 32));
+    // Low and high 64 bits of blocks 0, 1, 2 and 3
+    const __m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+    const __m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+
+    h[0] = _mm256_add_epi64(h[0], _mm256_and_si256(lo, mask));
+    h[1] = _mm256_add_epi64(h[1], _mm256_and_si256(_mm256_srli_epi64(lo, 26), mask));
+    h[2] = _mm256_add_epi64(h[2], _mm256_and_si256(
+                                _mm256_or_si256(_mm256_srli_epi64(lo, 52), _mm256_slli_epi64(hi, 12)),
+                                mask));
+    h[3] = _mm256_add_epi64(h[3], _mm256_and_si256(_mm256_srli_epi64(hi, 14), mask));
+    h[4] = _mm256_add_epi64(h[4], _mm256_or_si256(_mm256_srli_epi64(hi, 40),
+                                                  _mm256_set1_epi64x(1 << 24)));
+}
+
+// Processes groups * 4 blocks
+__attribute__((target("avx2")))
+void poly1305_blocks_avx2(uint32_t *h, const uint32_t *r, const uint8_t *m, size_t groups)
+{
+    uint32_t r2[5], r3[5], r4[5];
+    std::memcpy(r2, r, sizeof(r2));
+    poly1305_multiply(r2, r);
+    std::memcpy(r3, r2, sizeof(r3));
+    poly1305_multiply(r3, r);
+    std::memcpy(r4, r3, sizeof(r4));
+    poly1305_multiply(r4, r);
+
+    __m256i hv[5], rv[5], sv[5];
+    for (int j = 0; j < 5; ++j) {
+        hv[j] = _mm256_setr_epi64x(h[j], 0, 0, 0);
+        rv[j] = _mm256_set1_epi64x(r4[j]);
+        sv[j] = _mm256_set1_epi64x(r4[j] * 5);
+    }
+
+    poly1305_add_blocks_avx2(hv, m);
+    for (size_t g = 1; g < groups; ++g) {
+        poly1305_multiply_avx2(hv, rv, sv);
+        poly1305_add_blocks_avx2(hv, m + 64 * g);
+    }
+
+    for (int j = 0; j < 5; ++j) {
+        rv[j] = _mm256_setr_epi64x(r4[j], r3[j], r2[j], r[j]);
+        sv[j] = _mm256_setr_epi64x(r4[j] * 5, r3[j] * 5, r2[j] * 5, r[j] * 5);
+    }
+    poly1305_multiply_avx2(hv, rv, sv);
+
+    uint64_t sum[5];
+    for (int j = 0; j < 5; ++j) {
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), hv[j]);
+        sum[j] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    uint64_t c;
+    c = sum[0] >> 26; h[0] = sum[0] & LIMB_MASK;
+    sum[1] += c; c = sum[1] >> 26; h[1] = sum[1] & LIMB_MASK;
+    sum[2] += c; c = sum[2] >> 26; h[2] = sum[2] & LIMB_MASK;
+    sum[3] += c; c = sum[3] >> 26; h[3] = sum[3] & LIMB_MASK;
+    sum[4] += c; c = sum[4] >> 26; h[4] = sum[4] & LIMB_MASK;
+    h[0] += static_cast<uint32_t>(c * 5); c = h[0] >> 26; h[0] &= LIMB_MASK;
+    h[1] += static_cast<uint32_t>(c);
+}
+
+bool hasAvx2()
+{
+    static const bool avx2 = ChaCha::isSupported(ChaCha::AVX2);
+    return avx2;
+}
+#endif
+
+class Poly1305
+{
+public:
+    explicit Poly1305(const uint8_t *key)
+    {
+        m_r[0] = (load_le<uint32_t>(key + 0, 0)) & 0x3ffffff;
+        m_r[1] = (load_le<uint32_t>(key + 3, 0) >> 2) & 0x3ffff03;
+        m_r[2] = (load_le<uint32_t>(key + 6, 0) >> 4) & 0x3ffc0ff;
+        m_r[3] = (load_le<uint32_t>(key + 9, 0) >> 6) & 0x3f03fff;
+        m_r[4] = (load_le<uint32_t>(key + 12, 0) >> 8) & 0x00fffff;
+        for (int i = 0; i < 4; ++i) {
+            m_pad[i] = load_le<uint32_t>(key + 16, i);
+        }
+        std::memset(m_h, 0, sizeof(m_h));
+    }
+
+    // Processes nblocks full 16-byte blocks
+    void blocks(const uint8_t *m, size_t nblocks)
+    {
+#ifdef POLY1305_SIMD_X86
+        if (nblocks >= SIMD_MIN_BLOCKS && hasAvx2()) {
+            poly1305_blocks_avx2(m_h, m_r, m, nblocks / 4);
+            m += 64 * (nblocks / 4);
+            nblocks %= 4;
+        }
+#endif
+        for (; nblocks > 0; --nblocks, m += 16) {
+            m_h[0] += (load_le<uint32_t>(m + 0, 0)) & LIMB_MASK;
+            m_h[1] += (load_le<uint32_t>(m + 3, 0) >> 2) & LIMB_MASK;
+            m_h[2] += (load_le<uint32_t>(m + 6, 0) >> 4) & LIMB_MASK;
+            m_h[3] += (load_le<uint32_t>(m + 9, 0) >> 6) & LIMB_MASK;
+            m_h[4] += (load_le<uint32_t>(m + 12, 0) >> 8) | (1 << 24);
+            poly1305_multiply(m_h, m_r);
+        }
+    }
+
+    void finish(uint8_t *tag)
+    {
+        uint32_t h0 = m_h[0], h1 = m_h[1], h2 = m_h[2], h3 = m_h[3], h4 = m_h[4];
+        uint32_t c;
+        c = h1 >> 26; h1 &= LIMB_MASK;
+        h2 += c; c = h2 >> 26; h2 &= LIMB_MASK;
+        h3 += c; c = h3 >> 26; h3 &= LIMB_MASK;
+        h4 += c; c = h4 >> 26; h4 &= LIMB_MASK;
+        h0 += c * 5; c = h0 >> 26; h0 &= LIMB_MASK;
+        h1 += c;
+
+        // Compute h + -p and select it if h >= p
+        uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= LIMB_MASK;
+        uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= LIMB_MASK;
+        uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= LIMB_MASK;
+        uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= LIMB_MASK;
+        uint32_t g4 = h4 + c - (1UL << 26);
+
+        uint32_t mask = (g4 >> 31) - 1;
+        g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+        mask = ~mask;
+        h0 = (h0 & mask) | g0;
+        h1 = (h1 & mask) | g1;
+        h2 = (h2 & mask) | g2;
+        h3 = (h3 & mask) | g3;
+        h4 = (h4 & mask) | g4;
+
+        // h = (h + pad) % 2^128
+        h0 = h0 | (h1 << 26);
+        h1 = (h1 >> 6) | (h2 << 20);
+        h2 = (h2 >> 12) | (h3 << 14);
+        h3 = (h3 >> 18) | (h4 << 8);
+
+        uint64_t f;
+        f = static_cast<uint64_t>(h0) + m_pad[0]; store_le(static_cast<uint32_t>(f), tag + 0);
+        f = static_cast<uint64_t>(h1) + m_pad[1] + (f >> 32); store_le(static_cast<uint32_t>(f), tag + 4);
+        f = static_cast<uint64_t>(h2) + m_pad[2] + (f >> 32); store_le(static_cast<uint32_t>(f), tag + 8);
+        f = static_cast<uint64_t>(h3) + m_pad[3] + (f >> 32); store_le(static_cast<uint32_t>(f), tag + 12);
+    }
+
+private:
+    uint32_t m_r[5];
+    uint32_t m_h[5];
+    uint32_t m_pad[4];
+};
+
+// Computes the RFC 8439 tag over the cipher text (without associated data)
+void computeTag(const uint8_t *polyKey, const uint8_t *cipherText, size_t length, uint8_t *tag)
+{
+    Poly1305 poly(polyKey);
+    poly.blocks(cipherText, length / 16);
+    if (length % 16 != 0) {
+        uint8_t block[16] = {0};
+        std::memcpy(block, cipherText + length - length % 16, length % 16);
+        poly.blocks(block, 1);
+    }
+    uint8_t lengths[16] = {0};
+    store_le(static_cast<uint64_t>(length), lengths + 8);
+    poly.blocks(lengths, 1);
+    poly.finish(tag);
+}
+
+bool tagEquals(const uint8_t *a, const uint8_t *b)
+{
+    // Constant-time comparison
+    uint8_t diff = 0;
+    for (size_t i = 0; i < ChaCha20Poly1305::TAG_LENGTH; ++i) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+}
+
+const size_t ChaCha20Poly1305::NONCE_LENGTH;
+const size_t ChaCha20Poly1305::TAG_LENGTH;
+
+ChaCha20Poly1305::ChaCha20Poly1305(const std::string &key) :
+    m_chacha(key, std::string(NONCE_LENGTH, static_cast<char>(0))),
+    m_shortChaCha(key, std::string(NONCE_LENGTH, static_cast<char>(0)), ChaCha::SCALAR)
+{
+    if (key.length() != 32) {
+        throw std::length_error("The key length for ChaCha20-Poly1305 is invalid");
+    }
+}
+
+ChaCha &ChaCha20Poly1305::start(const uint8_t *nonce, size_t length, uint8_t *polyKey)
+{
+    ChaCha &chacha = length <= SHORT_MESSAGE_LENGTH ? m_shortChaCha : m_chacha;
+    chacha.setIV(nonce, NONCE_LENGTH);
+    // The first block is used for the Poly1305 key, and the rest for data
+    uint8_t block[64] = {0};
+    chacha.update(block, sizeof(block), block);
+    std::memcpy(polyKey, block, 32);
+    return chacha;
+}
+
+void ChaCha20Poly1305::seal(const uint8_t *nonce, const uint8_t *in, size_t length, uint8_t *out)
+{
+    seal(nonce, in, length, out, out + length);
+}
+
+void ChaCha20Poly1305::seal(const uint8_t *nonce, const uint8_t *in, size_t length, uint8_t *out,
+                            uint8_t *tag)
+{
+    uint8_t polyKey[32];
+    start(nonce, length, polyKey).update(in, length, out);
+    computeTag(polyKey, out, length, tag);
+}
+
+void ChaCha20Poly1305::open(const uint8_t *nonce, const uint8_t *in, size_t length, uint8_t *out)
+{
+    if (length < TAG_LENGTH) {
+        throw std::length_error("ChaCha20-Poly1305 message is too short");
+    }
+    length -= TAG_LENGTH;
+
+    uint8_t polyKey[32];
+    uint8_t tag[TAG_LENGTH];
+    ChaCha &chacha = start(nonce, length, polyKey);
+    computeTag(polyKey, in, length, tag);
+    if (!tagEquals(tag, in + length)) {
+        throw std::runtime_error("ChaCha20-Poly1305 tag verification failed");
+    }
+    chacha.update(in, length, out);
+}
+
+void ChaCha20Poly1305::sealLength(uint8_t *nonce, size_t length, uint8_t *out)
+{
+    if (length == 0 || length > CHUNK_SIZE_MASK) {
+        throw std::length_error("AEAD data chunk length is invalid");
+    }
+
+    const uint8_t rawLength[CHUNK_SIZE_LEN] = {
+        static_cast<uint8_t>(length >> 8),
+        static_cast<uint8_t>(length & 0xFF)
+    };
+    seal(nonce, rawLength, CHUNK_SIZE_LEN, out);
+    nonceIncrement(nonce);
+}
+
+size_t ChaCha20Poly1305::sealChunk(uint8_t *nonce, const uint8_t *payload, size_t length, uint8_t *out)
+{
+    sealLength(nonce, length, out);
+    out += CHUNK_SIZE_LEN + TAG_LENGTH;
+    seal(nonce, payload, length, out);
+    nonceIncrement(nonce);
+    return CHUNK_SIZE_LEN + length + 2 * TAG_LENGTH;
+}
+
+void ChaCha20Poly1305::sealChunk(uint8_t *nonce, uint8_t *payload, size_t length, uint8_t *header,
+                                 uint8_t *tag)
+{
+    sealLength(nonce, length, header);
+    seal(nonce, payload, length, payload, tag);
+    nonceIncrement(nonce);
+}
+
+size_t ChaCha20Poly1305::openChunk(uint8_t *nonce, const uint8_t *in, size_t length, uint8_t *out,
+                                   uint16_t *payloadLength)
+{
+    if (length < CHUNK_SIZE_LEN + TAG_LENGTH) {
+        throw std::length_error("AEAD data chunk is too small for length");
+    }
+
+    uint8_t rawLength[CHUNK_SIZE_LEN];
+    open(nonce, in, CHUNK_SIZE_LEN + TAG_LENGTH, rawLength);
+    nonceIncrement(nonce);
+    *payloadLength = ((rawLength[0] << 8) | rawLength[1]) & CHUNK_SIZE_MASK;
+    if (*payloadLength == 0) {
+        throw std::length_error("AEAD data chunk length is invalid");
+    }
+
+    size_t consumed = CHUNK_SIZE_LEN + TAG_LENGTH;
+    if (length - consumed < *payloadLength + TAG_LENGTH) {
+        return consumed;
+    }
+    open(nonce, in + consumed, *payloadLength + TAG_LENGTH, out);
+    nonceIncrement(nonce);
+    return consumed + *payloadLength + TAG_LENGTH;
+}
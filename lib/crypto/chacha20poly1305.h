@@ -0,0 +1,105 @@
+/*
+ * chacha20poly1305.h - the header file of ChaCha20Poly1305 class
+ *
+ * An in-tree ChaCha20-Poly1305 (RFC 8439) AEAD engine built on ChaCha,
+ * specialised for Shadowsocks AEAD chunks (no associated data).
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHACHA20POLY1305_H
+#define CHACHA20POLY1305_H
+
+#include <string>
+#include "chacha.h"
+#include "util/export.h"
+
+namespace QSS {
+
+class QSS_EXPORT ChaCha20Poly1305
+{
+public:
+    static const size_t NONCE_LENGTH = 12;
+    static const size_t TAG_LENGTH = 16;
+
+    /*
+     * Key length must be 32
+     */
+    explicit ChaCha20Poly1305(const std::string &key);
+
+    ChaCha20Poly1305(const ChaCha20Poly1305 &) = delete;
+
+    /*
+     * Encrypts a message and appends the tag to it.
+     * out must hold length + TAG_LENGTH bytes. out may be the same as in.
+     */
+    void seal(const uint8_t *nonce, const uint8_t *in, size_t length, uint8_t *out);
+
+    // The same as above, but the tag is written to tag instead of after out
+    void seal(const uint8_t *nonce, const uint8_t *in, size_t length, uint8_t *out, uint8_t *tag);
+
+    /*
+     * Verifies and decrypts a message, where length includes the tag.
+     * out must hold length - TAG_LENGTH bytes. out may be the same as in.
+     * Throws std::runtime_error if the tag doesn't match.
+     */
+    void open(const uint8_t *nonce, const uint8_t *in, size_t length, uint8_t *out);
+
+    /*
+     * Seals a Shadowsocks AEAD chunk: the big-endian payload length with
+     * nonce, followed by the payload with nonce + 1. They're two separate
+     * messages, each with its own key stream and tag.
+     * The nonce is incremented twice and length must be within [1, 0x3FFF].
+     * out must hold length + 2 + 2 * TAG_LENGTH bytes. The payload may be
+     * stored at out + 2 + TAG_LENGTH to seal it in place.
+     * Returns the number of bytes written to out.
+     */
+    size_t sealChunk(uint8_t *nonce, const uint8_t *payload, size_t length, uint8_t *out);
+
+    /*
+     * Seals a Shadowsocks AEAD chunk with the payload encrypted in place.
+     * The sealed length (2 + TAG_LENGTH bytes) is written to header, and the
+     * tag of payload is written to tag.
+     */
+    void sealChunk(uint8_t *nonce, uint8_t *payload, size_t length, uint8_t *header, uint8_t *tag);
+
+    /*
+     * Opens the length chunk at in and, if in holds it completely, the payload
+     * chunk following it. The nonce is incremented once per chunk opened.
+     * length must be no less than 2 + TAG_LENGTH.
+     * Returns the number of bytes consumed from in, which is 2 + TAG_LENGTH
+     * if only the length chunk is opened. out must hold *payloadLength bytes.
+     */
+    size_t openChunk(uint8_t *nonce, const uint8_t *in, size_t length, uint8_t *out,
+                     uint16_t *payloadLength);
+
+private:
+    ChaCha m_chacha;
+    // Short messages (e.g. the length chunk) don't need a whole SIMD batch
+    ChaCha m_shortChaCha;
+
+    // Sets up the key stream for nonce and writes the one-time Poly1305 key
+    ChaCha &start(const uint8_t *nonce, size_t length, uint8_t *polyKey);
+    // Seals the big-endian length of a chunk and increments the nonce
+    void sealLength(uint8_t *nonce, size_t length, uint8_t *out);
+};
+
+}
+
+#endif // CHACHA20POLY1305_H
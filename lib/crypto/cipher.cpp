@@ -21,17 +21,19 @@
  */
 
 #include "cipher.h"
+#include "randompool.h"
 
+#include <algorithm>
 #include <memory>
 #include <stdexcept>
 
-#include <botan/auto_rng.h>
 #include <botan/key_filt.h>
 #include <botan/lookup.h>
 #include <botan/md5.h>
 #include <botan/pipe.h>
 
 #ifdef USE_BOTAN2
+#include <botan/cipher_mode.h>
 #include <botan/hkdf.h>
 #include <botan/hmac.h>
 #include <botan/sha160.h>
@@ -51,6 +53,9 @@ using SecureByteArray = Botan::SecureVector<Botan::byte>;
 #define DataOfSecureByteArray(sba) sba.begin()
 #endif
 
+const size_t AEAD_CHUNK_SIZE_LEN = 2;
+const uint16_t AEAD_CHUNK_SIZE_MASK = 0x3FFF;
+
 // Copied from libsodium's sodium_increment
 void nonceIncrement(unsigned char *n, const size_t nlen)
 {
@@ -62,29 +67,74 @@ void nonceIncrement(unsigned char *n, const size_t nlen)
     }
 }
 
+// Adds value to the little-endian nonce n
+void nonceAdd(unsigned char *n, const size_t nlen, uint64_t value)
+{
+    uint_fast16_t c = 0U;
+    for (size_t i = 0U; i < nlen; i++) {
+        c += static_cast<uint_fast16_t>(n[i]) + (value & 0xFF);
+        n[i] = static_cast<unsigned char>(c);
+        c >>= 8;
+        value >>= 8;
+    }
+}
+
 }  // namespace
 
 namespace QSS {
 
+struct Cipher::ModeBuffer {
+    SecureByteArray data;
+};
+
 Cipher::Cipher(const std::string& method,
                std::string key,
                std::string iv,
                bool encrypt) :
+    Cipher(cipherInfoMap.at(method), backendOf(method), std::move(key), std::move(iv), encrypt)
+{
+}
+
+Cipher::Cipher(const CipherInfo &cipherInfo,
+               Backend backend,
+               std::string key,
+               std::string iv,
+               bool encrypt) :
+    m_filter(nullptr),
     m_key(std::move(key)),
     m_iv(std::move(iv)),
-    m_cipherInfo(cipherInfoMap.at(method))
+    m_cipherInfo(cipherInfo),
+    m_backend(backend),
+    m_encrypt(encrypt)
 {
-    if (method.find("rc4") != std::string::npos) {
+    switch (backend) {
+    case Backend::RC4:
         m_rc4 = std::make_unique<QSS::RC4>(m_key, m_iv);
         return;
-    }
-#ifndef USE_BOTAN2
-    else if (method.find("chacha20") != std::string::npos) {
-        chacha.reset(new ChaCha(m_key, m_iv));
+    case Backend::CHACHA:
+        // Our own ChaCha uses SIMD kernels when the CPU supports them
+        m_chacha = std::make_unique<QSS::ChaCha>(m_key, m_iv);
+        return;
+    case Backend::CHACHA20_POLY1305:
+        m_chachaPoly = std::make_unique<QSS::ChaCha20Poly1305>(m_key);
         return;
+    case Backend::BOTAN:
+        break;
     }
-#endif
     try {
+#ifdef USE_BOTAN2
+        m_mode.reset(Botan::get_cipher_mode(m_cipherInfo.internalName,
+                    encrypt ? Botan::ENCRYPTION : Botan::DECRYPTION));
+        if (!m_mode) {
+            throw Botan::Algorithm_Not_Found(m_cipherInfo.internalName);
+        }
+        m_mode->set_key(reinterpret_cast<const uint8_t *>(m_key.data()), m_key.size());
+        if (m_cipherInfo.type != CipherType::AEAD) {
+            // AEAD ciphers are (re)started with the current nonce for each chunk
+            m_mode->start(reinterpret_cast<const uint8_t *>(m_iv.data()), m_iv.size());
+        }
+        m_modeBuffer = std::make_unique<ModeBuffer>();
+#else
         Botan::SymmetricKey _key(
                     reinterpret_cast<const Botan::byte *>(m_key.data()),
                     m_key.size());
@@ -96,6 +146,7 @@ Cipher::Cipher(const std::string& method,
         // Botan::pipe will take control over filter
         // we shouldn't deallocate filter externally
         m_pipe = std::make_unique<Botan::Pipe>(m_filter);
+#endif
     } catch(const Botan::Exception &e) {
         QDebug(QtMsgType::QtFatalMsg) << "Failed to initialise cipher: " << e.what();
     }
@@ -103,6 +154,11 @@ Cipher::Cipher(const std::string& method,
 
 Cipher::~Cipher() = default;
 
+std::unique_ptr<Cipher> Cipher::clone() const
+{
+    return std::make_unique<Cipher>(m_cipherInfo, m_backend, m_key, m_iv, m_encrypt);
+}
+
 const std::unordered_map<std::string, Cipher::CipherInfo> Cipher::cipherInfoMap = {
     {"aes-128-cfb", {"AES-128/CFB", 16, 16, Cipher::CipherType::STREAM}},
     {"aes-192-cfb", {"AES-192/CFB", 24, 16, Cipher::CipherType::STREAM}},
@@ -142,29 +198,152 @@ std::string Cipher::update(const std::string &data)
 }
 
 std::string Cipher::update(const uint8_t *data, size_t length)
+{
+    std::string out(length + m_cipherInfo.tagLen, static_cast<char>(0));
+    out.resize(update(data, length, reinterpret_cast<uint8_t*>(&out[0])));
+    return out;
+}
+
+size_t Cipher::update(const uint8_t *data, size_t length, uint8_t *out)
 {
     if (m_chacha) {
-        return m_chacha->update(data, length);
+        m_chacha->update(data, length, out);
+        return length;
     }
     if (m_rc4) {
-        return m_rc4->update(data, length);
+        m_rc4->update(data, length, out);
+        return length;
+    }
+    if (m_chachaPoly) {
+        const uint8_t *nonce = reinterpret_cast<const uint8_t *>(m_iv.data());
+        if (m_encrypt) {
+            m_chachaPoly->seal(nonce, data, length, out);
+            return length + m_cipherInfo.tagLen;
+        }
+        m_chachaPoly->open(nonce, data, length, out);
+        return length - m_cipherInfo.tagLen;
+    }
+#ifdef USE_BOTAN2
+    if (m_mode) {
+        SecureByteArray &buffer = m_modeBuffer->data;
+        buffer.assign(data, data + length);
+        if (m_cipherInfo.type == CipherType::AEAD) {
+            m_mode->start(reinterpret_cast<const uint8_t *>(m_iv.data()), m_iv.size());
+        }
+        // For stream ciphers, finish() carries on the key stream without reset
+        m_mode->finish(buffer);
+        std::copy(buffer.begin(), buffer.end(), out);
+        return buffer.size();
     }
+#endif
     if (m_pipe) {
         m_pipe->process_msg(reinterpret_cast<const Botan::byte *>
                           (data), length);
-        SecureByteArray c = m_pipe->read_all(Botan::Pipe::LAST_MESSAGE);
-        return std::string(reinterpret_cast<const char *>(DataOfSecureByteArray(c)),
-                           c.size());
+        // Read straight into the output buffer to avoid intermediate copies
+        return m_pipe->read(reinterpret_cast<Botan::byte *>(out),
+                            m_pipe->remaining(Botan::Pipe::LAST_MESSAGE),
+                            Botan::Pipe::LAST_MESSAGE);
     }
     throw std::logic_error("Underlying ciphers are all uninitialised!");
 }
 
+size_t Cipher::sealChunk(const uint8_t *payload, size_t length, uint8_t *out)
+{
+    if (m_chachaPoly) {
+        return m_chachaPoly->sealChunk(reinterpret_cast<uint8_t *>(&m_iv[0]), payload, length, out);
+    }
+
+    const uint8_t rawLength[AEAD_CHUNK_SIZE_LEN] = {
+        static_cast<uint8_t>(length >> 8),
+        static_cast<uint8_t>(length & 0xFF)
+    };
+    size_t written = update(rawLength, AEAD_CHUNK_SIZE_LEN, out);
+    incrementIv();
+    written += update(payload, length, out + written);
+    incrementIv();
+    return written;
+}
+
+void Cipher::sealChunk(uint8_t *payload, size_t length, uint8_t *header, uint8_t *tag)
+{
+    if (m_chachaPoly) {
+        m_chachaPoly->sealChunk(reinterpret_cast<uint8_t *>(&m_iv[0]), payload, length, header, tag);
+        return;
+    }
+
+#ifdef USE_BOTAN2
+    if (m_mode && m_cipherInfo.type == CipherType::AEAD) {
+        const uint8_t rawLength[AEAD_CHUNK_SIZE_LEN] = {
+            static_cast<uint8_t>(length >> 8),
+            static_cast<uint8_t>(length & 0xFF)
+        };
+        update(rawLength, AEAD_CHUNK_SIZE_LEN, header);
+        incrementIv();
+
+        SecureByteArray &buffer = m_modeBuffer->data;
+        buffer.assign(payload, payload + length);
+        m_mode->start(reinterpret_cast<const uint8_t *>(m_iv.data()), m_iv.size());
+        m_mode->finish(buffer);
+        std::copy(buffer.begin(), buffer.begin() + length, payload);
+        std::copy(buffer.begin() + length, buffer.end(), tag);
+        incrementIv();
+        return;
+    }
+#endif
+    throw std::logic_error("Scatter-gather sealing requires an AEAD cipher");
+}
+
+size_t Cipher::openChunk(const uint8_t *data, size_t length, uint8_t *out, uint16_t *payloadLength)
+{
+    if (m_chachaPoly) {
+        return m_chachaPoly->openChunk(reinterpret_cast<uint8_t *>(&m_iv[0]), data, length, out,
+                                       payloadLength);
+    }
+
+    const size_t lengthChunkSize = AEAD_CHUNK_SIZE_LEN + m_cipherInfo.tagLen;
+    if (length < lengthChunkSize) {
+        throw std::length_error("AEAD data chunk is too small for length");
+    }
+    uint8_t rawLength[AEAD_CHUNK_SIZE_LEN];
+    update(data, lengthChunkSize, rawLength);
+    incrementIv();
+    *payloadLength = ((rawLength[0] << 8) | rawLength[1]) & AEAD_CHUNK_SIZE_MASK;
+    if (*payloadLength == 0) {
+        throw std::length_error("AEAD data chunk length is invalid");
+    }
+
+    if (length - lengthChunkSize < *payloadLength + m_cipherInfo.tagLen) {
+        return lengthChunkSize;
+    }
+    update(data + lengthChunkSize, *payloadLength + m_cipherInfo.tagLen, out);
+    incrementIv();
+    return lengthChunkSize + *payloadLength + m_cipherInfo.tagLen;
+}
+
 void Cipher::incrementIv()
 {
     nonceIncrement(reinterpret_cast<unsigned char*>(&m_iv[0]), m_iv.length());
-    m_filter->set_iv(Botan::InitializationVector(
-                       reinterpret_cast<const Botan::byte *>(m_iv.data()), m_iv.size()
-                       ));
+    if (m_filter) {
+        m_filter->set_iv(Botan::InitializationVector(
+                           reinterpret_cast<const Botan::byte *>(m_iv.data()), m_iv.size()
+                           ));
+    }
+}
+
+const std::string &Cipher::iv() const
+{
+    return m_iv;
+}
+
+void Cipher::setIv(const std::string &base, uint64_t offset)
+{
+    m_iv = base;
+    nonceAdd(reinterpret_cast<unsigned char*>(&m_iv[0]), m_iv.length(), offset);
+    if (m_filter) {
+        m_filter->set_iv(Botan::InitializationVector(
+                           reinterpret_cast<const Botan::byte *>(m_iv.data()), m_iv.size()
+                           ));
+    }
 }
 
 std::string Cipher::randomIv(int length)
@@ -174,9 +353,8 @@ std::string Cipher::randomIv(int length)
         return std::string();
     }
 
-    Botan::AutoSeeded_RNG rng;
-    SecureByteArray out = rng.random_vec(length);
-    return std::string(reinterpret_cast<const char *>(DataOfSecureByteArray(out)), out.size());
+    // The per-thread pool saves seeding a new RNG for each IV or salt
+    return RandomPool::bytes(length);
 }
 
 std::string Cipher::randomIv(const std::string &method)
@@ -202,13 +380,22 @@ bool Cipher::isSupported(const std::string &method)
         return false;
     }
 
-#ifndef USE_BOTAN2
-    if (method.find("chacha20") != std::string::npos)  return true;
-#endif
+    if (cIt->second.internalName == "ChaCha" || cIt->second.internalName == "ChaCha20Poly1305") {
+        return true;
+    }
     if (method.find("rc4") != std::string::npos) {
         return true;
     }
 
+#ifdef USE_BOTAN2
+    std::unique_ptr<Botan::Cipher_Mode> mode(
+                Botan::get_cipher_mode(cIt->second.internalName, Botan::ENCRYPTION));
+    if (!mode) {
+        qDebug("Method %s(%s) is not supported by Botan",
+               method.data(), cIt->second.internalName.data());
+        return false;
+    }
+#else
     std::unique_ptr<Botan::Keyed_Filter> keyFilter;
     try {
         keyFilter.reset(Botan::get_cipher(cIt->second.internalName, Botan::ENCRYPTION));
@@ -217,9 +404,25 @@ bool Cipher::isSupported(const std::string &method)
                method.data(), cIt->second.internalName.data(), e.what());
         return false;
     }
+#endif
     return true;
 }
 
+Cipher::Backend Cipher::backendOf(const std::string &method)
+{
+    if (method.find("rc4") != std::string::npos) {
+        return Backend::RC4;
+    }
+    const std::string &internalName = cipherInfoMap.at(method).internalName;
+    if (internalName == "ChaCha") {
+        return Backend::CHACHA;
+    }
+    if (internalName == "ChaCha20Poly1305") {
+        return Backend::CHACHA20_POLY1305;
+    }
+    return Backend::BOTAN;
+}
+
 std::vector<std::string> Cipher::supportedMethods()
 {
     std::vector<std::string> supportedMethods;
@@ -34,9 +34,11 @@
 #include <memory>
 #include "rc4.h"
 #include "chacha.h"
+#include "chacha20poly1305.h"
 #include "util/export.h"
 
 namespace Botan {
+class Cipher_Mode;
 class Keyed_Filter;
 class Pipe;
 class KDF;
@@ -47,6 +49,18 @@ namespace QSS {
 class QSS_EXPORT Cipher
 {
 public:
+    /*
+     * The implementation behind a cipher method
+     */
+    enum class Backend {
+        BOTAN,
+        RC4,
+        CHACHA,
+        CHACHA20_POLY1305
+    };
+
+    struct CipherInfo;
+
     /**
      * @brief Cipher
      * @param method The cipher method name (in Shadowsocks convention)
@@ -55,20 +69,89 @@ public:
      * @param encrypt Whether the operation is to encrypt, otherwise it's to decrypt
      */
     Cipher(const std::string &method, std::string key, std::string iv, bool encrypt);
+
+    /**
+     * @brief Cipher Constructs a cipher from the resolved method information
+     * This saves looking the method name up for each cipher.
+     * @param cipherInfo The cipher information, which must outlive this
+     * cipher (an entry of cipherInfoMap does)
+     * @param backend The backend of the method, as returned by backendOf()
+     */
+    Cipher(const CipherInfo &cipherInfo, Backend backend, std::string key, std::string iv, bool encrypt);
     Cipher(Cipher &&) = default;
     ~Cipher();
 
     Cipher(const Cipher &) = delete;
 
+    /**
+     * @brief clone Creates an independent cipher with the same method, key
+     * and the current nonce, e.g. to seal chunks on another thread
+     * The key stream position of a stream cipher isn't carried over, hence
+     * it's only meant for AEAD ciphers.
+     */
+    std::unique_ptr<Cipher> clone() const;
+
     std::string update(const std::string &data);
     std::string update(const uint8_t *data, size_t length);
 
+    /**
+     * @brief update Processes data into a caller-provided buffer
+     * @param data The input data
+     * @param length The length of input data
+     * @param out The output buffer, which must hold at least length bytes
+     * (plus tagLen bytes if it's an AEAD encryption). It can be the same as
+     * data to update in place, but they must not overlap otherwise.
+     * @return The number of bytes written to out
+     */
+    size_t update(const uint8_t *data, size_t length, uint8_t *out);
+
+    /**
+     * @brief sealChunk Encrypts a Shadowsocks AEAD chunk, which is the
+     * big-endian payload length followed by the payload, each sealed with
+     * its own nonce. The nonce is incremented twice.
+     * @param payload The plain text, whose length must be within [1, 0x3FFF]
+     * @param out The output buffer, which must hold at least
+     * length + 2 + 2 * tagLen bytes. The payload may be stored at
+     * out + 2 + tagLen to encrypt it in place.
+     * @return The number of bytes written to out
+     */
+    size_t sealChunk(const uint8_t *payload, size_t length, uint8_t *out);
+
+    /**
+     * @brief sealChunk An overload that encrypts the payload in place and
+     * stores the other parts of the chunk elsewhere, for scatter-gather output
+     * @param header Receives the encrypted length and its tag (2 + tagLen bytes)
+     * @param tag Receives the tag of the payload (tagLen bytes)
+     */
+    void sealChunk(uint8_t *payload, size_t length, uint8_t *header, uint8_t *tag);
+
+    /**
+     * @brief openChunk Decrypts the length part of a Shadowsocks AEAD chunk
+     * and, if data holds the whole chunk, the payload as well
+     * The nonce is incremented once for each part decrypted.
+     * @param length The length of data, which must be at least 2 + tagLen
+     * @param out The output buffer for payload, which is only written if the
+     * whole chunk is in data. Hence length bytes are always enough.
+     * @param payloadLength Set to the payload length decrypted
+     * @return The number of bytes consumed from data, which is 2 + tagLen if
+     * only the length part is decrypted
+     */
+    size_t openChunk(const uint8_t *data, size_t length, uint8_t *out, uint16_t *payloadLength);
+
     /**
      * @brief incrementIv Increments the current nonce by 1
      * This is required by Shadowsocks AEAD operation after each encryption/decryption
      */
     void incrementIv();
 
+    const std::string &iv() const;
+
+    /**
+     * @brief setIv Sets the nonce to base plus offset, both little-endian,
+     * which is where the nonce would be after offset increments from base
+     */
+    void setIv(const std::string &base, uint64_t offset);
+
     enum CipherType {
         STREAM,
         AEAD
@@ -117,6 +200,12 @@ public:
      */
     static bool isSupported(const std::string &method);
 
+    /**
+     * @brief backendOf Resolves the implementation of a supported method
+     * @param method The cipher method name in Shadowsocks convention
+     */
+    static Backend backendOf(const std::string &method);
+
     static std::vector<std::string> supportedMethods();
 
 #ifdef USE_BOTAN2
@@ -124,13 +213,24 @@ public:
 #endif
 
 private:
+    struct ModeBuffer;
+
+    /*
+     * With Botan-2, ciphers operate on the Cipher_Mode directly over a reusable
+     * buffer. The Pipe is only used with Botan-1.10, where Cipher_Mode is N/A.
+     */
+    std::unique_ptr<Botan::Cipher_Mode> m_mode;
+    std::unique_ptr<ModeBuffer> m_modeBuffer;
     Botan::Keyed_Filter *m_filter;
     std::unique_ptr<Botan::Pipe> m_pipe;
     std::unique_ptr<RC4> m_rc4;
     std::unique_ptr<ChaCha> m_chacha;
+    std::unique_ptr<ChaCha20Poly1305> m_chachaPoly;
     const std::string m_key; // preshared key
     std::string m_iv; // nonce
-    const CipherInfo m_cipherInfo;
+    const CipherInfo &m_cipherInfo;
+    const Backend m_backend;
+    const bool m_encrypt;
 };
 
 }
@@ -0,0 +1,147 @@
+/*
+ * cryptopool.cpp - the source file of CryptoPool class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "cryptopool.h"
+
+#include <memory>
+
+namespace QSS {
+
+CryptoPool::CryptoPool(int workers) :
+    m_task(nullptr),
+    m_count(0),
+    m_next(0),
+    m_finished(0),
+    m_generation(0),
+    m_stopping(false)
+{
+    for (int i = 1; i <= workers; ++i) {
+        m_threads.emplace_back(&CryptoPool::workerLoop, this, i);
+    }
+}
+
+CryptoPool::~CryptoPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+int CryptoPool::workerCount() const
+{
+    return static_cast<int>(m_threads.size());
+}
+
+CryptoPool &CryptoPool::local(int workers)
+{
+    thread_local std::unique_ptr<CryptoPool> pool;
+    if (!pool || pool->workerCount() != workers) {
+        pool = std::make_unique<CryptoPool>(workers);
+    }
+    return *pool;
+}
+
+void CryptoPool::run(size_t count, const Task &task)
+{
+    if (count == 0) {
+        return;
+    }
+    if (m_threads.empty() || count == 1) {
+        for (size_t i = 0; i < count; ++i) {
+            task(0, i);
+        }
+        return;
+    }
+
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_finished = 0;
+        m_error = nullptr;
+        generation = ++m_generation;
+    }
+    m_wake.notify_all();
+
+    // The calling thread takes its share rather than sitting idle
+    process(0, generation);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_finished == m_count; });
+    m_task = nullptr;
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void CryptoPool::workerLoop(size_t slot)
+{
+    uint64_t seen = 0;
+    for (;;) {
+        uint64_t generation;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this, seen] { return m_stopping || m_generation != seen; });
+            if (m_stopping) {
+                return;
+            }
+            generation = seen = m_generation;
+        }
+        process(slot, generation);
+    }
+}
+
+void CryptoPool::process(size_t slot, uint64_t generation)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    /*
+     * A worker may wake up late, after the job it was woken for has
+     * finished, so the generation is checked before taking each index
+     */
+    while (m_generation == generation && m_next < m_count) {
+        const size_t index = m_next++;
+        const Task &task = *m_task;
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            task(slot, index);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error && !m_error) {
+            m_error = error;
+        }
+        if (++m_finished == m_count) {
+            m_done.notify_all();
+        }
+    }
+}
+
+}  // namespace QSS
@@ -0,0 +1,99 @@
+/*
+ * cryptopool.h - the header file of CryptoPool class
+ *
+ * A small pool of worker threads that the I/O thread hands independent
+ * crypto jobs to, e.g. sealing the AEAD chunks of a large buffer.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CRYPTOPOOL_H
+#define CRYPTOPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "util/export.h"
+
+namespace QSS {
+
+class QSS_EXPORT CryptoPool
+{
+public:
+    /*
+     * The task of a job, called once for each index in [0, count).
+     * slot identifies the calling thread: 0 is the thread calling run(), and
+     * 1 to workerCount() are the workers. A slot never runs two tasks at the
+     * same time, so per-slot state (e.g. a cipher) needs no locking.
+     */
+    using Task = std::function<void(size_t slot, size_t index)>;
+
+    /*
+     * Starts workers threads. With no workers, run() does everything on
+     * the calling thread.
+     */
+    explicit CryptoPool(int workers);
+    ~CryptoPool();
+
+    CryptoPool(const CryptoPool &) = delete;
+
+    int workerCount() const;
+
+    /*
+     * The pool of the calling thread, with workers threads of its own.
+     * Each I/O thread seals on its own workers, so no thread ever waits
+     * for the jobs of another. It's recreated if workers has changed.
+     */
+    static CryptoPool &local(int workers);
+
+    /*
+     * Runs task for each index across the workers and the calling thread,
+     * and returns once all of them are done. The results are therefore ready
+     * in their original order. It mustn't be called from two threads at
+     * once, which the pools from local() never are.
+     * The first exception thrown by task is rethrown.
+     */
+    void run(size_t count, const Task &task);
+
+private:
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const Task *m_task;
+    size_t m_count;
+    size_t m_next;
+    size_t m_finished;
+    uint64_t m_generation;
+    std::exception_ptr m_error;
+    bool m_stopping;
+
+    void workerLoop(size_t slot);
+    // Takes and runs tasks of the current job until there are none left
+    void process(size_t slot, uint64_t generation);
+};
+
+}
+
+#endif // CRYPTOPOOL_H
@@ -21,8 +21,9 @@
  */
 
 #include "encryptor.h"
-#include <QDebug>
-#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 namespace {
 const size_t AEAD_CHUNK_SIZE_LEN = 2;
@@ -56,32 +57,75 @@ std::string evpBytesToKey(const QSS::Cipher::CipherInfo& cipherInfo,
 }  // anonymous namespace
 
 namespace  QSS {
-Encryptor::Encryptor(const std::string &method,
-                     const std::string &password) :
+EncryptorContext::EncryptorContext(const std::string &method,
+                                   const std::string &password,
+                                   int cryptoWorkers) :
     m_method(method),
     m_cipherInfo(Cipher::cipherInfoMap.at(m_method)),
+    m_backend(Cipher::backendOf(m_method)),
     m_masterKey(evpBytesToKey(m_cipherInfo, password)),
-    m_incompleteLength(0)
+    m_cryptoWorkers(cryptoWorkers)
+{
+}
+
+const std::string &EncryptorContext::method() const
+{
+    return m_method;
+}
+
+const Cipher::CipherInfo &EncryptorContext::cipherInfo() const
+{
+    return m_cipherInfo;
+}
+
+Cipher::Backend EncryptorContext::backend() const
+{
+    return m_backend;
+}
+
+const std::string &EncryptorContext::masterKey() const
+{
+    return m_masterKey;
+}
+
+int EncryptorContext::cryptoWorkers() const
+{
+    return m_cryptoWorkers;
+}
+
+Encryptor::Encryptor(const std::string &method,
+                     const std::string &password) :
+    Encryptor(std::make_shared<const EncryptorContext>(method, password))
+{
+}
+
+Encryptor::Encryptor(std::shared_ptr<const EncryptorContext> context) :
+    m_context(std::move(context)),
+    m_cipherInfo(m_context->cipherInfo()),
+    m_payloadLength(0)
 {
 }
 
 void Encryptor::initEncipher(std::string *header)
 {
-    std::string iv = Cipher::randomIv(m_method);
+    std::string iv;
     std::string key;
 #ifdef USE_BOTAN2
     if (m_cipherInfo.type == Cipher::CipherType::AEAD) {
+        iv = std::string(m_cipherInfo.ivLen, static_cast<char>(0));
         const std::string salt = Cipher::randomIv(m_cipherInfo.saltLen);
-        key = Cipher::deriveAeadSubkey(m_cipherInfo.keyLen, m_masterKey, salt);
+        key = Cipher::deriveAeadSubkey(m_cipherInfo.keyLen, m_context->masterKey(), salt);
         *header = salt;
     } else {
 #endif
-        key = m_masterKey;
+        iv = Cipher::randomIv(m_cipherInfo.ivLen);
+        key = m_context->masterKey();
         *header = iv;
 #ifdef USE_BOTAN2
     }
 #endif
-    m_enCipher = std::make_unique<QSS::Cipher>(m_method, std::move(key), std::move(iv), true);
+    m_enCipher = std::make_unique<QSS::Cipher>(m_cipherInfo, m_context->backend(),
+                                               std::move(key), std::move(iv), true);
 }
 
 void Encryptor::initDecipher(const char *data, size_t length, size_t *offset)
@@ -93,7 +137,8 @@ void Encryptor::initDecipher(const char *data, size_t length, size_t *offset)
         if (length < m_cipherInfo.saltLen) {
             throw std::length_error("Data chunk is too small to initialise an AEAD decipher");
         }
-        key = Cipher::deriveAeadSubkey(m_cipherInfo.keyLen, m_masterKey, std::string(data, m_cipherInfo.saltLen));
+        key = Cipher::deriveAeadSubkey(m_cipherInfo.keyLen, m_context->masterKey(),
+                                       std::string(data, m_cipherInfo.saltLen));
         *offset = m_cipherInfo.saltLen;
     } else {
 #endif
@@ -101,12 +146,13 @@ void Encryptor::initDecipher(const char *data, size_t length, size_t *offset)
             throw std::length_error("Data chunk is too small to initialise a stream decipher");
         }
         iv = std::string(data, m_cipherInfo.ivLen);
-        key = m_masterKey;
+        key = m_context->masterKey();
         *offset = m_cipherInfo.ivLen;
 #ifdef USE_BOTAN2
     }
 #endif
-    m_deCipher = std::make_unique<QSS::Cipher>(m_method, std::move(key), std::move(iv), false);
+    m_deCipher = std::make_unique<QSS::Cipher>(m_cipherInfo, m_context->backend(),
+                                               std::move(key), std::move(iv), false);
 }
 
 std::string Encryptor::encrypt(const std::string &in)
@@ -115,108 +161,315 @@ std::string Encryptor::encrypt(const std::string &in)
 }
 
 std::string Encryptor::encrypt(const uint8_t *data, size_t length)
+{
+    std::string encrypted(length + encryptOverhead(length), static_cast<char>(0));
+    encrypted.resize(encrypt(data, length, reinterpret_cast<uint8_t*>(&encrypted[0])));
+    return encrypted;
+}
+
+size_t Encryptor::encryptOverhead(size_t length) const
+{
+    if (length == 0) {
+        return 0;
+    }
+
+    size_t overhead = 0;
+#ifdef USE_BOTAN2
+    if (m_cipherInfo.type == Cipher::CipherType::AEAD) {
+        if (!m_enCipher) {
+            overhead += m_cipherInfo.saltLen;
+        }
+        const size_t chunks = (length + AEAD_CHUNK_SIZE_MASK - 1) / AEAD_CHUNK_SIZE_MASK;
+        overhead += chunks * (AEAD_CHUNK_SIZE_LEN + 2 * m_cipherInfo.tagLen);
+    } else {
+#endif
+        if (!m_enCipher) {
+            overhead += m_cipherInfo.ivLen;
+        }
+#ifdef USE_BOTAN2
+    }
+#endif
+    return overhead;
+}
+
+size_t Encryptor::encrypt(const uint8_t *data, size_t length, uint8_t *out)
 {
     if (length <= 0) {
-        return std::string();
+        return 0;
     }
 
-    std::string header;
+    uint8_t *pos = out;
     if (!m_enCipher) {
+        std::string header;
         initEncipher(&header);
+        pos = std::copy(header.begin(), header.end(), pos);
     }
 
-    std::string encrypted;
 #ifdef USE_BOTAN2
     if (m_cipherInfo.type == Cipher::CipherType::AEAD) {
-        uint16_t inLen = length > AEAD_CHUNK_SIZE_MASK ? AEAD_CHUNK_SIZE_MASK : length;
-        std::string rawLength(AEAD_CHUNK_SIZE_LEN, static_cast<char>(0));
-        qToBigEndian(inLen, reinterpret_cast<uint8_t*>(&rawLength[0]));
-        std::string encLength = m_enCipher->update(rawLength); // length + tag
-        m_enCipher->incrementIv();
-        std::string encPayload = m_enCipher->update(data, inLen); // payload + tag
-        m_enCipher->incrementIv();
-        encrypted = encLength + encPayload;
-        if (inLen < length) {
-            // Append the remaining part recursively if there is any
-            encrypted += encrypt(data + inLen, length - inLen);
+        while (length > 0) {
+            uint16_t inLen = length > AEAD_CHUNK_SIZE_MASK ? AEAD_CHUNK_SIZE_MASK : length;
+            pos += m_enCipher->sealChunk(data, inLen, pos); // length + tag + payload + tag
+            data += inLen;
+            length -= inLen;
         }
     } else {
 #endif
-        encrypted = m_enCipher->update(data, length);
+        pos += m_enCipher->update(data, length, pos);
 #ifdef USE_BOTAN2
     }
 #endif
-    return header + encrypted;
+    return pos - out;
 }
 
-std::string Encryptor::decrypt(const std::string &data)
+size_t Encryptor::encryptInPlace(uint8_t *buffer, size_t headroom, size_t length)
 {
-    return decrypt(reinterpret_cast<const uint8_t*>(data.data()), data.length());
+    if (length <= 0) {
+        return 0;
+    }
+    if (headroom < encryptOverhead(length)) {
+        throw std::length_error("Headroom is too small to encrypt in place");
+    }
+
+    uint8_t *pos = buffer;
+    const uint8_t *data = buffer + headroom;
+    if (!m_enCipher) {
+        std::string header;
+        initEncipher(&header);
+        pos = std::copy(header.begin(), header.end(), pos);
+    }
+
+    /*
+     * Since the headroom covers the overhead of all chunks, the output of
+     * each chunk always ends before the plain text of the next chunk begins.
+     * Therefore it's safe to move each chunk forward and encrypt it in place.
+     */
+#ifdef USE_BOTAN2
+    if (m_cipherInfo.type == Cipher::CipherType::AEAD) {
+        while (length > 0) {
+            uint16_t inLen = length > AEAD_CHUNK_SIZE_MASK ? AEAD_CHUNK_SIZE_MASK : length;
+            uint8_t *payload = pos + AEAD_CHUNK_SIZE_LEN + m_cipherInfo.tagLen;
+            std::memmove(payload, data, inLen);
+            pos += m_enCipher->sealChunk(payload, inLen, pos);
+            data += inLen;
+            length -= inLen;
+        }
+    } else {
+#endif
+        if (pos != data) {
+            std::memmove(pos, data, length);
+        }
+        pos += m_enCipher->update(pos, length, pos);
+#ifdef USE_BOTAN2
+    }
+#endif
+    return pos - buffer;
 }
 
-std::string Encryptor::decrypt(const uint8_t* data, size_t length)
+void Encryptor::appendSegment(const uint8_t *data, size_t length)
 {
+    if (!m_segments.empty()) {
+        Segment &last = m_segments.back();
+        if (last.data + last.length == data) {
+            last.length += length;
+            return;
+        }
+    }
+    m_segments.push_back({data, length});
+}
+
+const std::vector<Encryptor::Segment> &Encryptor::encryptSegments(uint8_t *data, size_t length)
+{
+    m_segments.clear();
     if (length <= 0) {
-        return std::string();
+        return m_segments;
     }
 
-    std::string out;
-    if (!m_deCipher) {
-        size_t headerLength = 0;
-        initDecipher(reinterpret_cast<const char*>(data), length, &headerLength);
-        data += headerLength;
-        length -= headerLength;
+    // Everything but the payload, i.e. overhead, goes to m_segmentHeaders
+    const size_t overhead = encryptOverhead(length);
+    if (m_segmentHeaders.size() < overhead) {
+        m_segmentHeaders.resize(overhead);
+    }
+    uint8_t *header = m_segmentHeaders.data();
+    if (!m_enCipher) {
+        std::string iv;
+        initEncipher(&iv);
+        header = std::copy(iv.begin(), iv.end(), header);
+        appendSegment(m_segmentHeaders.data(), iv.size());
     }
 
 #ifdef USE_BOTAN2
     if (m_cipherInfo.type == Cipher::CipherType::AEAD) {
-        // Concatenate the data with incomplete chunk (if it exists)
-        std::string chunk = m_incompleteChunk + std::string(reinterpret_cast<const char*>(data), length);
-        data = reinterpret_cast<const uint8_t*>(chunk.data());
-        length = chunk.length();
-        const uint8_t *dataEnd = data + length;
-
-        uint16_t payloadLength = 0;
-        if (m_incompleteLength != 0u) {
-            // The payload length is already known
-            payloadLength = m_incompleteLength;
-            m_incompleteLength = 0;
-            m_incompleteChunk.clear();
-        } else {
-            if (dataEnd - data < AEAD_CHUNK_SIZE_LEN + m_cipherInfo.tagLen) {
-                qDebug("AEAD data chunk is incomplete (too small for length)");
-                m_incompleteChunk = std::string(reinterpret_cast<const char*>(data), dataEnd - data);
-                return std::string();
-            }
-            std::string decLength = m_deCipher->update(data, AEAD_CHUNK_SIZE_LEN + m_cipherInfo.tagLen);
-            m_deCipher->incrementIv();
-            data += (AEAD_CHUNK_SIZE_LEN + m_cipherInfo.tagLen);
-            payloadLength = qFromBigEndian(*reinterpret_cast<const uint16_t*>(decLength.data())) & AEAD_CHUNK_SIZE_MASK;
-            if (payloadLength == 0) {
-                throw std::length_error("AEAD data chunk length is invalid");
+        const bool parallel = m_context->cryptoWorkers() > 0 && length > AEAD_CHUNK_SIZE_MASK;
+        if (parallel) {
+            sealChunksInParallel(data, length, header);
+        }
+        const size_t lengthChunkSize = AEAD_CHUNK_SIZE_LEN + m_cipherInfo.tagLen;
+        while (length > 0) {
+            uint16_t inLen = length > AEAD_CHUNK_SIZE_MASK ? AEAD_CHUNK_SIZE_MASK : length;
+            uint8_t *tag = header + lengthChunkSize;
+            if (!parallel) {
+                m_enCipher->sealChunk(data, inLen, header, tag);
             }
+            appendSegment(header, lengthChunkSize);
+            appendSegment(data, inLen);
+            appendSegment(tag, m_cipherInfo.tagLen);
+            header = tag + m_cipherInfo.tagLen;
+            data += inLen;
+            length -= inLen;
         }
+        return m_segments;
+    }
+#endif
+    m_enCipher->update(data, length, data);
+    appendSegment(data, length);
+    return m_segments;
+}
 
-        if (dataEnd - data < payloadLength + m_cipherInfo.tagLen) {
-            qDebug("AEAD data chunk is incomplete (too small for payload)");
-            m_incompleteChunk = std::string(reinterpret_cast<const char*>(data), dataEnd - data);
-            m_incompleteLength = payloadLength;
-            return std::string();
-        }
-        out = m_deCipher->update(data, payloadLength + m_cipherInfo.tagLen);
-        m_deCipher->incrementIv();
-        data += (payloadLength + m_cipherInfo.tagLen);
-        if (dataEnd > data) {
-            // Append remaining decrypted chunks recursively if there is any
-            out += decrypt(data, dataEnd - data);
+void Encryptor::sealChunksInParallel(uint8_t *data, size_t length, uint8_t *headers)
+{
+    CryptoPool &pool = CryptoPool::local(m_context->cryptoWorkers());
+    while (m_workerCiphers.size() < static_cast<size_t>(pool.workerCount())) {
+        m_workerCiphers.push_back(m_enCipher->clone());
+    }
+
+    /*
+     * Chunks are independent apart from the nonce, which is incremented twice
+     * per chunk. Hence chunk i is sealed with nonce base + 2 * i, and its
+     * header and tag are stored where the serial loop would put them.
+     */
+    const size_t chunkOverhead = AEAD_CHUNK_SIZE_LEN + 2 * m_cipherInfo.tagLen;
+    const size_t chunks = (length + AEAD_CHUNK_SIZE_MASK - 1) / AEAD_CHUNK_SIZE_MASK;
+    const std::string base = m_enCipher->iv();
+    pool.run(chunks, [&](size_t slot, size_t index) {
+        Cipher &cipher = slot == 0 ? *m_enCipher : *m_workerCiphers[slot - 1];
+        const size_t offset = index * AEAD_CHUNK_SIZE_MASK;
+        const size_t inLen = std::min<size_t>(length - offset, AEAD_CHUNK_SIZE_MASK);
+        uint8_t *header = headers + index * chunkOverhead;
+        cipher.setIv(base, 2 * index);
+        cipher.sealChunk(data + offset, inLen, header,
+                         header + AEAD_CHUNK_SIZE_LEN + m_cipherInfo.tagLen);
+    });
+    m_enCipher->setIv(base, 2 * chunks);
+}
+
+std::string Encryptor::decrypt(const std::string &data)
+{
+    return decrypt(reinterpret_cast<const uint8_t*>(data.data()), data.length());
+}
+
+std::string Encryptor::decrypt(const uint8_t* data, size_t length)
+{
+    std::string out(maxDecryptedSize(length), static_cast<char>(0));
+    out.resize(decrypt(data, length, reinterpret_cast<uint8_t*>(&out[0])));
+    return out;
+}
+
+size_t Encryptor::maxDecryptedSize(size_t length) const
+{
+    return length + m_pending.size();
+}
+
+bool Encryptor::takePending(const uint8_t **data, size_t *length, size_t required)
+{
+    if (m_pending.capacity() == 0) {
+        // The largest piece ever buffered is a whole AEAD chunk
+        m_pending.reserve(std::max(m_cipherInfo.ivLen, m_cipherInfo.saltLen)
+                          + AEAD_CHUNK_SIZE_MASK + m_cipherInfo.tagLen);
+    }
+    const size_t take = std::min(required - m_pending.size(), *length);
+    m_pending.insert(m_pending.end(), *data, *data + take);
+    *data += take;
+    *length -= take;
+    return m_pending.size() == required;
+}
+
+size_t Encryptor::decrypt(const uint8_t* data, size_t length, uint8_t *out)
+{
+    if (length <= 0) {
+        return 0;
+    }
+
+    if (!m_deCipher) {
+        size_t headerLength = m_cipherInfo.ivLen;
+#ifdef USE_BOTAN2
+        if (m_cipherInfo.type == Cipher::CipherType::AEAD) {
+            headerLength = m_cipherInfo.saltLen;
         }
-    } else {
 #endif
-        out = m_deCipher->update(data, length);
+        if (m_pending.empty() && length >= headerLength) {
+            initDecipher(reinterpret_cast<const char*>(data), length, &headerLength);
+            data += headerLength;
+            length -= headerLength;
+        } else {
+            // The IV (or salt) is split across reads
+            if (!takePending(&data, &length, headerLength)) {
+                return 0;
+            }
+            initDecipher(reinterpret_cast<const char*>(m_pending.data()), headerLength, &headerLength);
+            m_pending.clear();
+        }
+    }
+
 #ifdef USE_BOTAN2
+    if (m_cipherInfo.type == Cipher::CipherType::AEAD) {
+        /*
+         * Chunks are decrypted iteratively, straight from data if they're
+         * complete. Only the unconsumed part of a chunk split across reads
+         * is copied into m_pending, and each byte is copied at most once.
+         */
+        const size_t lengthChunkSize = AEAD_CHUNK_SIZE_LEN + m_cipherInfo.tagLen;
+        uint8_t *pos = out;
+        for (;;) {
+            if (!m_pending.empty()) {
+                if (m_payloadLength == 0) {
+                    if (!takePending(&data, &length, lengthChunkSize)) {
+                        break;
+                    }
+                    m_deCipher->openChunk(m_pending.data(), lengthChunkSize, pos, &m_payloadLength);
+                } else {
+                    if (!takePending(&data, &length, m_payloadLength + m_cipherInfo.tagLen)) {
+                        break;
+                    }
+                    pos += m_deCipher->update(m_pending.data(), m_pending.size(), pos);
+                    m_deCipher->incrementIv();
+                    m_payloadLength = 0;
+                }
+                m_pending.clear();
+            } else if (length == 0) {
+                break;
+            } else if (m_payloadLength == 0) {
+                if (length < lengthChunkSize) {
+                    takePending(&data, &length, lengthChunkSize);
+                    break;
+                }
+                // Decrypt the length and, if it's all here, the payload in one go
+                uint16_t payloadLength = 0;
+                const size_t consumed = m_deCipher->openChunk(data, length, pos, &payloadLength);
+                data += consumed;
+                length -= consumed;
+                if (consumed > lengthChunkSize) {
+                    pos += payloadLength;
+                } else {
+                    m_payloadLength = payloadLength;
+                }
+            } else {
+                const size_t payloadChunkSize = m_payloadLength + m_cipherInfo.tagLen;
+                if (length < payloadChunkSize) {
+                    takePending(&data, &length, payloadChunkSize);
+                    break;
+                }
+                pos += m_deCipher->update(data, payloadChunkSize, pos);
+                m_deCipher->incrementIv();
+                data += payloadChunkSize;
+                length -= payloadChunkSize;
+                m_payloadLength = 0;
+            }
+        }
+        return pos - out;
     }
 #endif
-    return out;
+    return m_deCipher->update(data, length, out);
 }
 
 std::string Encryptor::encryptAll(const std::string &in)
@@ -32,16 +32,59 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 #include "util/export.h"
 #include "cipher.h"
+#include "cryptopool.h"
 
 namespace QSS {
 
+/**
+ * @brief The EncryptorContext class holds what all sessions of a profile
+ * share: the resolved cipher method and the master key derived from the
+ * password. It's immutable, so it can be shared across Encryptors.
+ */
+class QSS_EXPORT EncryptorContext
+{
+public:
+    /**
+     * @brief EncryptorContext
+     * @param method The encryption method in Shadowsocks convention
+     * @param password The preshared password
+     * @param cryptoWorkers The number of threads that each thread's AEAD
+     * chunks of large buffers are sealed on in parallel, 0 disables
+     */
+    EncryptorContext(const std::string& method,
+                     const std::string& password,
+                     int cryptoWorkers = 0);
+
+    EncryptorContext(const EncryptorContext &) = delete;
+
+    const std::string &method() const;
+    const Cipher::CipherInfo &cipherInfo() const;
+    Cipher::Backend backend() const;
+    const std::string &masterKey() const;
+    int cryptoWorkers() const;
+
+private:
+    const std::string m_method;
+    const Cipher::CipherInfo &m_cipherInfo;
+    const Cipher::Backend m_backend;
+    const std::string m_masterKey;
+    const int m_cryptoWorkers;
+};
+
 class QSS_EXPORT Encryptor
 {
 public:
     using Creator = std::function<std::unique_ptr<Encryptor>()>;
 
+    // A contiguous piece of encrypted output, laid out the same as iovec
+    struct Segment {
+        const uint8_t *data;
+        size_t length;
+    };
+
     /**
      * @brief Encryptor
      * @param method The encryption method in Shadowsocks convention
@@ -50,6 +93,12 @@ public:
     Encryptor(const std::string& method,
               const std::string& password);
 
+    /**
+     * @brief Encryptor Constructs an encryptor with a shared context
+     * This is much cheaper than deriving the master key for each session.
+     */
+    explicit Encryptor(std::shared_ptr<const EncryptorContext> context);
+
     Encryptor(const Encryptor &) = delete;
 
     /**
@@ -66,6 +115,54 @@ public:
     std::string encrypt(const std::string &);
     std::string encrypt(const uint8_t *data, size_t length);
 
+    /**
+     * @brief encryptOverhead Gets the number of extra bytes that encrypting
+     * length bytes of plain text in the next encrypt() call would produce
+     * This includes the IV (or salt) if it hasn't been sent yet.
+     */
+    size_t encryptOverhead(size_t length) const;
+
+    /**
+     * @brief encrypt Encrypts plain text into a caller-provided buffer
+     * @param out The output buffer that must hold at least
+     * length + encryptOverhead(length) bytes. It must not overlap data.
+     * @return The number of bytes written to out
+     */
+    size_t encrypt(const uint8_t *data, size_t length, uint8_t *out);
+
+    /**
+     * @brief encryptInPlace Encrypts plain text inside the buffer it's stored
+     * The plain text starts at buffer + headroom, and headroom must be no less
+     * than encryptOverhead(length). The encrypted data is written from buffer.
+     * @return The length of encrypted data starting at buffer
+     */
+    size_t encryptInPlace(uint8_t *buffer, size_t headroom, size_t length);
+
+    /**
+     * @brief encryptSegments Encrypts data in place and returns the encrypted
+     * stream as a list of segments, which can be sent by a single writev().
+     * The payload of each AEAD chunk is encrypted where it is, so no data is
+     * moved. The IV (or salt), encrypted lengths and tags are stored in an
+     * internal buffer. The segments are valid until the next call.
+     * If the context has crypto workers, the chunks are sealed in parallel
+     * on the CryptoPool of the calling thread.
+     */
+    const std::vector<Segment> &encryptSegments(uint8_t *data, size_t length);
+
+    /**
+     * @brief maxDecryptedSize Gets the size of output buffer required to
+     * decrypt length bytes of data in the next decrypt() call
+     */
+    size_t maxDecryptedSize(size_t length) const;
+
+    /**
+     * @brief decrypt Decrypts data into a caller-provided buffer
+     * @param out The output buffer that must hold at least
+     * maxDecryptedSize(length) bytes. It must not overlap data.
+     * @return The number of bytes written to out
+     */
+    size_t decrypt(const uint8_t *data, size_t length, uint8_t *out);
+
     /**
      * decryptAll and encryptAll are the counterpart for UDP packets
      */
@@ -76,14 +173,34 @@ public:
     std::string encryptAll(const uint8_t *data, size_t length);
 
 private:
-    std::string m_method;
-    const Cipher::CipherInfo m_cipherInfo;
-    std::string m_masterKey;
-    std::string m_incompleteChunk;
-    uint16_t m_incompleteLength;
+    const std::shared_ptr<const EncryptorContext> m_context;
+    const Cipher::CipherInfo &m_cipherInfo;
+    /*
+     * The unconsumed part of the AEAD chunk (or the IV/salt) that is split
+     * across decrypt() calls. It never holds more than one chunk.
+     */
+    std::vector<uint8_t> m_pending;
+    // The payload length if the length of current AEAD chunk is decrypted
+    uint16_t m_payloadLength;
+    // The output of encryptSegments() and the storage of its non-payload parts
+    std::vector<Segment> m_segments;
+    std::vector<uint8_t> m_segmentHeaders;
+
+    // The ciphers of CryptoPool workers, indexed by slot - 1
+    std::vector<std::unique_ptr<Cipher>> m_workerCiphers;
+
+    // Appends a segment, merging it into the last one if they're adjacent
+    void appendSegment(const uint8_t *data, size_t length);
+    // Seals chunks on the CryptoPool with nonces precomputed from the current
+    void sealChunksInParallel(uint8_t *data, size_t length, uint8_t *headers);
 
     void initEncipher(std::string *header);
     void initDecipher(const char *data, size_t length, size_t *offset);
+    /*
+     * Moves bytes from data to m_pending until it holds required bytes.
+     * Returns whether m_pending holds required bytes now.
+     */
+    bool takePending(const uint8_t **data, size_t *length, size_t required);
 
 protected:
     std::unique_ptr<Cipher> m_enCipher;
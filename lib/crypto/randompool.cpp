@@ -0,0 +1,135 @@
+/*
+ * randompool.cpp - the source file of RandomPool class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "randompool.h"
+#include <QtGlobal>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <botan/auto_rng.h>
+
+#ifdef Q_OS_UNIX
+#include <pthread.h>
+#endif
+
+using namespace QSS;
+
+namespace {
+
+std::atomic<uint64_t> refillCount(0);
+std::atomic<uint64_t> servedCount(0);
+std::atomic<uint64_t> reseedCount(0);
+// Bumped in the child of each fork(), so that fill() needn't ask for the pid
+std::atomic<uint64_t> forkCount(0);
+
+void registerForkHandler()
+{
+#ifdef Q_OS_UNIX
+    static const bool registered = []() {
+        return pthread_atfork(nullptr, nullptr, []() { ++forkCount; }) == 0;
+    }();
+    Q_UNUSED(registered)
+#endif
+}
+
+struct ThreadPool {
+    std::unique_ptr<Botan::AutoSeeded_RNG> rng;
+    std::vector<uint8_t> buffer;
+    size_t position = 0; // the bytes before it have been handed out
+    uint64_t forks = 0; // the value of forkCount when rng was seeded
+
+    ThreadPool()
+    {
+        registerForkHandler();
+    }
+
+    ~ThreadPool()
+    {
+        wipe();
+    }
+
+    void wipe()
+    {
+        std::fill(buffer.begin(), buffer.end(), 0);
+        position = buffer.size();
+    }
+
+    void refill()
+    {
+        const uint64_t currentForks = forkCount.load(std::memory_order_relaxed);
+        if (!rng || forks != currentForks) {
+            rng = std::make_unique<Botan::AutoSeeded_RNG>();
+            forks = currentForks;
+            ++reseedCount;
+        }
+        buffer.resize(RandomPool::BLOCK_SIZE);
+        rng->randomize(buffer.data(), buffer.size());
+        position = 0;
+        ++refillCount;
+    }
+};
+
+thread_local ThreadPool threadPool;
+
+}
+
+const size_t RandomPool::BLOCK_SIZE;
+
+void RandomPool::fill(uint8_t *out, size_t length)
+{
+    ThreadPool &pool = threadPool;
+    // A forked child must not reuse the bytes its parent generated ahead
+    if (pool.forks != forkCount.load(std::memory_order_relaxed)) {
+        pool.wipe();
+    }
+
+    servedCount += length;
+    while (length > 0) {
+        if (pool.position == pool.buffer.size()) {
+            pool.refill();
+        }
+        const size_t n = std::min(length, pool.buffer.size() - pool.position);
+        uint8_t *begin = pool.buffer.data() + pool.position;
+        std::copy(begin, begin + n, out);
+        // Don't leave handed-out bytes in memory
+        std::memset(begin, 0, n);
+        pool.position += n;
+        out += n;
+        length -= n;
+    }
+}
+
+std::string RandomPool::bytes(size_t length)
+{
+    std::string out(length, static_cast<char>(0));
+    if (length > 0) {
+        fill(reinterpret_cast<uint8_t*>(&out[0]), length);
+    }
+    return out;
+}
+
+RandomPool::Stats RandomPool::stats()
+{
+    return Stats{refillCount.load(), servedCount.load(), reseedCount.load()};
+}
@@ -0,0 +1,62 @@
+/*
+ * randompool.h - the header file of RandomPool class
+ *
+ * A per-thread buffered CSPRNG used for salts and IVs, so that the RNG
+ * isn't seeded from the operating system for each connection or datagram.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RANDOMPOOL_H
+#define RANDOMPOOL_H
+
+#include <cstdint>
+#include <string>
+#include "util/export.h"
+
+namespace QSS {
+
+class QSS_EXPORT RandomPool
+{
+public:
+    RandomPool() = delete;
+
+    // The number of random bytes generated ahead in each refill
+    static const size_t BLOCK_SIZE = 4096;
+
+    struct Stats {
+        uint64_t refills; // the number of blocks generated (all threads)
+        uint64_t bytesServed; // the number of random bytes handed out
+        uint64_t reseeds; // the number of times the RNG is (re)created
+    };
+
+    /*
+     * Fills out with length random bytes from the pool of calling thread.
+     * Each thread owns its RNG, which is recreated after fork() so that the
+     * parent and child never hand out the same bytes.
+     */
+    static void fill(uint8_t *out, size_t length);
+    static std::string bytes(size_t length);
+
+    static Stats stats();
+};
+
+}
+
+#endif // RANDOMPOOL_H
@@ -52,9 +52,12 @@ std::string RC4::update(const uint8_t *in, size_t length)
 {
     std::string output;
     output.resize(length);
-    unsigned char *out =
-            reinterpret_cast<unsigned char*>(&output[0]);
+    update(in, length, reinterpret_cast<uint8_t*>(&output[0]));
+    return output;
+}
 
+void RC4::update(const uint8_t *in, size_t length, uint8_t *out)
+{
     for (uint16_t delta = 4096 - position;
          length >= delta;
          delta = 4096 - position) {//4096 == buffer.size()
@@ -66,7 +69,6 @@ std::string RC4::update(const uint8_t *in, size_t length)
     }
     Common::exclusive_or(buffer.data() + position, in, out, length);
     position += length;
-    return output;
 }
 
 std::string RC4::update(const std::string &input)
@@ -47,6 +47,9 @@ public:
     std::string update(const uint8_t *data, size_t length);
     std::string update(const std::string &input);
 
+    // output must hold at least length bytes. output may be the same as data
+    void update(const uint8_t *data, size_t length, uint8_t *output);
+
 private:
     void generate();
 
@@ -0,0 +1,202 @@
+/*
+ * connectionpool.cpp - the source file of ConnectionPool class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "connectionpool.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace QSS {
+
+ConnectionPool::ConnectionPool(SocketFactory factory, Address server, QObject *parent)
+    : QObject(parent)
+    , m_factory(std::move(factory))
+    , m_server(std::move(server))
+    , m_size(0)
+    , m_idleTimeout(10000)
+    , m_rate(0)
+    , m_decay(0.5)
+    , m_takenThisTick(0)
+    , m_purgeScheduled(false)
+{
+    m_clock.start();
+    m_ticker.setInterval(1000);
+    m_ticker.setTimerType(Qt::CoarseTimer);
+    connect(&m_ticker, &QTimer::timeout, this, &ConnectionPool::onTick);
+}
+
+ConnectionPool::~ConnectionPool() = default;
+
+void ConnectionPool::setSize(int size)
+{
+    m_size = std::max(size, 0);
+}
+
+void ConnectionPool::setIdleTimeout(int idleTimeout)
+{
+    m_idleTimeout = idleTimeout;
+}
+
+void ConnectionPool::setTick(int interval, double decay)
+{
+    m_ticker.setInterval(interval);
+    m_decay = std::min(std::max(decay, 0.0), 0.99);
+}
+
+std::unique_ptr<RelaySocket> ConnectionPool::take()
+{
+    if (m_size == 0) {
+        return nullptr;
+    }
+    ++m_takenThisTick;
+    if (!m_ticker.isActive()) {
+        m_ticker.start();
+    }
+
+    std::unique_ptr<RelaySocket> socket;
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->connected && !it->dead) {
+            socket = std::move(it->socket);
+            m_entries.erase(it);
+            socket->disconnect(this);
+            break;
+        }
+    }
+    refill();
+    return socket;
+}
+
+int ConnectionPool::idleCount() const
+{
+    return static_cast<int>(std::count_if(m_entries.begin(), m_entries.end(),
+                                          [](const Entry &entry) {
+        return entry.connected && !entry.dead;
+    }));
+}
+
+int ConnectionPool::target() const
+{
+    // A burst is made up for straight away, rather than after the next tick
+    const double rate = std::max(m_rate, static_cast<double>(m_takenThisTick));
+    return std::min(m_size, static_cast<int>(std::ceil(rate)));
+}
+
+int ConnectionPool::pendingCount() const
+{
+    return static_cast<int>(std::count_if(m_entries.begin(), m_entries.end(),
+                                          [](const Entry &entry) {
+        return !entry.dead;
+    }));
+}
+
+void ConnectionPool::refill()
+{
+    if (pendingCount() >= target()) {
+        return;
+    }
+    m_server.lookUp([this](bool success) {
+        if (!success) {
+            return;
+        }
+        for (int i = pendingCount(); i < target(); ++i) {
+            open();
+        }
+    });
+}
+
+void ConnectionPool::open()
+{
+    m_entries.push_back(Entry { std::unique_ptr<RelaySocket>(m_factory()),
+                                m_clock.elapsed(), false, false });
+    RelaySocket *socket = m_entries.back().socket.get();
+    connect(socket, &RelaySocket::connected, this, [this, socket]() {
+        for (Entry &entry : m_entries) {
+            if (entry.socket.get() == socket) {
+                entry.connected = true;
+                entry.since = m_clock.elapsed();
+                break;
+            }
+        }
+    });
+    connect(socket, &RelaySocket::disconnected, this, [this, socket]() {
+        markDead(socket);
+    });
+    connect(socket, &RelaySocket::errorOccurred, this, [this, socket]() {
+        QDebug(QtMsgType::QtDebugMsg).noquote() << "Pooled connection:" << socket->errorString();
+        markDead(socket);
+    });
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    socket->connectToHost(m_server.getFirstIP(), m_server.getPort());
+}
+
+void ConnectionPool::markDead(RelaySocket *socket)
+{
+    for (Entry &entry : m_entries) {
+        if (entry.socket.get() == socket) {
+            entry.dead = true;
+            break;
+        }
+    }
+    // The socket is in the middle of emitting, so it's deleted later
+    if (!m_purgeScheduled) {
+        m_purgeScheduled = true;
+        QTimer::singleShot(0, this, [this]() {
+            m_purgeScheduled = false;
+            purge();
+            refill();
+        });
+    }
+}
+
+void ConnectionPool::purge()
+{
+    m_entries.remove_if([](const Entry &entry) {
+        return entry.dead;
+    });
+}
+
+void ConnectionPool::onTick()
+{
+    m_rate = m_rate * m_decay + m_takenThisTick * (1 - m_decay);
+    if (m_rate < 0.1) {
+        m_rate = 0;
+    }
+    m_takenThisTick = 0;
+
+    /*
+     * Closes what has been waiting for too long, including the connections
+     * that haven't got through. Those over the target are left to expire.
+     */
+    const qint64 now = m_clock.elapsed();
+    m_entries.remove_if([this, now](const Entry &entry) {
+        return entry.dead || now - entry.since >= m_idleTimeout;
+    });
+    refill();
+
+    if (m_entries.empty() && m_rate == 0) {
+        m_ticker.stop();
+    }
+}
+
+}  // namespace QSS
@@ -0,0 +1,120 @@
+/*
+ * connectionpool.h - the header file of ConnectionPool class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+#include <functional>
+#include <list>
+#include <memory>
+#include "relaysocket.h"
+#include "types/address.h"
+
+namespace QSS {
+
+/*
+ * Keeps connections to the server open ahead of time, so that a new
+ * TcpRelayClient can send its header without waiting for a TCP handshake.
+ * The pool holds about as many connections as were taken in the last
+ * tick (a second by default) or so, and none at all while no connection
+ * is being made.
+ * It must be used on the thread it lives in.
+ */
+class QSS_EXPORT ConnectionPool : public QObject
+{
+    Q_OBJECT
+public:
+    // Creates an unconnected socket, the same kind as the relays use
+    using SocketFactory = std::function<RelaySocket *()>;
+
+    ConnectionPool(SocketFactory factory, Address server, QObject *parent = nullptr);
+    ~ConnectionPool() override;
+
+    ConnectionPool(const ConnectionPool &) = delete;
+
+    // At most size connections are kept, none if it's 0 (the default)
+    void setSize(int size);
+    /*
+     * A connection is closed once it's been waiting for idleTimeout msec,
+     * which should be well within the handshake timeout of the server
+     */
+    void setIdleTimeout(int idleTimeout);
+    /*
+     * Every tick (msec), the rate is updated and waiting connections are
+     * expired. decay is the weight of the past rate at each tick, from 0
+     * (only the last tick counts) to below 1. They default to 1000 and 0.5.
+     */
+    void setTick(int interval, double decay);
+
+    /*
+     * Takes a connected socket, or returns nullptr if there isn't one at
+     * hand. Either way, it counts towards the rate the pool refills for.
+     */
+    std::unique_ptr<RelaySocket> take();
+
+    // The number of connected sockets waiting to be taken
+    int idleCount() const;
+
+private:
+    struct Entry {
+        std::unique_ptr<RelaySocket> socket;
+        // When it was opened, or connected once it's connected (msec)
+        qint64 since;
+        bool connected;
+        // Closed by the server, waiting to be purged
+        bool dead;
+    };
+
+    SocketFactory m_factory;
+    Address m_server;
+    int m_size;
+    int m_idleTimeout;
+    // Connecting ones are appended, so the connected ones are oldest first
+    std::list<Entry> m_entries;
+    QElapsedTimer m_clock;
+    // Ticks to update the rate and to expire connections
+    QTimer m_ticker;
+    // The connections taken per tick, as a moving average
+    double m_rate;
+    double m_decay;
+    int m_takenThisTick;
+    bool m_purgeScheduled;
+
+    // The number of connections the pool aims to hold
+    int target() const;
+    // The connections that are connected or connecting
+    int pendingCount() const;
+    void refill();
+    void open();
+    void markDead(RelaySocket *socket);
+    void purge();
+
+private slots:
+    void onTick();
+};
+
+}
+
+#endif // CONNECTIONPOOL_H
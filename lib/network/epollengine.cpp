@@ -0,0 +1,642 @@
+/*
+ * epollengine.cpp - the source file of EpollEngine and EpollRelaySocket classes
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "epollengine.h"
+#include "nativesocket.h"
+
+#ifdef Q_OS_LINUX
+#include <QTimer>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// The maximum number of events handled in one go
+const int MAX_EVENTS = 256;
+
+/*
+ * Sends backlog from offset until the socket takes no more. Returns 0, or
+ * errno if it failed.
+ */
+int sendBacklog(int fd, const std::string &backlog, size_t *offset)
+{
+    while (*offset < backlog.size()) {
+        ssize_t n;
+        do {
+            n = ::send(fd, backlog.data() + *offset, backlog.size() - *offset, MSG_NOSIGNAL);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS ? 0 : errno;
+        }
+        *offset += n;
+    }
+    return 0;
+}
+
+}  // namespace
+
+namespace QSS {
+
+EpollEngine::EpollEngine(QObject *parent) :
+    QObject(parent),
+    m_epollFd(::epoll_create1(EPOLL_CLOEXEC)),
+    m_nextId(0),
+    m_dispatching(false),
+    m_scheduled(false)
+{
+    if (m_epollFd == -1) {
+        qFatal("Failed to create epoll instance: %s", std::strerror(errno));
+    }
+    // The epoll descriptor is readable (level-triggered) while it has events
+    m_notifier = std::make_unique<QSocketNotifier>(m_epollFd, QSocketNotifier::Read);
+    connect(m_notifier.get(), &QSocketNotifier::activated, this, &EpollEngine::onActivated);
+}
+
+EpollEngine::~EpollEngine()
+{
+    m_notifier.reset();
+    for (const auto &lingering : m_lingering) {
+        ::close(lingering.second.fd);
+    }
+    ::close(m_epollFd);
+}
+
+bool EpollEngine::isSupported()
+{
+    return true;
+}
+
+uint64_t EpollEngine::attach(EpollRelaySocket *socket)
+{
+    const uint64_t id = ++m_nextId;
+    m_sockets.emplace(id, socket);
+    return id;
+}
+
+void EpollEngine::detach(uint64_t id)
+{
+    m_sockets.erase(id);
+}
+
+bool EpollEngine::watch(int fd, uint64_t id)
+{
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = id;
+    return ::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void EpollEngine::unwatch(int fd)
+{
+    ::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void EpollEngine::defer(uint64_t id)
+{
+    m_deferred.push_back(id);
+    if (!m_dispatching && !m_scheduled) {
+        m_scheduled = true;
+        QTimer::singleShot(0, this, [this]() {
+            m_scheduled = false;
+            processDeferred();
+        });
+    }
+}
+
+void EpollEngine::linger(uint64_t id, int fd, std::string backlog)
+{
+    m_lingering.emplace(id, Lingering { fd, std::move(backlog), 0 });
+}
+
+void EpollEngine::handleLingering(uint64_t id, uint32_t events)
+{
+    auto it = m_lingering.find(id);
+    if (it == m_lingering.end()) {
+        return;
+    }
+
+    Lingering &lingering = it->second;
+    const int error = (events & EPOLLERR)
+            ? ECONNRESET : sendBacklog(lingering.fd, lingering.backlog, &lingering.offset);
+    if (error == 0 && lingering.offset < lingering.backlog.size()) {
+        return;
+    }
+    unwatch(lingering.fd);
+    if (error == 0) {
+        NativeSocket::closeGracefully(lingering.fd);
+    } else {
+        ::close(lingering.fd);
+    }
+    m_lingering.erase(it);
+}
+
+void EpollEngine::onActivated()
+{
+    epoll_event events[MAX_EVENTS];
+    const int count = ::epoll_wait(m_epollFd, events, MAX_EVENTS, 0);
+
+    m_dispatching = true;
+    for (int i = 0; i < count; ++i) {
+        // The socket may have been deleted by an earlier event's handler
+        auto it = m_sockets.find(events[i].data.u64);
+        if (it != m_sockets.end()) {
+            it->second->handleEvents(events[i].events);
+        } else {
+            handleLingering(events[i].data.u64, events[i].events);
+        }
+    }
+    m_dispatching = false;
+    processDeferred();
+}
+
+void EpollEngine::processDeferred()
+{
+    /*
+     * Calls deferred during this round wait for the next one, so that a
+     * busy socket can't starve the others or the Qt event loop
+     */
+    std::vector<uint64_t> deferred;
+    deferred.swap(m_deferred);
+    m_dispatching = true;
+    for (uint64_t id : deferred) {
+        auto it = m_sockets.find(id);
+        if (it != m_sockets.end()) {
+            it->second->runDeferred();
+        }
+    }
+    m_dispatching = false;
+
+    if (!m_deferred.empty() && !m_scheduled) {
+        m_scheduled = true;
+        QTimer::singleShot(0, this, [this]() {
+            m_scheduled = false;
+            processDeferred();
+        });
+    }
+}
+
+EpollRelaySocket::EpollRelaySocket(EpollEngine *engine, qintptr socketDescriptor, QObject *parent) :
+    RelaySocket(parent),
+    m_engine(engine),
+    m_fd(-1),
+    m_id(engine->attach(this)),
+    m_connecting(false),
+    m_readable(false),
+    m_peerClosed(false),
+    m_readPaused(false),
+    m_closing(false),
+    m_lowDelay(false),
+    m_keepAlive(false),
+    m_fastOpen(false),
+    m_fastOpenSet(false),
+    m_synPending(false),
+    m_deferred(0),
+    m_written(0),
+    m_writeOffset(0),
+    m_error(QAbstractSocket::UnknownSocketError)
+{
+    if (socketDescriptor != -1) {
+        setUp(static_cast<int>(socketDescriptor));
+    }
+}
+
+EpollRelaySocket::~EpollRelaySocket()
+{
+    if (m_closing && m_engine) {
+        m_writeBuffer.erase(0, m_writeOffset);
+        m_engine->linger(m_id, m_fd, std::move(m_writeBuffer));
+        m_fd = -1;
+    }
+    abort();
+    if (m_engine) {
+        m_engine->detach(m_id);
+    }
+}
+
+void EpollRelaySocket::setUp(int fd)
+{
+    m_fd = fd;
+    if (!m_engine) {
+        setError(EBADF);
+        return;
+    }
+    ::fcntl(m_fd, F_SETFL, ::fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+    NativeSocket::setOption(m_fd, QAbstractSocket::LowDelayOption, m_lowDelay);
+    NativeSocket::setOption(m_fd, QAbstractSocket::KeepAliveOption, m_keepAlive);
+    if (!m_engine->watch(m_fd, m_id)) {
+        setError(errno);
+    }
+}
+
+void EpollRelaySocket::defer(Deferred deferred)
+{
+    if (!m_engine || m_closing) {
+        return;
+    }
+    if (m_deferred == 0) {
+        m_engine->defer(m_id);
+    }
+    m_deferred |= deferred;
+}
+
+void EpollRelaySocket::setError(int error)
+{
+    m_error = NativeSocket::errorFromErrno(error);
+    m_errorString = QString::fromLocal8Bit(std::strerror(error));
+    defer(DEFER_ERROR);
+}
+
+qint64 EpollRelaySocket::read(char *data, qint64 maxSize)
+{
+    if (m_fd == -1 || m_closing) {
+        return -1;
+    }
+
+    ssize_t n;
+    do {
+        n = ::recv(m_fd, data, maxSize, 0);
+    } while (n == -1 && errno == EINTR);
+
+    if (n > 0) {
+        // Edge-triggered: it's only drained if the kernel had less than asked
+        if (n < maxSize) {
+            m_readable = false;
+        }
+        return n;
+    }
+    m_readable = false;
+    if (n == 0) {
+        m_peerClosed = true;
+        defer(DEFER_DISCONNECTED);
+        return 0;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+    }
+    setError(errno);
+    return -1;
+}
+
+qint64 EpollRelaySocket::write(const char *data, qint64 size)
+{
+    if (m_fd == -1 || m_closing) {
+        return -1;
+    }
+    // The send below carries the SYN
+    m_synPending = false;
+
+    qint64 sent = 0;
+    if (!m_connecting && bytesToWrite() == 0) {
+        ssize_t n;
+        do {
+            n = ::send(m_fd, data, size, MSG_NOSIGNAL);
+        } while (n == -1 && errno == EINTR);
+        // EINPROGRESS: a Fast Open connection whose SYN couldn't take the data
+        if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINPROGRESS) {
+            setError(errno);
+            return -1;
+        }
+        if (n > 0) {
+            sent = n;
+            m_written += n;
+            defer(DEFER_WRITTEN);
+        }
+    }
+
+    // The rest is sent once the socket becomes writable
+    if (sent < size) {
+        if (m_writeOffset > 0 && m_writeOffset == m_writeBuffer.size()) {
+            m_writeBuffer.clear();
+            m_writeOffset = 0;
+        }
+        m_writeBuffer.append(data + sent, size - sent);
+    }
+    return size;
+}
+
+bool EpollRelaySocket::flush()
+{
+    const size_t before = m_writeOffset;
+    const int error = sendBacklog(m_fd, m_writeBuffer, &m_writeOffset);
+    const size_t sent = m_writeOffset - before;
+    m_written += sent;
+    if (error != 0) {
+        setError(error);
+        return false;
+    }
+    if (m_writeOffset == m_writeBuffer.size()) {
+        m_writeBuffer.clear();
+        m_writeOffset = 0;
+    }
+    if (sent > 0) {
+        defer(DEFER_WRITTEN);
+    }
+    return true;
+}
+
+qint64 EpollRelaySocket::bytesToWrite() const
+{
+    return m_writeBuffer.size() - m_writeOffset;
+}
+
+qintptr EpollRelaySocket::socketDescriptor() const
+{
+    return m_fd;
+}
+
+void EpollRelaySocket::connectToHost(const QHostAddress &address, uint16_t port)
+{
+    sockaddr_storage storage;
+    const socklen_t length = NativeSocket::toSockAddr(address, port, &storage);
+
+    abort();
+    const int fd = ::socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        setError(errno);
+        return;
+    }
+    setUp(fd);
+    // Falls back to a normal connect if the kernel doesn't take it
+    m_fastOpenSet = m_fastOpen && NativeSocket::setFastOpenConnect(m_fd);
+
+    int ret;
+    do {
+        ret = ::connect(m_fd, reinterpret_cast<sockaddr *>(&storage), length);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == 0) {
+        // Either a local connection, or a Fast Open one that hasn't started
+        m_synPending = m_fastOpenSet;
+        defer(DEFER_CONNECTED);
+    } else if (errno == EINPROGRESS) {
+        m_connecting = true;
+    } else {
+        setError(errno);
+    }
+}
+
+void EpollRelaySocket::close()
+{
+    if (m_closing) {
+        return;
+    }
+    if (m_fd == -1 || !m_engine || bytesToWrite() == 0) {
+        abort();
+        return;
+    }
+
+    // Events only go on writing the backlog from now on, see handleEvents()
+    m_closing = true;
+    m_readable = false;
+    m_deferred = 0;
+}
+
+void EpollRelaySocket::abort()
+{
+    if (m_fd != -1) {
+        if (m_engine) {
+            m_engine->unwatch(m_fd);
+        }
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_closing = false;
+    m_connecting = false;
+    m_synPending = false;
+    m_readable = false;
+    m_deferred = 0;
+    m_written = 0;
+    m_writeBuffer.clear();
+    m_writeOffset = 0;
+}
+
+void EpollRelaySocket::setReadBufferSize(qint64)
+{
+    // Data is read straight from the kernel, which does the buffering
+}
+
+void EpollRelaySocket::setSocketOption(QAbstractSocket::SocketOption option, const QVariant &value)
+{
+    // Kept to be applied to the descriptor of connectToHost() as well
+    if (option == QAbstractSocket::LowDelayOption) {
+        m_lowDelay = value.toBool();
+    } else if (option == QAbstractSocket::KeepAliveOption) {
+        m_keepAlive = value.toBool();
+    }
+    if (m_fd != -1) {
+        NativeSocket::setOption(m_fd, option, value.toBool());
+    }
+}
+
+void EpollRelaySocket::setReadPaused(bool paused)
+{
+    // Unread data is simply left in the kernel while paused
+    m_readPaused = paused;
+    if (!paused && (m_readable || m_peerClosed)) {
+        defer(DEFER_READ);
+    }
+}
+
+QHostAddress EpollRelaySocket::localAddress() const
+{
+    return NativeSocket::localAddress(m_fd);
+}
+
+uint16_t EpollRelaySocket::localPort() const
+{
+    return NativeSocket::localPort(m_fd);
+}
+
+QHostAddress EpollRelaySocket::peerAddress() const
+{
+    return NativeSocket::peerAddress(m_fd);
+}
+
+uint16_t EpollRelaySocket::peerPort() const
+{
+    return NativeSocket::peerPort(m_fd);
+}
+
+QAbstractSocket::SocketError EpollRelaySocket::error() const
+{
+    return m_error;
+}
+
+QString EpollRelaySocket::errorString() const
+{
+    return m_errorString;
+}
+
+bool EpollRelaySocket::canWriteDirectly() const
+{
+    // Errors of direct writes show up as EPOLLERR, the same as any other
+    return true;
+}
+
+void EpollRelaySocket::writtenDirectly(qint64 count)
+{
+    m_written += count;
+    defer(DEFER_WRITTEN);
+}
+
+bool EpollRelaySocket::setFastOpen(bool enabled)
+{
+    m_fastOpen = enabled;
+    return true;
+}
+
+RelaySocket::FastOpen EpollRelaySocket::fastOpenResult() const
+{
+    if (!m_fastOpen || m_fd == -1) {
+        return FastOpen::NOT_USED;
+    }
+    if (m_fastOpenSet && NativeSocket::fastOpenAccepted(m_fd)) {
+        return FastOpen::ACCEPTED;
+    }
+    return FastOpen::FELL_BACK;
+}
+
+void EpollRelaySocket::handleEvents(uint32_t events)
+{
+    if (m_closing) {
+        if ((events & EPOLLERR) || !flush()) {
+            abort();
+        } else if (bytesToWrite() == 0) {
+            m_engine->unwatch(m_fd);
+            NativeSocket::closeGracefully(m_fd);
+            m_fd = -1;
+            abort();
+        }
+        return;
+    }
+
+    QPointer<EpollRelaySocket> self(this);
+
+    if (m_connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        ::getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        m_connecting = false;
+        if (error != 0) {
+            setError(error);
+            return;
+        }
+        emit connected();
+        if (!self || m_fd == -1) {
+            return;
+        }
+    } else if (events & EPOLLERR) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        ::getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        setError(error != 0 ? error : ECONNRESET);
+        return;
+    }
+
+    if ((events & EPOLLOUT) && bytesToWrite() > 0 && !flush()) {
+        return;
+    }
+    if (events & (EPOLLRDHUP | EPOLLHUP)) {
+        m_peerClosed = true;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        m_readable = true;
+        notifyReadable();
+    }
+}
+
+void EpollRelaySocket::notifyReadable()
+{
+    if (m_fd == -1 || m_closing || m_readPaused || (!m_readable && !m_peerClosed)) {
+        return;
+    }
+
+    /*
+     * readyRead is only emitted if there's data. The end of stream is told by
+     * disconnected, the same as QTcpSocket.
+     */
+    int available = 0;
+    ::ioctl(m_fd, FIONREAD, &available);
+    if (available <= 0) {
+        m_readable = false;
+        if (m_peerClosed) {
+            defer(DEFER_DISCONNECTED);
+        }
+        return;
+    }
+
+    QPointer<EpollRelaySocket> self(this);
+    emit readyRead();
+    /*
+     * Carry on with the rest in the next round if it wasn't drained, or
+     * tell the end of stream once it's drained
+     */
+    if (self && m_fd != -1 && (m_readable || m_peerClosed)) {
+        defer(DEFER_READ);
+    }
+}
+
+void EpollRelaySocket::runDeferred()
+{
+    const int deferred = m_deferred;
+    m_deferred = 0;
+    QPointer<EpollRelaySocket> self(this);
+
+    if (deferred & DEFER_ERROR) {
+        emit errorOccurred(m_error);
+        return;
+    }
+    if (deferred & DEFER_CONNECTED) {
+        emit connected();
+        if (!self) {
+            return;
+        }
+        // Nothing was written on connected, so the SYN would wait for good
+        if (m_synPending && m_fd != -1) {
+            m_synPending = false;
+            NativeSocket::startFastOpen(m_fd);
+        }
+    }
+    if ((deferred & DEFER_WRITTEN) && m_written > 0) {
+        const qint64 written = m_written;
+        m_written = 0;
+        emit bytesWritten(written);
+        if (!self) {
+            return;
+        }
+    }
+    if (deferred & DEFER_DISCONNECTED) {
+        emit disconnected();
+        return;
+    }
+    if (deferred & DEFER_READ) {
+        notifyReadable();
+    }
+}
+
+}  // namespace QSS
+
+#endif // Q_OS_LINUX
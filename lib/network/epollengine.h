@@ -0,0 +1,199 @@
+/*
+ * epollengine.h - the header file of EpollEngine and EpollRelaySocket classes
+ *
+ * A Linux-only relay engine on raw non-blocking sockets and edge-triggered
+ * epoll, which avoids the buffers, notifiers and signal dispatch that each
+ * QTcpSocket carries. The epoll instance is plugged into the Qt event loop
+ * through a single QSocketNotifier, so timers and DNS lookups still work.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EPOLLENGINE_H
+#define EPOLLENGINE_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+#include <QPointer>
+#include <QSocketNotifier>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "relaysocket.h"
+
+namespace QSS {
+
+class EpollRelaySocket;
+
+/*
+ * An epoll instance serving the sockets of one thread.
+ * It must be created and used on that thread. Sockets outliving it are
+ * simply closed without it.
+ */
+class QSS_EXPORT EpollEngine : public QObject
+{
+    Q_OBJECT
+public:
+    explicit EpollEngine(QObject *parent = nullptr);
+    ~EpollEngine() override;
+
+    EpollEngine(const EpollEngine &) = delete;
+
+    static bool isSupported();
+
+    /*
+     * A socket is attached for its lifetime and gets an id, which events and
+     * deferred calls are delivered with. Hence nothing is delivered to a
+     * socket after it's detached, even if it's deleted while handling events.
+     * Its descriptor is watched for edge-triggered reads and writes.
+     */
+    uint64_t attach(EpollRelaySocket *socket);
+    void detach(uint64_t id);
+    bool watch(int fd, uint64_t id);
+    void unwatch(int fd);
+
+    /*
+     * Asks the engine to call back the socket after the current events, to
+     * emit deferred signals or to carry on reading a socket that has more
+     * data than it read at once
+     */
+    void defer(uint64_t id);
+
+    /*
+     * Takes over the descriptor of a socket that is deleted while closing,
+     * together with the data it has left to write. The data is written out
+     * before the write side is shut down and the descriptor is closed.
+     * It's still watched under the id of the socket, which must be detached.
+     */
+    void linger(uint64_t id, int fd, std::string backlog);
+
+private:
+    // A descriptor taken over by linger()
+    struct Lingering {
+        int fd;
+        std::string backlog;
+        size_t offset;
+    };
+
+    int m_epollFd;
+    std::unique_ptr<QSocketNotifier> m_notifier;
+    std::unordered_map<uint64_t, EpollRelaySocket *> m_sockets;
+    std::unordered_map<uint64_t, Lingering> m_lingering;
+    std::vector<uint64_t> m_deferred;
+    uint64_t m_nextId;
+    bool m_dispatching;
+    bool m_scheduled;
+
+    void onActivated();
+    void processDeferred();
+    void handleLingering(uint64_t id, uint32_t events);
+};
+
+class QSS_EXPORT EpollRelaySocket : public RelaySocket
+{
+    Q_OBJECT
+public:
+    // Wraps a connected socket, or creates one on connectToHost() if it's -1
+    explicit EpollRelaySocket(EpollEngine *engine, qintptr socketDescriptor = -1,
+                              QObject *parent = nullptr);
+    ~EpollRelaySocket() override;
+
+    qint64 read(char *data, qint64 maxSize) override;
+    qint64 write(const char *data, qint64 size) override;
+    using RelaySocket::write;
+    qint64 bytesToWrite() const override;
+    qintptr socketDescriptor() const override;
+    void connectToHost(const QHostAddress &address, uint16_t port) override;
+    /*
+     * Stops reading straight away, but the data left to write is still
+     * written out before the write side is shut down and the descriptor is
+     * closed, as QTcpSocket does. No signal is emitted after this. If the
+     * socket is deleted in the meantime, the engine carries on with it.
+     */
+    void close() override;
+
+    void setReadBufferSize(qint64 size) override;
+    void setSocketOption(QAbstractSocket::SocketOption option, const QVariant &value) override;
+    void setReadPaused(bool paused) override;
+
+    QHostAddress localAddress() const override;
+    uint16_t localPort() const override;
+    QHostAddress peerAddress() const override;
+    uint16_t peerPort() const override;
+    QAbstractSocket::SocketError error() const override;
+    QString errorString() const override;
+
+    bool canWriteDirectly() const override;
+    void writtenDirectly(qint64 count) override;
+    bool setFastOpen(bool enabled) override;
+    FastOpen fastOpenResult() const override;
+
+private:
+    friend class EpollEngine;
+
+    // The signals waiting to be emitted by the engine
+    enum Deferred {
+        DEFER_READ = 1,
+        DEFER_CONNECTED = 2,
+        DEFER_WRITTEN = 4,
+        DEFER_ERROR = 8,
+        DEFER_DISCONNECTED = 16
+    };
+
+    QPointer<EpollEngine> m_engine;
+    int m_fd;
+    uint64_t m_id;
+    bool m_connecting;
+    bool m_readable;
+    bool m_peerClosed;
+    bool m_readPaused;
+    // Whether close() is waiting for the data left to write
+    bool m_closing;
+    bool m_lowDelay;
+    bool m_keepAlive;
+    bool m_fastOpen;
+    // Whether the kernel took TCP_FASTOPEN_CONNECT for the current connection
+    bool m_fastOpenSet;
+    // connect() returned straight away, and the SYN waits for the first write
+    bool m_synPending;
+    int m_deferred;
+    qint64 m_written;
+    std::string m_writeBuffer;
+    size_t m_writeOffset;
+    QAbstractSocket::SocketError m_error;
+    QString m_errorString;
+
+    void setUp(int fd);
+    void defer(Deferred deferred);
+    void setError(int error);
+    bool flush();
+    // Closes the descriptor at once, dropping what's left to write
+    void abort();
+    // Called by the engine
+    void handleEvents(uint32_t events);
+    void runDeferred();
+    void notifyReadable();
+};
+
+}
+
+#endif // Q_OS_LINUX
+
+#endif // EPOLLENGINE_H
@@ -0,0 +1,169 @@
+/*
+ * happyeyeballs.cpp - the source file of HappyEyeballs class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "happyeyeballs.h"
+#include <QDebug>
+#include <algorithm>
+#include <utility>
+
+namespace QSS {
+
+const int HappyEyeballs::DEFAULT_ATTEMPT_DELAY;
+
+HappyEyeballs::HappyEyeballs(SocketFactory factory, QObject *parent)
+    : QObject(parent)
+    , m_factory(std::move(factory))
+    , m_port(0)
+    , m_next(0)
+    , m_finished(false)
+{
+    m_delayTimer.setSingleShot(true);
+    m_delayTimer.setInterval(DEFAULT_ATTEMPT_DELAY);
+    connect(&m_delayTimer, &QTimer::timeout, this, &HappyEyeballs::startNext);
+}
+
+HappyEyeballs::~HappyEyeballs()
+{
+}
+
+void HappyEyeballs::setAttemptDelay(int msec)
+{
+    m_delayTimer.setInterval(msec);
+}
+
+std::vector<QHostAddress> HappyEyeballs::interleave(const std::vector<QHostAddress> &addresses)
+{
+    if (addresses.empty()) {
+        return {};
+    }
+    std::vector<QHostAddress> first;
+    std::vector<QHostAddress> second;
+    const QAbstractSocket::NetworkLayerProtocol family = addresses.front().protocol();
+    for (const QHostAddress &address : addresses) {
+        (address.protocol() == family ? first : second).push_back(address);
+    }
+
+    std::vector<QHostAddress> result;
+    result.reserve(addresses.size());
+    for (size_t i = 0; i < std::max(first.size(), second.size()); ++i) {
+        if (i < first.size()) {
+            result.push_back(first[i]);
+        }
+        if (i < second.size()) {
+            result.push_back(second[i]);
+        }
+    }
+    return result;
+}
+
+void HappyEyeballs::connectToHost(const std::vector<QHostAddress> &addresses, uint16_t port)
+{
+    m_addresses = interleave(addresses);
+    m_port = port;
+    if (m_addresses.empty()) {
+        m_finished = true;
+        emit failed(QStringLiteral("No address to connect to"));
+        return;
+    }
+    startNext();
+}
+
+std::unique_ptr<RelaySocket> HappyEyeballs::takeSocket()
+{
+    return std::move(m_winner);
+}
+
+QHostAddress HappyEyeballs::address() const
+{
+    return m_winnerAddress;
+}
+
+void HappyEyeballs::startNext()
+{
+    if (m_finished || m_next >= m_addresses.size()) {
+        return;
+    }
+
+    const size_t index = m_attempts.size();
+    const QHostAddress address = m_addresses[m_next++];
+    RelaySocket *socket = m_factory();
+    // connected has to mean that the host answered
+    socket->setFastOpen(false);
+    m_attempts.push_back(Attempt{std::unique_ptr<RelaySocket>(socket), address, false});
+    connect(socket, &RelaySocket::connected, this, [index, this]() {
+        onAttemptConnected(index);
+    });
+    connect(socket, &RelaySocket::errorOccurred, this, [index, this]() {
+        onAttemptFailed(index);
+    });
+    m_delayTimer.start();
+    // Nothing about the attempts may be held on to, since it may fail straight away
+    socket->connectToHost(address, m_port);
+}
+
+void HappyEyeballs::onAttemptConnected(size_t index)
+{
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+    m_delayTimer.stop();
+
+    Attempt &attempt = m_attempts[index];
+    disconnect(attempt.socket.get(), nullptr, this, nullptr);
+    m_winner = std::move(attempt.socket);
+    m_winnerAddress = attempt.address;
+    for (Attempt &other : m_attempts) {
+        if (other.socket && !other.failed) {
+            other.socket->close();
+        }
+    }
+    emit connected();
+}
+
+void HappyEyeballs::onAttemptFailed(size_t index)
+{
+    Attempt &attempt = m_attempts[index];
+    if (m_finished || attempt.failed) {
+        return;
+    }
+    attempt.failed = true;
+    const QString errorString = attempt.socket->errorString();
+    QDebug(QtMsgType::QtDebugMsg).noquote() << "Connecting to" << attempt.address.toString()
+                                            << "failed:" << errorString;
+    attempt.socket->close();
+
+    // The next address doesn't have to wait for the delay
+    if (m_next < m_addresses.size()) {
+        startNext();
+        return;
+    }
+    const bool allFailed = std::all_of(m_attempts.begin(), m_attempts.end(),
+                                       [](const Attempt &a) { return a.failed; });
+    if (allFailed) {
+        m_finished = true;
+        m_delayTimer.stop();
+        emit failed(errorString);
+    }
+}
+
+}  // namespace QSS
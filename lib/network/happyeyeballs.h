@@ -0,0 +1,115 @@
+/*
+ * happyeyeballs.h - the header file of HappyEyeballs class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HAPPYEYEBALLS_H
+#define HAPPYEYEBALLS_H
+
+#include <QHostAddress>
+#include <QObject>
+#include <QTimer>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "relaysocket.h"
+
+namespace QSS {
+
+/*
+ * Connects to whichever address of a host answers first (RFC 8305). The
+ * addresses are tried in turn, alternating between IPv6 and IPv4, and a
+ * new attempt is started whenever the previous one fails or hasn't
+ * connected within the attempt delay. The attempts carry on side by side
+ * until one of them connects, and the rest are closed.
+ * The attempts don't use TCP Fast Open, which would have them connected
+ * before any handshake, so that the first one would always win.
+ */
+class QSS_EXPORT HappyEyeballs : public QObject
+{
+    Q_OBJECT
+public:
+    // Creates an unconnected socket, the same kind as the relays use
+    using SocketFactory = std::function<RelaySocket *()>;
+
+    // The attempt delay recommended by RFC 8305 (msec)
+    static const int DEFAULT_ATTEMPT_DELAY = 250;
+
+    explicit HappyEyeballs(SocketFactory factory, QObject *parent = nullptr);
+    ~HappyEyeballs() override;
+
+    HappyEyeballs(const HappyEyeballs &) = delete;
+
+    void setAttemptDelay(int msec);
+
+    /*
+     * Orders addresses the way they're tried, starting with the family of
+     * the first address and then alternating between the families, while
+     * keeping the order within each family
+     */
+    static std::vector<QHostAddress> interleave(const std::vector<QHostAddress> &addresses);
+
+    // Starts connecting to port on addresses, which can't be started twice
+    void connectToHost(const std::vector<QHostAddress> &addresses, uint16_t port);
+
+    /*
+     * Takes the socket that's connected, after connected has been emitted.
+     * It's disconnected from this object already.
+     */
+    std::unique_ptr<RelaySocket> takeSocket();
+
+    // The address of the connected socket
+    QHostAddress address() const;
+
+signals:
+    void connected();
+    // All attempts have failed, and errorString is that of the last one
+    void failed(const QString &errorString);
+
+private:
+    struct Attempt {
+        std::unique_ptr<RelaySocket> socket;
+        QHostAddress address;
+        bool failed;
+    };
+
+    SocketFactory m_factory;
+    std::vector<QHostAddress> m_addresses;
+    uint16_t m_port;
+    size_t m_next;
+    /*
+     * The closed attempts stay here until this object is destroyed, since
+     * they fail inside their own signals
+     */
+    std::vector<Attempt> m_attempts;
+    std::unique_ptr<RelaySocket> m_winner;
+    QHostAddress m_winnerAddress;
+    QTimer m_delayTimer;
+    bool m_finished;
+
+    // Starts the next attempt, if there are addresses left
+    void startNext();
+    void onAttemptConnected(size_t index);
+    void onAttemptFailed(size_t index);
+};
+
+}
+
+#endif // HAPPYEYEBALLS_H
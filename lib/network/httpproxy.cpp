@@ -22,6 +22,8 @@
 
 #include "httpproxy.h"
 #include "socketstream.h"
+#include "types/address.h"
+#include "util/common.h"
 #include <QDebug>
 #include <QTcpSocket>
 #include <QUrl>
@@ -118,8 +120,8 @@ void HttpProxy::onSocketReadyRead()
     }
 
     proxySocket = new QTcpSocket(socket);
-    proxySocket->setProxy(upstreamProxy);
     if (method != "CONNECT") {
+        proxySocket->setProxy(upstreamProxy);
         proxySocket->setObjectName(key);
         proxySocket->setProperty("reqData", reqData);
         connect (proxySocket, &QTcpSocket::connected,
@@ -127,8 +129,17 @@ void HttpProxy::onSocketReadyRead()
         connect (proxySocket, &QTcpSocket::readyRead,
                  this, &HttpProxy::onProxySocketReadyRead);
     } else {
+        /*
+         * The SOCKS5 handshake is done here instead of by Qt, so that the
+         * tunnel is a plain TCP connection which SocketStream can splice
+         */
+        proxySocket->setProxy(QNetworkProxy::NoProxy);
+        proxySocket->setProperty("target", QByteArray::fromStdString(
+                                     Common::packAddress(Address(host.toStdString(), port))));
         connect (proxySocket, &QTcpSocket::connected,
                  this, &HttpProxy::onProxySocketConnectedHttps);
+        connect (proxySocket, &QTcpSocket::readyRead,
+                 this, &HttpProxy::onProxySocketSocksReadyRead);
     }
     connect (proxySocket, &QTcpSocket::disconnected,
              proxySocket, &QTcpSocket::deleteLater);
@@ -137,7 +148,11 @@ void HttpProxy::onSocketReadyRead()
              (&QTcpSocket::error),
              this,
              &HttpProxy::onSocketError);
-    proxySocket->connectToHost(host, port);
+    if (method != "CONNECT") {
+        proxySocket->connectToHost(host, port);
+    } else {
+        proxySocket->connectToHost(upstreamProxy.hostName(), upstreamProxy.port());
+    }
 }
 
 void HttpProxy::onProxySocketConnected()
@@ -151,8 +166,66 @@ void HttpProxy::onProxySocketConnectedHttps()
 {
     QTcpSocket *proxySocket = qobject_cast<QTcpSocket *>(sender());
     QTcpSocket *socket = qobject_cast<QTcpSocket *>(proxySocket->parent());
+    // Anything sent from now on belongs to the tunnel
     disconnect(socket, &QTcpSocket::readyRead,
                this, &HttpProxy::onSocketReadyRead);
+    // Greeting with no authentication
+    static constexpr const char greeting[] = { 5, 1, 0 };
+    proxySocket->write(greeting, 3);
+}
+
+void HttpProxy::onProxySocketSocksReadyRead()
+{
+    QTcpSocket *proxySocket = qobject_cast<QTcpSocket *>(sender());
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(proxySocket->parent());
+
+    if (!proxySocket->property("greeted").toBool()) {
+        if (proxySocket->bytesAvailable() < 2) {
+            return;
+        }
+        if (proxySocket->read(2) != QByteArray("\x05\x00", 2)) {
+            qCritical("The SOCKS5 server rejected the HTTPS tunnel");
+            socket->disconnectFromHost();
+            return;
+        }
+        proxySocket->setProperty("greeted", true);
+        // CMD_CONNECT
+        static constexpr const char request[] = { 5, 1, 0 };
+        proxySocket->write(QByteArray(request, 3) + proxySocket->property("target").toByteArray());
+    }
+
+    // VER REP RSV ATYP followed by the bound address and port
+    const QByteArray reply = proxySocket->peek(proxySocket->bytesAvailable());
+    if (reply.size() < 5) {
+        return;
+    }
+    int headerLength = 0;
+    switch (reply.at(3)) {
+    case Address::IPV4:
+        headerLength = 1 + 4 + 2;
+        break;
+    case Address::HOST:
+        headerLength = 1 + 1 + static_cast<uint8_t>(reply.at(4)) + 2;
+        break;
+    case Address::IPV6:
+        headerLength = 1 + 16 + 2;
+        break;
+    }
+    if (reply.at(1) != 0 || headerLength == 0) {
+        qCritical("The SOCKS5 server failed to connect the HTTPS tunnel");
+        socket->disconnectFromHost();
+        return;
+    }
+    if (reply.size() < 3 + headerLength) {
+        return;
+    }
+    proxySocket->read(3 + headerLength);
+    disconnect(proxySocket, &QTcpSocket::readyRead,
+               this, &HttpProxy::onProxySocketSocksReadyRead);
+
+    static const QByteArray httpsHeader =
+            "HTTP/1.0 200 Connection established\r\n\r\n";
+    socket->write(httpsHeader);
 
     /*
      * once it's connected
@@ -163,9 +236,11 @@ void HttpProxy::onProxySocketConnectedHttps()
             stream, &SocketStream::deleteLater);
     connect(proxySocket, &QTcpSocket::disconnected,
             stream, &SocketStream::deleteLater);
-    static const QByteArray httpsHeader =
-            "HTTP/1.0 200 Connection established\r\n\r\n";
-    socket->write(httpsHeader);
+    // The sockets are closed quietly once the stream is spliced
+    connect(stream, &SocketStream::finished,
+            socket, &QTcpSocket::deleteLater);
+    connect(stream, &SocketStream::finished,
+            stream, &SocketStream::deleteLater);
 }
 
 void HttpProxy::onProxySocketReadyRead()
@@ -60,6 +60,7 @@ private slots:
     void onProxySocketConnected();
     //this function is used for HTTPS transparent proxy
     void onProxySocketConnectedHttps();
+    void onProxySocketSocksReadyRead();
     void onProxySocketReadyRead();
 };
 
@@ -0,0 +1,426 @@
+/*
+ * iouring.cpp - the source file of IoUring class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "iouring.h"
+
+#ifdef Q_OS_LINUX
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// Multishot receives came last of what's used here
+#ifdef IORING_RECV_MULTISHOT
+#define QSS_HAVE_IO_URING
+#endif
+#endif
+#endif
+
+namespace QSS {
+
+#ifdef QSS_HAVE_IO_URING
+
+namespace {
+
+const uint16_t BUFFER_GROUP = 0;
+
+int ioUringSetup(unsigned entries, io_uring_params *params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    int ret;
+    do {
+        ret = static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+                                         flags, nullptr, 0));
+    } while (ret == -1 && errno == EINTR);
+    return ret;
+}
+
+int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned count)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+std::runtime_error systemError(const char *what)
+{
+    return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+}  // namespace
+
+IoUring::IoUring(unsigned entries, unsigned bufferCount, unsigned bufferSize) :
+    m_fd(-1),
+    m_entries(0),
+    m_ring(MAP_FAILED),
+    m_ringSize(0),
+    m_sqes(static_cast<io_uring_sqe *>(MAP_FAILED)),
+    m_sqesSize(0),
+    m_sqLocalTail(0),
+    m_bufferSize(bufferSize),
+    m_availableBuffers(0),
+    m_lastRecycle(nullptr)
+{
+    if (bufferCount == 0 || bufferCount > 65536) {
+        throw std::invalid_argument("The number of buffers must be within [1, 65536]");
+    }
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    // Receives may complete many times each, so leave more room for them
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = entries * 2;
+    m_fd = ioUringSetup(entries, &params);
+    if (m_fd == -1) {
+        throw systemError("io_uring_setup");
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        release();
+        throw std::runtime_error("io_uring is too old");
+    }
+    m_entries = params.sq_entries;
+
+    m_ringSize = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                  params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    m_ring = ::mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_fd, IORING_OFF_SQ_RING);
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = static_cast<io_uring_sqe *>(::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+    if (m_ring == MAP_FAILED || m_sqes == MAP_FAILED) {
+        const std::runtime_error error = systemError("mmap");
+        release();
+        throw error;
+    }
+    auto *sq = static_cast<uint8_t *>(m_ring);
+    m_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    m_sqFlags = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+    m_sqLocalTail = *m_sqTail;
+    m_cqHead = reinterpret_cast<unsigned *>(sq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(sq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned *>(sq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(sq + params.cq_off.cqes);
+
+    /*
+     * Multishot receives (6.0) were added along with zero-copy sends, which
+     * is the only way to tell them apart from here
+     */
+    std::vector<uint8_t> probeData(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto *probe = reinterpret_cast<io_uring_probe *>(probeData.data());
+    if (ioUringRegister(m_fd, IORING_REGISTER_PROBE, probe, 256) != 0) {
+        const std::runtime_error error = systemError("io_uring_register");
+        release();
+        throw error;
+    }
+    for (int op : {IORING_OP_RECV, IORING_OP_SEND, IORING_OP_CONNECT,
+                   IORING_OP_PROVIDE_BUFFERS, IORING_OP_SEND_ZC}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            release();
+            throw std::runtime_error("io_uring doesn't support multishot receives");
+        }
+    }
+
+    /*
+     * The buffers are given to the kernel with IORING_OP_PROVIDE_BUFFERS.
+     * A registered buffer ring would save the operation, but it's not
+     * reliable across kernels.
+     */
+    m_buffers.resize(static_cast<size_t>(bufferCount) * bufferSize);
+    for (unsigned i = 0; i < bufferCount; ++i) {
+        recycleBuffer(static_cast<uint16_t>(i));
+    }
+    if (submit() < 0) {
+        const std::runtime_error error = systemError("io_uring_enter");
+        release();
+        throw error;
+    }
+}
+
+IoUring::~IoUring()
+{
+    release();
+}
+
+void IoUring::release()
+{
+    // Closing the ring cancels whatever is in flight
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    if (m_sqes != MAP_FAILED) {
+        ::munmap(m_sqes, m_sqesSize);
+        m_sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    }
+    if (m_ring != MAP_FAILED) {
+        ::munmap(m_ring, m_ringSize);
+        m_ring = MAP_FAILED;
+    }
+}
+
+bool IoUring::isSupported()
+{
+    static const bool supported = []() {
+        try {
+            IoUring ring(2, 1, 1);
+            return true;
+        } catch (const std::exception &) {
+            return false;
+        }
+    }();
+    return supported;
+}
+
+int IoUring::fd() const
+{
+    return m_fd;
+}
+
+io_uring_sqe *IoUring::nextSqe()
+{
+    if (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_entries) {
+        submit();
+        if (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_entries) {
+            return nullptr;
+        }
+    }
+    const unsigned index = m_sqLocalTail & m_sqMask;
+    io_uring_sqe *sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    m_sqArray[index] = index;
+    ++m_sqLocalTail;
+    return sqe;
+}
+
+bool IoUring::recvMultishot(int fd, uint64_t userData)
+{
+    io_uring_sqe *sqe = nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::send(int fd, const void *data, size_t length, uint64_t userData)
+{
+    io_uring_sqe *sqe = nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(length);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::connect(int fd, const sockaddr *address, uint32_t length, uint64_t userData)
+{
+    io_uring_sqe *sqe = nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(address);
+    sqe->off = length;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::cancel(uint64_t target, uint64_t userData)
+{
+    io_uring_sqe *sqe = nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = userData;
+    return true;
+}
+
+int IoUring::submit()
+{
+    if (!m_unrecycled.empty()) {
+        // A full queue is submitted by nextSqe(), which finds this empty then
+        std::vector<uint16_t> unrecycled;
+        unrecycled.swap(m_unrecycled);
+        for (uint16_t id : unrecycled) {
+            recycleBuffer(id);
+        }
+    }
+
+    const unsigned count = m_sqLocalTail - *m_sqTail;
+    m_lastRecycle = nullptr;
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+    if (count == 0) {
+        return 0;
+    }
+    return ioUringEnter(m_fd, count, 0, 0);
+}
+
+unsigned IoUring::pending() const
+{
+    return m_sqLocalTail - *m_sqTail + static_cast<unsigned>(m_unrecycled.size());
+}
+
+unsigned IoUring::complete(const Handler &handler)
+{
+    unsigned count = 0;
+    for (;;) {
+        unsigned head = *m_cqHead;
+        const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            // Completions that didn't fit are kept by the kernel until asked
+            if (__atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) {
+                ioUringEnter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+                if (*m_cqHead != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+                    continue;
+                }
+            }
+            return count;
+        }
+        const io_uring_cqe cqe = m_cqes[head & m_cqMask];
+        // Consumed before the handler runs, which may queue more operations
+        __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            --m_availableBuffers;
+        }
+        handler(cqe.user_data, cqe.res, cqe.flags);
+        ++count;
+    }
+}
+
+uint16_t IoUring::bufferId(uint32_t flags)
+{
+    return static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+bool IoUring::hasBuffer(uint32_t flags)
+{
+    return flags & IORING_CQE_F_BUFFER;
+}
+
+bool IoUring::hasMore(uint32_t flags)
+{
+    return flags & IORING_CQE_F_MORE;
+}
+
+const uint8_t *IoUring::buffer(uint16_t id) const
+{
+    return m_buffers.data() + static_cast<size_t>(id) * m_bufferSize;
+}
+
+size_t IoUring::bufferSize() const
+{
+    return m_bufferSize;
+}
+
+unsigned IoUring::availableBuffers() const
+{
+    return m_availableBuffers;
+}
+
+void IoUring::recycleBuffer(uint16_t id)
+{
+    // The queued operation isn't seen by the kernel until it's submitted
+    if (m_lastRecycle && m_lastRecycle->off + m_lastRecycle->fd == id) {
+        ++m_lastRecycle->fd;
+        ++m_availableBuffers;
+        return;
+    }
+    io_uring_sqe *sqe = nextSqe();
+    if (!sqe) {
+        m_unrecycled.push_back(id);
+        return;
+    }
+    ++m_availableBuffers;
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer(id));
+    sqe->len = static_cast<uint32_t>(m_bufferSize);
+    sqe->off = id;
+    sqe->buf_group = BUFFER_GROUP;
+    // Nothing to tell unless it fails
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    m_lastRecycle = sqe;
+}
+
+#else
+
+IoUring::IoUring(unsigned, unsigned, unsigned)
+{
+    throw std::runtime_error("io_uring isn't available in this build");
+}
+
+IoUring::~IoUring() = default;
+
+bool IoUring::isSupported()
+{
+    return false;
+}
+
+int IoUring::fd() const { return -1; }
+bool IoUring::recvMultishot(int, uint64_t) { return false; }
+bool IoUring::send(int, const void *, size_t, uint64_t) { return false; }
+bool IoUring::connect(int, const sockaddr *, uint32_t, uint64_t) { return false; }
+bool IoUring::cancel(uint64_t, uint64_t) { return false; }
+int IoUring::submit() { return -1; }
+unsigned IoUring::pending() const { return 0; }
+unsigned IoUring::complete(const Handler &) { return 0; }
+uint16_t IoUring::bufferId(uint32_t) { return 0; }
+bool IoUring::hasBuffer(uint32_t) { return false; }
+bool IoUring::hasMore(uint32_t) { return false; }
+const uint8_t *IoUring::buffer(uint16_t) const { return nullptr; }
+size_t IoUring::bufferSize() const { return 0; }
+unsigned IoUring::availableBuffers() const { return 0; }
+void IoUring::recycleBuffer(uint16_t) {}
+
+#endif // QSS_HAVE_IO_URING
+
+}  // namespace QSS
+
+#endif // Q_OS_LINUX
@@ -0,0 +1,148 @@
+/*
+ * iouring.h - the header file of IoUring class
+ *
+ * A minimal io_uring instance for socket I/O, set up with raw system calls
+ * so that it doesn't depend on liburing. It also owns a group of provided
+ * buffers, which multishot receives pick their buffers from.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "util/export.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct sockaddr;
+
+namespace QSS {
+
+class QSS_EXPORT IoUring
+{
+public:
+    /*
+     * entries is the size of the submission queue, and the completion queue
+     * is twice as large. bufferCount buffers of bufferSize bytes each are
+     * provided to receives.
+     * Throws std::runtime_error if io_uring or any operation it needs is
+     * unavailable.
+     */
+    IoUring(unsigned entries, unsigned bufferCount, unsigned bufferSize);
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+
+    /*
+     * Whether the running kernel supports everything used here, i.e.
+     * multishot receives from a ring of provided buffers (Linux 6.0)
+     */
+    static bool isSupported();
+
+    // The descriptor becomes readable when there are completions
+    int fd() const;
+
+    /*
+     * These queue an operation, which is submitted by the next submit().
+     * The memory passed in must stay valid until the operation completes.
+     * Each completion carries the userData of its operation, which must not
+     * be 0 as it's used internally.
+     * Return false if the submission queue is still full after submitting.
+     */
+    bool recvMultishot(int fd, uint64_t userData);
+    bool send(int fd, const void *data, size_t length, uint64_t userData);
+    bool connect(int fd, const sockaddr *address, uint32_t length, uint64_t userData);
+    // Cancels the operation of target. Only a failure to do so is completed.
+    bool cancel(uint64_t target, uint64_t userData);
+
+    // Submits all queued operations in one system call
+    int submit();
+    // The queued operations, including the recycling left over by a full queue
+    unsigned pending() const;
+
+    /*
+     * Calls handler for every completion that's available, without waiting.
+     * The arguments are userData, the result and the flags of a completion.
+     * Returns the number of completions handled.
+     */
+    using Handler = std::function<void(uint64_t, int32_t, uint32_t)>;
+    unsigned complete(const Handler &handler);
+
+    // Provided buffers. A completion with IORING_CQE_F_BUFFER set owns one.
+    static uint16_t bufferId(uint32_t flags);
+    static bool hasBuffer(uint32_t flags);
+    static bool hasMore(uint32_t flags);
+    const uint8_t *buffer(uint16_t id) const;
+    size_t bufferSize() const;
+    // The number of buffers the kernel has, including the queued recycling
+    unsigned availableBuffers() const;
+    /*
+     * Gives a buffer back to the kernel once its data is consumed. This is
+     * queued and submitted along with other operations. If the submission
+     * queue is full, it's queued by the next submit() instead.
+     */
+    void recycleBuffer(uint16_t id);
+
+private:
+    int m_fd;
+    unsigned m_entries;
+
+    // The submission and completion rings share one mapping
+    void *m_ring;
+    size_t m_ringSize;
+    io_uring_sqe *m_sqes;
+    size_t m_sqesSize;
+
+    unsigned *m_sqHead;
+    unsigned *m_sqTail;
+    unsigned m_sqMask;
+    unsigned *m_sqArray;
+    unsigned *m_sqFlags;
+    unsigned m_sqLocalTail;
+
+    unsigned *m_cqHead;
+    unsigned *m_cqTail;
+    unsigned m_cqMask;
+    io_uring_cqe *m_cqes;
+
+    std::vector<uint8_t> m_buffers;
+    size_t m_bufferSize;
+    unsigned m_availableBuffers;
+    // The last queued recycling, which adjacent buffers are merged into
+    io_uring_sqe *m_lastRecycle;
+    // The buffers that couldn't be recycled since the queue was full
+    std::vector<uint16_t> m_unrecycled;
+
+    io_uring_sqe *nextSqe();
+    void release();
+};
+
+}
+
+#endif // Q_OS_LINUX
+
+#endif // IOURING_H
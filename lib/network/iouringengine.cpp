@@ -0,0 +1,745 @@
+/*
+ * iouringengine.cpp - the source file of IoUringEngine and IoUringRelaySocket
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "iouringengine.h"
+#include "nativesocket.h"
+
+#ifdef Q_OS_LINUX
+#include <QTimer>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// The size of the submission queue of each engine
+const unsigned RING_ENTRIES = 1024;
+// The buffers provided to receives, 4 MiB for each engine
+const unsigned BUFFER_COUNT = 256;
+const unsigned BUFFER_SIZE = 16384;
+
+}  // namespace
+
+namespace QSS {
+
+IoUringEngine::IoUringEngine(QObject *parent) :
+    QObject(parent),
+    m_ring(new IoUring(RING_ENTRIES, BUFFER_COUNT, BUFFER_SIZE)),
+    m_nextId(0),
+    m_dispatching(false),
+    m_scheduled(false)
+{
+    // The ring descriptor is readable while there are completions
+    m_notifier = std::make_unique<QSocketNotifier>(m_ring->fd(), QSocketNotifier::Read);
+    connect(m_notifier.get(), &QSocketNotifier::activated, this, &IoUringEngine::onActivated);
+}
+
+IoUringEngine::~IoUringEngine()
+{
+    m_notifier.reset();
+    m_ring.reset();
+    for (const auto &lingering : m_lingering) {
+        ::close(lingering.second.fd);
+    }
+}
+
+bool IoUringEngine::isSupported()
+{
+    return IoUring::isSupported();
+}
+
+IoUring &IoUringEngine::ring()
+{
+    return *m_ring;
+}
+
+uint64_t IoUringEngine::attach(IoUringRelaySocket *socket)
+{
+    const uint64_t id = ++m_nextId;
+    m_sockets.emplace(id, socket);
+    return id;
+}
+
+void IoUringEngine::detach(uint64_t id)
+{
+    m_sockets.erase(id);
+}
+
+void IoUringEngine::hold(uint64_t userData, std::shared_ptr<void> data)
+{
+    m_held[userData] = std::move(data);
+}
+
+void IoUringEngine::defer(uint64_t id)
+{
+    m_deferred.push_back(id);
+    schedule();
+}
+
+void IoUringEngine::scheduleSubmit()
+{
+    schedule();
+}
+
+void IoUringEngine::waitForBuffers(uint64_t id)
+{
+    m_starved.push_back(id);
+}
+
+void IoUringEngine::recycleBuffer(uint16_t bufferId)
+{
+    m_ring->recycleBuffer(bufferId);
+    // Queued with the other operations, and starved receives go after it
+    schedule();
+}
+
+void IoUringEngine::linger(uint64_t id, int fd, std::shared_ptr<std::string> sending,
+                           size_t offset, std::string pending)
+{
+    m_lingering.emplace(id, Lingering { fd, std::move(sending), offset, std::move(pending) });
+}
+
+void IoUringEngine::handleLingering(uint64_t userData, int32_t result, uint32_t flags)
+{
+    const uint64_t id = userData >> 2;
+    auto it = m_lingering.find(id);
+    if (it == m_lingering.end()) {
+        return;
+    }
+
+    Lingering &lingering = it->second;
+    switch (static_cast<IoUringRelaySocket::Operation>(userData & 3)) {
+    case IoUringRelaySocket::OP_RECV:
+    case IoUringRelaySocket::OP_CANCEL:
+        // Nothing is read any more, and buffers are recycled by onCompletion()
+        return;
+    case IoUringRelaySocket::OP_SEND:
+        if (result >= 0) {
+            lingering.offset += result;
+            if (lingering.offset == lingering.sending->size()) {
+                lingering.sending.reset();
+            }
+        }
+        break;
+    case IoUringRelaySocket::OP_CONNECT:
+        break;
+    }
+
+    if (result >= 0 && !lingering.sending && !lingering.pending.empty()) {
+        lingering.sending = std::make_shared<std::string>();
+        lingering.sending->swap(lingering.pending);
+        lingering.offset = 0;
+    }
+    if (result >= 0 && lingering.sending) {
+        const uint64_t data = (id << 2) | IoUringRelaySocket::OP_SEND;
+        if (m_ring->send(lingering.fd, lingering.sending->data() + lingering.offset,
+                         lingering.sending->size() - lingering.offset, data)) {
+            hold(data, lingering.sending);
+            schedule();
+            return;
+        }
+        result = -EBUSY;
+    }
+
+    // The receive holds on to the socket until it's cancelled
+    m_ring->cancel((id << 2) | IoUringRelaySocket::OP_RECV,
+                   (id << 2) | IoUringRelaySocket::OP_CANCEL);
+    schedule();
+    if (result >= 0) {
+        NativeSocket::closeGracefully(lingering.fd);
+    } else {
+        ::shutdown(lingering.fd, SHUT_RDWR);
+        ::close(lingering.fd);
+    }
+    m_lingering.erase(it);
+}
+
+void IoUringEngine::schedule()
+{
+    if (!m_dispatching && !m_scheduled) {
+        m_scheduled = true;
+        QTimer::singleShot(0, this, [this]() {
+            m_scheduled = false;
+            processDeferred();
+        });
+    }
+}
+
+void IoUringEngine::onActivated()
+{
+    m_dispatching = true;
+    m_ring->complete([this](uint64_t userData, int32_t result, uint32_t flags) {
+        onCompletion(userData, result, flags);
+    });
+    m_dispatching = false;
+    processDeferred();
+}
+
+void IoUringEngine::onCompletion(uint64_t userData, int32_t result, uint32_t flags)
+{
+    // A failed recycling of buffers is reported with 0
+    if (userData == 0) {
+        qWarning("io_uring failed to provide buffers: %s", std::strerror(-result));
+        return;
+    }
+
+    const auto op = static_cast<IoUringRelaySocket::Operation>(userData & 3);
+    if (op != IoUringRelaySocket::OP_RECV) {
+        m_held.erase(userData);
+    }
+    auto it = m_sockets.find(userData >> 2);
+    if (it != m_sockets.end()) {
+        it->second->handleCompletion(op, result, flags);
+        return;
+    }
+    handleLingering(userData, result, flags);
+    if (IoUring::hasBuffer(flags)) {
+        // Received after the socket is closed
+        m_ring->recycleBuffer(IoUring::bufferId(flags));
+    }
+}
+
+void IoUringEngine::processDeferred()
+{
+    std::vector<uint64_t> deferred;
+    deferred.swap(m_deferred);
+    m_dispatching = true;
+    for (uint64_t id : deferred) {
+        auto it = m_sockets.find(id);
+        if (it != m_sockets.end()) {
+            it->second->runDeferred();
+        }
+    }
+
+    // Starved receives are only rearmed once there are buffers for them
+    if (!m_starved.empty() && m_ring->availableBuffers() > 0) {
+        std::vector<uint64_t> starved;
+        starved.swap(m_starved);
+        for (uint64_t id : starved) {
+            auto it = m_sockets.find(id);
+            if (it != m_sockets.end()) {
+                it->second->receive();
+            }
+        }
+    }
+    m_dispatching = false;
+
+    // Everything queued in this round goes in a single system call
+    if (m_ring->pending() > 0 && m_ring->submit() < 0) {
+        qWarning("io_uring_enter failed: %s", std::strerror(errno));
+    }
+
+    if (!m_deferred.empty()) {
+        schedule();
+    }
+}
+
+IoUringRelaySocket::IoUringRelaySocket(IoUringEngine *engine,
+                                       qintptr socketDescriptor,
+                                       QObject *parent) :
+    RelaySocket(parent),
+    m_engine(engine),
+    m_fd(-1),
+    m_id(engine->attach(this)),
+    m_connecting(false),
+    m_receiving(false),
+    m_peerClosed(false),
+    m_readPaused(false),
+    m_closing(false),
+    m_lowDelay(false),
+    m_keepAlive(false),
+    m_fastOpen(false),
+    m_fastOpenSet(false),
+    m_deferred(0),
+    m_written(0),
+    m_sendOffset(0),
+    m_error(QAbstractSocket::UnknownSocketError)
+{
+    if (socketDescriptor != -1) {
+        setUp(static_cast<int>(socketDescriptor));
+        receive();
+    }
+}
+
+IoUringRelaySocket::~IoUringRelaySocket()
+{
+    if (m_closing && m_engine) {
+        m_engine->linger(m_id, m_fd, std::move(m_sending), m_sendOffset, std::move(m_pending));
+        m_fd = -1;
+    }
+    abort();
+    if (m_engine) {
+        m_engine->detach(m_id);
+    }
+}
+
+uint64_t IoUringRelaySocket::userData(Operation op) const
+{
+    return (m_id << 2) | op;
+}
+
+void IoUringRelaySocket::setUp(int fd)
+{
+    m_fd = fd;
+    NativeSocket::setOption(m_fd, QAbstractSocket::LowDelayOption, m_lowDelay);
+    NativeSocket::setOption(m_fd, QAbstractSocket::KeepAliveOption, m_keepAlive);
+}
+
+void IoUringRelaySocket::defer(Deferred deferred)
+{
+    if (!m_engine || m_closing) {
+        return;
+    }
+    if (m_deferred == 0) {
+        m_engine->defer(m_id);
+    }
+    m_deferred |= deferred;
+}
+
+void IoUringRelaySocket::setError(int error)
+{
+    // Nothing is told after close(), which just gives up on the backlog
+    if (m_closing) {
+        abort();
+        return;
+    }
+    m_error = NativeSocket::errorFromErrno(error);
+    m_errorString = QString::fromLocal8Bit(std::strerror(error));
+    defer(DEFER_ERROR);
+}
+
+void IoUringRelaySocket::receive()
+{
+    if (m_fd == -1 || m_receiving || m_peerClosed || m_readPaused || !m_engine) {
+        return;
+    }
+    if (!m_engine->ring().recvMultishot(m_fd, userData(OP_RECV))) {
+        setError(EBUSY);
+        return;
+    }
+    m_receiving = true;
+    m_engine->scheduleSubmit();
+}
+
+qint64 IoUringRelaySocket::read(char *data, qint64 maxSize)
+{
+    if (m_fd == -1 || m_closing || !m_engine) {
+        return -1;
+    }
+
+    qint64 total = 0;
+    while (total < maxSize && !m_received.empty()) {
+        Chunk &chunk = m_received.front();
+        const uint32_t length = static_cast<uint32_t>(
+                    std::min<qint64>(chunk.length - chunk.offset, maxSize - total));
+        std::memcpy(data + total, m_engine->ring().buffer(chunk.buffer) + chunk.offset, length);
+        total += length;
+        chunk.offset += length;
+        if (chunk.offset == chunk.length) {
+            m_engine->recycleBuffer(chunk.buffer);
+            m_received.pop_front();
+        }
+    }
+    return total;
+}
+
+qint64 IoUringRelaySocket::write(const char *data, qint64 size)
+{
+    if (m_fd == -1 || m_closing || !m_engine) {
+        return -1;
+    }
+    m_pending.append(data, size);
+    if (!m_connecting && !m_sending) {
+        startSend();
+    }
+    return size;
+}
+
+void IoUringRelaySocket::startSend()
+{
+    if (m_pending.empty()) {
+        return;
+    }
+    m_sending = std::make_shared<std::string>();
+    m_sending->swap(m_pending);
+    m_sendOffset = 0;
+    submitSend();
+}
+
+void IoUringRelaySocket::submitSend()
+{
+    const uint64_t data = userData(OP_SEND);
+    if (!m_engine->ring().send(m_fd, m_sending->data() + m_sendOffset,
+                               m_sending->size() - m_sendOffset, data)) {
+        setError(EBUSY);
+        return;
+    }
+    // The kernel reads it later on, even if this socket is gone by then
+    m_engine->hold(data, m_sending);
+    m_engine->scheduleSubmit();
+}
+
+qint64 IoUringRelaySocket::bytesToWrite() const
+{
+    return (m_sending ? m_sending->size() - m_sendOffset : 0) + m_pending.size();
+}
+
+qintptr IoUringRelaySocket::socketDescriptor() const
+{
+    return m_fd;
+}
+
+void IoUringRelaySocket::connectToHost(const QHostAddress &address, uint16_t port)
+{
+    abort();
+    if (!m_engine) {
+        setError(EBADF);
+        return;
+    }
+
+    auto storage = std::make_shared<sockaddr_storage>();
+    const socklen_t length = NativeSocket::toSockAddr(address, port, storage.get());
+    const int fd = ::socket(storage->ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        setError(errno);
+        return;
+    }
+    setUp(fd);
+    // Falls back to a normal connect if the kernel doesn't take it
+    m_fastOpenSet = m_fastOpen && NativeSocket::setFastOpenConnect(m_fd);
+
+    const uint64_t data = userData(OP_CONNECT);
+    if (!m_engine->ring().connect(m_fd, reinterpret_cast<const sockaddr *>(storage.get()),
+                                  length, data)) {
+        setError(EBUSY);
+        return;
+    }
+    m_engine->hold(data, storage);
+    m_engine->scheduleSubmit();
+    m_connecting = true;
+}
+
+void IoUringRelaySocket::close()
+{
+    if (m_closing) {
+        return;
+    }
+    if (m_fd == -1 || !m_engine || bytesToWrite() == 0) {
+        abort();
+        return;
+    }
+
+    // Completions only go on writing the backlog from now on, see handleClosing()
+    m_closing = true;
+    for (const Chunk &chunk : m_received) {
+        m_engine->recycleBuffer(chunk.buffer);
+    }
+    m_received.clear();
+    m_deferred = 0;
+}
+
+void IoUringRelaySocket::abort()
+{
+    if (m_fd != -1) {
+        // Completes what's in flight, which is dropped as the id changes below
+        ::shutdown(m_fd, SHUT_RDWR);
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    if (m_engine) {
+        for (const Chunk &chunk : m_received) {
+            m_engine->recycleBuffer(chunk.buffer);
+        }
+        m_engine->detach(m_id);
+        m_id = m_engine->attach(this);
+    }
+    m_received.clear();
+    m_closing = false;
+    m_connecting = false;
+    m_receiving = false;
+    m_peerClosed = false;
+    m_deferred = 0;
+    m_written = 0;
+    m_sending.reset();
+    m_sendOffset = 0;
+    m_pending.clear();
+}
+
+void IoUringRelaySocket::setReadBufferSize(qint64)
+{
+    // Data is received into the buffers provided to the ring
+}
+
+void IoUringRelaySocket::setSocketOption(QAbstractSocket::SocketOption option,
+                                         const QVariant &value)
+{
+    if (option == QAbstractSocket::LowDelayOption) {
+        m_lowDelay = value.toBool();
+    } else if (option == QAbstractSocket::KeepAliveOption) {
+        m_keepAlive = value.toBool();
+    }
+    if (m_fd != -1) {
+        NativeSocket::setOption(m_fd, option, value.toBool());
+    }
+}
+
+void IoUringRelaySocket::setReadPaused(bool paused)
+{
+    if (m_readPaused == paused) {
+        return;
+    }
+    m_readPaused = paused;
+    if (m_fd == -1 || !m_engine) {
+        return;
+    }
+    if (paused) {
+        // Otherwise the multishot receive would keep taking provided buffers
+        if (m_receiving && m_engine->ring().cancel(userData(OP_RECV), userData(OP_CANCEL))) {
+            m_engine->scheduleSubmit();
+        }
+    } else {
+        receive();
+        if (!m_received.empty() || m_peerClosed) {
+            defer(DEFER_READ);
+        }
+    }
+}
+
+QHostAddress IoUringRelaySocket::localAddress() const
+{
+    return NativeSocket::localAddress(m_fd);
+}
+
+uint16_t IoUringRelaySocket::localPort() const
+{
+    return NativeSocket::localPort(m_fd);
+}
+
+QHostAddress IoUringRelaySocket::peerAddress() const
+{
+    return NativeSocket::peerAddress(m_fd);
+}
+
+uint16_t IoUringRelaySocket::peerPort() const
+{
+    return NativeSocket::peerPort(m_fd);
+}
+
+QAbstractSocket::SocketError IoUringRelaySocket::error() const
+{
+    return m_error;
+}
+
+QString IoUringRelaySocket::errorString() const
+{
+    return m_errorString;
+}
+
+bool IoUringRelaySocket::canWriteDirectly() const
+{
+    return false;
+}
+
+void IoUringRelaySocket::writtenDirectly(qint64 count)
+{
+    m_written += count;
+    defer(DEFER_WRITTEN);
+}
+
+bool IoUringRelaySocket::setFastOpen(bool enabled)
+{
+    m_fastOpen = enabled;
+    return true;
+}
+
+RelaySocket::FastOpen IoUringRelaySocket::fastOpenResult() const
+{
+    if (!m_fastOpen || m_fd == -1) {
+        return FastOpen::NOT_USED;
+    }
+    if (m_fastOpenSet && NativeSocket::fastOpenAccepted(m_fd)) {
+        return FastOpen::ACCEPTED;
+    }
+    return FastOpen::FELL_BACK;
+}
+
+void IoUringRelaySocket::handleCompletion(Operation op, int32_t result, uint32_t flags)
+{
+    if (m_closing) {
+        handleClosing(op, result, flags);
+        return;
+    }
+
+    switch (op) {
+    case OP_RECV:
+        if (result > 0 && IoUring::hasBuffer(flags)) {
+            m_received.push_back(Chunk{IoUring::bufferId(flags), 0, static_cast<uint32_t>(result)});
+            defer(DEFER_READ);
+        }
+        if (!IoUring::hasMore(flags)) {
+            m_receiving = false;
+            if (result == 0) {
+                m_peerClosed = true;
+                defer(DEFER_READ);
+            } else if (result == -ENOBUFS) {
+                m_engine->waitForBuffers(m_id);
+            } else if (result == -ECANCELED) {
+                // Paused, or resumed before the cancellation took effect
+                receive();
+            } else if (result < 0) {
+                setError(-result);
+            } else {
+                // Ended for another reason, e.g. the completion queue overflowed
+                receive();
+            }
+        }
+        break;
+    case OP_SEND:
+        if (result < 0) {
+            setError(-result);
+            break;
+        }
+        m_sendOffset += result;
+        m_written += result;
+        defer(DEFER_WRITTEN);
+        if (m_sendOffset < m_sending->size()) {
+            submitSend();
+        } else {
+            m_sending.reset();
+            startSend();
+        }
+        break;
+    case OP_CANCEL:
+        // The receive had already ended
+        break;
+    case OP_CONNECT:
+        m_connecting = false;
+        if (result < 0) {
+            setError(-result);
+            break;
+        }
+        receive();
+        startSend();
+        {
+            QPointer<IoUringRelaySocket> self(this);
+            emit connected();
+            // Under Fast Open, nothing to send means the SYN would wait for good
+            if (self && m_fd != -1 && m_fastOpenSet && !m_sending) {
+                NativeSocket::startFastOpen(m_fd);
+            }
+        }
+        break;
+    }
+}
+
+void IoUringRelaySocket::handleClosing(Operation op, int32_t result, uint32_t flags)
+{
+    switch (op) {
+    case OP_RECV:
+        // Nothing is read any more
+        if (IoUring::hasBuffer(flags)) {
+            m_engine->recycleBuffer(IoUring::bufferId(flags));
+        }
+        if (!IoUring::hasMore(flags)) {
+            m_receiving = false;
+        }
+        return;
+    case OP_CANCEL:
+        return;
+    case OP_SEND:
+        if (result >= 0) {
+            m_sendOffset += result;
+            if (m_sendOffset < m_sending->size()) {
+                submitSend();
+                return;
+            }
+            m_sending.reset();
+        }
+        break;
+    case OP_CONNECT:
+        m_connecting = false;
+        break;
+    }
+
+    if (result < 0) {
+        abort();
+        return;
+    }
+    startSend();
+    // submitSend() aborts if it fails
+    if (m_fd == -1 || m_sending) {
+        return;
+    }
+    if (m_receiving && m_engine->ring().cancel(userData(OP_RECV), userData(OP_CANCEL))) {
+        m_engine->scheduleSubmit();
+    }
+    NativeSocket::closeGracefully(m_fd);
+    m_fd = -1;
+    abort();
+}
+
+void IoUringRelaySocket::notifyReadable()
+{
+    if (m_fd == -1 || m_closing || m_readPaused) {
+        return;
+    }
+    if (!m_received.empty()) {
+        QPointer<IoUringRelaySocket> self(this);
+        emit readyRead();
+        // Carry on with the rest, or report the end, in the next round
+        if (self && m_fd != -1 && (!m_received.empty() || m_peerClosed)) {
+            defer(DEFER_READ);
+        }
+    } else if (m_peerClosed) {
+        emit disconnected();
+    }
+}
+
+void IoUringRelaySocket::runDeferred()
+{
+    const int deferred = m_deferred;
+    m_deferred = 0;
+    QPointer<IoUringRelaySocket> self(this);
+
+    if (deferred & DEFER_ERROR) {
+        emit errorOccurred(m_error);
+        return;
+    }
+    if ((deferred & DEFER_WRITTEN) && m_written > 0) {
+        const qint64 written = m_written;
+        m_written = 0;
+        emit bytesWritten(written);
+        if (!self) {
+            return;
+        }
+    }
+    if (deferred & DEFER_READ) {
+        notifyReadable();
+    }
+}
+
+}  // namespace QSS
+
+#endif // Q_OS_LINUX
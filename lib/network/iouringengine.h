@@ -0,0 +1,238 @@
+/*
+ * iouringengine.h - the header file of IoUringEngine and IoUringRelaySocket
+ *
+ * A Linux-only relay engine on io_uring. Receives are multishot into the
+ * provided buffers of the ring, and the sends and receives of all sockets
+ * of a thread are submitted together once per event loop round. The ring
+ * is plugged into the Qt event loop through a single QSocketNotifier.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IOURINGENGINE_H
+#define IOURINGENGINE_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+#include <QPointer>
+#include <QSocketNotifier>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "iouring.h"
+#include "relaysocket.h"
+
+struct sockaddr_storage;
+
+namespace QSS {
+
+class IoUringRelaySocket;
+
+/*
+ * An io_uring instance serving the sockets of one thread.
+ * It must be created and used on that thread. Sockets outliving it are
+ * simply closed without it.
+ */
+class QSS_EXPORT IoUringEngine : public QObject
+{
+    Q_OBJECT
+public:
+    // Throws std::runtime_error if io_uring can't be set up
+    explicit IoUringEngine(QObject *parent = nullptr);
+    ~IoUringEngine() override;
+
+    IoUringEngine(const IoUringEngine &) = delete;
+
+    static bool isSupported();
+
+    IoUring &ring();
+
+    /*
+     * A socket is attached for as long as it's using a descriptor, and its
+     * id is in the userData of its operations, which is (id << 2) | op.
+     * Completions for an id that's detached are dropped.
+     */
+    uint64_t attach(IoUringRelaySocket *socket);
+    void detach(uint64_t id);
+
+    // Keeps data alive until the operation of userData completes
+    void hold(uint64_t userData, std::shared_ptr<void> data);
+
+    /*
+     * Asks the engine to call back the socket after the current completions,
+     * and to submit whatever is queued by then
+     */
+    void defer(uint64_t id);
+    // Submits the queued operations at the end of this event loop round
+    void scheduleSubmit();
+
+    // The socket's receive ran out of buffers and is rearmed on recycling
+    void waitForBuffers(uint64_t id);
+    void recycleBuffer(uint16_t bufferId);
+
+    /*
+     * Takes over the descriptor of a socket that is deleted while closing,
+     * together with the data it has left to write, i.e. the rest of the send
+     * in flight from offset, and pending. The data is written out before the
+     * write side is shut down and the descriptor is closed. Its operations
+     * are still completed under the id of the socket, which must be detached.
+     */
+    void linger(uint64_t id, int fd, std::shared_ptr<std::string> sending, size_t offset,
+                std::string pending);
+
+private:
+    // A descriptor taken over by linger()
+    struct Lingering {
+        int fd;
+        std::shared_ptr<std::string> sending;
+        size_t offset;
+        std::string pending;
+    };
+
+    std::unordered_map<uint64_t, std::shared_ptr<void> > m_held;
+    // Declared after m_held, so that the ring is gone before what it uses
+    std::unique_ptr<IoUring> m_ring;
+    std::unique_ptr<QSocketNotifier> m_notifier;
+    std::unordered_map<uint64_t, IoUringRelaySocket *> m_sockets;
+    std::unordered_map<uint64_t, Lingering> m_lingering;
+    std::vector<uint64_t> m_deferred;
+    std::vector<uint64_t> m_starved;
+    uint64_t m_nextId;
+    bool m_dispatching;
+    bool m_scheduled;
+
+    void onActivated();
+    void onCompletion(uint64_t userData, int32_t result, uint32_t flags);
+    void handleLingering(uint64_t userData, int32_t result, uint32_t flags);
+    void schedule();
+    void processDeferred();
+};
+
+class QSS_EXPORT IoUringRelaySocket : public RelaySocket
+{
+    Q_OBJECT
+public:
+    // Wraps a connected socket, or creates one on connectToHost() if it's -1
+    explicit IoUringRelaySocket(IoUringEngine *engine, qintptr socketDescriptor = -1,
+                                QObject *parent = nullptr);
+    ~IoUringRelaySocket() override;
+
+    qint64 read(char *data, qint64 maxSize) override;
+    qint64 write(const char *data, qint64 size) override;
+    using RelaySocket::write;
+    qint64 bytesToWrite() const override;
+    qintptr socketDescriptor() const override;
+    void connectToHost(const QHostAddress &address, uint16_t port) override;
+    /*
+     * Stops reading straight away, but the data left to write is still
+     * written out before the write side is shut down and the descriptor is
+     * closed, as QTcpSocket does. No signal is emitted after this. If the
+     * socket is deleted in the meantime, the engine carries on with it.
+     */
+    void close() override;
+
+    void setReadBufferSize(qint64 size) override;
+    void setSocketOption(QAbstractSocket::SocketOption option, const QVariant &value) override;
+    void setReadPaused(bool paused) override;
+
+    QHostAddress localAddress() const override;
+    uint16_t localPort() const override;
+    QHostAddress peerAddress() const override;
+    uint16_t peerPort() const override;
+    QAbstractSocket::SocketError error() const override;
+    QString errorString() const override;
+
+    // Writes go through the ring to be batched
+    bool canWriteDirectly() const override;
+    void writtenDirectly(qint64 count) override;
+    bool setFastOpen(bool enabled) override;
+    FastOpen fastOpenResult() const override;
+
+private:
+    friend class IoUringEngine;
+
+    enum Operation {
+        OP_CANCEL = 0,
+        OP_RECV = 1,
+        OP_SEND = 2,
+        OP_CONNECT = 3
+    };
+
+    // The signals waiting to be emitted by the engine
+    enum Deferred {
+        DEFER_READ = 1,
+        DEFER_WRITTEN = 2,
+        DEFER_ERROR = 4
+    };
+
+    // Received data in a provided buffer
+    struct Chunk {
+        uint16_t buffer;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    QPointer<IoUringEngine> m_engine;
+    int m_fd;
+    uint64_t m_id;
+    bool m_connecting;
+    bool m_receiving;
+    bool m_peerClosed;
+    bool m_readPaused;
+    // Whether close() is waiting for the data left to write
+    bool m_closing;
+    bool m_lowDelay;
+    bool m_keepAlive;
+    bool m_fastOpen;
+    // Whether the kernel took TCP_FASTOPEN_CONNECT for the current connection
+    bool m_fastOpenSet;
+    int m_deferred;
+    qint64 m_written;
+    std::deque<Chunk> m_received;
+    // The data of the send in flight, and what's written after it
+    std::shared_ptr<std::string> m_sending;
+    size_t m_sendOffset;
+    std::string m_pending;
+    QAbstractSocket::SocketError m_error;
+    QString m_errorString;
+
+    uint64_t userData(Operation op) const;
+    void setUp(int fd);
+    void defer(Deferred deferred);
+    void setError(int error);
+    void receive();
+    void startSend();
+    void submitSend();
+    // Closes the descriptor at once, dropping what's left to write
+    void abort();
+    // Called by the engine
+    void handleCompletion(Operation op, int32_t result, uint32_t flags);
+    void handleClosing(Operation op, int32_t result, uint32_t flags);
+    void runDeferred();
+    void notifyReadable();
+};
+
+}
+
+#endif // Q_OS_LINUX
+
+#endif // IOURINGENGINE_H
@@ -0,0 +1,726 @@
+/*
+ * muxsession.cpp - the source file of MuxSession and MuxStreamSocket classes
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "muxsession.h"
+#include "util/bufferpool.h"
+#include <QDebug>
+#include <QPointer>
+#include <QTimer>
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace QSS {
+
+namespace {
+
+const qint64 CarrierRecvSize = 65536;
+
+void putUint32(char *out, uint32_t value)
+{
+    out[0] = static_cast<char>(value >> 24);
+    out[1] = static_cast<char>(value >> 16);
+    out[2] = static_cast<char>(value >> 8);
+    out[3] = static_cast<char>(value);
+}
+
+uint32_t getUint32(const char *in)
+{
+    const auto *bytes = reinterpret_cast<const uint8_t *>(in);
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16)
+            | (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+}  // namespace
+
+const uint8_t MuxSession::PREAMBLE;
+const uint8_t MuxSession::VERSION;
+const uint32_t MuxSession::WINDOW;
+const int MuxSession::MAX_STREAMS;
+const size_t MuxSession::HEADER_SIZE;
+const size_t MuxSession::MAX_PAYLOAD;
+const qint64 MuxSession::MAX_BACKLOG;
+
+MuxSession::MuxSession(Role role,
+                       RelaySocket *carrier,
+                       std::unique_ptr<Encryptor> encryptor,
+                       TimingWheel *wheel,
+                       int idleTimeout,
+                       QObject *parent)
+    : QObject(parent)
+    , m_role(role)
+    , m_carrier(carrier)
+    , m_encryptor(std::move(encryptor))
+    , m_connected(role == Role::SERVER)
+    , m_closed(false)
+    , m_nextId(1)
+    , m_timer(wheel, [this]() { onTimeout(); })
+    , m_idleTimeout(idleTimeout)
+    , m_pinged(false)
+{
+    connect(m_carrier.get(), &RelaySocket::connected, this, &MuxSession::onCarrierConnected);
+    connect(m_carrier.get(), &RelaySocket::readyRead, this, &MuxSession::onCarrierReadyRead);
+    connect(m_carrier.get(), &RelaySocket::bytesWritten,
+            this, &MuxSession::onCarrierBytesWritten);
+    connect(m_carrier.get(), &RelaySocket::disconnected, this, &MuxSession::closeCarrier);
+    connect(m_carrier.get(), &RelaySocket::errorOccurred, this, [this]() {
+        //it's not an "error" if remote host closed a connection
+        if (m_carrier->error() != QAbstractSocket::RemoteHostClosedError) {
+            QDebug(QtMsgType::QtWarningMsg).noquote() << "Mux carrier:" << m_carrier->errorString();
+        }
+        closeCarrier();
+    });
+
+    m_carrier->setReadBufferSize(CarrierRecvSize);
+    m_carrier->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    m_carrier->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+
+    if (m_role == Role::CLIENT) {
+        static const char preamble[] = { static_cast<char>(PREAMBLE), static_cast<char>(VERSION) };
+        sendPlain(std::string(preamble, 2));
+    }
+    m_timer.start(m_idleTimeout, true);
+}
+
+MuxSession::~MuxSession()
+{
+    // Streams outliving the session just stop working
+    for (auto &entry : m_streams) {
+        if (entry.second.socket) {
+            entry.second.socket->m_session = nullptr;
+        }
+    }
+}
+
+void MuxSession::connectToServer(Address server)
+{
+    m_serverAddress = std::move(server);
+    m_serverAddress.lookUp([this](bool success) {
+        if (success) {
+            m_carrier->connectToHost(m_serverAddress.getFirstIP(), m_serverAddress.getPort());
+        } else {
+            qDebug("Failed to lookup server address. Closing mux session.");
+            closeCarrier();
+        }
+    });
+}
+
+void MuxSession::start(const std::string &plain)
+{
+    m_inbound = plain;
+    handleFrames();
+    // The carrier may have got more than what its relay has read
+    QTimer::singleShot(0, this, [this]() {
+        onCarrierReadyRead();
+    });
+}
+
+MuxStreamSocket *MuxSession::createStream()
+{
+    const uint32_t id = m_nextId++;
+    auto stream = new MuxStreamSocket(this, id);
+    if (m_closed) {
+        stream->m_session = nullptr;
+        stream->fail(QAbstractSocket::RemoteHostClosedError,
+                     QStringLiteral("The mux session is closed"));
+    } else if (streamCount() >= MAX_STREAMS) {
+        stream->m_session = nullptr;
+        stream->fail(QAbstractSocket::SocketResourceError,
+                     QStringLiteral("The mux session has too many streams"));
+    } else {
+        m_streams[id].socket = stream;
+    }
+    return stream;
+}
+
+int MuxSession::streamCount() const
+{
+    int count = 0;
+    for (const auto &entry : m_streams) {
+        if (entry.second.socket) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool MuxSession::isClosed() const
+{
+    return m_closed;
+}
+
+bool MuxSession::isAvailable() const
+{
+    return !m_closed && !hasBacklog() && streamCount() < MAX_STREAMS;
+}
+
+const RelaySocket *MuxSession::carrier() const
+{
+    return m_carrier.get();
+}
+
+void MuxSession::sendFrame(FrameType type, uint32_t id, const char *payload, size_t length)
+{
+    std::string frame(HEADER_SIZE + length, '\0');
+    frame[0] = static_cast<char>(type);
+    putUint32(&frame[1], id);
+    frame[5] = static_cast<char>(length >> 8);
+    frame[6] = static_cast<char>(length);
+    if (length > 0) {
+        std::memcpy(&frame[HEADER_SIZE], payload, length);
+    }
+    // Keepalives don't keep a session from being idle
+    if (type != PING && type != PONG) {
+        m_timer.touch();
+    }
+    sendPlain(frame);
+}
+
+void MuxSession::sendPlain(const std::string &plain)
+{
+    if (m_closed) {
+        return;
+    }
+    const std::string encrypted = m_encryptor->encrypt(plain);
+    if (!m_connected) {
+        m_outbound += encrypted;
+        return;
+    }
+    // A failed write is reported by the carrier's errorOccurred
+    m_carrier->write(encrypted.data(), encrypted.size());
+}
+
+bool MuxSession::hasBacklog() const
+{
+    return m_carrier->bytesToWrite() + static_cast<qint64>(m_outbound.size()) > MAX_BACKLOG;
+}
+
+void MuxSession::flushStream(uint32_t id)
+{
+    auto it = m_streams.find(id);
+    if (it == m_streams.end() || m_closed) {
+        return;
+    }
+    Stream &stream = it->second;
+    if (!stream.opened) {
+        return;
+    }
+
+    size_t sent = 0;
+    while (!stream.finSent && sent < stream.toSend.size() && stream.credit > 0 && !hasBacklog()) {
+        const size_t length = std::min({ stream.toSend.size() - sent,
+                                         MAX_PAYLOAD,
+                                         static_cast<size_t>(stream.credit) });
+        sendFrame(DATA, id, stream.toSend.data() + sent, length);
+        sent += length;
+        stream.credit -= static_cast<uint32_t>(length);
+    }
+    if (sent > 0) {
+        stream.toSend.erase(0, sent);
+        if (stream.socket) {
+            stream.socket->m_written += static_cast<qint64>(sent);
+            stream.socket->defer(MuxStreamSocket::DEFER_WRITTEN);
+        }
+    }
+
+    if (stream.closing && !stream.finSent && stream.toSend.empty()) {
+        sendFrame(FIN, id, nullptr, 0);
+        stream.finSent = true;
+    }
+    if (stream.finSent && !stream.socket) {
+        m_streams.erase(it);
+    }
+}
+
+void MuxSession::handleFrames()
+{
+    size_t offset = 0;
+    while (!m_closed && m_inbound.size() - offset >= HEADER_SIZE) {
+        const char *frame = m_inbound.data() + offset;
+        const size_t length = (static_cast<size_t>(static_cast<uint8_t>(frame[5])) << 8)
+                | static_cast<uint8_t>(frame[6]);
+        if (m_inbound.size() - offset < HEADER_SIZE + length) {
+            break;
+        }
+        handleFrame(static_cast<FrameType>(frame[0]), getUint32(frame + 1),
+                    frame + HEADER_SIZE, length);
+        offset += HEADER_SIZE + length;
+    }
+    m_inbound.erase(0, offset);
+}
+
+void MuxSession::handleFrame(FrameType type, uint32_t id, const char *payload, size_t length)
+{
+    auto it = m_streams.find(id);
+    MuxStreamSocket *socket = it == m_streams.end() ? nullptr : it->second.socket;
+    if (type != PING && type != PONG) {
+        m_timer.touch();
+    }
+
+    switch (type) {
+    case SYN:
+    {
+        if (m_role != Role::SERVER || it != m_streams.end()) {
+            qWarning("Mux stream %u can't be opened. Closing mux session.", id);
+            closeCarrier();
+            return;
+        }
+        if (streamCount() >= MAX_STREAMS) {
+            qWarning("Mux stream %u is over the limit of %d streams", id, MAX_STREAMS);
+            sendFrame(RST, id, nullptr, 0);
+            break;
+        }
+        auto stream = new MuxStreamSocket(this, id);
+        Stream &state = m_streams[id];
+        state.socket = stream;
+        state.opened = true;
+        emit incomingStream(stream);
+        break;
+    }
+    case DATA:
+        // Data racing a FIN or RST sent by this side is dropped
+        if (!socket || socket->m_closed || it->second.finSent) {
+            break;
+        }
+        if (socket->m_received.size() + socket->m_consumed + length > WINDOW) {
+            qWarning("Mux stream %u exceeded its window", id);
+            sendFrame(RST, id, nullptr, 0);
+            resetStream(id, QStringLiteral("Mux stream exceeded its window"));
+            break;
+        }
+        socket->m_received.append(payload, length);
+        socket->defer(MuxStreamSocket::DEFER_READ);
+        break;
+    case FIN:
+        if (socket) {
+            socket->m_peerClosed = true;
+            socket->defer(MuxStreamSocket::DEFER_READ);
+        }
+        break;
+    case RST:
+        resetStream(id, QStringLiteral("Mux stream reset by peer"));
+        break;
+    case WINDOW_UPDATE:
+        if (it != m_streams.end() && length == 4) {
+            it->second.credit += getUint32(payload);
+            flushStream(id);
+        }
+        break;
+    case PING:
+        sendFrame(PONG, id, nullptr, 0);
+        break;
+    case PONG:
+        // Reading anything at all answers PING
+        break;
+    default:
+        qWarning("Unknown mux frame type %d. Closing mux session.", static_cast<int>(type));
+        closeCarrier();
+    }
+}
+
+void MuxSession::resetStream(uint32_t id, const QString &reason)
+{
+    auto it = m_streams.find(id);
+    if (it == m_streams.end()) {
+        return;
+    }
+    Stream &stream = it->second;
+    stream.toSend.clear();
+    stream.closing = true;
+    stream.finSent = true;
+    if (!stream.socket) {
+        m_streams.erase(it);
+        return;
+    }
+    stream.socket->fail(QAbstractSocket::NetworkError, reason);
+}
+
+void MuxSession::closeCarrier()
+{
+    if (m_closed) {
+        return;
+    }
+    m_closed = true;
+    m_timer.stop();
+    m_carrier->close();
+
+    std::unordered_map<uint32_t, Stream> streams;
+    streams.swap(m_streams);
+    for (auto &entry : streams) {
+        if (MuxStreamSocket *socket = entry.second.socket) {
+            socket->m_session = nullptr;
+            socket->fail(QAbstractSocket::RemoteHostClosedError,
+                         QStringLiteral("The mux session is closed"));
+        }
+    }
+    emit finished();
+}
+
+void MuxSession::onTimeout()
+{
+    if (m_pinged || !m_connected || m_carrier->bytesToWrite() > 0) {
+        qWarning("Mux carrier stalled. Closing mux session.");
+        closeCarrier();
+        return;
+    }
+    // The server leaves it to the client to close an idle session
+    if (m_role == Role::CLIENT && m_streams.empty()) {
+        closeCarrier();
+        return;
+    }
+    sendFrame(PING, 0, nullptr, 0);
+    m_pinged = true;
+    m_timer.start(m_idleTimeout, true);
+}
+
+void MuxSession::openStream(uint32_t id)
+{
+    auto it = m_streams.find(id);
+    if (it == m_streams.end() || it->second.opened) {
+        return;
+    }
+    it->second.opened = true;
+    sendFrame(SYN, id, nullptr, 0);
+    // Data may follow SYN straight away, so there's no round trip to wait for
+    if (m_connected) {
+        it->second.socket->defer(MuxStreamSocket::DEFER_CONNECTED);
+    }
+    flushStream(id);
+}
+
+void MuxSession::write(uint32_t id, const char *data, size_t size)
+{
+    auto it = m_streams.find(id);
+    if (it == m_streams.end() || it->second.closing) {
+        return;
+    }
+    it->second.toSend.append(data, size);
+    flushStream(id);
+}
+
+qint64 MuxSession::bytesToWrite(uint32_t id) const
+{
+    auto it = m_streams.find(id);
+    return it == m_streams.end() ? 0 : static_cast<qint64>(it->second.toSend.size());
+}
+
+void MuxSession::closeStream(uint32_t id)
+{
+    auto it = m_streams.find(id);
+    if (it == m_streams.end()) {
+        return;
+    }
+    it->second.closing = true;
+    // Nothing to tell the server about a stream that was never opened
+    if (!it->second.opened) {
+        it->second.toSend.clear();
+        it->second.finSent = true;
+    }
+    flushStream(id);
+}
+
+void MuxSession::releaseStream(uint32_t id)
+{
+    auto it = m_streams.find(id);
+    if (it == m_streams.end()) {
+        return;
+    }
+    it->second.socket = nullptr;
+    if (it->second.opened) {
+        closeStream(id);
+    } else {
+        m_streams.erase(it);
+    }
+}
+
+void MuxSession::consumed(uint32_t id, uint32_t bytes)
+{
+    char payload[4];
+    putUint32(payload, bytes);
+    sendFrame(WINDOW_UPDATE, id, payload, sizeof(payload));
+}
+
+void MuxSession::onCarrierConnected()
+{
+    m_connected = true;
+    if (!m_outbound.empty()) {
+        m_carrier->write(m_outbound.data(), m_outbound.size());
+        m_outbound.clear();
+    }
+    for (auto &entry : m_streams) {
+        if (entry.second.socket && entry.second.opened) {
+            entry.second.socket->defer(MuxStreamSocket::DEFER_CONNECTED);
+        }
+    }
+    onCarrierBytesWritten();
+}
+
+void MuxSession::onCarrierReadyRead()
+{
+    if (m_closed) {
+        return;
+    }
+    BufferPool::Buffer buffer = BufferPool::local().acquire(CarrierRecvSize);
+    for (;;) {
+        const qint64 readSize = m_carrier->read(buffer.data(), CarrierRecvSize);
+        if (readSize == -1) {
+            closeCarrier();
+            return;
+        }
+        if (readSize == 0) {
+            return;
+        }
+        m_pinged = false;
+        try {
+            m_inbound += m_encryptor->decrypt(reinterpret_cast<const uint8_t *>(buffer.data()),
+                                              readSize);
+        } catch (const std::exception &e) {
+            QDebug(QtMsgType::QtCriticalMsg) << "Mux carrier:" << e.what();
+            closeCarrier();
+            return;
+        }
+        handleFrames();
+        // A short read means the carrier is drained
+        if (m_closed || readSize < CarrierRecvSize) {
+            return;
+        }
+    }
+}
+
+void MuxSession::onCarrierBytesWritten()
+{
+    // The carrier is getting somewhere, so it isn't stalled
+    m_timer.touch();
+    if (m_closed || hasBacklog()) {
+        return;
+    }
+    // Flushing may erase streams, hence the copy of their IDs
+    std::vector<uint32_t> pending;
+    for (const auto &entry : m_streams) {
+        if (!entry.second.toSend.empty() || (entry.second.closing && !entry.second.finSent)) {
+            pending.push_back(entry.first);
+        }
+    }
+    for (uint32_t id : pending) {
+        flushStream(id);
+    }
+}
+
+MuxStreamSocket::MuxStreamSocket(MuxSession *session, uint32_t id)
+    : m_session(session)
+    , m_id(id)
+    , m_closed(false)
+    , m_readPaused(false)
+    , m_peerClosed(false)
+    , m_consumed(0)
+    , m_written(0)
+    , m_deferred(0)
+    , m_error(QAbstractSocket::UnknownSocketError)
+{
+}
+
+MuxStreamSocket::~MuxStreamSocket()
+{
+    if (m_session) {
+        m_session->releaseStream(m_id);
+    }
+}
+
+qint64 MuxStreamSocket::read(char *data, qint64 maxSize)
+{
+    if (m_closed) {
+        return -1;
+    }
+    const size_t size = static_cast<size_t>(std::min<qint64>(maxSize, m_received.size()));
+    std::memcpy(data, m_received.data(), size);
+    m_received.erase(0, size);
+
+    // Gives the window back in large steps rather than for every read
+    m_consumed += static_cast<uint32_t>(size);
+    if (m_session && m_consumed >= MuxSession::WINDOW / 2) {
+        m_session->consumed(m_id, m_consumed);
+        m_consumed = 0;
+    }
+    return static_cast<qint64>(size);
+}
+
+qint64 MuxStreamSocket::write(const char *data, qint64 size)
+{
+    if (m_closed || !m_session) {
+        return -1;
+    }
+    m_session->write(m_id, data, static_cast<size_t>(size));
+    return size;
+}
+
+qint64 MuxStreamSocket::bytesToWrite() const
+{
+    return m_session ? m_session->bytesToWrite(m_id) : 0;
+}
+
+qintptr MuxStreamSocket::socketDescriptor() const
+{
+    return -1;
+}
+
+void MuxStreamSocket::connectToHost(const QHostAddress &, uint16_t)
+{
+    if (!m_session) {
+        fail(QAbstractSocket::RemoteHostClosedError, QStringLiteral("The mux session is closed"));
+        return;
+    }
+    m_session->openStream(m_id);
+}
+
+void MuxStreamSocket::close()
+{
+    if (m_closed) {
+        return;
+    }
+    m_closed = true;
+    m_deferred = 0;
+    m_received.clear();
+    // What's been written is still sent, followed by FIN
+    if (m_session) {
+        m_session->closeStream(m_id);
+    }
+}
+
+void MuxStreamSocket::setReadBufferSize(qint64)
+{
+    // The window of the stream bounds what's buffered
+}
+
+void MuxStreamSocket::setSocketOption(QAbstractSocket::SocketOption, const QVariant &)
+{
+    // The options apply to the carrier, which the session sets up itself
+}
+
+void MuxStreamSocket::setReadPaused(bool paused)
+{
+    // The peer stops sending once the window is used up
+    m_readPaused = paused;
+    if (!paused && (!m_received.empty() || m_peerClosed)) {
+        defer(DEFER_READ);
+    }
+}
+
+QHostAddress MuxStreamSocket::localAddress() const
+{
+    return m_session ? m_session->carrier()->localAddress() : QHostAddress();
+}
+
+uint16_t MuxStreamSocket::localPort() const
+{
+    return m_session ? m_session->carrier()->localPort() : 0;
+}
+
+QHostAddress MuxStreamSocket::peerAddress() const
+{
+    return m_session ? m_session->carrier()->peerAddress() : QHostAddress();
+}
+
+uint16_t MuxStreamSocket::peerPort() const
+{
+    return m_session ? m_session->carrier()->peerPort() : 0;
+}
+
+QAbstractSocket::SocketError MuxStreamSocket::error() const
+{
+    return m_error;
+}
+
+QString MuxStreamSocket::errorString() const
+{
+    return m_errorString;
+}
+
+void MuxStreamSocket::defer(Deferred deferred)
+{
+    if (m_closed) {
+        return;
+    }
+    if (m_deferred == 0) {
+        QTimer::singleShot(0, this, [this]() {
+            emitDeferred();
+        });
+    }
+    m_deferred |= deferred;
+}
+
+void MuxStreamSocket::emitDeferred()
+{
+    const int deferred = m_deferred;
+    m_deferred = 0;
+    if (m_closed || deferred == 0) {
+        return;
+    }
+    QPointer<MuxStreamSocket> self(this);
+
+    if (deferred & DEFER_ERROR) {
+        emit errorOccurred(m_error);
+        return;
+    }
+    if (deferred & DEFER_CONNECTED) {
+        emit connected();
+        if (!self || m_closed) {
+            return;
+        }
+    }
+    if ((deferred & DEFER_WRITTEN) && m_written > 0) {
+        const qint64 written = m_written;
+        m_written = 0;
+        emit bytesWritten(written);
+        if (!self || m_closed) {
+            return;
+        }
+    }
+    if (deferred & DEFER_DISCONNECTED) {
+        emit disconnected();
+        return;
+    }
+    if ((deferred & DEFER_READ) && !m_readPaused) {
+        // readyRead is only emitted if there's data, the same as QTcpSocket
+        if (!m_received.empty()) {
+            emit readyRead();
+            if (!self || m_closed) {
+                return;
+            }
+        }
+        if (!m_readPaused && !m_received.empty()) {
+            defer(DEFER_READ);
+        } else if (m_received.empty() && m_peerClosed) {
+            defer(DEFER_DISCONNECTED);
+        }
+    }
+}
+
+void MuxStreamSocket::fail(QAbstractSocket::SocketError error, const QString &reason)
+{
+    m_error = error;
+    m_errorString = reason;
+    defer(DEFER_ERROR);
+}
+
+}  // namespace QSS
@@ -0,0 +1,260 @@
+/*
+ * muxsession.h - the header file of MuxSession and MuxStreamSocket classes
+ *
+ * A MuxSession carries many TCP connections between a libQtShadowsocks
+ * client and server over one long-lived encrypted connection, so that
+ * opening a connection costs neither a TCP handshake nor a new salt.
+ *
+ * The session is a normal Shadowsocks connection whose plain text starts
+ * with PREAMBLE (in place of an address type) and VERSION, followed by
+ * frames of a type byte, a 32-bit stream ID, a 16-bit payload length and
+ * the payload, all in network byte order. A stream sends at most WINDOW
+ * bytes ahead of what its peer has read, which WINDOW_UPDATE frames give
+ * back.
+ *
+ * A session that's been quiet for its idle timeout sends PING, which the
+ * peer answers with PONG. It's closed if nothing is heard by the next
+ * timeout, if its carrier couldn't send anything all along, or if a client
+ * session has no streams left.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUXSESSION_H
+#define MUXSESSION_H
+
+#include <QObject>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "relaysocket.h"
+#include "crypto/encryptor.h"
+#include "types/address.h"
+#include "util/timingwheel.h"
+
+namespace QSS {
+
+class MuxStreamSocket;
+
+class QSS_EXPORT MuxSession : public QObject
+{
+    Q_OBJECT
+public:
+    static const uint8_t PREAMBLE = 0x7F;
+    static const uint8_t VERSION = 1;
+    static const uint32_t WINDOW = 256 * 1024;
+    // A client fails more streams than this, and a server resets them
+    static const int MAX_STREAMS = 256;
+
+    enum class Role {
+        CLIENT,
+        SERVER
+    };
+
+    /*
+     * Takes the ownership of carrier and encryptor. A client session gets
+     * its carrier connected by connectToServer(). A server session takes
+     * over an accepted carrier whose preamble has been read, and gets going
+     * with start().
+     * The deadline is kept on wheel, and idleTimeout (msec) is how long the
+     * session may stay quiet before pinging its peer. 0 disables it.
+     */
+    MuxSession(Role role,
+               RelaySocket *carrier,
+               std::unique_ptr<Encryptor> encryptor,
+               TimingWheel *wheel,
+               int idleTimeout,
+               QObject *parent = nullptr);
+    ~MuxSession() override;
+
+    MuxSession(const MuxSession &) = delete;
+
+    void connectToServer(Address server);
+    // Handles plain, what was decrypted after the preamble, and reads on
+    void start(const std::string &plain);
+
+    /*
+     * Creates a stream on a client session, which is opened on the server
+     * by its connectToHost(). The caller takes the ownership.
+     */
+    MuxStreamSocket *createStream();
+
+    int streamCount() const;
+    bool isClosed() const;
+    /*
+     * Whether a new stream should be created on this session, which isn't
+     * the case once it's closed, has MAX_STREAMS streams, or its carrier
+     * is falling behind.
+     */
+    bool isAvailable() const;
+    const RelaySocket *carrier() const;
+
+signals:
+    // A stream opened by the client. The receiver takes the ownership.
+    void incomingStream(MuxStreamSocket *stream);
+    // The carrier is closed, and so are all the streams
+    void finished();
+
+private:
+    friend class MuxStreamSocket;
+
+    enum FrameType : uint8_t {
+        SYN = 0,
+        DATA = 1,
+        FIN = 2,
+        RST = 3,
+        WINDOW_UPDATE = 4,
+        PING = 5,
+        PONG = 6
+    };
+
+    static const size_t HEADER_SIZE = 7;
+    static const size_t MAX_PAYLOAD = 16 * 1024;
+    // Streams hold their data back while the carrier has this much to write
+    static const qint64 MAX_BACKLOG = 1024 * 1024;
+
+    /*
+     * The sending side of a stream. It stays after the socket is destroyed
+     * until what was written to the socket has been sent, followed by FIN.
+     */
+    struct Stream {
+        // nullptr once the socket is destroyed
+        MuxStreamSocket *socket = nullptr;
+        std::string toSend;
+        uint32_t credit = WINDOW;
+        bool opened = false;
+        // FIN is sent after toSend
+        bool closing = false;
+        bool finSent = false;
+    };
+
+    const Role m_role;
+    std::unique_ptr<RelaySocket> m_carrier;
+    std::unique_ptr<Encryptor> m_encryptor;
+    Address m_serverAddress;
+    bool m_connected;
+    bool m_closed;
+    // Decrypted frames that haven't been handled entirely
+    std::string m_inbound;
+    // Encrypted data waiting for the carrier to connect
+    std::string m_outbound;
+    std::unordered_map<uint32_t, Stream> m_streams;
+    uint32_t m_nextId;
+    TimingWheel::Timer m_timer;
+    const int m_idleTimeout;
+    // PING was sent, and nothing has been read since
+    bool m_pinged;
+
+    void sendFrame(FrameType type, uint32_t id, const char *payload, size_t length);
+    void sendPlain(const std::string &plain);
+    bool hasBacklog() const;
+    /*
+     * Sends what the stream has got within its window and the backlog limit.
+     * The stream is erased if it's done with, hence it mustn't be used after.
+     */
+    void flushStream(uint32_t id);
+    void handleFrames();
+    void handleFrame(FrameType type, uint32_t id, const char *payload, size_t length);
+    // Fails the stream without sending anything more on it
+    void resetStream(uint32_t id, const QString &reason);
+    void closeCarrier();
+    void onTimeout();
+
+    // Called by the sockets of streams
+    void openStream(uint32_t id);
+    void write(uint32_t id, const char *data, size_t size);
+    qint64 bytesToWrite(uint32_t id) const;
+    void closeStream(uint32_t id);
+    void releaseStream(uint32_t id);
+    void consumed(uint32_t id, uint32_t bytes);
+
+    void onCarrierConnected();
+    void onCarrierReadyRead();
+    void onCarrierBytesWritten();
+};
+
+/*
+ * A stream of a MuxSession, which stands in for the remote socket of a
+ * TcpRelayClient or the local socket of a TcpRelayServer. The data on it
+ * isn't encrypted by the relay, since the session does it.
+ */
+class QSS_EXPORT MuxStreamSocket : public RelaySocket
+{
+    Q_OBJECT
+public:
+    ~MuxStreamSocket() override;
+
+    qint64 read(char *data, qint64 maxSize) override;
+    qint64 write(const char *data, qint64 size) override;
+    using RelaySocket::write;
+    qint64 bytesToWrite() const override;
+    qintptr socketDescriptor() const override;
+    // The stream always goes to the server of its session
+    void connectToHost(const QHostAddress &address, uint16_t port) override;
+    void close() override;
+
+    void setReadBufferSize(qint64 size) override;
+    void setSocketOption(QAbstractSocket::SocketOption option, const QVariant &value) override;
+    void setReadPaused(bool paused) override;
+
+    // Those of the carrier
+    QHostAddress localAddress() const override;
+    uint16_t localPort() const override;
+    QHostAddress peerAddress() const override;
+    uint16_t peerPort() const override;
+    QAbstractSocket::SocketError error() const override;
+    QString errorString() const override;
+
+private:
+    friend class MuxSession;
+
+    enum Deferred {
+        DEFER_READ = 1,
+        DEFER_CONNECTED = 2,
+        DEFER_WRITTEN = 4,
+        DEFER_ERROR = 8,
+        DEFER_DISCONNECTED = 16
+    };
+
+    MuxStreamSocket(MuxSession *session, uint32_t id);
+
+    // nullptr once the session is gone
+    MuxSession *m_session;
+    const uint32_t m_id;
+    bool m_closed;
+    bool m_readPaused;
+    // FIN was received, so disconnected follows once m_received is read
+    bool m_peerClosed;
+    std::string m_received;
+    // Read since the last WINDOW frame
+    uint32_t m_consumed;
+    qint64 m_written;
+    int m_deferred;
+    QAbstractSocket::SocketError m_error;
+    QString m_errorString;
+
+    void defer(Deferred deferred);
+    void emitDeferred();
+    // The session is gone, or the stream was reset by the peer
+    void fail(QAbstractSocket::SocketError error, const QString &reason);
+};
+
+}
+
+#endif // MUXSESSION_H
@@ -0,0 +1,217 @@
+/*
+ * nativesocket.cpp - helpers for the relay engines on raw socket descriptors
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "nativesocket.h"
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+// Older libc headers don't have it, while the kernel (4.11+) might
+#if defined(Q_OS_LINUX) && !defined(TCP_FASTOPEN_CONNECT)
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+
+namespace {
+
+uint16_t portOf(const sockaddr_storage &storage)
+{
+    if (storage.ss_family == AF_INET) {
+        return ntohs(reinterpret_cast<const sockaddr_in *>(&storage)->sin_port);
+    }
+    if (storage.ss_family == AF_INET6) {
+        return ntohs(reinterpret_cast<const sockaddr_in6 *>(&storage)->sin6_port);
+    }
+    return 0;
+}
+
+bool sockName(int fd, bool peer, sockaddr_storage *storage)
+{
+    socklen_t length = sizeof(sockaddr_storage);
+    auto *addr = reinterpret_cast<sockaddr *>(storage);
+    return fd != -1 && (peer ? ::getpeername(fd, addr, &length)
+                             : ::getsockname(fd, addr, &length)) == 0;
+}
+
+}  // namespace
+
+namespace QSS {
+
+socklen_t NativeSocket::toSockAddr(const QHostAddress &address,
+                                   uint16_t port,
+                                   sockaddr_storage *storage)
+{
+    std::memset(storage, 0, sizeof(sockaddr_storage));
+    if (address.protocol() == QAbstractSocket::IPv4Protocol) {
+        auto *in = reinterpret_cast<sockaddr_in *>(storage);
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        in->sin_addr.s_addr = htonl(address.toIPv4Address());
+        return sizeof(sockaddr_in);
+    }
+    auto *in6 = reinterpret_cast<sockaddr_in6 *>(storage);
+    in6->sin6_family = AF_INET6;
+    in6->sin6_port = htons(port);
+    const Q_IPV6ADDR ipv6 = address.toIPv6Address();
+    std::memcpy(&in6->sin6_addr, ipv6.c, sizeof(ipv6.c));
+    return sizeof(sockaddr_in6);
+}
+
+QAbstractSocket::SocketError NativeSocket::errorFromErrno(int error)
+{
+    switch (error) {
+    case ECONNREFUSED:
+        return QAbstractSocket::ConnectionRefusedError;
+    case ECONNRESET:
+    case EPIPE:
+        return QAbstractSocket::RemoteHostClosedError;
+    case ETIMEDOUT:
+        return QAbstractSocket::SocketTimeoutError;
+    case ENETDOWN:
+    case ENETUNREACH:
+    case EHOSTUNREACH:
+        return QAbstractSocket::NetworkError;
+    case EADDRINUSE:
+        return QAbstractSocket::AddressInUseError;
+    case EACCES:
+    case EPERM:
+        return QAbstractSocket::SocketAccessError;
+    case EMFILE:
+    case ENFILE:
+    case ENOBUFS:
+    case ENOMEM:
+        return QAbstractSocket::SocketResourceError;
+    default:
+        return QAbstractSocket::UnknownSocketError;
+    }
+}
+
+QHostAddress NativeSocket::localAddress(int fd)
+{
+    sockaddr_storage storage;
+    if (!sockName(fd, false, &storage)) {
+        return QHostAddress();
+    }
+    return QHostAddress(reinterpret_cast<const sockaddr *>(&storage));
+}
+
+uint16_t NativeSocket::localPort(int fd)
+{
+    sockaddr_storage storage;
+    return sockName(fd, false, &storage) ? portOf(storage) : 0;
+}
+
+QHostAddress NativeSocket::peerAddress(int fd)
+{
+    sockaddr_storage storage;
+    if (!sockName(fd, true, &storage)) {
+        return QHostAddress();
+    }
+    return QHostAddress(reinterpret_cast<const sockaddr *>(&storage));
+}
+
+uint16_t NativeSocket::peerPort(int fd)
+{
+    sockaddr_storage storage;
+    return sockName(fd, true, &storage) ? portOf(storage) : 0;
+}
+
+void NativeSocket::setOption(int fd, QAbstractSocket::SocketOption option, bool enabled)
+{
+    const int on = enabled ? 1 : 0;
+    if (option == QAbstractSocket::LowDelayOption) {
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    } else if (option == QAbstractSocket::KeepAliveOption) {
+        ::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    }
+}
+
+qint64 NativeSocket::receive(int fd, char *data, qint64 maxSize)
+{
+    ssize_t n;
+    do {
+        n = ::recv(fd, data, static_cast<size_t>(maxSize), MSG_DONTWAIT);
+    } while (n == -1 && errno == EINTR);
+    return n > 0 ? n : 0;
+}
+
+bool NativeSocket::setFastOpenConnect(int fd)
+{
+#ifdef Q_OS_LINUX
+    const int on = 1;
+    return ::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on)) == 0;
+#else
+    Q_UNUSED(fd)
+    return false;
+#endif
+}
+
+void NativeSocket::startFastOpen(int fd)
+{
+    // A failed connection is reported by the poller, not by this
+    ssize_t n;
+    do {
+        n = ::send(fd, nullptr, 0, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+}
+
+bool NativeSocket::setFastOpenListen(int fd, int queueLength)
+{
+#ifdef Q_OS_LINUX
+    return ::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &queueLength, sizeof(queueLength)) == 0;
+#else
+    Q_UNUSED(fd)
+    Q_UNUSED(queueLength)
+    return false;
+#endif
+}
+
+bool NativeSocket::fastOpenAccepted(int fd)
+{
+#ifdef Q_OS_LINUX
+    tcp_info info;
+    socklen_t length = sizeof(info);
+    if (::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) != 0) {
+        return false;
+    }
+    return (info.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+#else
+    Q_UNUSED(fd)
+    return false;
+#endif
+}
+
+void NativeSocket::closeGracefully(int fd)
+{
+    ::shutdown(fd, SHUT_WR);
+    char discarded[4096];
+    while (::recv(fd, discarded, sizeof(discarded), MSG_DONTWAIT) > 0) {
+    }
+    ::close(fd);
+}
+
+}  // namespace QSS
+
+#endif // Q_OS_UNIX
@@ -0,0 +1,87 @@
+/*
+ * nativesocket.h - helpers for the relay engines on raw socket descriptors
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NATIVESOCKET_H
+#define NATIVESOCKET_H
+
+#include <QAbstractSocket>
+#include <QHostAddress>
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+
+namespace QSS {
+
+namespace NativeSocket {
+
+// Fills storage with address and port, and returns the length used
+socklen_t toSockAddr(const QHostAddress &address, uint16_t port, sockaddr_storage *storage);
+
+// The QAbstractSocket counterpart of an errno value
+QAbstractSocket::SocketError errorFromErrno(int error);
+
+// Return QHostAddress() and 0 on failures, the same as QTcpSocket
+QHostAddress localAddress(int fd);
+uint16_t localPort(int fd);
+QHostAddress peerAddress(int fd);
+uint16_t peerPort(int fd);
+
+/*
+ * Reads what fd has got without blocking. Returns 0 if there's nothing,
+ * and leaves the end of the stream to be found by the socket's own reads.
+ */
+qint64 receive(int fd, char *data, qint64 maxSize);
+
+// Applies the socket options that the relay engines support
+void setOption(int fd, QAbstractSocket::SocketOption option, bool enabled);
+
+/*
+ * TCP Fast Open (Linux only, false elsewhere). With setFastOpenConnect,
+ * connect() on fd returns straight away and the SYN carries the first
+ * write. setFastOpenListen lets a listening fd take data in the SYN, with
+ * up to queueLength such connections pending. fastOpenAccepted tells if
+ * the peer acknowledged the data in the SYN, once the handshake is done.
+ */
+bool setFastOpenConnect(int fd);
+bool setFastOpenListen(int fd, int queueLength);
+bool fastOpenAccepted(int fd);
+/*
+ * Sends the SYN that setFastOpenConnect holds back for the first write, for
+ * a connection with nothing to write. It does nothing if the handshake is
+ * under way already.
+ */
+void startFastOpen(int fd);
+
+/*
+ * Shuts down the write side of fd once everything is written to it, and
+ * closes it. Unread data would make the kernel reset the connection on
+ * close, dropping what it hasn't sent yet, so that's discarded first.
+ */
+void closeGracefully(int fd);
+
+}
+
+}
+
+#endif // Q_OS_UNIX
+
+#endif // NATIVESOCKET_H
@@ -0,0 +1,190 @@
+/*
+ * relaysocket.cpp - the source file of RelaySocket and QtRelaySocket classes
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaysocket.h"
+#include "nativesocket.h"
+#include <QTimer>
+
+namespace QSS {
+
+RelaySocket::RelaySocket(QObject *parent) : QObject(parent)
+{
+}
+
+RelaySocket::~RelaySocket() = default;
+
+qint64 RelaySocket::write(const QByteArray &data)
+{
+    return write(data.constData(), data.size());
+}
+
+bool RelaySocket::canWriteDirectly() const
+{
+    return false;
+}
+
+void RelaySocket::writtenDirectly(qint64 count)
+{
+    QTimer::singleShot(0, this, [count, this]() {
+        emit bytesWritten(count);
+    });
+}
+
+bool RelaySocket::setFastOpen(bool)
+{
+    return false;
+}
+
+RelaySocket::FastOpen RelaySocket::fastOpenResult() const
+{
+    return FastOpen::NOT_USED;
+}
+
+QtRelaySocket::QtRelaySocket(QTcpSocket *socket, QObject *parent) :
+    RelaySocket(parent),
+    m_socket(socket),
+    m_readPaused(false)
+{
+    connect(m_socket.get(), &QTcpSocket::readyRead, this, [this]() {
+        if (!m_readPaused) {
+            emit readyRead();
+        }
+    });
+    connect(m_socket.get(), &QTcpSocket::connected, this, &RelaySocket::connected);
+    connect(m_socket.get(), &QTcpSocket::disconnected, this, &RelaySocket::disconnected);
+    connect(m_socket.get(), &QTcpSocket::bytesWritten, this, &RelaySocket::bytesWritten);
+    connect(m_socket.get(),
+            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
+            (&QTcpSocket::error),
+            this,
+            &RelaySocket::errorOccurred);
+}
+
+QtRelaySocket::~QtRelaySocket()
+{
+    // A socket closed with data left to write gets on with it, and deletes itself then
+    if (m_socket->state() == QAbstractSocket::ClosingState) {
+        QTcpSocket *socket = m_socket.release();
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket,
+                static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
+                (&QTcpSocket::error),
+                socket,
+                &QObject::deleteLater);
+    }
+}
+
+qint64 QtRelaySocket::read(char *data, qint64 maxSize)
+{
+    qint64 size = m_socket->read(data, maxSize);
+#ifdef Q_OS_UNIX
+    /*
+     * QTcpSocket fills its buffer only once per readyRead, so the rest comes
+     * from the kernel. Otherwise a relay could never read more than the
+     * buffer at once, however large its read budget.
+     */
+    if (size >= 0 && size < maxSize && m_socket->state() == QAbstractSocket::ConnectedState) {
+        size += NativeSocket::receive(m_socket->socketDescriptor(), data + size, maxSize - size);
+    }
+#endif
+    return size;
+}
+
+qint64 QtRelaySocket::write(const char *data, qint64 size)
+{
+    return m_socket->write(data, size);
+}
+
+qint64 QtRelaySocket::bytesToWrite() const
+{
+    return m_socket->bytesToWrite();
+}
+
+qintptr QtRelaySocket::socketDescriptor() const
+{
+    return m_socket->socketDescriptor();
+}
+
+void QtRelaySocket::connectToHost(const QHostAddress &address, uint16_t port)
+{
+    m_socket->connectToHost(address, port);
+}
+
+void QtRelaySocket::close()
+{
+    m_socket->close();
+}
+
+void QtRelaySocket::setReadBufferSize(qint64 size)
+{
+    m_socket->setReadBufferSize(size);
+}
+
+void QtRelaySocket::setSocketOption(QAbstractSocket::SocketOption option, const QVariant &value)
+{
+    m_socket->setSocketOption(option, value);
+}
+
+void QtRelaySocket::setReadPaused(bool paused)
+{
+    m_readPaused = paused;
+    // QTcpSocket stops reading by itself once its read buffer is full
+    if (!paused) {
+        QTimer::singleShot(0, this, [this]() {
+            if (!m_readPaused && m_socket->bytesAvailable() > 0) {
+                emit readyRead();
+            }
+        });
+    }
+}
+
+QHostAddress QtRelaySocket::localAddress() const
+{
+    return m_socket->localAddress();
+}
+
+uint16_t QtRelaySocket::localPort() const
+{
+    return m_socket->localPort();
+}
+
+QHostAddress QtRelaySocket::peerAddress() const
+{
+    return m_socket->peerAddress();
+}
+
+uint16_t QtRelaySocket::peerPort() const
+{
+    return m_socket->peerPort();
+}
+
+QAbstractSocket::SocketError QtRelaySocket::error() const
+{
+    return m_socket->error();
+}
+
+QString QtRelaySocket::errorString() const
+{
+    return m_socket->errorString();
+}
+
+}  // namespace QSS
@@ -0,0 +1,157 @@
+/*
+ * relaysocket.h - the header file of RelaySocket and QtRelaySocket classes
+ *
+ * RelaySocket is the stream socket interface that TcpRelay works on, so
+ * that it can run on QTcpSocket or on the native epoll and io_uring engines
+ * alike.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RELAYSOCKET_H
+#define RELAYSOCKET_H
+
+#include <QHostAddress>
+#include <QTcpSocket>
+#include <QVariant>
+#include <memory>
+#include "util/export.h"
+
+namespace QSS {
+
+class QSS_EXPORT RelaySocket : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RelaySocket(QObject *parent = nullptr);
+    ~RelaySocket() override;
+
+    RelaySocket(const RelaySocket &) = delete;
+
+    /*
+     * The same semantics as their QTcpSocket counterparts. Callers must not
+     * rely on signals being emitted, or not, from within these functions.
+     */
+    virtual qint64 read(char *data, qint64 maxSize) = 0;
+    virtual qint64 write(const char *data, qint64 size) = 0;
+    qint64 write(const QByteArray &data);
+    virtual qint64 bytesToWrite() const = 0;
+    virtual qintptr socketDescriptor() const = 0;
+    virtual void connectToHost(const QHostAddress &address, uint16_t port) = 0;
+    virtual void close() = 0;
+
+    virtual void setReadBufferSize(qint64 size) = 0;
+    virtual void setSocketOption(QAbstractSocket::SocketOption option, const QVariant &value) = 0;
+
+    /*
+     * While paused, readyRead isn't emitted and the socket stops reading
+     * from the kernel as soon as it can, so that TCP flow control holds the
+     * peer back. readyRead is emitted after resuming if there's data left.
+     */
+    virtual void setReadPaused(bool paused) = 0;
+
+    virtual QHostAddress localAddress() const = 0;
+    virtual uint16_t localPort() const = 0;
+    virtual QHostAddress peerAddress() const = 0;
+    virtual uint16_t peerPort() const = 0;
+    virtual QAbstractSocket::SocketError error() const = 0;
+    virtual QString errorString() const = 0;
+
+    /*
+     * Whether writing to socketDescriptor() directly (e.g. by sendmsg) is
+     * preferred to write() when bytesToWrite() is 0. It's false by default,
+     * since the socket wouldn't find out about errors of such writes.
+     */
+    virtual bool canWriteDirectly() const;
+
+    /*
+     * Tells the socket that count bytes were written to socketDescriptor()
+     * directly, so that bytesWritten is still emitted, after the caller
+     * has returned to the event loop
+     */
+    virtual void writtenDirectly(qint64 count);
+
+    /*
+     * Makes connectToHost() use TCP Fast Open, so that what's written before
+     * the handshake is done goes in the SYN. Returns false if the socket
+     * doesn't support it, which is the default.
+     * With a cookie cached for the host, connected is emitted before the
+     * SYN is even sent, since it waits for what's written on connected.
+     * Hence connected doesn't mean the host is reachable, only that data
+     * may be written, and failures show up as errorOccurred later on.
+     */
+    virtual bool setFastOpen(bool enabled);
+
+    enum class FastOpen {
+        // It wasn't asked for, or there's no connection
+        NOT_USED,
+        ACCEPTED,
+        // The kernel refused it, or the data went after the handshake
+        FELL_BACK
+    };
+
+    // How TCP Fast Open went for connectToHost(), once data has been received
+    virtual FastOpen fastOpenResult() const;
+
+signals:
+    void readyRead();
+    void connected();
+    void disconnected();
+    void errorOccurred(QAbstractSocket::SocketError);
+    void bytesWritten(qint64);
+};
+
+/*
+ * The RelaySocket on top of QTcpSocket, which works on all platforms
+ */
+class QSS_EXPORT QtRelaySocket : public RelaySocket
+{
+    Q_OBJECT
+public:
+    // Takes the ownership of socket
+    explicit QtRelaySocket(QTcpSocket *socket, QObject *parent = nullptr);
+    ~QtRelaySocket() override;
+
+    qint64 read(char *data, qint64 maxSize) override;
+    qint64 write(const char *data, qint64 size) override;
+    using RelaySocket::write;
+    qint64 bytesToWrite() const override;
+    qintptr socketDescriptor() const override;
+    void connectToHost(const QHostAddress &address, uint16_t port) override;
+    void close() override;
+
+    void setReadBufferSize(qint64 size) override;
+    void setSocketOption(QAbstractSocket::SocketOption option, const QVariant &value) override;
+    void setReadPaused(bool paused) override;
+
+    QHostAddress localAddress() const override;
+    uint16_t localPort() const override;
+    QHostAddress peerAddress() const override;
+    uint16_t peerPort() const override;
+    QAbstractSocket::SocketError error() const override;
+    QString errorString() const override;
+
+private:
+    std::unique_ptr<QTcpSocket> m_socket;
+    bool m_readPaused;
+};
+
+}
+
+#endif // RELAYSOCKET_H
@@ -0,0 +1,139 @@
+/*
+ * reuseport.cpp - SO_REUSEPORT listening sockets
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "reuseport.h"
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace QSS {
+
+bool ReusePort::isSupported()
+{
+#if defined(Q_OS_UNIX) && defined(SO_REUSEPORT)
+    return true;
+#else
+    return false;
+#endif
+}
+
+qintptr ReusePort::bind(QAbstractSocket::SocketType type,
+                        const QHostAddress &address,
+                        uint16_t port,
+                        int incomingCpu)
+{
+#if defined(Q_OS_UNIX) && defined(SO_REUSEPORT)
+    sockaddr_storage storage;
+    std::memset(&storage, 0, sizeof(storage));
+    socklen_t length;
+    const bool ipv4 = address.protocol() == QAbstractSocket::IPv4Protocol;
+    if (ipv4) {
+        auto *in = reinterpret_cast<sockaddr_in*>(&storage);
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        in->sin_addr.s_addr = htonl(address.toIPv4Address());
+        length = sizeof(sockaddr_in);
+    } else {
+        // QHostAddress::Any is dual-stack, which is bound to :: without V6ONLY
+        auto *in6 = reinterpret_cast<sockaddr_in6*>(&storage);
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        const Q_IPV6ADDR ipv6 = address.protocol() == QAbstractSocket::IPv6Protocol
+                ? address.toIPv6Address() : QHostAddress(QHostAddress::AnyIPv6).toIPv6Address();
+        std::memcpy(&in6->sin6_addr, ipv6.c, sizeof(ipv6.c));
+        length = sizeof(sockaddr_in6);
+    }
+
+    const bool tcp = type == QAbstractSocket::TcpSocket;
+    const int fd = ::socket(ipv4 ? AF_INET : AF_INET6, tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    const int on = 1;
+    bool ok = ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK) != -1
+            && ::fcntl(fd, F_SETFD, FD_CLOEXEC) != -1
+            && ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0
+            && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == 0;
+    if (ok && !ipv4) {
+        const int v6only = address.protocol() == QAbstractSocket::IPv6Protocol ? 1 : 0;
+        ok = ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) == 0;
+    }
+#ifdef SO_INCOMING_CPU
+    if (ok && incomingCpu >= 0
+            && ::setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &incomingCpu, sizeof(incomingCpu)) != 0) {
+        // It's only a hint, the socket works without it
+        qWarning("Failed to set SO_INCOMING_CPU to %d", incomingCpu);
+    }
+#else
+    Q_UNUSED(incomingCpu)
+#endif
+    ok = ok && ::bind(fd, reinterpret_cast<sockaddr*>(&storage), length) == 0;
+    if (ok && tcp) {
+        ok = ::listen(fd, SOMAXCONN) == 0;
+    }
+    if (!ok) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    Q_UNUSED(type)
+    Q_UNUSED(address)
+    Q_UNUSED(port)
+    Q_UNUSED(incomingCpu)
+    return -1;
+#endif
+}
+
+void ReusePort::close(qintptr socketDescriptor)
+{
+#ifdef Q_OS_UNIX
+    ::close(static_cast<int>(socketDescriptor));
+#else
+    Q_UNUSED(socketDescriptor)
+#endif
+}
+
+bool ReusePort::pinCurrentThread(int cpu)
+{
+#ifdef Q_OS_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    Q_UNUSED(cpu)
+    return false;
+#endif
+}
+
+}  // namespace QSS
@@ -0,0 +1,65 @@
+/*
+ * reuseport.h - SO_REUSEPORT listening sockets
+ *
+ * Each worker thread can own a listening socket bound to the same address,
+ * so that the kernel spreads connections and datagrams across them.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REUSEPORT_H
+#define REUSEPORT_H
+
+#include <QAbstractSocket>
+#include <QHostAddress>
+#include "util/export.h"
+
+namespace QSS {
+
+namespace ReusePort {
+
+// Whether SO_REUSEPORT sockets can be opened on this platform
+QSS_EXPORT bool isSupported();
+
+/*
+ * Opens a non-blocking socket with SO_REUSEPORT and binds it to address
+ * and port. A TCP socket is put into the listening state as well.
+ * If incomingCpu >= 0, SO_INCOMING_CPU is set so that the kernel prefers
+ * this socket for traffic received on that CPU (where supported).
+ * Returns the socket descriptor, or -1 if it fails.
+ */
+QSS_EXPORT qintptr bind(QAbstractSocket::SocketType type,
+                        const QHostAddress &address,
+                        uint16_t port,
+                        int incomingCpu = -1);
+
+// Closes a descriptor returned by bind() that hasn't been taken over
+QSS_EXPORT void close(qintptr socketDescriptor);
+
+/*
+ * Pins the calling thread to the cpu, so that it runs where the traffic of
+ * its SO_INCOMING_CPU sockets arrives. Returns false if it's not supported.
+ */
+QSS_EXPORT bool pinCurrentThread(int cpu);
+
+}
+
+}
+
+#endif // REUSEPORT_H
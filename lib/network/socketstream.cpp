@@ -21,20 +21,86 @@
  */
 
 #include "socketstream.h"
+#include <QNetworkProxy>
+#include <QTimer>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 using namespace QSS;
 
+namespace {
+#ifdef Q_OS_LINUX
+// The pipe capacity by default, so that a splice into it never blocks
+const size_t SPLICE_LENGTH = 65536;
+const int HALF_CLOSE_TIMEOUT = 60000;
+#endif
+}
+
 SocketStream::SocketStream(QAbstractSocket *a,
                            QAbstractSocket *b,
                            QObject *parent) :
     QObject(parent),
     m_as(a),
     m_bs(b)
+#ifdef Q_OS_LINUX
+    , m_splice(canSplice(a) && canSplice(b))
+    , m_fds{-1, -1}
+#endif
 {
     connect(m_as, &QAbstractSocket::readyRead,
             this, &SocketStream::onSocketAReadyRead);
     connect(m_bs, &QAbstractSocket::readyRead,
             this, &SocketStream::onSocketBReadyRead);
+#ifdef Q_OS_LINUX
+    m_halfCloseTimer.setSingleShot(true);
+    m_halfCloseTimer.setInterval(HALF_CLOSE_TIMEOUT);
+    connect(&m_halfCloseTimer, &QTimer::timeout, this, &SocketStream::finish);
+    if (m_splice) {
+        // Whatever Qt has buffered must be flushed before taking over
+        connect(m_as, &QAbstractSocket::bytesWritten,
+                this, &SocketStream::tryTakeOver);
+        connect(m_bs, &QAbstractSocket::bytesWritten,
+                this, &SocketStream::tryTakeOver);
+        QTimer::singleShot(0, this, &SocketStream::tryTakeOver);
+    }
+#endif
+    // Data that arrived before the stream was set up
+    if (m_as->bytesAvailable() > 0) {
+        onSocketAReadyRead();
+    }
+    if (m_bs->bytesAvailable() > 0) {
+        onSocketBReadyRead();
+    }
+}
+
+SocketStream::~SocketStream()
+{
+#ifdef Q_OS_LINUX
+    closeDescriptors();
+#endif
+}
+
+bool SocketStream::isSpliced() const
+{
+#ifdef Q_OS_LINUX
+    return m_fds[0] != -1;
+#else
+    return false;
+#endif
+}
+
+void SocketStream::setHalfCloseTimeout(int msec)
+{
+#ifdef Q_OS_LINUX
+    m_halfCloseTimer.setInterval(msec);
+#else
+    Q_UNUSED(msec)
+#endif
 }
 
 void SocketStream::onSocketAReadyRead()
@@ -54,3 +120,175 @@ void SocketStream::onSocketBReadyRead()
         qCritical("The first socket is not writable");
     }
 }
+
+void SocketStream::tryTakeOver()
+{
+#ifdef Q_OS_LINUX
+    if (!m_splice || isSpliced()) {
+        return;
+    }
+    // The sockets may have been closed or got data in the meantime
+    if (m_as->state() != QAbstractSocket::ConnectedState
+            || m_bs->state() != QAbstractSocket::ConnectedState) {
+        m_splice = false;
+        return;
+    }
+    if (m_as->bytesAvailable() > 0 || m_as->bytesToWrite() > 0
+            || m_bs->bytesAvailable() > 0 || m_bs->bytesToWrite() > 0) {
+        return;
+    }
+    if (!takeOver()) {
+        qWarning("Failed to set up splice, copying the stream instead");
+        m_splice = false;
+        closeDescriptors();
+    }
+#endif
+}
+
+#ifdef Q_OS_LINUX
+bool SocketStream::canSplice(const QAbstractSocket *socket)
+{
+    // A proxied socket's descriptor carries the proxy protocol too
+    const QNetworkProxy::ProxyType proxy = socket->proxy().type();
+    return socket->socketType() == QAbstractSocket::TcpSocket
+            && socket->state() == QAbstractSocket::ConnectedState
+            && socket->socketDescriptor() != -1
+            && (proxy == QNetworkProxy::NoProxy
+                || (proxy == QNetworkProxy::DefaultProxy
+                    && QNetworkProxy::applicationProxy().type() == QNetworkProxy::NoProxy));
+}
+
+bool SocketStream::takeOver()
+{
+    // Duplicated so that they survive the Qt sockets being closed
+    m_fds[0] = ::fcntl(static_cast<int>(m_as->socketDescriptor()), F_DUPFD_CLOEXEC, 0);
+    m_fds[1] = ::fcntl(static_cast<int>(m_bs->socketDescriptor()), F_DUPFD_CLOEXEC, 0);
+    if (m_fds[0] == -1 || m_fds[1] == -1) {
+        return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+        Pipe &pipe = m_pipes[i];
+        pipe.from = m_fds[i];
+        pipe.to = m_fds[1 - i];
+        if (::pipe2(pipe.pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+            return false;
+        }
+    }
+
+    disconnect(m_as, nullptr, this, nullptr);
+    disconnect(m_bs, nullptr, this, nullptr);
+    // Stops Qt from reading the descriptors without telling anyone about it
+    for (QAbstractSocket *socket : {m_as, m_bs}) {
+        const bool blocked = socket->blockSignals(true);
+        socket->abort();
+        socket->blockSignals(blocked);
+    }
+
+    for (Pipe &pipe : m_pipes) {
+        Pipe *p = &pipe;
+        pipe.readNotifier = std::make_unique<QSocketNotifier>(pipe.from, QSocketNotifier::Read);
+        pipe.writeNotifier = std::make_unique<QSocketNotifier>(pipe.to, QSocketNotifier::Write);
+        pipe.writeNotifier->setEnabled(false);
+        connect(pipe.readNotifier.get(), &QSocketNotifier::activated,
+                this, [this, p]() { onPipeActivated(*p); });
+        connect(pipe.writeNotifier.get(), &QSocketNotifier::activated,
+                this, [this, p]() { onPipeActivated(*p); });
+    }
+    // The kernel may have received data that Qt hasn't been notified of
+    QTimer::singleShot(0, this, [this]() {
+        onPipeActivated(m_pipes[0]);
+        onPipeActivated(m_pipes[1]);
+    });
+    return true;
+}
+
+bool SocketStream::pump(Pipe &pipe)
+{
+    while (!pipe.done) {
+        if (pipe.buffered > 0) {
+            const ssize_t n = ::splice(pipe.pipe[0], nullptr, pipe.to, nullptr, pipe.buffered,
+                                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                if (errno != EAGAIN) {
+                    return false;
+                }
+                // Stop reading until the other side can take more
+                pipe.readNotifier->setEnabled(false);
+                pipe.writeNotifier->setEnabled(true);
+                return true;
+            }
+            pipe.buffered -= static_cast<size_t>(n);
+            continue;
+        }
+        if (pipe.eof) {
+            ::shutdown(pipe.to, SHUT_WR);
+            pipe.done = true;
+            break;
+        }
+        const ssize_t n = ::splice(pipe.from, nullptr, pipe.pipe[1], nullptr, SPLICE_LENGTH,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno != EAGAIN) {
+                return false;
+            }
+            pipe.readNotifier->setEnabled(true);
+            pipe.writeNotifier->setEnabled(false);
+            return true;
+        }
+        if (n == 0) {
+            pipe.eof = true;
+        }
+        pipe.buffered += static_cast<size_t>(n);
+    }
+    pipe.readNotifier->setEnabled(false);
+    pipe.writeNotifier->setEnabled(false);
+    return true;
+}
+
+void SocketStream::onPipeActivated(Pipe &pipe)
+{
+    if (!isSpliced()) {
+        return;
+    }
+    if (!pump(pipe) || (m_pipes[0].done && m_pipes[1].done)) {
+        finish();
+    } else if ((m_pipes[0].done || m_pipes[1].done) && !m_halfCloseTimer.isActive()) {
+        m_halfCloseTimer.start();
+    }
+}
+
+void SocketStream::finish()
+{
+    if (!isSpliced()) {
+        return;
+    }
+    m_halfCloseTimer.stop();
+    closeDescriptors();
+    emit finished();
+}
+
+void SocketStream::closeDescriptors()
+{
+    for (Pipe &pipe : m_pipes) {
+        // This may be called from their activated signals
+        for (std::unique_ptr<QSocketNotifier> *notifier : {&pipe.readNotifier, &pipe.writeNotifier}) {
+            if (*notifier) {
+                (*notifier)->setEnabled(false);
+                notifier->release()->deleteLater();
+            }
+        }
+        for (int &fd : pipe.pipe) {
+            if (fd != -1) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    }
+    for (int &fd : m_fds) {
+        if (fd != -1) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+}
+#endif
@@ -25,6 +25,9 @@
 
 #include <QObject>
 #include <QAbstractSocket>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <memory>
 #include "util/export.h"
 
 namespace QSS {
@@ -37,20 +40,71 @@ public:
      * A light-weight class dedicated to stream data between two sockets
      * all available data from socket a will be written to socket b
      * vice versa
+     *
+     * On Linux, once both are connected plain TCP sockets with nothing
+     * buffered by Qt, the stream takes over their descriptors and moves
+     * data in the kernel with splice(). The sockets are then closed
+     * (without emitting any signal) and finished() is emitted when both
+     * directions are done, on an error, or once one direction has been done
+     * for the half-close timeout. Otherwise it keeps copying through
+     * QIODevice.
      */
     SocketStream(QAbstractSocket *a,
                  QAbstractSocket *b,
                  QObject *parent = 0);
+    ~SocketStream() override;
 
     SocketStream(const SocketStream &) = delete;
 
+    // Whether the stream has taken over the sockets and is using splice()
+    bool isSpliced() const;
+
+    /*
+     * How long (msec) a spliced stream waits for the other direction to end
+     * after one has ended, since there's no telling whether its peer has
+     * gone or is still sending. It's 60 seconds by default.
+     */
+    void setHalfCloseTimeout(int msec);
+
+signals:
+    void finished();
+
 private:
     QAbstractSocket *m_as;
     QAbstractSocket *m_bs;
 
+#ifdef Q_OS_LINUX
+    // One direction of the spliced stream, from one descriptor to the other
+    struct Pipe
+    {
+        int from = -1;
+        int to = -1;
+        int pipe[2] = {-1, -1};
+        size_t buffered = 0;
+        bool eof = false;
+        bool done = false;
+        std::unique_ptr<QSocketNotifier> readNotifier;
+        std::unique_ptr<QSocketNotifier> writeNotifier;
+    };
+
+    bool m_splice;
+    int m_fds[2];
+    Pipe m_pipes[2];
+    QTimer m_halfCloseTimer;
+
+    static bool canSplice(const QAbstractSocket *socket);
+    bool takeOver();
+    // Moves data until either side would block. Returns false on errors
+    bool pump(Pipe &pipe);
+    void onPipeActivated(Pipe &pipe);
+    void finish();
+    void closeDescriptors();
+#endif
+
 private slots:
     void onSocketAReadyRead();
     void onSocketBReadyRead();
+    void tryTakeOver();
 };
 
 }
@@ -23,11 +23,22 @@
 #include "tcprelay.h"
 #include "util/common.h"
 #include <QDebug>
+#include <QTimer>
+#include <algorithm>
+#include <cstring>
 #include <utility>
 
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
 namespace QSS {
 
-TcpRelay::TcpRelay(QTcpSocket *localSocket,
+TcpRelay::TcpRelay(RelaySocket *localSocket,
+                   RelaySocket *remoteSocket,
+                   TimingWheel *wheel,
                    int timeout,
                    Address server_addr,
                    const Encryptor::Creator& ec) :
@@ -35,44 +46,143 @@ TcpRelay::TcpRelay(QTcpSocket *localSocket,
     m_serverAddress(std::move(server_addr)),
     m_encryptor(ec()),
     m_local(localSocket),
-    m_remote(new QTcpSocket()),
-    m_timer(new QTimer())
-{
-    m_timer->setInterval(timeout);
-    connect(m_timer.get(), &QTimer::timeout, this, &TcpRelay::onTimeout);
-
-    connect(m_local.get(),
-            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
-            (&QTcpSocket::error),
-            this,
-            &TcpRelay::onLocalTcpSocketError);
-    connect(m_local.get(), &QTcpSocket::disconnected, this, &TcpRelay::close);
-    connect(m_local.get(), &QTcpSocket::readyRead,
-            this, &TcpRelay::onLocalTcpSocketReadyRead);
-    connect(m_local.get(), &QTcpSocket::readyRead,
-            m_timer.get(), static_cast<void (QTimer::*)()> (&QTimer::start));
+    m_remote(remoteSocket),
+    m_timer(wheel, [this]() { onTimeout(); }),
+    m_idleTimeout(timeout),
+    m_connectTimeout(timeout),
+    m_handshakeTimeout(timeout),
+    m_headroom(m_encryptor ? m_encryptor->encryptOverhead(RemoteRecvSize) : 0),
+    m_highWatermark(0),
+    m_lowWatermark(0),
+    m_localPaused(false),
+    m_remotePaused(false),
+    m_readBudget(0),
+    m_localYielded(false),
+    m_remoteYielded(false),
+    m_traffic(nullptr),
+    m_fastOpenPending(true),
+    m_latencyPending(false)
+{
+    m_timer.start(m_handshakeTimeout);
 
-    connect(m_remote.get(), &QTcpSocket::connected, this, &TcpRelay::onRemoteConnected);
-    connect(m_remote.get(),
-            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
-            (&QTcpSocket::error),
-            this, &TcpRelay::onRemoteTcpSocketError);
-    connect(m_remote.get(), &QTcpSocket::disconnected, this, &TcpRelay::close);
-    connect(m_remote.get(), &QTcpSocket::readyRead,
-            this, &TcpRelay::onRemoteTcpSocketReadyRead);
-    connect(m_remote.get(), &QTcpSocket::readyRead,
-            m_timer.get(), static_cast<void (QTimer::*)()> (&QTimer::start));
-    connect(m_remote.get(), &QTcpSocket::bytesWritten, this, &TcpRelay::bytesSend);
+    connect(m_local.get(), &RelaySocket::errorOccurred,
+            this, &TcpRelay::onLocalTcpSocketError);
+    connect(m_local.get(), &RelaySocket::disconnected, this, &TcpRelay::close);
+    connect(m_local.get(), &RelaySocket::readyRead,
+            this, &TcpRelay::onLocalTcpSocketReadyRead);
+    connect(m_local.get(), &RelaySocket::bytesWritten, this, &TcpRelay::onLocalBytesWritten);
 
     m_local->setReadBufferSize(RemoteRecvSize);
     m_local->setSocketOption(QAbstractSocket::LowDelayOption, 1);
     m_local->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
 
+    setUpRemote();
+}
+
+void TcpRelay::setUpRemote()
+{
+    connect(m_remote.get(), &RelaySocket::connected, this, &TcpRelay::onRemoteConnected);
+    connect(m_remote.get(), &RelaySocket::errorOccurred,
+            this, &TcpRelay::onRemoteTcpSocketError);
+    connect(m_remote.get(), &RelaySocket::disconnected, this, &TcpRelay::close);
+    connect(m_remote.get(), &RelaySocket::readyRead,
+            this, &TcpRelay::onRemoteTcpSocketReadyRead);
+    connect(m_remote.get(), &RelaySocket::bytesWritten, this, &TcpRelay::onRemoteBytesWritten);
+
     m_remote->setReadBufferSize(RemoteRecvSize);
     m_remote->setSocketOption(QAbstractSocket::LowDelayOption, 1);
     m_remote->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
 }
 
+void TcpRelay::replaceRemote(std::unique_ptr<RelaySocket> remote)
+{
+    disconnect(m_remote.get(), nullptr, this, nullptr);
+    m_remote = std::move(remote);
+    setUpRemote();
+}
+
+void TcpRelay::setWatermarks(qint64 high, qint64 low)
+{
+    m_highWatermark = high;
+    m_lowWatermark = std::min(low, high);
+}
+
+void TcpRelay::setReadBudget(qint64 budget)
+{
+    m_readBudget = budget;
+}
+
+void TcpRelay::setTrafficCounter(TrafficCounter *counter)
+{
+    m_traffic = counter;
+}
+
+void TcpRelay::setStageTimeouts(int connectTimeout, int handshakeTimeout)
+{
+    m_connectTimeout = connectTimeout;
+    m_handshakeTimeout = handshakeTimeout;
+    if (m_stage == INIT) {
+        m_timer.start(m_handshakeTimeout);
+    }
+}
+
+void TcpRelay::setStage(STAGE stage)
+{
+    m_stage = stage;
+    switch (stage) {
+    case DNS:
+        // The lookup and the connection share the connect timeout
+        m_timer.start(m_connectTimeout);
+        break;
+    case UDP_ASSOC:
+    case STREAM:
+        m_timer.start(m_idleTimeout, true);
+        break;
+    case DESTROYED:
+        m_timer.stop();
+        break;
+    default:
+        // ADDR is still part of the handshake, and CONNECTING follows DNS
+        break;
+    }
+}
+
+qint64 TcpRelay::pendingToRemote() const
+{
+    return m_remote->bytesToWrite() + static_cast<qint64>(m_dataToWrite.size());
+}
+
+void TcpRelay::checkHighWatermark(RelaySocket *source, bool &paused, qint64 pending)
+{
+    if (!paused && m_highWatermark > 0 && pending > m_highWatermark && m_stage != DESTROYED) {
+        paused = true;
+        source->setReadPaused(true);
+        emit readPaused();
+    }
+}
+
+void TcpRelay::checkLowWatermark(RelaySocket *source, bool &paused, qint64 pending)
+{
+    if (paused && pending <= m_lowWatermark) {
+        paused = false;
+        source->setReadPaused(false);
+    }
+}
+
+void TcpRelay::onLocalBytesWritten()
+{
+    checkLowWatermark(m_remote.get(), m_remotePaused, m_local->bytesToWrite());
+}
+
+void TcpRelay::onRemoteBytesWritten(qint64 bytes)
+{
+    if (m_traffic) {
+        m_traffic->addSent(bytes);
+    }
+    emit bytesSend(bytes);
+    checkLowWatermark(m_local.get(), m_localPaused, pendingToRemote());
+}
+
 void TcpRelay::close()
 {
     if (m_stage == DESTROYED) {
@@ -81,7 +191,7 @@ void TcpRelay::close()
 
     m_local->close();
     m_remote->close();
-    m_stage = DESTROYED;
+    setStage(DESTROYED);
     emit finished();
 }
 
@@ -96,15 +206,111 @@ void TcpRelay::onLocalTcpSocketError()
     close();
 }
 
+std::unique_ptr<RelaySocket> TcpRelay::detachLocal()
+{
+    disconnect(m_local.get(), nullptr, this, nullptr);
+    std::unique_ptr<RelaySocket> local = std::move(m_local);
+    m_remote->close();
+    setStage(DESTROYED);
+    emit finished();
+    return local;
+}
+
+std::string TcpRelay::encrypt(const std::string &data)
+{
+    return m_encryptor ? m_encryptor->encrypt(data) : data;
+}
+
+bool TcpRelay::writeEncrypted(RelaySocket *socket, uint8_t *data, size_t length)
+{
+    if (!m_encryptor) {
+        return socket->write(reinterpret_cast<const char*>(data), length) != -1;
+    }
+    return writeSegments(socket, m_encryptor->encryptSegments(data, length));
+}
+
+size_t TcpRelay::decryptToBuffer(const uint8_t *data, size_t length)
+{
+    const size_t maxLength = m_encryptor ? m_encryptor->maxDecryptedSize(length) : length;
+    if (m_plainBuffer.size() < maxLength) {
+        m_plainBuffer = BufferPool::local().acquire(maxLength);
+    }
+    if (!m_encryptor) {
+        std::memcpy(m_plainBuffer.data(), data, length);
+        return length;
+    }
+    return m_encryptor->decrypt(data, length, reinterpret_cast<uint8_t*>(m_plainBuffer.data()));
+}
+
 bool TcpRelay::writeToRemote(const char *data, size_t length)
 {
     return m_remote->write(data, length) != -1;
 }
 
+bool TcpRelay::writeSegments(RelaySocket *socket, const std::vector<Encryptor::Segment> &segments)
+{
+    size_t index = 0;
+    size_t offset = 0;
+#ifdef Q_OS_UNIX
+    /*
+     * RelaySocket doesn't have a gather write. Bypass it only if its write
+     * buffer is empty, otherwise the data would be sent out of order.
+     */
+    if (socket->canWriteDirectly() && socket->bytesToWrite() == 0
+            && socket->socketDescriptor() != -1) {
+        std::vector<iovec> iov(segments.size());
+        for (size_t i = 0; i < segments.size(); ++i) {
+            iov[i].iov_base = const_cast<uint8_t*>(segments[i].data);
+            iov[i].iov_len = segments[i].length;
+        }
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov.data();
+        msg.msg_iovlen = iov.size();
+#ifdef MSG_NOSIGNAL
+        // A peer that has reset the connection mustn't raise SIGPIPE
+        const int flags = MSG_NOSIGNAL;
+#else
+        // Elsewhere the socket is a QTcpSocket, whose engine ignores SIGPIPE
+        const int flags = 0;
+#endif
+        ssize_t written;
+        do {
+            written = ::sendmsg(socket->socketDescriptor(), &msg, flags);
+        } while (written == -1 && errno == EINTR);
+        if (written == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        if (written > 0) {
+            socket->writtenDirectly(written);
+            // Skip over whatever the kernel has taken
+            size_t remaining = written;
+            while (index < segments.size() && remaining >= segments[index].length) {
+                remaining -= segments[index].length;
+                ++index;
+            }
+            offset = remaining;
+        }
+    }
+#endif
+    for (; index < segments.size(); ++index, offset = 0) {
+        const char *data = reinterpret_cast<const char*>(segments[index].data) + offset;
+        if (socket->write(data, segments[index].length - offset) == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void TcpRelay::onRemoteConnected()
 {
-    emit latencyAvailable(m_startTime.msecsTo(QTime::currentTime()));
-    m_stage = STREAM;
+    // connected comes before the handshake under Fast Open, which tells nothing
+    if (m_remote->fastOpenResult() == RelaySocket::FastOpen::NOT_USED) {
+        emit latencyAvailable(m_startTime.msecsTo(QTime::currentTime()));
+    } else {
+        m_latencyPending = true;
+    }
+    setStage(STREAM);
     if (!m_dataToWrite.empty()) {
         writeToRemote(m_dataToWrite.data(), m_dataToWrite.size());
         m_dataToWrite.clear();
@@ -124,55 +330,123 @@ void TcpRelay::onRemoteTcpSocketError()
 
 void TcpRelay::onLocalTcpSocketReadyRead()
 {
-    std::string data;
-    data.resize(RemoteRecvSize);
-    int64_t readSize = m_local->read(&data[0], data.size());
-    if (readSize == -1) {
-        qCritical("Attempted to read from closed local socket.");
-        close();
-        return;
-    }
-    data.resize(readSize);
-
-    if (data.empty()) {
-        qCritical("Local received empty data.");
-        close();
-        return;
-    }
-    handleLocalTcpData(data);
+    readFrom(true, false);
 }
 
 void TcpRelay::onRemoteTcpSocketReadyRead()
 {
-    std::string buf;
-    buf.resize(RemoteRecvSize);
-    int64_t readSize = m_remote->read(&buf[0], buf.size());
-    if (readSize == -1) {
-        qCritical("Attempted to read from closed remote socket.");
-        close();
-        return;
-    }
-    buf.resize(readSize);
+    readFrom(false, false);
+}
 
-    if (buf.empty()) {
-        qWarning("Remote received empty data.");
-        close();
-        return;
+void TcpRelay::readFrom(bool local, bool resumed)
+{
+    RelaySocket *socket = local ? m_local.get() : m_remote.get();
+    const bool &paused = local ? m_localPaused : m_remotePaused;
+    BufferPool::Buffer buffer = BufferPool::local().acquire(m_headroom + RemoteRecvSize);
+    qint64 budget = m_readBudget;
+    // Postpones the idle timeout without touching any kernel timer
+    m_timer.touch();
+
+    for (bool first = !resumed; ; first = false) {
+        int64_t readSize = socket->read(buffer.data() + m_headroom, RemoteRecvSize);
+        if (readSize == -1) {
+            if (local) {
+                qCritical("Attempted to read from closed local socket.");
+            } else {
+                qCritical("Attempted to read from closed remote socket.");
+            }
+            close();
+            return;
+        }
+        if (readSize == 0) {
+            // Drained, but readyRead promised some data in the first place
+            if (first && local) {
+                qCritical("Local received empty data.");
+                close();
+            } else if (first) {
+                qWarning("Remote received empty data.");
+                close();
+            }
+            return;
+        }
+
+        uint8_t *data = reinterpret_cast<uint8_t*>(buffer.data());
+        if (local) {
+            handleLocalTcpData(data, m_headroom, readSize);
+            m_plainBuffer.reset();
+            checkHighWatermark(m_local.get(), m_localPaused, pendingToRemote());
+        } else {
+            if (m_traffic) {
+                m_traffic->addReceived(readSize);
+                // The handshake is surely done once the remote has sent something
+                if (m_fastOpenPending) {
+                    m_fastOpenPending = false;
+                    const RelaySocket::FastOpen result = m_remote->fastOpenResult();
+                    if (result != RelaySocket::FastOpen::NOT_USED) {
+                        m_traffic->addFastOpen(result == RelaySocket::FastOpen::ACCEPTED);
+                    }
+                }
+            }
+            if (m_latencyPending) {
+                m_latencyPending = false;
+                emit latencyAvailable(m_startTime.msecsTo(QTime::currentTime()));
+            }
+            emit bytesRead(readSize);
+            try {
+                handleRemoteTcpData(data, m_headroom, readSize);
+            } catch (const std::exception &e) {
+                QDebug(QtMsgType::QtCriticalMsg) << "Remote:" << e.what();
+                close();
+            }
+            m_plainBuffer.reset();
+            checkHighWatermark(m_remote.get(), m_remotePaused, m_local->bytesToWrite());
+        }
+
+        budget -= readSize;
+        // A short read means the socket is drained
+        if (m_stage == DESTROYED || paused || readSize < RemoteRecvSize) {
+            return;
+        }
+        if (budget <= 0) {
+            if (m_readBudget > 0) {
+                yieldRead(local);
+            }
+            return;
+        }
     }
-    emit bytesRead(buf.size());
-    try {
-        handleRemoteTcpData(buf);
-    } catch (const std::exception &e) {
-        QDebug(QtMsgType::QtCriticalMsg) << "Remote:" << e.what();
-        close();
+}
+
+void TcpRelay::yieldRead(bool local)
+{
+    bool &yielded = local ? m_localYielded : m_remoteYielded;
+    if (yielded) {
         return;
     }
-    m_local->write(buf.data(), buf.size());
+    yielded = true;
+    // Queued behind whatever the other connections of this thread have got
+    QTimer::singleShot(0, this, [this, local]() {
+        (local ? m_localYielded : m_remoteYielded) = false;
+        if (m_stage != DESTROYED && !(local ? m_localPaused : m_remotePaused)) {
+            readFrom(local, true);
+        }
+    });
 }
 
 void TcpRelay::onTimeout()
 {
-    qInfo("TCP connection timeout.");
+    switch (m_stage) {
+    case INIT:
+    case ADDR:
+        qInfo("TCP handshake timeout.");
+        break;
+    case DNS:
+    case CONNECTING:
+        qInfo("TCP connect timeout.");
+        break;
+    default:
+        qInfo("TCP connection timeout.");
+        break;
+    }
     close();
 }
 
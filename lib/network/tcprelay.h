@@ -24,11 +24,13 @@
 #define TCPRELAY_H
 
 #include <QObject>
-#include <QTcpSocket>
-#include <QTimer>
 #include <QTime>
+#include "relaysocket.h"
 #include "types/address.h"
 #include "crypto/encryptor.h"
+#include "util/bufferpool.h"
+#include "util/timingwheel.h"
+#include "util/trafficcounter.h"
 
 namespace QSS {
 
@@ -39,15 +41,58 @@ class QSS_EXPORT TcpRelay : public QObject
 {
     Q_OBJECT
 public:
-    TcpRelay(QTcpSocket *localSocket,
+    /*
+     * Takes the ownership of both sockets. localSocket is connected, while
+     * remoteSocket is connected to the remote later on.
+     * The timeouts are kept on wheel, and timeout (msec) is how long the
+     * connection may stay idle once it's established.
+     * If ec creates no encryptor, the data is relayed as it is, which is
+     * the case for the streams of a MuxSession.
+     */
+    TcpRelay(RelaySocket *localSocket,
+             RelaySocket *remoteSocket,
+             TimingWheel *wheel,
              int timeout,
              Address server_addr,
              const Encryptor::Creator& ec);
 
     TcpRelay(const TcpRelay &) = delete;
 
+    /*
+     * Reading from a socket is paused once more than high bytes are waiting
+     * to be written to the other one, and resumed when it's down to low.
+     * A high of 0 (the default) disables this.
+     */
+    void setWatermarks(qint64 high, qint64 low);
+
+    /*
+     * Each readyRead reads until the socket is drained or budget bytes are
+     * read, after which the rest is read after the other connections of
+     * the thread have had their turn. A budget of 0 reads once per readyRead.
+     * A QtRelaySocket only reads past its buffer on Unix, so elsewhere it
+     * reads once per readyRead regardless.
+     */
+    void setReadBudget(qint64 budget);
+
+    /*
+     * The time (msec) allowed to look up and connect to the remote, and for
+     * the local side to get through its handshake (the SOCKS5 negotiation or
+     * the address header), respectively. Both default to the idle timeout.
+     */
+    void setStageTimeouts(int connectTimeout, int handshakeTimeout);
+
+    /*
+     * The remote traffic is added to counter, which must outlive this
+     * connection, as well as being emitted by bytesRead and bytesSend.
+     * So is how TCP Fast Open went, if the remote socket attempted it.
+     */
+    void setTrafficCounter(TrafficCounter *counter);
+
     enum STAGE { INIT, ADDR, UDP_ASSOC, DNS, CONNECTING, STREAM, DESTROYED };
 
+public slots:
+    void close();
+
 signals:
     /*
      * Count only remote socket's traffic
@@ -57,8 +102,13 @@ signals:
     void bytesRead(quint64);
     void bytesSend(quint64);
 
-    //time used for remote to connect to the host (msec)
+    /*
+     * time used for remote to connect to the host (msec), or to send its
+     * first reply if it connected with TCP Fast Open
+     */
     void latencyAvailable(int);
+    // Reading from either socket was paused by the watermarks
+    void readPaused();
     void finished();
 
 protected:
@@ -70,16 +120,105 @@ protected:
     std::string m_dataToWrite;
 
     std::unique_ptr<Encryptor> m_encryptor;
-    std::unique_ptr<QTcpSocket> m_local;
-    std::unique_ptr<QTcpSocket> m_remote;
-    std::unique_ptr<QTimer> m_timer;
+    std::unique_ptr<RelaySocket> m_local;
+    std::unique_ptr<RelaySocket> m_remote;
+    TimingWheel::Timer m_timer;
     QTime m_startTime;
+    const int m_idleTimeout;
+    int m_connectTimeout;
+    int m_handshakeTimeout;
+
+    /*
+     * Socket data is read into a slab of the thread's BufferPool, after
+     * m_headroom bytes so that it can be encrypted in place and written to
+     * the socket without intermediate copies.
+     */
+    const size_t m_headroom;
+    /*
+     * The pooled buffer that data is decrypted into. It's only held while
+     * the data read is being handled.
+     */
+    BufferPool::Buffer m_plainBuffer;
+
+    qint64 m_highWatermark;
+    qint64 m_lowWatermark;
+    bool m_localPaused;
+    bool m_remotePaused;
+    qint64 m_readBudget;
+    bool m_localYielded;
+    bool m_remoteYielded;
+    TrafficCounter *m_traffic;
+    // Whether the TCP Fast Open result of the remote is yet to be counted
+    bool m_fastOpenPending;
+    /*
+     * Whether latencyAvailable waits for the first reply of the remote,
+     * since it connected with TCP Fast Open before any handshake
+     */
+    bool m_latencyPending;
+
+    // Moves on to stage, starting the timeout of the stage if it has one of its own
+    void setStage(STAGE stage);
+
+    // The bytes waiting to go out to the remote, including m_dataToWrite
+    qint64 pendingToRemote() const;
+    // Pause or resume reading from source according to pending bytes of the other
+    void checkHighWatermark(RelaySocket *source, bool &paused, qint64 pending);
+    void checkLowWatermark(RelaySocket *source, bool &paused, qint64 pending);
+
+    /*
+     * Reads and handles data from the local or remote socket within the read
+     * budget. If resumed, it's continuing where the budget ran out before.
+     */
+    void readFrom(bool local, bool resumed);
+    // Carries on reading after the events queued in the meantime
+    void yieldRead(bool local);
 
     bool writeToRemote(const char *data, size_t length);
 
+    // Connects the signals of m_remote and sets its options
+    void setUpRemote();
+    /*
+     * Replaces the remote socket, which hasn't been used yet, with remote.
+     * It's for a remote socket connected by other means, such as HappyEyeballs.
+     */
+    void replaceRemote(std::unique_ptr<RelaySocket> remote);
+
+    /*
+     * Takes the local socket away, closing the rest of this connection.
+     * The socket is disconnected from this connection beforehand.
+     */
+    std::unique_ptr<RelaySocket> detachLocal();
+
+    // Encrypts data, or leaves it as it is if there's no encryptor
+    std::string encrypt(const std::string &data);
+    /*
+     * Encrypts data in place and writes it to socket. The same headroom as
+     * for Encryptor::encryptSegments is required before data.
+     */
+    bool writeEncrypted(RelaySocket *socket, uint8_t *data, size_t length);
+
+    /*
+     * Writes the segments to socket, using a single sendmsg() if the socket
+     * allows it and has nothing pending in its write buffer. Whatever the
+     * kernel doesn't take immediately is queued in the socket's buffer.
+     */
+    bool writeSegments(RelaySocket *socket, const std::vector<Encryptor::Segment> &segments);
+
+    /*
+     * Decrypts data into m_plainBuffer, which is acquired if needed.
+     * Returns the length of plain text at the beginning of m_plainBuffer.
+     */
+    size_t decryptToBuffer(const uint8_t *data, size_t length);
+
     virtual void handleStageAddr(std::string &data) = 0;
-    virtual void handleLocalTcpData(std::string &data) = 0;
-    virtual void handleRemoteTcpData(std::string &data) = 0;
+
+    /*
+     * The data to handle is stored at buffer + headroom, and the headroom is
+     * enough to call Encryptor::encryptInPlace on the data.
+     * The handlers are responsible for writing the processed data out.
+     */
+    virtual void handleLocalTcpData(uint8_t *buffer, size_t headroom, size_t length) = 0;
+    virtual void handleRemoteTcpData(uint8_t *buffer, size_t headroom, size_t length) = 0;
 
 protected slots:
     void onRemoteConnected();
@@ -87,8 +226,9 @@ protected slots:
     void onLocalTcpSocketError();
     void onLocalTcpSocketReadyRead();
     void onRemoteTcpSocketReadyRead();
+    void onLocalBytesWritten();
+    void onRemoteBytesWritten(qint64 bytes);
     void onTimeout();
-    void close();
 };
 
 }
@@ -27,14 +27,22 @@
 
 namespace QSS {
 
-TcpRelayClient::TcpRelayClient(QTcpSocket *localSocket,
+TcpRelayClient::TcpRelayClient(RelaySocket *localSocket,
+                               RelaySocket *remoteSocket,
+                               TimingWheel *wheel,
                                int timeout,
                                Address server_addr,
                                const Encryptor::Creator& ec)
-    : TcpRelay(localSocket, timeout, server_addr, ec)
+    : TcpRelay(localSocket, remoteSocket, wheel, timeout, server_addr, ec)
+    , m_remoteConnected(false)
 {
 }
 
+void TcpRelayClient::setRemoteConnected()
+{
+    m_remoteConnected = true;
+}
+
 void TcpRelayClient::handleStageAddr(std::string &data)
 {
     auto cmd = static_cast<int>(data.at(1));
@@ -45,7 +53,7 @@ void TcpRelayClient::handleStageAddr(std::string &data)
         uint16_t port = m_local->localPort();
         std::string toWrite = std::string(header_data, 3) + Common::packAddress(addr, port);
         m_local->write(toWrite.data(), toWrite.length());
-        m_stage = UDP_ASSOC;
+        setStage(UDP_ASSOC);
         return;
     } if (cmd == 1) {//CMD_CONNECT
         data = data.substr(3);
@@ -67,14 +75,21 @@ void TcpRelayClient::handleStageAddr(std::string &data)
             << "Connecting " << m_remoteAddress << " from "
             << m_local->peerAddress().toString() << ":" << m_local->peerPort();
 
-    m_stage = DNS;
     static constexpr const char res [] = { 5, 0, 0, 1, 0, 0, 0, 0, 16, 16 };
     static const QByteArray response(res, 10);
     m_local->write(response);
-    m_dataToWrite += m_encryptor->encrypt(data);
+    if (m_remoteConnected) {
+        setStage(STREAM);
+        const std::string header = encrypt(data);
+        writeToRemote(header.data(), header.size());
+        return;
+    }
+
+    setStage(DNS);
+    m_dataToWrite += encrypt(data);
     m_serverAddress.lookUp([this](bool success) {
         if (success) {
-            m_stage = CONNECTING;
+            setStage(CONNECTING);
             m_startTime = QTime::currentTime();
             m_remote->connectToHost(m_serverAddress.getFirstIP(), m_serverAddress.getPort());
         } else {
@@ -84,13 +99,18 @@ void TcpRelayClient::handleStageAddr(std::string &data)
     });
 }
 
-void TcpRelayClient::handleLocalTcpData(std::string &data)
+void TcpRelayClient::handleLocalTcpData(uint8_t *buffer, size_t headroom, size_t length)
 {
+    if (m_stage == STREAM) {
+        if (!writeEncrypted(m_remote.get(), buffer + headroom, length)) {
+            qWarning("Failed to write to remote. Closing TCP connection.");
+            close();
+        }
+        return;
+    }
+
+    std::string data(reinterpret_cast<const char*>(buffer + headroom), length);
     switch (m_stage) {
-    case STREAM:
-        data = m_encryptor->encrypt(data);
-        writeToRemote(data.data(), data.size());
-        break;
     case INIT:
     {
         static constexpr const char reject_data [] = { 0, 91 };
@@ -104,13 +124,13 @@ void TcpRelayClient::handleLocalTcpData(std::string &data)
         } else {
             m_local->write(accept);
         }
-        m_stage = ADDR;
+        setStage(ADDR);
         break;
     }
     case CONNECTING:
     case DNS:
         // take DNS into account, otherwise some data will get lost
-        m_dataToWrite += m_encryptor->encrypt(data);
+        m_dataToWrite += encrypt(data);
         break;
     case ADDR:
         handleStageAddr(data);
@@ -120,9 +140,10 @@ void TcpRelayClient::handleLocalTcpData(std::string &data)
     }
 }
 
-void TcpRelayClient::handleRemoteTcpData(std::string &data)
+void TcpRelayClient::handleRemoteTcpData(uint8_t *buffer, size_t headroom, size_t length)
 {
-    data = m_encryptor->decrypt(data);
+    const size_t plainLength = decryptToBuffer(buffer + headroom, length);
+    m_local->write(m_plainBuffer.data(), plainLength);
 }
 
 }  // namespace QSS
@@ -31,15 +31,25 @@ class QSS_EXPORT TcpRelayClient : public TcpRelay
 {
     Q_OBJECT
 public:
-    TcpRelayClient(QTcpSocket *localSocket,
+    TcpRelayClient(RelaySocket *localSocket,
+                   RelaySocket *remoteSocket,
+                   TimingWheel *wheel,
                    int timeout,
                    Address server_addr,
                    const Encryptor::Creator &ec);
 
+    /*
+     * The remote socket is connected to the server already (e.g. it's from
+     * a ConnectionPool), so the header is sent as soon as it's known
+     */
+    void setRemoteConnected();
+
 protected:
+    bool m_remoteConnected;
+
     void handleStageAddr(std::string &data) final;
-    void handleLocalTcpData(std::string &data) final;
-    void handleRemoteTcpData(std::string &data) final;
+    void handleLocalTcpData(uint8_t *buffer, size_t headroom, size_t length) final;
+    void handleRemoteTcpData(uint8_t *buffer, size_t headroom, size_t length) final;
 };
 
 }
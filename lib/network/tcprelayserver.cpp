@@ -21,23 +21,48 @@
  */
 
 #include "tcprelayserver.h"
+#include "muxsession.h"
 #include "util/common.h"
 #include <QDebug>
 #include <utility>
 
 namespace QSS {
 
-TcpRelayServer::TcpRelayServer(QTcpSocket *localSocket,
+TcpRelayServer::TcpRelayServer(RelaySocket *localSocket,
+                               RelaySocket *remoteSocket,
+                               TimingWheel *wheel,
                                int timeout,
                                Address server_addr,
                                const Encryptor::Creator& ec,
                                bool autoBan)
-    : TcpRelay(localSocket, timeout, server_addr, ec)
+    : TcpRelay(localSocket, remoteSocket, wheel, timeout, server_addr, ec)
     , autoBan(autoBan)
 {}
 
+void TcpRelayServer::setMuxAcceptor(MuxAcceptor acceptor)
+{
+    m_muxAcceptor = std::move(acceptor);
+}
+
+void TcpRelayServer::setSocketFactory(HappyEyeballs::SocketFactory factory)
+{
+    m_socketFactory = std::move(factory);
+}
+
 void TcpRelayServer::handleStageAddr(std::string &data)
 {
+    if (m_muxAcceptor && static_cast<uint8_t>(data[0]) == MuxSession::PREAMBLE) {
+        if (data.size() < 2 || static_cast<uint8_t>(data[1]) != MuxSession::VERSION) {
+            qCritical("Unsupported mux version.");
+            close();
+            return;
+        }
+        // The session carries on with the cipher state of this connection
+        std::unique_ptr<Encryptor> encryptor = std::move(m_encryptor);
+        m_muxAcceptor(detachLocal(), std::move(encryptor), data.substr(2));
+        return;
+    }
+
     int header_length = 0;
     Common::parseHeader(data, m_remoteAddress, header_length);
     if (header_length == 0) {
@@ -53,16 +78,14 @@ void TcpRelayServer::handleStageAddr(std::string &data)
             << "Connecting " << m_remoteAddress << " from "
             << m_local->peerAddress().toString() << ":" << m_local->peerPort();
 
-    m_stage = DNS;
+    setStage(DNS);
     if (data.size() > header_length) {
         data = data.substr(header_length);
         m_dataToWrite += data;
     }
     m_remoteAddress.lookUp([this](bool success) {
         if (success) {
-            m_stage = CONNECTING;
-            m_startTime = QTime::currentTime();
-            m_remote->connectToHost(m_remoteAddress.getFirstIP(), m_remoteAddress.getPort());
+            connectToRemote();
         } else {
             QDebug(QtMsgType::QtDebugMsg).noquote() << "Failed to lookup remote address. Closing TCP connection.";
             close();
@@ -70,36 +93,69 @@ void TcpRelayServer::handleStageAddr(std::string &data)
     });
 }
 
-void TcpRelayServer::handleLocalTcpData(std::string &data)
+void TcpRelayServer::connectToRemote()
+{
+    setStage(CONNECTING);
+    // The latency covers the whole race, not just the attempt that won
+    m_startTime = QTime::currentTime();
+    if (!m_socketFactory || m_remoteAddress.getAllIPs().size() < 2) {
+        m_remote->connectToHost(m_remoteAddress.getFirstIP(), m_remoteAddress.getPort());
+        return;
+    }
+
+    m_eyeballs = std::make_unique<HappyEyeballs>(m_socketFactory);
+    connect(m_eyeballs.get(), &HappyEyeballs::connected, this, [this]() {
+        // It may be closed by the connect timeout while the attempts carry on
+        if (m_stage != CONNECTING) {
+            return;
+        }
+        replaceRemote(m_eyeballs->takeSocket());
+        QDebug(QtMsgType::QtDebugMsg).noquote() << "Connected" << m_remoteAddress
+                                                << "at" << m_eyeballs->address().toString();
+        onRemoteConnected();
+    });
+    connect(m_eyeballs.get(), &HappyEyeballs::failed, this, [this](const QString &errorString) {
+        QDebug(QtMsgType::QtWarningMsg).noquote() << "Remote socket:" << errorString;
+        close();
+    });
+    m_eyeballs->connectToHost(m_remoteAddress.getAllIPs(), m_remoteAddress.getPort());
+}
+
+void TcpRelayServer::handleLocalTcpData(uint8_t *buffer, size_t headroom, size_t length)
 {
+    size_t plainLength = 0;
     try {
-        data = m_encryptor->decrypt(data);
+        plainLength = decryptToBuffer(buffer + headroom, length);
     } catch (const std::exception &e) {
         QDebug(QtMsgType::QtCriticalMsg) << "Local:" << e.what();
         close();
         return;
     }
 
-    if (data.empty()) {
+    if (plainLength == 0) {
         qWarning("Data is empty after decryption.");
         return;
     }
 
     if (m_stage == STREAM) {
-        writeToRemote(data.data(), data.size());
+        writeToRemote(m_plainBuffer.data(), plainLength);
     } else if (m_stage == CONNECTING || m_stage == DNS) {
         // take DNS into account, otherwise some data will get lost
-        m_dataToWrite += data;
+        m_dataToWrite.append(m_plainBuffer.data(), plainLength);
     } else if (m_stage == INIT) {
+        std::string data(m_plainBuffer.data(), plainLength);
         handleStageAddr(data);
     } else {
         qCritical("Local unknown stage.");
     }
 }
 
-void TcpRelayServer::handleRemoteTcpData(std::string &data)
+void TcpRelayServer::handleRemoteTcpData(uint8_t *buffer, size_t headroom, size_t length)
 {
-    data = m_encryptor->encrypt(data);
+    if (!writeEncrypted(m_local.get(), buffer + headroom, length)) {
+        qWarning("Failed to write to local. Closing TCP connection.");
+        close();
+    }
 }
 
 }  // namespace QSS
@@ -24,6 +24,8 @@
 #define TCPRELAYSERVER_H
 
 #include "tcprelay.h"
+#include "happyeyeballs.h"
+#include <functional>
 
 namespace QSS {
 
@@ -31,18 +33,47 @@ class QSS_EXPORT TcpRelayServer : public TcpRelay
 {
     Q_OBJECT
 public:
-    TcpRelayServer(QTcpSocket *localSocket,
+    TcpRelayServer(RelaySocket *localSocket,
+                   RelaySocket *remoteSocket,
+                   TimingWheel *wheel,
                    int timeout,
                    Address server_addr,
                    const Encryptor::Creator& ec,
                    bool autoBan);
 
+    /*
+     * Takes over the local socket of a MuxSession connection, along with
+     * the encryptor and the plain text after the mux preamble
+     */
+    using MuxAcceptor = std::function<void(std::unique_ptr<RelaySocket>,
+                                           std::unique_ptr<Encryptor>,
+                                           std::string)>;
+
+    /*
+     * Connections opening a MuxSession are handed to acceptor. Without one
+     * (the default), they're rejected like any other malformed header.
+     */
+    void setMuxAcceptor(MuxAcceptor acceptor);
+
+    /*
+     * If the remote has more than one address, they're raced by
+     * HappyEyeballs with sockets from factory, and the remote socket
+     * passed in is replaced by the winner. Without a factory (the
+     * default), only the first address is tried.
+     */
+    void setSocketFactory(HappyEyeballs::SocketFactory factory);
+
 protected:
     const bool autoBan;
+    MuxAcceptor m_muxAcceptor;
+    HappyEyeballs::SocketFactory m_socketFactory;
+    std::unique_ptr<HappyEyeballs> m_eyeballs;
+
+    void connectToRemote();
 
     void handleStageAddr(std::string &data) final;
-    void handleLocalTcpData(std::string &data) final;
-    void handleRemoteTcpData(std::string &data) final;
+    void handleLocalTcpData(uint8_t *buffer, size_t headroom, size_t length) final;
+    void handleRemoteTcpData(uint8_t *buffer, size_t headroom, size_t length) final;
 };
 
 }
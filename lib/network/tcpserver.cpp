@@ -21,11 +21,15 @@
  */
 
 
-#include "tcprelayclient.h"
-#include "tcprelayserver.h"
 #include "tcpserver.h"
-#include "util/common.h"
+#include "tcpworker.h"
+#include "epollengine.h"
+#include "iouringengine.h"
+#include "reuseport.h"
 #include <QDebug>
+#ifdef Q_OS_UNIX
+#include "nativesocket.h"
+#endif
 #include <utility>
 
 namespace QSS {
@@ -34,55 +38,318 @@ TcpServer::TcpServer(Encryptor::Creator&& ec,
                      int timeout,
                      bool is_local,
                      bool auto_ban,
-                     Address serverAddress)
-    : m_encryptorCreator(std::move(ec))
-    , m_isLocal(is_local)
-    , m_autoBan(auto_ban)
-    , m_serverAddress(std::move(serverAddress))
-    , m_timeout(timeout)
+                     Address serverAddress,
+                     int workers)
+    : m_dispatch(Dispatch::LEAST_CONNECTIONS)
+    , m_nextWorker(0)
+    , m_sharded(false)
+    , m_fastOpen(false)
 {
+    qRegisterMetaType<qintptr>("qintptr");
+    qRegisterMetaType<QVector<quint64> >("QVector<quint64>");
+
+    if (workers <= 0) {
+        // Serve on this thread, the same as a single worker in place
+        m_workers.push_back(new TcpWorker(ec, timeout, is_local, auto_ban,
+                                          serverAddress, 0, this));
+    }
+    for (int i = 0; i < workers; ++i) {
+        auto thread = std::make_unique<QThread>();
+        thread->setObjectName(QString("TcpWorker %1").arg(i));
+        auto worker = new TcpWorker(ec, timeout, is_local, auto_ban, serverAddress, i);
+        worker->moveToThread(thread.get());
+        // Connections are destroyed in the thread which owns their sockets
+        connect(thread.get(), &QThread::finished, worker, &QObject::deleteLater);
+        thread->start();
+        m_workers.push_back(worker);
+        m_threads.push_back(std::move(thread));
+    }
+
+    for (TcpWorker *worker : m_workers) {
+        connect(worker, &TcpWorker::bytesRead, this, &TcpServer::bytesRead);
+        connect(worker, &TcpWorker::bytesSend, this, &TcpServer::bytesSend);
+        connect(worker, &TcpWorker::latencyAvailable,
+                this, &TcpServer::latencyAvailable);
+        connect(worker, &TcpWorker::readPaused, this, &TcpServer::readPaused);
+    }
 }
 
 TcpServer::~TcpServer()
 {
-    if (isListening()) {
-        close();
+    if (isListeningAll()) {
+        closeAll();
+    }
+    for (auto &thread : m_threads) {
+        thread->quit();
+    }
+    for (auto &thread : m_threads) {
+        thread->wait();
     }
 }
 
-void TcpServer::incomingConnection(qintptr socketDescriptor)
+void TcpServer::setDispatch(Dispatch dispatch)
+{
+    m_dispatch = dispatch;
+}
+
+bool TcpServer::setEpollEngine(bool enabled)
+{
+#ifdef Q_OS_LINUX
+    const bool supported = EpollEngine::isSupported();
+#else
+    const bool supported = false;
+#endif
+    for (TcpWorker *worker : m_workers) {
+        worker->setEpollEngine(enabled && supported);
+    }
+    return supported || !enabled;
+}
+
+bool TcpServer::setIoUring(bool enabled)
+{
+#ifdef Q_OS_LINUX
+    const bool supported = IoUringEngine::isSupported();
+#else
+    const bool supported = false;
+#endif
+    for (TcpWorker *worker : m_workers) {
+        worker->setIoUring(enabled && supported);
+    }
+    return supported || !enabled;
+}
+
+void TcpServer::setWatermarks(qint64 high, qint64 low)
+{
+    for (TcpWorker *worker : m_workers) {
+        worker->setWatermarks(high, low);
+    }
+}
+
+void TcpServer::setReadBudget(qint64 budget)
+{
+    for (TcpWorker *worker : m_workers) {
+        worker->setReadBudget(budget);
+    }
+}
+
+void TcpServer::setStageTimeouts(int connectTimeout, int handshakeTimeout)
+{
+    for (TcpWorker *worker : m_workers) {
+        worker->setStageTimeouts(connectTimeout, handshakeTimeout);
+    }
+}
+
+void TcpServer::setTrafficSignals(bool enabled)
+{
+    for (TcpWorker *worker : m_workers) {
+        worker->setTrafficSignals(enabled);
+    }
+}
+
+void TcpServer::setMux(bool enabled, int connections)
 {
-    auto localSocket = std::make_unique<QTcpSocket>();
-    localSocket->setSocketDescriptor(socketDescriptor);
+    for (TcpWorker *worker : m_workers) {
+        worker->setMux(enabled, connections);
+    }
+}
 
-    if (!m_isLocal && m_autoBan && Common::isAddressBanned(localSocket->peerAddress())) {
-        QDebug(QtMsgType::QtInfoMsg).noquote() << "A banned IP" << localSocket->peerAddress()
-                                               << "attempted to access this server";
+void TcpServer::setPool(int size, int idleTimeout)
+{
+    if (m_workers.empty()) {
         return;
     }
+    const int workers = static_cast<int>(m_workers.size());
+    for (TcpWorker *worker : m_workers) {
+        worker->setPool((size + workers - 1) / workers, idleTimeout);
+    }
+}
+
+void TcpServer::setFastOpen(bool enabled)
+{
+    m_fastOpen = enabled;
+    for (TcpWorker *worker : m_workers) {
+        worker->setFastOpen(enabled);
+    }
+}
 
-    //timeout * 1000: convert sec to msec
-    std::shared_ptr<TcpRelay> con;
-    if (m_isLocal) {
-        con = std::make_shared<TcpRelayClient>(localSocket.release(),
-                                               m_timeout * 1000,
-                                               m_serverAddress,
-                                               m_encryptorCreator);
-    } else {
-        con = std::make_shared<TcpRelayServer>(localSocket.release(),
-                                               m_timeout * 1000,
-                                               m_serverAddress,
-                                               m_encryptorCreator,
-                                               m_autoBan);
-    }
-    m_conList.push_back(con);
-    connect(con.get(), &TcpRelay::bytesRead, this, &TcpServer::bytesRead);
-    connect(con.get(), &TcpRelay::bytesSend, this, &TcpServer::bytesSend);
-    connect(con.get(), &TcpRelay::latencyAvailable,
-            this, &TcpServer::latencyAvailable);
-    connect(con.get(), &TcpRelay::finished, this, [con, this]() {
-        m_conList.remove(con);
-    });
+quint64 TcpServer::bytesReceived() const
+{
+    quint64 bytes = 0;
+    for (const TcpWorker *worker : m_workers) {
+        bytes += worker->traffic().received();
+    }
+    return bytes;
+}
+
+quint64 TcpServer::bytesSent() const
+{
+    quint64 bytes = 0;
+    for (const TcpWorker *worker : m_workers) {
+        bytes += worker->traffic().sent();
+    }
+    return bytes;
+}
+
+quint64 TcpServer::fastOpenAccepted() const
+{
+    quint64 count = 0;
+    for (const TcpWorker *worker : m_workers) {
+        count += worker->traffic().fastOpenAccepted();
+    }
+    return count;
+}
+
+quint64 TcpServer::fastOpenFallbacks() const
+{
+    quint64 count = 0;
+    for (const TcpWorker *worker : m_workers) {
+        count += worker->traffic().fastOpenFallbacks();
+    }
+    return count;
+}
+
+int TcpServer::workerCount() const
+{
+    return static_cast<int>(m_workers.size());
+}
+
+QThread *TcpServer::workerThread(int index) const
+{
+    // The single worker in place lives on the thread of this server
+    return m_workers.at(index)->thread();
+}
+
+int TcpServer::connectionCount(int index) const
+{
+    return m_workers.at(index)->connectionCount();
+}
+
+QVector<quint64> TcpServer::connectionIds() const
+{
+    QVector<quint64> ids;
+    for (TcpWorker *worker : m_workers) {
+        QVector<quint64> workerIds;
+        QMetaObject::invokeMethod(worker, "connectionIds", connectionTo(worker),
+                                  Q_RETURN_ARG(QVector<quint64>, workerIds));
+        ids += workerIds;
+    }
+    return ids;
+}
+
+bool TcpServer::closeConnection(quint64 id)
+{
+    const uint32_t index = Registry<TcpRelay>::tagOf(id);
+    if (index >= m_workers.size()) {
+        return false;
+    }
+    bool closed = false;
+    QMetaObject::invokeMethod(m_workers[index], "closeConnection", connectionTo(m_workers[index]),
+                              Q_RETURN_ARG(bool, closed), Q_ARG(quint64, id));
+    return closed;
+}
+
+Qt::ConnectionType TcpServer::connectionTo(const TcpWorker *worker) const
+{
+    // Without workers of its own, the worker is on the thread of this server
+    return worker->thread() == QThread::currentThread()
+            ? Qt::DirectConnection : Qt::BlockingQueuedConnection;
+}
+
+bool TcpServer::listenSharded(const QHostAddress &address, uint16_t port, bool pinCpu)
+{
+    if (m_threads.empty() || !ReusePort::isSupported()) {
+        return false;
+    }
+
+    const int cpus = QThread::idealThreadCount();
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        const int cpu = pinCpu ? static_cast<int>(i) % cpus : -1;
+        const qintptr fd = ReusePort::bind(QAbstractSocket::TcpSocket, address, port, cpu);
+        bool ok = false;
+        if (fd != -1) {
+            setFastOpenListen(fd);
+            QMetaObject::invokeMethod(m_workers[i], "listen", Qt::BlockingQueuedConnection,
+                                      Q_RETURN_ARG(bool, ok),
+                                      Q_ARG(qintptr, fd), Q_ARG(int, cpu));
+        }
+        if (!ok) {
+            m_sharded = true;
+            closeAll();
+            return false;
+        }
+    }
+    m_sharded = true;
+    return true;
+}
+
+bool TcpServer::isSharded() const
+{
+    return m_sharded;
+}
+
+bool TcpServer::listenSingle(const QHostAddress &address, quint16 port)
+{
+    if (!QTcpServer::listen(address, port)) {
+        return false;
+    }
+    setFastOpenListen(socketDescriptor());
+    return true;
+}
+
+bool TcpServer::isListeningAll() const
+{
+    return m_sharded || QTcpServer::isListening();
+}
+
+void TcpServer::closeAll()
+{
+    QTcpServer::close();
+    if (m_sharded) {
+        for (TcpWorker *worker : m_workers) {
+            QMetaObject::invokeMethod(worker, "closeListener", Qt::BlockingQueuedConnection);
+        }
+        m_sharded = false;
+    }
+}
+
+void TcpServer::setFastOpenListen(qintptr socketDescriptor)
+{
+    if (!m_fastOpen) {
+        return;
+    }
+#ifdef Q_OS_UNIX
+    if (NativeSocket::setFastOpenListen(socketDescriptor, maxPendingConnections())) {
+        return;
+    }
+#else
+    Q_UNUSED(socketDescriptor)
+#endif
+    qWarning("TCP Fast Open is refused by the system, listening without it");
+}
+
+TcpWorker *TcpServer::pickWorker()
+{
+    if (m_dispatch == Dispatch::ROUND_ROBIN) {
+        TcpWorker *worker = m_workers[m_nextWorker];
+        m_nextWorker = (m_nextWorker + 1) % m_workers.size();
+        return worker;
+    }
+
+    TcpWorker *least = m_workers.front();
+    int leastCount = least->connectionCount();
+    for (TcpWorker *worker : m_workers) {
+        const int count = worker->connectionCount();
+        if (count < leastCount) {
+            least = worker;
+            leastCount = count;
+        }
+    }
+    return least;
+}
+
+void TcpServer::incomingConnection(qintptr socketDescriptor)
+{
+    pickWorker()->dispatch(socketDescriptor);
 }
 
 }  // namespace QSS
@@ -24,45 +24,157 @@
 #define TCPSERVER_H
 
 #include <QTcpServer>
-#include <list>
+#include <QThread>
+#include <QVector>
 #include <memory>
+#include <vector>
 #include "crypto/encryptor.h"
 #include "types/address.h"
 #include "util/export.h"
 
 namespace QSS {
 
-class TcpRelay;
+class TcpWorker;
 
 class QSS_EXPORT TcpServer : public QTcpServer
 {
     Q_OBJECT
 public:
+    /*
+     * With workers > 0, each worker runs its own event loop on a dedicated
+     * thread and accepted connections are spread over them. Otherwise all
+     * connections are served on the thread of this server.
+     */
     TcpServer(Encryptor::Creator&& ec,
               int m_timeout,
               bool is_local,
               bool auto_ban,
-              Address m_serverAddress);
+              Address m_serverAddress,
+              int workers = 0);
     ~TcpServer() override;
 
     TcpServer(const TcpServer &) = delete;
 
+    // How accepted connections are assigned to workers
+    enum class Dispatch {
+        ROUND_ROBIN,
+        LEAST_CONNECTIONS
+    };
+
+    void setDispatch(Dispatch dispatch);
+
+    /*
+     * Relays connections on the native epoll engine instead of QTcpSocket.
+     * Returns false if the engine is unsupported on this platform.
+     * It must be set before listening.
+     */
+    bool setEpollEngine(bool enabled);
+
+    /*
+     * Relays connections on io_uring, in preference to epoll.
+     * Returns false if io_uring is unsupported by the running kernel.
+     * It must be set before listening.
+     */
+    bool setIoUring(bool enabled);
+
+    // The watermarks of connections, see TcpRelay::setWatermarks
+    void setWatermarks(qint64 high, qint64 low);
+    // The read budget of connections, see TcpRelay::setReadBudget
+    void setReadBudget(qint64 budget);
+    // The connect and handshake timeouts (sec), see TcpRelay::setStageTimeouts
+    void setStageTimeouts(int connectTimeout, int handshakeTimeout);
+
+    /*
+     * Whether bytesRead and bytesSend are emitted for every read and write,
+     * see TcpWorker::setTrafficSignals. It must be set before listening.
+     */
+    void setTrafficSignals(bool enabled);
+    // The mux mode of the workers, see TcpWorker::setMux. It must be set before listening.
+    void setMux(bool enabled, int connections);
+    /*
+     * The connection pool of the workers, see TcpWorker::setPool. The size
+     * is shared out among the workers. It must be set before listening.
+     */
+    void setPool(int size, int idleTimeout);
+    /*
+     * Enables TCP Fast Open on the listening sockets, and on the remote
+     * sockets of the workers (see TcpWorker::setFastOpen). The kernel may
+     * refuse it, in which case connections just carry on without it.
+     * It must be set before listening.
+     */
+    void setFastOpen(bool enabled);
+    // The remote traffic of all connections so far, summed over the workers
+    quint64 bytesReceived() const;
+    quint64 bytesSent() const;
+    // The remote connections that had data in their SYN, and those that fell back
+    quint64 fastOpenAccepted() const;
+    quint64 fastOpenFallbacks() const;
+    /*
+     * The workers, which is 1 if the server serves on its own thread, and
+     * the thread the worker at index lives on
+     */
+    int workerCount() const;
+    QThread *workerThread(int index) const;
+    // The open connections of the worker at index, see TcpWorker::connectionCount
+    int connectionCount(int index) const;
+
+    /*
+     * The IDs of the open connections of all workers, and closing one of
+     * them by its ID, which tells its worker (see TcpWorker::connectionIds).
+     * These wait for the workers to answer, so they mustn't be called on the
+     * thread of a worker.
+     */
+    QVector<quint64> connectionIds() const;
+    bool closeConnection(quint64 id);
+
+    /*
+     * Opens a SO_REUSEPORT listening socket for each worker, so that the
+     * kernel spreads connections over workers without a handoff through
+     * this server. With pinCpu, worker i is pinned to CPU i (modulo the
+     * number of CPUs) and its socket gets a matching SO_INCOMING_CPU.
+     * Returns false if there are no workers or SO_REUSEPORT is unsupported.
+     */
+    bool listenSharded(const QHostAddress &address, uint16_t port, bool pinCpu);
+    bool isSharded() const;
+
+    /*
+     * QTcpServer::listen, which enables TCP Fast Open on the socket as well
+     * if it's been set
+     */
+    bool listenSingle(const QHostAddress &address, quint16 port);
+
+    /*
+     * Unlike isListening() and close() of QTcpServer, these cover the
+     * sharded listening sockets as well
+     */
+    bool isListeningAll() const;
+    void closeAll();
+
 signals:
+    /*
+     * The signals of connections on worker threads are queued to the thread
+     * of this server, so that receivers don't need to be thread-safe
+     */
     void bytesRead(quint64);
     void bytesSend(quint64);
     void latencyAvailable(int);
+    void readPaused();
 
 protected:
     void incomingConnection(qintptr socketDescriptor) Q_DECL_OVERRIDE;
 
 private:
-    Encryptor::Creator m_encryptorCreator;
-    const bool m_isLocal;
-    const bool m_autoBan;
-    const Address m_serverAddress;
-    const int m_timeout;
+    std::vector<TcpWorker *> m_workers;
+    std::vector<std::unique_ptr<QThread> > m_threads;
+    Dispatch m_dispatch;
+    size_t m_nextWorker;
+    bool m_sharded;
+    bool m_fastOpen;
 
-    std::list<std::shared_ptr<TcpRelay> > m_conList;
+    TcpWorker *pickWorker();
+    // How to call worker from the current thread and wait for its answer
+    Qt::ConnectionType connectionTo(const TcpWorker *worker) const;
+    void setFastOpenListen(qintptr socketDescriptor);
 };
 
 }
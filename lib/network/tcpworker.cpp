@@ -0,0 +1,420 @@
+/*
+ * tcpworker.cpp - the source file of TcpWorker class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "tcprelayclient.h"
+#include "tcprelayserver.h"
+#include "tcpworker.h"
+#include "connectionpool.h"
+#include "epollengine.h"
+#include "iouringengine.h"
+#include "muxsession.h"
+#include "reuseport.h"
+#include "util/common.h"
+#include "util/timingwheel.h"
+#include <QDebug>
+#include <QTimer>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Passes connections accepted by a worker's own listening socket to it
+class WorkerListener : public QTcpServer
+{
+public:
+    explicit WorkerListener(QSS::TcpWorker *worker) : m_worker(worker) {}
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) Q_DECL_OVERRIDE
+    {
+        m_worker->dispatch(socketDescriptor);
+    }
+
+private:
+    QSS::TcpWorker *m_worker;
+};
+
+// The streams of a MuxSession are encrypted by the session as a whole
+std::unique_ptr<QSS::Encryptor> noEncryptor()
+{
+    return nullptr;
+}
+
+}  // namespace
+
+namespace QSS {
+
+TcpWorker::TcpWorker(const Encryptor::Creator &ec,
+                     int timeout,
+                     bool is_local,
+                     bool auto_ban,
+                     Address serverAddress,
+                     int index,
+                     QObject *parent)
+    : QObject(parent)
+    , m_encryptorCreator(ec)
+    , m_isLocal(is_local)
+    , m_autoBan(auto_ban)
+    , m_serverAddress(std::move(serverAddress))
+    , m_timeout(timeout)
+    , m_useEpoll(false)
+    , m_useIoUring(false)
+    , m_highWatermark(0)
+    , m_lowWatermark(0)
+    , m_readBudget(0)
+    , m_connectTimeout(timeout)
+    , m_handshakeTimeout(timeout)
+    , m_trafficSignals(false)
+    , m_mux(false)
+    , m_muxConnections(1)
+    , m_poolSize(0)
+    , m_poolIdleTimeout(10)
+    , m_fastOpen(false)
+    , m_connections(static_cast<uint32_t>(index))
+    , m_connectionCount(0)
+{
+}
+
+TcpWorker::~TcpWorker() = default;
+
+void TcpWorker::dispatch(qintptr socketDescriptor)
+{
+    // Counted here so that a burst of connections isn't all sent to one worker
+    ++m_connectionCount;
+    QMetaObject::invokeMethod(this, "addConnection", Qt::AutoConnection,
+                              Q_ARG(qintptr, socketDescriptor));
+}
+
+int TcpWorker::connectionCount() const
+{
+    return m_connectionCount;
+}
+
+void TcpWorker::setEpollEngine(bool enabled)
+{
+#ifdef Q_OS_LINUX
+    m_useEpoll = enabled && EpollEngine::isSupported();
+#else
+    Q_UNUSED(enabled)
+#endif
+}
+
+void TcpWorker::setIoUring(bool enabled)
+{
+#ifdef Q_OS_LINUX
+    m_useIoUring = enabled && IoUringEngine::isSupported();
+#else
+    Q_UNUSED(enabled)
+#endif
+}
+
+void TcpWorker::setWatermarks(qint64 high, qint64 low)
+{
+    m_highWatermark = high;
+    m_lowWatermark = low;
+}
+
+void TcpWorker::setReadBudget(qint64 budget)
+{
+    m_readBudget = budget;
+}
+
+void TcpWorker::setStageTimeouts(int connectTimeout, int handshakeTimeout)
+{
+    m_connectTimeout = connectTimeout;
+    m_handshakeTimeout = handshakeTimeout;
+}
+
+void TcpWorker::setTrafficSignals(bool enabled)
+{
+    m_trafficSignals = enabled;
+}
+
+const TrafficCounter &TcpWorker::traffic() const
+{
+    return m_traffic;
+}
+
+void TcpWorker::setMux(bool enabled, int connections)
+{
+    m_mux = enabled;
+    m_muxConnections = std::max(connections, 1);
+}
+
+void TcpWorker::setPool(int size, int idleTimeout)
+{
+    m_poolSize = size;
+    m_poolIdleTimeout = idleTimeout;
+}
+
+void TcpWorker::setFastOpen(bool enabled)
+{
+    m_fastOpen = enabled;
+}
+
+bool TcpWorker::listen(qintptr socketDescriptor, int cpu)
+{
+    if (cpu >= 0 && !ReusePort::pinCurrentThread(cpu)) {
+        qWarning("Failed to pin TCP worker thread to CPU %d", cpu);
+    }
+    m_listener = std::make_unique<WorkerListener>(this);
+    m_listener->setMaxPendingConnections(FD_SETSIZE);
+    if (!m_listener->setSocketDescriptor(socketDescriptor)) {
+        QDebug(QtMsgType::QtWarningMsg).noquote() << "TCP worker listen failed:"
+                                                  << m_listener->errorString();
+        m_listener.reset();
+        ReusePort::close(socketDescriptor);
+        return false;
+    }
+    return true;
+}
+
+void TcpWorker::closeListener()
+{
+    m_listener.reset();
+}
+
+QVector<quint64> TcpWorker::connectionIds() const
+{
+    QVector<quint64> ids;
+    ids.reserve(static_cast<int>(m_connections.size()));
+    m_connections.forEach([&ids](quint64 id, TcpRelay *) {
+        ids.push_back(id);
+    });
+    return ids;
+}
+
+bool TcpWorker::closeConnection(quint64 id)
+{
+    TcpRelay *con = m_connections.find(id);
+    if (!con) {
+        return false;
+    }
+    con->close();
+    return true;
+}
+
+RelaySocket *TcpWorker::createSocket(qintptr socketDescriptor)
+{
+#ifdef Q_OS_LINUX
+    if (m_useIoUring && !m_ring) {
+        // Created on the first connection so that it lives in this thread
+        try {
+            m_ring = std::make_unique<IoUringEngine>();
+        } catch (const std::exception &e) {
+            qWarning("Failed to set up io_uring (%s), falling back", e.what());
+            m_useIoUring = false;
+        }
+    }
+    if (m_useIoUring) {
+        return new IoUringRelaySocket(m_ring.get(), socketDescriptor);
+    }
+    if (m_useEpoll) {
+        // Created on the first connection so that it lives in this thread
+        if (!m_engine) {
+            m_engine = std::make_unique<EpollEngine>();
+        }
+        return new EpollRelaySocket(m_engine.get(), socketDescriptor);
+    }
+#endif
+    auto socket = new QTcpSocket();
+    if (socketDescriptor != -1) {
+        socket->setSocketDescriptor(socketDescriptor);
+    }
+    return new QtRelaySocket(socket);
+}
+
+RelaySocket *TcpWorker::createRemoteSocket()
+{
+    RelaySocket *socket = createSocket();
+    if (m_fastOpen) {
+        // Harmless if the engine can't do it, which has been warned about
+        socket->setFastOpen(true);
+    }
+    return socket;
+}
+
+void TcpWorker::addConnection(qintptr socketDescriptor)
+{
+    std::unique_ptr<RelaySocket> localSocket(createSocket(socketDescriptor));
+
+    if (!m_isLocal && m_autoBan && Common::isAddressBanned(localSocket->peerAddress())) {
+        QDebug(QtMsgType::QtInfoMsg).noquote() << "A banned IP" << localSocket->peerAddress()
+                                               << "attempted to access this server";
+        --m_connectionCount;
+        return;
+    }
+
+    // Created on the first connection so that they live in this thread
+    if (!m_wheel) {
+        m_wheel = std::make_unique<TimingWheel>();
+    }
+    if (m_isLocal && !m_mux && m_poolSize > 0 && !m_pool) {
+        m_pool = std::make_unique<ConnectionPool>([this]() {
+            return createSocket();
+        }, m_serverAddress);
+        m_pool->setSize(m_poolSize);
+        m_pool->setIdleTimeout(m_poolIdleTimeout * 1000);
+    }
+
+    //timeout * 1000: convert sec to msec
+    if (m_isLocal) {
+        std::unique_ptr<RelaySocket> pooled;
+        if (m_pool) {
+            pooled = m_pool->take();
+        }
+        const bool connected = static_cast<bool>(pooled);
+        RelaySocket *remoteSocket;
+        if (m_mux) {
+            remoteSocket = muxSession()->createStream();
+        } else {
+            remoteSocket = connected ? pooled.release() : createRemoteSocket();
+        }
+        auto con = std::make_unique<TcpRelayClient>(localSocket.release(),
+                                                    remoteSocket,
+                                                    m_wheel.get(),
+                                                    m_timeout * 1000,
+                                                    m_serverAddress,
+                                                    m_mux ? Encryptor::Creator(noEncryptor)
+                                                          : m_encryptorCreator);
+        if (connected) {
+            con->setRemoteConnected();
+        }
+        addRelay(std::move(con));
+    } else {
+        auto con = std::make_unique<TcpRelayServer>(localSocket.release(),
+                                                    createRemoteSocket(),
+                                                    m_wheel.get(),
+                                                    m_timeout * 1000,
+                                                    m_serverAddress,
+                                                    m_encryptorCreator,
+                                                    m_autoBan);
+        con->setSocketFactory([this]() {
+            return createRemoteSocket();
+        });
+        if (m_mux) {
+            con->setMuxAcceptor([this](std::unique_ptr<RelaySocket> carrier,
+                                       std::unique_ptr<Encryptor> encryptor,
+                                       std::string plain) {
+                auto session = std::make_unique<MuxSession>(MuxSession::Role::SERVER,
+                                                            carrier.release(),
+                                                            std::move(encryptor),
+                                                            m_wheel.get(),
+                                                            m_timeout * 1000);
+                MuxSession *s = session.get();
+                addMuxSession(std::move(session));
+                s->start(plain);
+            });
+        }
+        addRelay(std::move(con));
+    }
+}
+
+void TcpWorker::addMuxStream(MuxStreamSocket *stream)
+{
+    // A stream counts as a connection, while its session doesn't
+    ++m_connectionCount;
+    auto con = std::make_unique<TcpRelayServer>(stream,
+                                                createRemoteSocket(),
+                                                m_wheel.get(),
+                                                m_timeout * 1000,
+                                                m_serverAddress,
+                                                noEncryptor,
+                                                m_autoBan);
+    con->setSocketFactory([this]() {
+        return createRemoteSocket();
+    });
+    addRelay(std::move(con));
+}
+
+void TcpWorker::addRelay(std::unique_ptr<TcpRelay> con)
+{
+    con->setWatermarks(m_highWatermark, m_lowWatermark);
+    con->setReadBudget(m_readBudget);
+    con->setStageTimeouts(m_connectTimeout * 1000, m_handshakeTimeout * 1000);
+    con->setTrafficCounter(&m_traffic);
+    if (m_trafficSignals) {
+        connect(con.get(), &TcpRelay::bytesRead, this, &TcpWorker::bytesRead);
+        connect(con.get(), &TcpRelay::bytesSend, this, &TcpWorker::bytesSend);
+    }
+    connect(con.get(), &TcpRelay::latencyAvailable,
+            this, &TcpWorker::latencyAvailable);
+    connect(con.get(), &TcpRelay::readPaused, this, &TcpWorker::readPaused);
+    TcpRelay *relay = con.get();
+    const Registry<TcpRelay>::Id id = m_connections.add(std::move(con));
+    connect(relay, &TcpRelay::finished, this, [id, this]() {
+        --m_connectionCount;
+        // Destroyed after close() has returned, which may be deep in its own stack
+        QTimer::singleShot(0, this, [id, this]() {
+            m_connections.remove(id);
+        });
+    });
+}
+
+MuxSession *TcpWorker::muxSession()
+{
+    MuxSession *least = nullptr;
+    size_t open = 0;
+    m_muxSessions.forEach([&least, &open](quint64, MuxSession *session) {
+        if (session->isClosed()) {
+            return;
+        }
+        ++open;
+        // A session that's full or stalled still counts, but takes no more
+        if (!session->isAvailable()) {
+            return;
+        }
+        if (!least || session->streamCount() < least->streamCount()) {
+            least = session;
+        }
+    });
+    // Spread the streams over the sessions, opening them as they're needed
+    if (least && (least->streamCount() == 0 || open >= static_cast<size_t>(m_muxConnections))) {
+        return least;
+    }
+
+    auto session = std::make_unique<MuxSession>(MuxSession::Role::CLIENT,
+                                                createSocket(),
+                                                m_encryptorCreator(),
+                                                m_wheel.get(),
+                                                m_timeout * 1000);
+    MuxSession *s = session.get();
+    addMuxSession(std::move(session));
+    s->connectToServer(m_serverAddress);
+    return s;
+}
+
+void TcpWorker::addMuxSession(std::unique_ptr<MuxSession> session)
+{
+    MuxSession *s = session.get();
+    const Registry<MuxSession>::Id id = m_muxSessions.add(std::move(session));
+    connect(s, &MuxSession::incomingStream, this, &TcpWorker::addMuxStream);
+    connect(s, &MuxSession::finished, this, [id, this]() {
+        // The same as connections, it may be deep in its own stack
+        QTimer::singleShot(0, this, [id, this]() {
+            m_muxSessions.remove(id);
+        });
+    });
+}
+
+}  // namespace QSS
@@ -0,0 +1,206 @@
+/*
+ * tcpworker.h - the header file of TcpWorker class
+ *
+ * A TcpWorker owns a share of the TCP connections accepted by TcpServer
+ * and serves them on the event loop of its thread.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TCPWORKER_H
+#define TCPWORKER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include "crypto/encryptor.h"
+#include "types/address.h"
+#include "util/export.h"
+#include "util/registry.h"
+#include "util/trafficcounter.h"
+
+namespace QSS {
+
+class ConnectionPool;
+class EpollEngine;
+class IoUringEngine;
+class MuxSession;
+class MuxStreamSocket;
+class RelaySocket;
+class TcpRelay;
+class TimingWheel;
+
+class QSS_EXPORT TcpWorker : public QObject
+{
+    Q_OBJECT
+public:
+    /*
+     * index tells the workers of a TcpServer apart, and goes into the IDs
+     * of connections (see connectionIds). It's below 2^Registry::TAG_BITS.
+     */
+    TcpWorker(const Encryptor::Creator &ec,
+              int timeout,
+              bool is_local,
+              bool auto_ban,
+              Address serverAddress,
+              int index = 0,
+              QObject *parent = nullptr);
+    ~TcpWorker() override;
+
+    TcpWorker(const TcpWorker &) = delete;
+
+    /*
+     * Hands an accepted socket over to this worker. This can be called from
+     * any thread, and the connection is set up in the thread of this worker.
+     */
+    void dispatch(qintptr socketDescriptor);
+
+    // The number of connections dispatched to this worker that are still open
+    int connectionCount() const;
+
+    /*
+     * Relays connections on the native epoll engine instead of QTcpSocket.
+     * It only takes effect if the engine is supported, and must be set
+     * before any connection is dispatched.
+     */
+    void setEpollEngine(bool enabled);
+
+    /*
+     * Relays connections on io_uring, which takes precedence over epoll.
+     * If the ring can't be set up, the worker falls back to epoll or
+     * QTcpSocket. It must be set before any connection is dispatched.
+     */
+    void setIoUring(bool enabled);
+
+    // The watermarks of connections, see TcpRelay::setWatermarks
+    void setWatermarks(qint64 high, qint64 low);
+    // The read budget of connections, see TcpRelay::setReadBudget
+    void setReadBudget(qint64 budget);
+    // The connect and handshake timeouts (sec), see TcpRelay::setStageTimeouts
+    void setStageTimeouts(int connectTimeout, int handshakeTimeout);
+
+    /*
+     * The remote traffic of the connections is always added up in traffic().
+     * Forwarding it through bytesRead and bytesSend as well, for every read
+     * and write, is opt-in. It must be set before any connection is dispatched.
+     */
+    void setTrafficSignals(bool enabled);
+    const TrafficCounter &traffic() const;
+
+    /*
+     * In local mode, relays connections as streams of up to connections
+     * MuxSession connections to the server instead of a connection each.
+     * In server mode, accepts MuxSession connections on top of normal ones.
+     * It must be set before any connection is dispatched.
+     */
+    void setMux(bool enabled, int connections);
+
+    /*
+     * In local mode without mux, keeps up to size connections to the server
+     * open ahead of time, for up to idleTimeout sec each (see ConnectionPool).
+     * It must be set before any connection is dispatched.
+     */
+    void setPool(int size, int idleTimeout);
+
+    /*
+     * Connects to the remote with TCP Fast Open, which is counted in
+     * traffic(). It's only supported by the epoll and io_uring engines.
+     * It must be set before any connection is dispatched.
+     */
+    void setFastOpen(bool enabled);
+
+    /*
+     * Accepts connections from a listening socket of its own (e.g. one of
+     * the SO_REUSEPORT shards) on the thread of this worker.
+     * If cpu >= 0, the thread is pinned to it.
+     * These must be called on the thread of this worker.
+     */
+    Q_INVOKABLE bool listen(qintptr socketDescriptor, int cpu);
+    Q_INVOKABLE void closeListener();
+
+    /*
+     * The IDs of the open connections, and closing one of them by its ID.
+     * Registry<TcpRelay>::tagOf an ID is the index of its worker, so IDs are
+     * unique among the workers of a TcpServer.
+     * These must be called on the thread of this worker as well.
+     */
+    Q_INVOKABLE QVector<quint64> connectionIds() const;
+    Q_INVOKABLE bool closeConnection(quint64 id);
+
+signals:
+    void bytesRead(quint64);
+    void bytesSend(quint64);
+    void latencyAvailable(int);
+    void readPaused();
+
+private:
+    Encryptor::Creator m_encryptorCreator;
+    const bool m_isLocal;
+    const bool m_autoBan;
+    const Address m_serverAddress;
+    const int m_timeout;
+    bool m_useEpoll;
+    bool m_useIoUring;
+    qint64 m_highWatermark;
+    qint64 m_lowWatermark;
+    qint64 m_readBudget;
+    int m_connectTimeout;
+    int m_handshakeTimeout;
+    bool m_trafficSignals;
+    bool m_mux;
+    int m_muxConnections;
+    int m_poolSize;
+    int m_poolIdleTimeout;
+    bool m_fastOpen;
+
+    // Declared before the connections so that they outlive their sockets
+    std::unique_ptr<EpollEngine> m_engine;
+    std::unique_ptr<IoUringEngine> m_ring;
+    // Keeps the timeouts of all connections of this worker
+    std::unique_ptr<TimingWheel> m_wheel;
+    std::unique_ptr<ConnectionPool> m_pool;
+    TrafficCounter m_traffic;
+    // Declared before the connections so that they outlive their streams
+    Registry<MuxSession> m_muxSessions;
+    Registry<TcpRelay> m_connections;
+    std::atomic<int> m_connectionCount;
+    std::unique_ptr<QTcpServer> m_listener;
+
+    // Creates a socket from socketDescriptor, or an unconnected one if it's -1
+    RelaySocket *createSocket(qintptr socketDescriptor = -1);
+    // Creates an unconnected socket for the remote leg of a relay
+    RelaySocket *createRemoteSocket();
+    // Sets up and keeps con, which counts as one of the connections
+    void addRelay(std::unique_ptr<TcpRelay> con);
+
+    // The client session to open the next stream on, which may be a new one
+    MuxSession *muxSession();
+    void addMuxSession(std::unique_ptr<MuxSession> session);
+
+private slots:
+    void addConnection(qintptr socketDescriptor);
+    void addMuxStream(MuxStreamSocket *stream);
+};
+
+}
+
+#endif // TCPWORKER_H
@@ -35,8 +35,11 @@ UdpRelay::UdpRelay(const Encryptor::Creator& ec,
     m_isLocal(is_local),
     m_autoBan(auto_ban),
     m_encryptor(ec()),
-    m_encryptorCreator(ec)
+    m_encryptorCreator(ec),
+    m_traffic(nullptr)
 {
+    // So that the socket goes along with this relay to a worker thread
+    m_listenSocket.setParent(this);
     m_listenSocket.setReadBufferSize(RemoteRecvSize);
     m_listenSocket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
 
@@ -49,8 +52,17 @@ UdpRelay::UdpRelay(const Encryptor::Creator& ec,
             (&QUdpSocket::error),
             this,
             &UdpRelay::onSocketError);
-    connect(&m_listenSocket, &QUdpSocket::bytesWritten,
-            this, &UdpRelay::bytesSend);
+    connect(&m_listenSocket, &QUdpSocket::bytesWritten, this, [this](qint64 bytes) {
+        if (m_traffic) {
+            m_traffic->addSent(bytes);
+        }
+        emit bytesSend(bytes);
+    });
+}
+
+void UdpRelay::setTrafficCounter(TrafficCounter *counter)
+{
+    m_traffic = counter;
 }
 
 bool UdpRelay::isListening() const
@@ -67,6 +79,12 @@ bool UdpRelay::listen(const QHostAddress& addr, uint16_t port)
               );
 }
 
+bool UdpRelay::listen(qintptr socketDescriptor)
+{
+    return m_listenSocket.setSocketDescriptor(socketDescriptor,
+                                              QAbstractSocket::BoundState);
+}
+
 void UdpRelay::close()
 {
     m_listenSocket.close();
@@ -109,6 +127,9 @@ void UdpRelay::onServerUdpSocketReadyRead()
                                                  packetSize,
                                                  &r_addr,
                                                  &r_port);
+    if (m_traffic && readSize > 0) {
+        m_traffic->addReceived(readSize);
+    }
     emit bytesRead(readSize);
 
     if (m_isLocal) {
@@ -29,6 +29,7 @@
 #include <map>
 #include "types/address.h"
 #include "crypto/encryptor.h"
+#include "util/trafficcounter.h"
 
 namespace QSS {
 
@@ -45,8 +46,19 @@ public:
 
     bool isListening() const;
 
+    /*
+     * The traffic of the listen socket is added to counter, which must
+     * outlive this relay, as well as being emitted by bytesRead and bytesSend
+     */
+    void setTrafficCounter(TrafficCounter *counter);
+
 public slots:
     bool listen(const QHostAddress& addr, uint16_t port);
+    /*
+     * Serves on an already bound socket, e.g. one of the SO_REUSEPORT shards
+     * opened by ReusePort::bind(). This takes over the descriptor.
+     */
+    bool listen(qintptr socketDescriptor);
     void close();
 
 signals:
@@ -67,6 +79,7 @@ private:
     QUdpSocket m_listenSocket;
     std::unique_ptr<Encryptor> m_encryptor;
     Encryptor::Creator m_encryptorCreator;
+    TrafficCounter *m_traffic;
 
     std::map<Address, std::shared_ptr<QUdpSocket> > m_cache;
 
@@ -24,12 +24,17 @@
 
 #include "address.h"
 #include "util/common.h"
+#include "util/dnscache.h"
+#include <utility>
 
 namespace  QSS {
 
 void DnsLookup::lookup(const QString& hostname)
 {
-    QHostInfo::lookupHost(hostname, this, SLOT(lookedUp(QHostInfo)));
+    DnsCache::lookUp(hostname.toStdString(), this, [this](const QList<QHostAddress> &ips) {
+        m_ips = ips;
+        emit finished();
+    });
 }
 
 const QList<QHostAddress> DnsLookup::iplist() const
@@ -37,16 +42,6 @@ const QList<QHostAddress> DnsLookup::iplist() const
     return m_ips;
 }
 
-void DnsLookup::lookedUp(const QHostInfo &info)
-{
-    if (info.error() != QHostInfo::NoError) {
-        qWarning("DNS lookup failed: %s", info.errorString().toStdString().data());
-    } else {
-        m_ips = info.addresses();
-    }
-    emit finished();
-}
-
 Address::Address(const std::string &a, uint16_t p)
 {
     m_data.second = p;
@@ -59,6 +54,25 @@ Address::Address(const QHostAddress &ip, uint16_t p)
     setIPAddress(ip);
 }
 
+Address::Address(const Address &o) :
+    m_data(o.m_data),
+    m_ipAddrList(o.m_ipAddrList)
+{
+}
+
+Address::Address(Address &&o) :
+    m_data(std::move(o.m_data)),
+    m_ipAddrList(std::move(o.m_ipAddrList))
+{
+}
+
+Address& Address::operator=(const Address &o)
+{
+    m_data = o.m_data;
+    m_ipAddrList = o.m_ipAddrList;
+    return *this;
+}
+
 const std::string& Address::getAddress() const
 {
     return m_data.first;
@@ -77,6 +91,11 @@ QHostAddress Address::getFirstIP() const
     return m_ipAddrList.empty() ? QHostAddress() : m_ipAddrList.front();
 }
 
+const std::vector<QHostAddress> &Address::getAllIPs() const
+{
+    return m_ipAddrList;
+}
+
 bool Address::isIPValid() const
 {
     return !m_ipAddrList.empty();
@@ -93,17 +112,25 @@ void Address::lookUp(Address::LookUpCallback cb)
         return cb(true);
     }
 
-    if (m_dns) {
-        // DNS lookup is in-progress
+    m_lookUpCallbacks.push_back(std::move(cb));
+    if (m_lookUpCallbacks.size() > 1) {
+        // DNS lookup is in-progress, which calls this one back as well
         return;
     }
 
-    m_dns = std::make_shared<DnsLookup>();
-    QObject::connect(m_dns.get(), &DnsLookup::finished, [cb, this]() {
-        m_ipAddrList = m_dns->iplist().toVector().toStdVector();
-        cb(!m_ipAddrList.empty());
-        m_dns.reset();
-    });
+    if (!m_dns) {
+        m_dns = std::make_unique<DnsLookup>();
+        QObject::connect(m_dns.get(), &DnsLookup::finished, [this]() {
+            m_ipAddrList = m_dns->iplist().toVector().toStdVector();
+            const bool success = !m_ipAddrList.empty();
+            // A callback may start another lookup if this one has failed
+            std::vector<LookUpCallback> callbacks;
+            callbacks.swap(m_lookUpCallbacks);
+            for (const LookUpCallback &callback : callbacks) {
+                callback(success);
+            }
+        });
+    }
     m_dns->lookup(QString::fromStdString(m_data.first));
 }
 
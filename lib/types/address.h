@@ -41,15 +41,13 @@ class QSS_EXPORT DnsLookup : public QObject
     // A simple wrapper class to provide asynchronous DNS lookup
     Q_OBJECT
 public:
+    // Looks up hostname through DnsCache, which may finish before this returns
     void lookup(const QString& hostname);
     const QList<QHostAddress> iplist() const;
 
 signals:
     void finished();
 
-private slots:
-    void lookedUp(const QHostInfo& info);
-
 private:
     QList<QHostAddress> m_ips;
 };
@@ -63,10 +61,11 @@ public:
     Address(const QHostAddress &ip,
             uint16_t p);
 
-    Address(const Address &) = default;
-    Address(Address &&) = default;
+    // Neither a copy nor a moved one takes part in a lookup in progress
+    Address(const Address &);
+    Address(Address &&);
 
-    Address& operator=(const Address&) = default;
+    Address& operator=(const Address&);
 
     const std::string &getAddress() const;
 
@@ -87,6 +86,9 @@ public:
      */
     QHostAddress getFirstIP() const;
 
+    // All the IP addresses, in the order they were looked up
+    const std::vector<QHostAddress> &getAllIPs() const;
+
     bool isIPValid() const;
     uint16_t getPort() const;
 
@@ -98,7 +100,9 @@ public:
 
     /*
      * Looks up the network address if the address is a domain name.
-     * The callback is invoked whenever the operation is finished.
+     * The callback is invoked whenever the operation is finished, which
+     * is before this returns if the address is already known or cached.
+     * Lookups made while one is in progress are called back along with it.
      */
     void lookUp(LookUpCallback);
 
@@ -138,7 +142,9 @@ public:
 private:
     std::pair<std::string, uint16_t> m_data;//first: address string; second: port
     std::vector<QHostAddress> m_ipAddrList;
-    std::shared_ptr<DnsLookup> m_dns;
+    // Destroyed along with this address, which drops the lookup in progress
+    std::unique_ptr<DnsLookup> m_dns;
+    std::vector<LookUpCallback> m_lookUpCallbacks;
 };
 
 }
@@ -7,6 +7,23 @@ namespace QSS {
 struct ProfilePrivate {
     bool httpProxy = false;
     bool debug = false;
+    int cryptoWorkers = 0;
+    int workers = 0;
+    bool reusePort = false;
+    bool incomingCpu = false;
+    bool epollEngine = false;
+    bool ioUring = false;
+    int highWatermark = 1024 * 1024;
+    int lowWatermark = 256 * 1024;
+    int readBudget = 256 * 1024;
+    int connectTimeout = 10;
+    int handshakeTimeout = 30;
+    int trafficInterval = 250;
+    bool mux = false;
+    int muxConnections = 4;
+    int poolSize = 0;
+    int poolIdleTimeout = 10;
+    bool fastOpen = false;
     std::string pluginExec;
     std::string pluginOpts;
 };
@@ -110,6 +127,91 @@ bool Profile::httpProxy() const
     return d_private->httpProxy;
 }
 
+int Profile::cryptoWorkers() const
+{
+    return d_private->cryptoWorkers;
+}
+
+int Profile::workers() const
+{
+    return d_private->workers;
+}
+
+bool Profile::reusePort() const
+{
+    return d_private->reusePort;
+}
+
+bool Profile::incomingCpu() const
+{
+    return d_private->incomingCpu;
+}
+
+bool Profile::epollEngine() const
+{
+    return d_private->epollEngine;
+}
+
+bool Profile::ioUring() const
+{
+    return d_private->ioUring;
+}
+
+int Profile::highWatermark() const
+{
+    return d_private->highWatermark;
+}
+
+int Profile::lowWatermark() const
+{
+    return d_private->lowWatermark;
+}
+
+int Profile::readBudget() const
+{
+    return d_private->readBudget;
+}
+
+int Profile::connectTimeout() const
+{
+    return d_private->connectTimeout;
+}
+
+int Profile::handshakeTimeout() const
+{
+    return d_private->handshakeTimeout;
+}
+
+int Profile::trafficInterval() const
+{
+    return d_private->trafficInterval;
+}
+
+bool Profile::mux() const
+{
+    return d_private->mux;
+}
+
+int Profile::muxConnections() const
+{
+    return d_private->muxConnections;
+}
+
+int Profile::poolSize() const
+{
+    return d_private->poolSize;
+}
+
+int Profile::poolIdleTimeout() const
+{
+    return d_private->poolIdleTimeout;
+}
+
+bool Profile::fastOpen() const
+{
+    return d_private->fastOpen;
+}
+
 bool Profile::isValid() const
 {
     return !method().empty() && !password().empty() && !serverAddress().empty();
@@ -165,6 +267,91 @@ void Profile::setHttpProxy(bool e)
     d_private->httpProxy = e;
 }
 
+void Profile::setCryptoWorkers(int workers)
+{
+    d_private->cryptoWorkers = workers;
+}
+
+void Profile::setWorkers(int workers)
+{
+    d_private->workers = workers;
+}
+
+void Profile::setReusePort(bool reuse)
+{
+    d_private->reusePort = reuse;
+}
+
+void Profile::setIncomingCpu(bool pin)
+{
+    d_private->incomingCpu = pin;
+}
+
+void Profile::setEpollEngine(bool enabled)
+{
+    d_private->epollEngine = enabled;
+}
+
+void Profile::setIoUring(bool enabled)
+{
+    d_private->ioUring = enabled;
+}
+
+void Profile::setHighWatermark(int bytes)
+{
+    d_private->highWatermark = bytes;
+}
+
+void Profile::setLowWatermark(int bytes)
+{
+    d_private->lowWatermark = bytes;
+}
+
+void Profile::setReadBudget(int bytes)
+{
+    d_private->readBudget = bytes;
+}
+
+void Profile::setConnectTimeout(int t)
+{
+    d_private->connectTimeout = t;
+}
+
+void Profile::setHandshakeTimeout(int t)
+{
+    d_private->handshakeTimeout = t;
+}
+
+void Profile::setTrafficInterval(int msecs)
+{
+    d_private->trafficInterval = msecs;
+}
+
+void Profile::setMux(bool enabled)
+{
+    d_private->mux = enabled;
+}
+
+void Profile::setMuxConnections(int connections)
+{
+    d_private->muxConnections = connections;
+}
+
+void Profile::setPoolSize(int size)
+{
+    d_private->poolSize = size;
+}
+
+void Profile::setPoolIdleTimeout(int t)
+{
+    d_private->poolIdleTimeout = t;
+}
+
+void Profile::setFastOpen(bool enabled)
+{
+    d_private->fastOpen = enabled;
+}
+
 void Profile::enableDebug()
 {
     d_private->debug = true;
@@ -52,6 +52,63 @@ public:
     bool httpProxy() const;
     bool debug() const;
     bool hasPlugin() const;
+    // The number of threads per I/O thread that large AEAD buffers are
+    // encrypted on, 0 disables
+    int cryptoWorkers() const;
+    // The number of threads that TCP connections are served on, 0 disables
+    int workers() const;
+    // Whether each worker listens on a SO_REUSEPORT socket of its own
+    bool reusePort() const;
+    // Whether the SO_REUSEPORT workers are pinned to CPUs with SO_INCOMING_CPU
+    bool incomingCpu() const;
+    // Whether TCP connections are relayed on the native epoll engine (Linux)
+    bool epollEngine() const;
+    // Whether TCP connections are relayed on io_uring (Linux 6.0 or later)
+    bool ioUring() const;
+    /*
+     * Reading from one side of a TCP connection is paused once the other side
+     * has more than highWatermark bytes waiting to be written, and resumed
+     * when it's down to lowWatermark. A highWatermark of 0 disables this.
+     */
+    int highWatermark() const;
+    int lowWatermark() const;
+    /*
+     * The bytes read from a TCP socket per wakeup before yielding to other
+     * connections. 0 reads once per wakeup.
+     */
+    int readBudget() const;
+    /*
+     * The seconds a TCP connection may take to connect to the remote, and
+     * to get through the handshake with the local side. timeout() is how
+     * long it may then stay idle.
+     */
+    int connectTimeout() const;
+    int handshakeTimeout() const;
+    /*
+     * The traffic signals of Controller are coalesced and emitted every
+     * trafficInterval msec. 0 emits them for every read and write instead.
+     */
+    int trafficInterval() const;
+    /*
+     * Whether TCP connections are relayed as streams of a few long-lived
+     * connections to the server (muxConnections per worker), which the
+     * server must have enabled as well. It doesn't apply to UDP.
+     */
+    bool mux() const;
+    int muxConnections() const;
+    /*
+     * In local mode without mux, up to poolSize connections to the server
+     * are opened ahead of time according to the recent connection rate,
+     * and closed after waiting for poolIdleTimeout sec. 0 disables the pool.
+     */
+    int poolSize() const;
+    int poolIdleTimeout() const;
+    /*
+     * TCP Fast Open on the listener and, with the epoll or io_uring engine,
+     * on connections to the remote. It falls back to a normal handshake if
+     * the kernel or the peer refuses it.
+     */
+    bool fastOpen() const;
 
     /**
      * @brief isValid Whether this profile has essential information.
@@ -73,6 +130,23 @@ public:
     void setLocalPort(uint16_t);
     void setTimeout(int);
     void setHttpProxy(bool);
+    void setCryptoWorkers(int);
+    void setWorkers(int);
+    void setReusePort(bool);
+    void setIncomingCpu(bool);
+    void setEpollEngine(bool);
+    void setIoUring(bool);
+    void setHighWatermark(int);
+    void setLowWatermark(int);
+    void setReadBudget(int);
+    void setConnectTimeout(int);
+    void setHandshakeTimeout(int);
+    void setTrafficInterval(int);
+    void setMux(bool);
+    void setMuxConnections(int);
+    void setPoolSize(int);
+    void setPoolIdleTimeout(int);
+    void setFastOpen(bool);
     void enableDebug();
     void disableDebug();
     void setPlugin(std::string exec, std::string opts = std::string());
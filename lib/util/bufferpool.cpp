@@ -0,0 +1,206 @@
+/*
+ * bufferpool.cpp - the source file of BufferPool class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "bufferpool.h"
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#endif
+
+namespace QSS {
+
+namespace {
+
+// The pools of all threads, and what the exited ones have counted
+std::mutex registryMutex;
+std::vector<const BufferPool *> registry;
+BufferPool::Stats retired = {0, 0, 0};
+
+}  // namespace
+
+const size_t BufferPool::SLAB_SIZE;
+const size_t BufferPool::ARENA_SIZE;
+std::atomic<bool> BufferPool::s_hugePages(false);
+
+BufferPool::Buffer::Buffer(BufferPool *pool, char *data, size_t size) :
+    m_pool(pool),
+    m_data(data),
+    m_size(size)
+{
+}
+
+BufferPool::Buffer::Buffer(Buffer &&b) noexcept :
+    m_pool(b.m_pool),
+    m_data(b.m_data),
+    m_size(b.m_size)
+{
+    b.m_pool = nullptr;
+    b.m_data = nullptr;
+    b.m_size = 0;
+}
+
+BufferPool::Buffer &BufferPool::Buffer::operator=(Buffer &&b) noexcept
+{
+    if (this != &b) {
+        reset();
+        std::swap(m_pool, b.m_pool);
+        std::swap(m_data, b.m_data);
+        std::swap(m_size, b.m_size);
+    }
+    return *this;
+}
+
+BufferPool::Buffer::~Buffer()
+{
+    reset();
+}
+
+void BufferPool::Buffer::reset()
+{
+    if (m_pool) {
+        m_pool->release(m_data);
+    } else {
+        delete[] m_data;
+    }
+    m_pool = nullptr;
+    m_data = nullptr;
+    m_size = 0;
+}
+
+BufferPool::BufferPool() :
+    m_hits(0),
+    m_misses(0),
+    m_arenaCount(0)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.push_back(this);
+}
+
+BufferPool::~BufferPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        const Stats stats = localStats();
+        retired.hits += stats.hits;
+        retired.misses += stats.misses;
+        retired.arenas += stats.arenas;
+        for (auto it = registry.begin(); it != registry.end(); ++it) {
+            if (*it == this) {
+                registry.erase(it);
+                break;
+            }
+        }
+    }
+    for (char *arena : m_arenas) {
+        std::free(arena);
+    }
+}
+
+BufferPool &BufferPool::local()
+{
+    thread_local BufferPool pool;
+    return pool;
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t size)
+{
+    if (size <= SLAB_SIZE && !m_free.empty()) {
+        m_hits.store(m_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        char *slab = m_free.back();
+        m_free.pop_back();
+        return Buffer(this, slab, size);
+    }
+
+    m_misses.store(m_misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (size <= SLAB_SIZE && allocateArena()) {
+        char *slab = m_free.back();
+        m_free.pop_back();
+        return Buffer(this, slab, size);
+    }
+    return Buffer(nullptr, new char[size], size);
+}
+
+BufferPool::Stats BufferPool::localStats() const
+{
+    return Stats{m_hits.load(std::memory_order_relaxed),
+                 m_misses.load(std::memory_order_relaxed),
+                 m_arenaCount.load(std::memory_order_relaxed)};
+}
+
+BufferPool::Stats BufferPool::stats()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    Stats total = retired;
+    for (const BufferPool *pool : registry) {
+        const Stats stats = pool->localStats();
+        total.hits += stats.hits;
+        total.misses += stats.misses;
+        total.arenas += stats.arenas;
+    }
+    return total;
+}
+
+void BufferPool::setHugePages(bool enabled)
+{
+    s_hugePages = enabled;
+}
+
+void BufferPool::release(char *slab)
+{
+    m_free.push_back(slab);
+}
+
+bool BufferPool::allocateArena()
+{
+    void *arena = nullptr;
+#ifdef Q_OS_LINUX
+    if (s_hugePages) {
+        // Huge pages are only used for aligned ranges
+        if (posix_memalign(&arena, ARENA_SIZE, ARENA_SIZE) == 0) {
+            madvise(arena, ARENA_SIZE, MADV_HUGEPAGE);
+        } else {
+            arena = nullptr;
+        }
+    }
+#endif
+    if (!arena) {
+        arena = std::malloc(ARENA_SIZE);
+    }
+    if (!arena) {
+        return false;
+    }
+
+    char *base = static_cast<char *>(arena);
+    m_arenas.push_back(base);
+    m_arenaCount.store(m_arenas.size(), std::memory_order_relaxed);
+    // Handed out from the front of the arena first
+    for (size_t offset = (ARENA_SIZE / SLAB_SIZE) * SLAB_SIZE; offset > 0; offset -= SLAB_SIZE) {
+        m_free.push_back(base + offset - SLAB_SIZE);
+    }
+    return true;
+}
+
+}  // namespace QSS
@@ -0,0 +1,124 @@
+/*
+ * bufferpool.h - the header file of BufferPool class
+ *
+ * A per-thread pool of fixed-size slabs, which are carved out of larger
+ * arenas (optionally backed by transparent huge pages). The relays read
+ * into, encrypt and decrypt in these slabs instead of keeping buffers of
+ * their own, so memory scales with threads rather than connections.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "export.h"
+
+namespace QSS {
+
+class QSS_EXPORT BufferPool
+{
+public:
+    // Large enough for a 64 KiB read plus the encryption headroom
+    static const size_t SLAB_SIZE = 72 * 1024;
+    // Slabs are allocated in arenas of this size, which aren't freed until the thread exits
+    static const size_t ARENA_SIZE = 2 * 1024 * 1024;
+
+    /*
+     * A slab, or a heap buffer if the size doesn't fit in one, that's given
+     * back when it's destroyed. It must be destroyed on the thread that
+     * acquired it.
+     */
+    class QSS_EXPORT Buffer
+    {
+    public:
+        Buffer() = default;
+        Buffer(Buffer &&b) noexcept;
+        Buffer &operator=(Buffer &&b) noexcept;
+        ~Buffer();
+
+        Buffer(const Buffer &) = delete;
+
+        char *data() const { return m_data; }
+        size_t size() const { return m_size; }
+        bool isNull() const { return m_data == nullptr; }
+        void reset();
+
+    private:
+        friend class BufferPool;
+        Buffer(BufferPool *pool, char *data, size_t size);
+
+        // nullptr if the buffer is from the heap
+        BufferPool *m_pool = nullptr;
+        char *m_data = nullptr;
+        size_t m_size = 0;
+    };
+
+    struct Stats {
+        // Acquisitions served by a free slab
+        uint64_t hits;
+        // Acquisitions that needed a new arena or a heap buffer
+        uint64_t misses;
+        uint64_t arenas;
+    };
+
+    BufferPool();
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+
+    // The pool of the calling thread
+    static BufferPool &local();
+
+    // The first size bytes of the buffer are usable, and aren't zeroed
+    Buffer acquire(size_t size);
+
+    Stats localStats() const;
+    // The sum over all threads, including those that have exited
+    static Stats stats();
+
+    /*
+     * Whether arenas allocated from now on are advised to be backed by
+     * transparent huge pages (Linux only). It applies to the whole process,
+     * so it's set by the application rather than through a Profile.
+     */
+    static void setHugePages(bool enabled);
+
+private:
+    std::vector<char *> m_arenas;
+    std::vector<char *> m_free;
+    // Only written by the owning thread, but read by stats()
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+    std::atomic<uint64_t> m_arenaCount;
+
+    static std::atomic<bool> s_hugePages;
+
+    void release(char *slab);
+    bool allocateArena();
+};
+
+}
+
+#endif // BUFFERPOOL_H
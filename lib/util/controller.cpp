@@ -30,6 +30,8 @@
 
 #include "controller.h"
 #include "crypto/encryptor.h"
+#include "network/reuseport.h"
+#include <QThread>
 
 namespace QSS {
 
@@ -40,6 +42,9 @@ Controller::Controller(Profile _profile,
     QObject(parent),
     m_bytesReceived(0),
     m_bytesSent(0),
+    m_readPauses(0),
+    m_fastOpenAccepted(0),
+    m_fastOpenFallbacks(0),
     m_profile(std::move(_profile)),
     m_isLocal(is_local),
     m_autoBan(auto_ban)
@@ -70,49 +75,108 @@ Controller::Controller(Profile _profile,
         }
     }
 
+    // The master key is derived once and shared by all sessions
+    const auto encryptorContext = std::make_shared<const EncryptorContext>(
+                m_profile.method(), m_profile.password(), m_profile.cryptoWorkers());
+    m_encryptorCreator = [encryptorContext]() {
+        return std::make_unique<Encryptor>(encryptorContext);
+    };
     m_tcpServer = std::make_unique<QSS::TcpServer>(
-                    [this]() { return std::make_unique<Encryptor>(m_profile.method(), m_profile.password()); },
+                    Encryptor::Creator(m_encryptorCreator),
                     m_profile.timeout(),
                     m_isLocal,
                     m_autoBan,
-                    m_serverAddress);
+                    m_serverAddress,
+                    m_profile.workers());
+
+    bool nativeEngine = m_profile.epollEngine() || m_profile.ioUring();
+    if (!m_tcpServer->setEpollEngine(m_profile.epollEngine())) {
+        qWarning("The epoll engine is not supported on this platform, using QTcpSocket");
+        nativeEngine = false;
+    }
+    if (!m_tcpServer->setIoUring(m_profile.ioUring())) {
+        qWarning("io_uring is not supported by this kernel, falling back");
+        nativeEngine = nativeEngine && m_profile.epollEngine();
+    }
+    m_tcpServer->setWatermarks(m_profile.highWatermark(), m_profile.lowWatermark());
+    m_tcpServer->setReadBudget(m_profile.readBudget());
+    m_tcpServer->setStageTimeouts(m_profile.connectTimeout(), m_profile.handshakeTimeout());
+    m_tcpServer->setTrafficSignals(m_profile.trafficInterval() <= 0);
+    m_tcpServer->setMux(m_profile.mux(), m_profile.muxConnections());
+    m_tcpServer->setPool(m_profile.poolSize(), m_profile.poolIdleTimeout());
+    m_tcpServer->setFastOpen(m_profile.fastOpen());
+    if (m_profile.fastOpen() && !nativeEngine) {
+        qWarning("TCP Fast Open needs the epoll or io_uring engine to connect, "
+                 "it's only used by the listener");
+    }
 
     //FD_SETSIZE which is the maximum value on *nix platforms. (1024 by default)
     m_tcpServer->setMaxPendingConnections(FD_SETSIZE);
     m_udpRelay = std::make_unique<QSS::UdpRelay>(
-                   [this]() { return std::make_unique<Encryptor>(m_profile.method(), m_profile.password()); },
+                   m_encryptorCreator,
                    m_isLocal,
                    m_autoBan,
                    m_serverAddress);
 
+    m_udpRelay->setTrafficCounter(&m_udpTraffic);
+
     connect(m_tcpServer.get(), &TcpServer::acceptError,
             this, &Controller::onTcpServerError);
-    connect(m_tcpServer.get(), &TcpServer::bytesRead, this, &Controller::onBytesRead);
-    connect(m_tcpServer.get(), &TcpServer::bytesSend, this, &Controller::onBytesSend);
     connect(m_tcpServer.get(), &TcpServer::latencyAvailable,
             this, &Controller::tcpLatencyAvailable);
+    connect(m_tcpServer.get(), &TcpServer::readPaused, this, &Controller::onReadPaused);
 
-    connect(m_udpRelay.get(), &UdpRelay::bytesRead, this, &Controller::onBytesRead);
-    connect(m_udpRelay.get(), &UdpRelay::bytesSend, this, &Controller::onBytesSend);
+    if (m_profile.trafficInterval() > 0) {
+        m_trafficTimer.setInterval(m_profile.trafficInterval());
+        connect(&m_trafficTimer, &QTimer::timeout, this, &Controller::updateTraffic);
+    } else {
+        connect(m_tcpServer.get(), &TcpServer::bytesRead, this, &Controller::onBytesRead);
+        connect(m_tcpServer.get(), &TcpServer::bytesSend, this, &Controller::onBytesSend);
+        connect(m_udpRelay.get(), &UdpRelay::bytesRead, this, &Controller::onBytesRead);
+        connect(m_udpRelay.get(), &UdpRelay::bytesSend, this, &Controller::onBytesSend);
+    }
 }
 
 Controller::~Controller()
 {
-    if (m_tcpServer->isListening()) {
+    if (m_tcpServer->isListeningAll()) {
         stop();
     }
 }
 
+QVector<quint64> Controller::tcpConnectionIds() const
+{
+    return m_tcpServer->connectionIds();
+}
+
+bool Controller::closeTcpConnection(quint64 id)
+{
+    return m_tcpServer->closeConnection(id);
+}
+
 bool Controller::start()
 {
     bool listen_ret = false;
 
-    if (m_isLocal) {
+    // The HTTP proxy needs the SOCKS5 port, which is random and can't be shared
+    const bool sharded = m_profile.reusePort()
+            && m_profile.workers() > 0
+            && !(m_isLocal && m_profile.httpProxy())
+            && ReusePort::isSupported();
+    if (m_profile.reusePort() && !sharded) {
+        qWarning("SO_REUSEPORT listeners need workers and aren't available "
+                 "with the HTTP proxy. Using a single listener instead.");
+    }
+
+    if (m_isLocal && sharded) {
+        qInfo("Running in local mode.");
+        listen_ret = listenSharded(getLocalAddr(), m_profile.localPort());
+    } else if (m_isLocal) {
         qInfo("Running in local mode.");
         QHostAddress localAddress = m_profile.httpProxy()
             ? QHostAddress::LocalHost
             : getLocalAddr();
-        listen_ret = m_tcpServer->listen(
+        listen_ret = m_tcpServer->listenSingle(
                     localAddress,
                     m_profile.httpProxy() ? 0 : m_profile.localPort());
         if (listen_ret) {
@@ -131,10 +195,13 @@ bool Controller::start()
                 }
             }
         }
+    } else if (sharded) {
+        qInfo("Running in server mode.");
+        listen_ret = listenSharded(m_serverAddress.getFirstIP(), m_profile.serverPort());
     } else {
         qInfo("Running in server mode.");
-        listen_ret = m_tcpServer->listen(m_serverAddress.getFirstIP(),
-                                       m_profile.serverPort());
+        listen_ret = m_tcpServer->listenSingle(m_serverAddress.getFirstIP(),
+                                               m_profile.serverPort());
         if (listen_ret) {
             listen_ret = m_udpRelay->listen(m_serverAddress.getFirstIP(),
                                        m_profile.serverPort());
@@ -146,6 +213,9 @@ bool Controller::start()
                 << "TCP server listening at "
                 << (m_isLocal ? getLocalAddr().toString() : m_serverAddress.getFirstIP().toString())
                 << ":" << (m_isLocal ? m_profile.localPort() : m_profile.serverPort());
+        if (m_profile.trafficInterval() > 0) {
+            m_trafficTimer.start();
+        }
         emit runningStateChanged(true);
     } else {
         qCritical("TCP server listen failed.");
@@ -159,12 +229,66 @@ void Controller::stop()
     if (m_httpProxy) {
         m_httpProxy->close();
     }
-    m_tcpServer->close();
+    m_tcpServer->closeAll();
     m_udpRelay->close();
+    closeUdpShards();
+    if (m_trafficTimer.isActive()) {
+        m_trafficTimer.stop();
+        updateTraffic();
+    }
     emit runningStateChanged(false);
     qInfo("Stopped.");
 }
 
+bool Controller::listenSharded(const QHostAddress &address, uint16_t port)
+{
+    if (!m_tcpServer->listenSharded(address, port, m_profile.incomingCpu())) {
+        return false;
+    }
+
+    const int cpus = QThread::idealThreadCount();
+    for (int i = 0; i < m_tcpServer->workerCount(); ++i) {
+        const int cpu = m_profile.incomingCpu() ? i % cpus : -1;
+        const qintptr fd = ReusePort::bind(QAbstractSocket::UdpSocket, address, port, cpu);
+        if (fd == -1) {
+            m_tcpServer->closeAll();
+            closeUdpShards();
+            return false;
+        }
+
+        QThread *thread = m_tcpServer->workerThread(i);
+        auto *relay = new UdpRelay(m_encryptorCreator, m_isLocal, m_autoBan, m_serverAddress);
+        relay->moveToThread(thread);
+        connect(thread, &QThread::finished, relay, &QObject::deleteLater);
+        m_udpShardTraffic.push_back(std::make_unique<TrafficCounter>());
+        relay->setTrafficCounter(m_udpShardTraffic.back().get());
+        if (m_profile.trafficInterval() <= 0) {
+            connect(relay, &UdpRelay::bytesRead, this, &Controller::onBytesRead);
+            connect(relay, &UdpRelay::bytesSend, this, &Controller::onBytesSend);
+        }
+        m_udpShards.push_back(relay);
+
+        bool ok = false;
+        QMetaObject::invokeMethod(relay, "listen", Qt::BlockingQueuedConnection,
+                                  Q_RETURN_ARG(bool, ok), Q_ARG(qintptr, fd));
+        if (!ok) {
+            ReusePort::close(fd);
+            m_tcpServer->closeAll();
+            closeUdpShards();
+            return false;
+        }
+    }
+    return true;
+}
+
+void Controller::closeUdpShards()
+{
+    for (UdpRelay *relay : m_udpShards) {
+        relay->deleteLater();
+    }
+    m_udpShards.clear();
+}
+
 QHostAddress Controller::getLocalAddr()
 {
     QHostAddress addr(QString::fromStdString(m_profile.localAddress()));
@@ -193,6 +317,7 @@ void Controller::onBytesRead(quint64 r)
         m_bytesReceived += r;
         emit newBytesReceived(r);
         emit bytesReceivedChanged(m_bytesReceived);
+        updateFastOpen();
     }
 }
 
@@ -205,4 +330,44 @@ void Controller::onBytesSend(quint64 s)
     }
 }
 
+void Controller::updateTraffic()
+{
+    uint64_t received = m_tcpServer->bytesReceived() + m_udpTraffic.received();
+    uint64_t sent = m_tcpServer->bytesSent() + m_udpTraffic.sent();
+    for (const auto &counter : m_udpShardTraffic) {
+        received += counter->received();
+        sent += counter->sent();
+    }
+    if (received != m_bytesReceived) {
+        const uint64_t newBytes = received - m_bytesReceived;
+        m_bytesReceived = received;
+        emit newBytesReceived(newBytes);
+        emit bytesReceivedChanged(m_bytesReceived);
+    }
+    if (sent != m_bytesSent) {
+        const uint64_t newBytes = sent - m_bytesSent;
+        m_bytesSent = sent;
+        emit newBytesSent(newBytes);
+        emit bytesSentChanged(m_bytesSent);
+    }
+    updateFastOpen();
+}
+
+void Controller::updateFastOpen()
+{
+    const uint64_t accepted = m_tcpServer->fastOpenAccepted();
+    const uint64_t fallbacks = m_tcpServer->fastOpenFallbacks();
+    if (accepted != m_fastOpenAccepted || fallbacks != m_fastOpenFallbacks) {
+        m_fastOpenAccepted = accepted;
+        m_fastOpenFallbacks = fallbacks;
+        emit tcpFastOpenChanged(m_fastOpenAccepted, m_fastOpenFallbacks);
+    }
+}
+
+void Controller::onReadPaused()
+{
+    ++m_readPauses;
+    emit tcpReadPausesChanged(m_readPauses);
+}
+
 } // namespace QSS
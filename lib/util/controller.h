@@ -25,11 +25,13 @@
 
 #include <QHostAddress>
 #include <QObject>
+#include <QTimer>
 #include "network/tcpserver.h"
 #include "export.h"
 #include "network/httpproxy.h"
 #include "types/profile.h"
 #include "network/udprelay.h"
+#include "trafficcounter.h"
 
 #ifndef USE_BOTAN2
 namespace Botan {
@@ -51,11 +53,22 @@ public:
 
     Controller(const Controller&) = delete;
 
+    /*
+     * The IDs of the open TCP connections, and closing one of them by its
+     * ID, for administration. IDs are unique across the TCP workers.
+     */
+    QVector<quint64> tcpConnectionIds() const;
+    bool closeTcpConnection(quint64 id);
+
 signals:
     // Connect this signal to get notified when running state is changed
     void runningStateChanged(bool);
 
-    // These two signals pass any new bytes read or sent
+    /*
+     * These two signals pass any new bytes read or sent.
+     * Like the two below, they're emitted at most once per
+     * Profile::trafficInterval, or for every read and write if it's 0.
+     */
     void newBytesReceived(quint64);
     void newBytesSent(quint64);
 
@@ -73,6 +86,19 @@ signals:
      */
     void tcpLatencyAvailable(int);
 
+    /*
+     * The number of times so far that reading from a TCP connection was
+     * paused because the other side of it couldn't keep up
+     */
+    void tcpReadPausesChanged(quint64);
+
+    /*
+     * The number of remote TCP connections so far whose SYN data was
+     * accepted with TCP Fast Open, and of those that fell back to a normal
+     * handshake. Emitted along with the traffic signals when they change.
+     */
+    void tcpFastOpenChanged(quint64 accepted, quint64 fallbacks);
+
 public slots:
     bool start(); // Return true if start successfully, otherwise return false
     void stop();
@@ -87,6 +113,16 @@ protected:
     // The total bytes recevied or sent by/from all TCP and UDP connections.
     uint64_t m_bytesReceived;
     uint64_t m_bytesSent;
+    uint64_t m_readPauses;
+    uint64_t m_fastOpenAccepted;
+    uint64_t m_fastOpenFallbacks;
+    /*
+     * What the UDP relays have counted, including the shards that have been
+     * closed. The TCP connections are counted by the workers of m_tcpServer.
+     */
+    TrafficCounter m_udpTraffic;
+    std::vector<std::unique_ptr<TrafficCounter> > m_udpShardTraffic;
+    QTimer m_trafficTimer;
 
     Profile m_profile;
     Address m_serverAddress;
@@ -99,13 +135,27 @@ protected:
     std::unique_ptr<TcpServer> m_tcpServer;
     std::unique_ptr<UdpRelay> m_udpRelay;
     std::unique_ptr<HttpProxy> m_httpProxy;
+    Encryptor::Creator m_encryptorCreator;
+    /*
+     * The UDP relays of SO_REUSEPORT shards, one on each worker thread of
+     * m_tcpServer. They're deleted in their threads.
+     */
+    std::vector<UdpRelay *> m_udpShards;
 
     QHostAddress getLocalAddr();
+    // Opens a SO_REUSEPORT TCP listener and UDP relay on each worker thread
+    bool listenSharded(const QHostAddress &address, uint16_t port);
+    void closeUdpShards();
+    // Emits the traffic signals if anything has been counted since the last time
+    void updateTraffic();
+    // Emits tcpFastOpenChanged if the counts have changed
+    void updateFastOpen();
 
 protected slots:
     void onTcpServerError(QAbstractSocket::SocketError err);
     void onBytesRead(quint64);
     void onBytesSend(quint64);
+    void onReadPaused();
 };
 
 }
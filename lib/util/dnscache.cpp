@@ -0,0 +1,190 @@
+/*
+ * dnscache.cpp - the source file of DnsCache class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "dnscache.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace QSS {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Entry {
+    std::string hostname;
+    QList<QHostAddress> addresses;
+    Clock::time_point expiry;
+};
+
+std::mutex cacheMutex;
+// The most recently used first
+std::list<Entry> entries;
+std::unordered_map<std::string, std::list<Entry>::iterator> entryIndex;
+std::unordered_map<std::string, DnsQuery *> inFlight;
+size_t cacheCapacity = 1024;
+int cacheTtl = 60;
+DnsCache::Stats counters = {0, 0, 0, 0, 0, 0};
+
+void evict()
+{
+    while (entries.size() > cacheCapacity) {
+        entryIndex.erase(entries.back().hostname);
+        entries.pop_back();
+    }
+}
+
+}  // namespace
+
+const int DnsCache::NEGATIVE_TTL;
+
+void DnsCache::lookUp(const std::string &hostname, QObject *context, Callback callback)
+{
+    std::unique_lock<std::mutex> lock(cacheMutex);
+    auto cached = entryIndex.find(hostname);
+    if (cached != entryIndex.end()) {
+        if (Clock::now() < cached->second->expiry) {
+            entries.splice(entries.begin(), entries, cached->second);
+            ++counters.hits;
+            const QList<QHostAddress> addresses = cached->second->addresses;
+            lock.unlock();
+            callback(addresses);
+            return;
+        }
+        entries.erase(cached->second);
+        entryIndex.erase(cached);
+    }
+
+    DnsQuery *query;
+    auto flight = inFlight.find(hostname);
+    const bool joined = flight != inFlight.end();
+    if (joined) {
+        ++counters.coalesced;
+        query = flight->second;
+    } else {
+        ++counters.misses;
+        query = new DnsQuery(hostname);
+        /*
+         * Queries run on the main thread, which outlives the workers, so
+         * that the others waiting for one aren't left hanging if the thread
+         * that started it goes away
+         */
+        if (QCoreApplication::instance()) {
+            query->moveToThread(QCoreApplication::instance()->thread());
+        }
+        inFlight.emplace(hostname, query);
+    }
+    // The query is only finished with the lock held, so it can't miss this one
+    QObject::connect(query, &DnsQuery::finished, context, std::move(callback));
+    lock.unlock();
+
+    if (!joined) {
+        QMetaObject::invokeMethod(query, "start", Qt::QueuedConnection);
+    }
+}
+
+void DnsCache::setCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cacheCapacity = capacity;
+    evict();
+}
+
+void DnsCache::setTtl(int ttl)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cacheTtl = ttl;
+}
+
+DnsCache::Stats DnsCache::stats()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    Stats result = counters;
+    result.size = entries.size();
+    return result;
+}
+
+void DnsCache::clear()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    entries.clear();
+    entryIndex.clear();
+    counters = {0, 0, 0, 0, 0, 0};
+}
+
+void DnsCache::finish(const std::string &hostname,
+                      const QList<QHostAddress> &addresses,
+                      qint64 queryTime)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    inFlight.erase(hostname);
+    counters.queryTime += static_cast<uint64_t>(queryTime);
+    if (addresses.isEmpty()) {
+        ++counters.failures;
+    }
+
+    const int ttl = addresses.isEmpty() ? std::min(cacheTtl, NEGATIVE_TTL) : cacheTtl;
+    if (ttl <= 0 || cacheCapacity == 0) {
+        return;
+    }
+    auto cached = entryIndex.find(hostname);
+    if (cached != entryIndex.end()) {
+        entries.erase(cached->second);
+    }
+    entries.push_front(Entry{hostname, addresses, Clock::now() + std::chrono::seconds(ttl)});
+    entryIndex[hostname] = entries.begin();
+    evict();
+}
+
+DnsQuery::DnsQuery(std::string hostname) :
+    m_hostname(std::move(hostname))
+{
+    // The result is queued to the threads of the lookups
+    qRegisterMetaType<QList<QHostAddress> >("QList<QHostAddress>");
+}
+
+void DnsQuery::start()
+{
+    m_timer.start();
+    QHostInfo::lookupHost(QString::fromStdString(m_hostname), this, SLOT(lookedUp(QHostInfo)));
+}
+
+void DnsQuery::lookedUp(const QHostInfo &info)
+{
+    QList<QHostAddress> addresses;
+    if (info.error() != QHostInfo::NoError) {
+        qWarning("DNS lookup failed: %s", info.errorString().toStdString().data());
+    } else {
+        addresses = info.addresses();
+    }
+    DnsCache::finish(m_hostname, addresses, m_timer.elapsed());
+    emit finished(addresses);
+    deleteLater();
+}
+
+}  // namespace QSS
@@ -0,0 +1,133 @@
+/*
+ * dnscache.h - the header file of DnsCache class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QList>
+#include <QObject>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "export.h"
+
+namespace QSS {
+
+/*
+ * The process-wide cache of host name lookups, shared by all threads.
+ * Concurrent lookups of a name share a single query, and the results,
+ * including failures, are kept for a while in a bounded LRU cache.
+ *
+ * QHostInfo doesn't expose the TTLs of the records, so the results are
+ * kept for a fixed TTL instead, see setTtl.
+ *
+ * Being shared by all Controllers, it's configured by the application
+ * rather than through a Profile.
+ */
+class QSS_EXPORT DnsCache
+{
+public:
+    // How long a failed lookup is cached for at most (sec)
+    static const int NEGATIVE_TTL = 10;
+
+    // The addresses found, which is empty if the lookup failed
+    using Callback = std::function<void(const QList<QHostAddress> &)>;
+
+    struct Stats {
+        // Lookups answered by the cache, including cached failures
+        uint64_t hits;
+        // Lookups that started a query
+        uint64_t misses;
+        // Lookups that joined a query in flight
+        uint64_t coalesced;
+        // Queries that found nothing
+        uint64_t failures;
+        // The time spent by all queries (msec)
+        uint64_t queryTime;
+        // The names cached at the moment
+        size_t size;
+    };
+
+    DnsCache() = delete;
+
+    /*
+     * Looks up hostname, calling callback on the thread of context, which
+     * must run an event loop. A cached result is passed before this returns.
+     * The callback isn't called if context is destroyed in the meantime.
+     */
+    static void lookUp(const std::string &hostname, QObject *context, Callback callback);
+
+    // At most capacity names are cached, the least recently used are evicted
+    static void setCapacity(size_t capacity);
+    /*
+     * Results are cached for ttl sec, and failures for NEGATIVE_TTL sec
+     * or ttl if it's less. 0 disables caching, though lookups in flight
+     * are still shared.
+     */
+    static void setTtl(int ttl);
+
+    static Stats stats();
+    // Drops the cached results and zeroes the statistics
+    static void clear();
+
+private:
+    friend class DnsQuery;
+
+    // Caches the result of the query for hostname, which is no longer in flight
+    static void finish(const std::string &hostname,
+                       const QList<QHostAddress> &addresses,
+                       qint64 queryTime);
+};
+
+/*
+ * A lookup in flight, which is shared by the lookups of the same name.
+ * It lives on the main thread, and deletes itself once it's finished.
+ */
+class QSS_EXPORT DnsQuery : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DnsQuery(std::string hostname);
+
+    DnsQuery(const DnsQuery &) = delete;
+
+public slots:
+    void start();
+
+signals:
+    void finished(const QList<QHostAddress> &addresses);
+
+private slots:
+    void lookedUp(const QHostInfo &info);
+
+private:
+    const std::string m_hostname;
+    QElapsedTimer m_timer;
+};
+
+}
+
+#endif // DNSCACHE_H
@@ -0,0 +1,158 @@
+/*
+ * registry.h - the header file of Registry class template
+ *
+ * A slot map of owned objects. Each one is given an ID made of its slot
+ * index and the generation of the slot, so that adding, removing and
+ * looking up take constant time, and the ID of a removed object never
+ * refers to whatever reuses its slot later. The ID carries the tag of
+ * the registry as well, which tells registries of the same kind apart.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace QSS {
+
+template<typename T>
+class Registry
+{
+public:
+    // 0 is never a valid ID
+    using Id = uint64_t;
+
+    /*
+     * The top TAG_BITS bits of an ID are the tag, followed by the generation
+     * and the 32-bit slot index
+     */
+    static const int TAG_BITS = 12;
+
+    explicit Registry(uint32_t tag = 0) :
+        m_tag(static_cast<Id>(tag) << (64 - TAG_BITS))
+    {
+    }
+
+    Registry(const Registry &) = delete;
+
+    static uint32_t tagOf(Id id)
+    {
+        return static_cast<uint32_t>(id >> (64 - TAG_BITS));
+    }
+
+    Id add(std::unique_ptr<T> object)
+    {
+        uint32_t index;
+        if (m_free.empty()) {
+            index = static_cast<uint32_t>(m_slots.size());
+            m_slots.emplace_back();
+        } else {
+            index = m_free.back();
+            m_free.pop_back();
+        }
+        Slot &slot = m_slots[index];
+        slot.object = std::move(object);
+        ++m_size;
+        return idOf(index);
+    }
+
+    // nullptr if there's no such object, or if it has been removed
+    T *find(Id id) const
+    {
+        const Slot *slot = slotOf(id);
+        return slot ? slot->object.get() : nullptr;
+    }
+
+    // Destroys the object. Returns false if it has been removed already.
+    bool remove(Id id)
+    {
+        Slot *slot = const_cast<Slot *>(slotOf(id));
+        if (!slot) {
+            return false;
+        }
+        // Moved out first, in case its destructor gets back to the registry
+        std::unique_ptr<T> object = std::move(slot->object);
+        // Generation 0 is skipped on wrap-around, to keep ID 0 invalid
+        slot->generation = (slot->generation + 1) & GENERATION_MASK;
+        if (slot->generation == 0) {
+            slot->generation = 1;
+        }
+        m_free.push_back(static_cast<uint32_t>(id));
+        --m_size;
+        return true;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    // Calls f(id, object) on each object. f mustn't add or remove objects.
+    template<typename F>
+    void forEach(F f) const
+    {
+        for (size_t i = 0; i < m_slots.size(); ++i) {
+            if (m_slots[i].object) {
+                f(idOf(static_cast<uint32_t>(i)), m_slots[i].object.get());
+            }
+        }
+    }
+
+private:
+    static const uint32_t GENERATION_MASK = (1u << (32 - TAG_BITS)) - 1;
+
+    struct Slot {
+        std::unique_ptr<T> object;
+        uint32_t generation = 1;
+    };
+
+    const Id m_tag;
+    std::vector<Slot> m_slots;
+    // Indices of the empty slots, which are reused last in first out
+    std::vector<uint32_t> m_free;
+    size_t m_size = 0;
+
+    Id idOf(uint32_t index) const
+    {
+        return m_tag | (static_cast<Id>(m_slots[index].generation) << 32) | index;
+    }
+
+    const Slot *slotOf(Id id) const
+    {
+        const auto index = static_cast<uint32_t>(id);
+        if (index >= m_slots.size() || tagOf(id) != tagOf(m_tag)) {
+            return nullptr;
+        }
+        const Slot &slot = m_slots[index];
+        if (!slot.object || slot.generation != ((id >> 32) & GENERATION_MASK)) {
+            return nullptr;
+        }
+        return &slot;
+    }
+};
+
+}
+
+#endif // REGISTRY_H
@@ -0,0 +1,166 @@
+/*
+ * timingwheel.cpp - the source file of TimingWheel class
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "timingwheel.h"
+#include <utility>
+
+namespace QSS {
+
+TimingWheel::Timer::Timer(TimingWheel *wheel, std::function<void()> onExpired)
+    : m_wheel(wheel)
+    , m_onExpired(std::move(onExpired))
+{
+}
+
+TimingWheel::Timer::~Timer()
+{
+    stop();
+}
+
+void TimingWheel::Timer::start(int msecs, bool idle)
+{
+    stop();
+    if (msecs <= 0) {
+        return;
+    }
+    if (m_wheel->m_count == 0) {
+        // The clock may have moved on while the ticker was stopped
+        m_wheel->m_now = m_wheel->m_clock.elapsed() / m_wheel->m_tickMsecs;
+        m_wheel->m_ticker.start();
+    }
+    m_idle = idle;
+    // One more tick since the current one is partly over already
+    m_ticks = (msecs + m_wheel->m_tickMsecs - 1) / m_wheel->m_tickMsecs + 1;
+    m_start = m_wheel->m_now;
+    m_lastActivity = m_start;
+    m_wheel->insert(this);
+}
+
+void TimingWheel::Timer::stop()
+{
+    if (isActive()) {
+        TimingWheel::unlink(this);
+        --m_wheel->m_count;
+    }
+}
+
+uint64_t TimingWheel::Timer::deadline() const
+{
+    return (m_idle ? m_lastActivity : m_start) + m_ticks;
+}
+
+TimingWheel::TimingWheel(int tickMsecs, QObject *parent)
+    : QObject(parent)
+    , m_tickMsecs(tickMsecs)
+    , m_count(0)
+    , m_now(0)
+    , m_ticker(this)
+{
+    for (Link &slot : m_slots) {
+        slot.prev = slot.next = &slot;
+    }
+    m_clock.start();
+    m_ticker.setInterval(tickMsecs);
+    m_ticker.setTimerType(Qt::CoarseTimer);
+    connect(&m_ticker, &QTimer::timeout, this, &TimingWheel::onTick);
+}
+
+TimingWheel::~TimingWheel()
+{
+    // Leave the remaining timers inactive rather than pointing into m_slots
+    for (Link &slot : m_slots) {
+        while (slot.next != &slot) {
+            unlink(slot.next);
+        }
+    }
+}
+
+int TimingWheel::tickInterval() const
+{
+    return m_tickMsecs;
+}
+
+int TimingWheel::count() const
+{
+    return m_count;
+}
+
+void TimingWheel::insert(Timer *timer)
+{
+    Link &slot = m_slots[timer->deadline() % SLOTS];
+    timer->prev = slot.prev;
+    timer->next = &slot;
+    slot.prev->next = timer;
+    slot.prev = timer;
+    ++m_count;
+}
+
+void TimingWheel::unlink(Link *link)
+{
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->prev = link->next = nullptr;
+}
+
+void TimingWheel::onTick()
+{
+    // Catches up on the ticks missed if the event loop was held up
+    const uint64_t now = m_clock.elapsed() / m_tickMsecs;
+    while (m_now < now && m_count > 0) {
+        ++m_now;
+        Link &slot = m_slots[m_now % SLOTS];
+        if (slot.next == &slot) {
+            continue;
+        }
+
+        /*
+         * Moves the slot onto a list of its own, so that the timers started
+         * or stopped by the callbacks don't get in the way of the iteration
+         */
+        Link pending;
+        pending.next = slot.next;
+        pending.prev = slot.prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        slot.prev = slot.next = &slot;
+
+        while (pending.next != &pending) {
+            auto timer = static_cast<Timer *>(pending.next);
+            unlink(timer);
+            --m_count;
+            if (timer->deadline() > m_now) {
+                // Touched since it was inserted, or due in a later round
+                insert(timer);
+            } else {
+                timer->m_onExpired();
+            }
+        }
+    }
+    if (m_now < now) {
+        m_now = now;
+    }
+    if (m_count == 0) {
+        m_ticker.stop();
+    }
+}
+
+}  // namespace QSS
@@ -0,0 +1,118 @@
+/*
+ * timingwheel.h - the header file of TimingWheel class
+ *
+ * A hashed timing wheel that expires the timers of a thread at a coarse
+ * granularity, using a single QTimer. Activity on an idle timer is only
+ * recorded (a plain store), and whether it has really expired is checked
+ * when the wheel reaches its slot.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include "export.h"
+
+namespace QSS {
+
+class QSS_EXPORT TimingWheel : public QObject
+{
+    Q_OBJECT
+
+    // A node of the circular lists hanging off the slots
+    struct Link {
+        Link *prev = nullptr;
+        Link *next = nullptr;
+    };
+
+public:
+    static const size_t SLOTS = 512;
+
+    /*
+     * A timer on the wheel. It must be used on the thread of the wheel, and
+     * the wheel must outlive it.
+     */
+    class QSS_EXPORT Timer : private Link
+    {
+    public:
+        // onExpired is allowed to destroy this timer
+        Timer(TimingWheel *wheel, std::function<void()> onExpired);
+        ~Timer();
+
+        Timer(const Timer &) = delete;
+
+        /*
+         * Expires after msecs, give or take a tick. If idle, the time is
+         * counted from the last touch() instead of from now.
+         * Restarts the timer if it's active, and msecs <= 0 stops it.
+         */
+        void start(int msecs, bool idle = false);
+        void stop();
+        bool isActive() const { return next != nullptr; }
+
+        // Records activity, which postpones an idle timer
+        void touch() { m_lastActivity = m_wheel->m_now; }
+
+    private:
+        friend class TimingWheel;
+
+        TimingWheel *m_wheel;
+        std::function<void()> m_onExpired;
+        bool m_idle = false;
+        uint64_t m_ticks = 0;
+        uint64_t m_start = 0;
+        uint64_t m_lastActivity = 0;
+
+        uint64_t deadline() const;
+    };
+
+    explicit TimingWheel(int tickMsecs = 1000, QObject *parent = nullptr);
+    ~TimingWheel() override;
+
+    TimingWheel(const TimingWheel &) = delete;
+
+    int tickInterval() const;
+    // The number of active timers
+    int count() const;
+
+private:
+    const int m_tickMsecs;
+    Link m_slots[SLOTS];
+    int m_count;
+    // Ticks elapsed on m_clock, as of the last sweep
+    uint64_t m_now;
+    QElapsedTimer m_clock;
+    // Only running while there are active timers
+    QTimer m_ticker;
+
+    void insert(Timer *timer);
+    static void unlink(Link *link);
+    void onTick();
+};
+
+}
+
+#endif // TIMINGWHEEL_H
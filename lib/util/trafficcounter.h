@@ -0,0 +1,94 @@
+/*
+ * trafficcounter.h - the header file of TrafficCounter class
+ *
+ * The bytes received and sent by the connections of one thread. They're
+ * counted on the hot path without any signal or locked instruction, and
+ * read from other threads whenever the totals are wanted.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRAFFICCOUNTER_H
+#define TRAFFICCOUNTER_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace QSS {
+
+class TrafficCounter
+{
+public:
+    TrafficCounter() = default;
+    TrafficCounter(const TrafficCounter &) = delete;
+
+    /*
+     * Only the thread that relays the traffic may add to a counter, so that
+     * a plain load and store does instead of a read-modify-write
+     */
+    void addReceived(uint64_t bytes)
+    {
+        m_received.store(m_received.load(std::memory_order_relaxed) + bytes,
+                         std::memory_order_relaxed);
+    }
+
+    void addSent(uint64_t bytes)
+    {
+        m_sent.store(m_sent.load(std::memory_order_relaxed) + bytes,
+                     std::memory_order_relaxed);
+    }
+
+    // A connection that attempted TCP Fast Open, and whether it was accepted
+    void addFastOpen(bool accepted)
+    {
+        std::atomic<uint64_t> &count = accepted ? m_fastOpenAccepted : m_fastOpenFallbacks;
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // These can be called from any thread
+    uint64_t received() const
+    {
+        return m_received.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sent() const
+    {
+        return m_sent.load(std::memory_order_relaxed);
+    }
+
+    uint64_t fastOpenAccepted() const
+    {
+        return m_fastOpenAccepted.load(std::memory_order_relaxed);
+    }
+
+    uint64_t fastOpenFallbacks() const
+    {
+        return m_fastOpenFallbacks.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_received{0};
+    std::atomic<uint64_t> m_sent{0};
+    std::atomic<uint64_t> m_fastOpenAccepted{0};
+    std::atomic<uint64_t> m_fastOpenFallbacks{0};
+};
+
+}
+
+#endif // TRAFFICCOUNTER_H
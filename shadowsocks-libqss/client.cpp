@@ -26,6 +26,9 @@
 #include <QJsonObject>
 #include <QDebug>
 #include "client.h"
+#include "util/bufferpool.h"
+#include "util/dnscache.h"
+#include <algorithm>
 
 Client::Client() :
     autoBan(false)
@@ -61,6 +64,31 @@ bool Client::readConfig(const QString &file)
     profile.setServerPort(confObj["server_port"].toInt());
     profile.setTimeout(confObj["timeout"].toInt());
     profile.setHttpProxy(confObj["http_proxy"].toBool());
+    profile.setCryptoWorkers(confObj["crypto_workers"].toInt());
+    profile.setWorkers(confObj["workers"].toInt());
+    profile.setReusePort(confObj["reuse_port"].toBool());
+    profile.setIncomingCpu(confObj["incoming_cpu"].toBool());
+    profile.setEpollEngine(confObj["epoll"].toBool());
+    profile.setIoUring(confObj["io_uring"].toBool());
+    profile.setHighWatermark(confObj["high_watermark"].toInt(profile.highWatermark()));
+    profile.setLowWatermark(confObj["low_watermark"].toInt(profile.lowWatermark()));
+    profile.setReadBudget(confObj["read_budget"].toInt(profile.readBudget()));
+    profile.setConnectTimeout(confObj["connect_timeout"].toInt(profile.connectTimeout()));
+    profile.setHandshakeTimeout(confObj["handshake_timeout"].toInt(profile.handshakeTimeout()));
+    profile.setTrafficInterval(confObj["traffic_interval"].toInt(profile.trafficInterval()));
+    profile.setMux(confObj["mux"].toBool());
+    profile.setMuxConnections(confObj["mux_connections"].toInt(profile.muxConnections()));
+    profile.setPoolSize(confObj["pool_size"].toInt(profile.poolSize()));
+    profile.setPoolIdleTimeout(confObj["pool_idle_timeout"].toInt(profile.poolIdleTimeout()));
+    profile.setFastOpen(confObj["fast_open"].toBool());
+    // The buffer pools and the DNS cache are process-wide rather than part of the profile
+    QSS::BufferPool::setHugePages(confObj["huge_pages"].toBool());
+    if (confObj.contains("dns_cache_size")) {
+        QSS::DnsCache::setCapacity(static_cast<size_t>(std::max(confObj["dns_cache_size"].toInt(), 0)));
+    }
+    if (confObj.contains("dns_cache_ttl")) {
+        QSS::DnsCache::setTtl(confObj["dns_cache_ttl"].toInt());
+    }
     if (confObj["auth"].toBool()) {
         QDebug(QtMsgType::QtCriticalMsg) << "OTA is deprecated, please remove OTA from the configuration file.";
     }
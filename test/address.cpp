@@ -18,6 +18,7 @@ private Q_SLOTS:
     void testSetIPAddress();
     void testSetPort();
     void testLookup();
+    void testLookupInProgress();
 };
 
 void Address::testConstructor1()
@@ -93,5 +94,22 @@ void Address::testLookup()
     });
 }
 
+void Address::testLookupInProgress()
+{
+    // The second one joins the lookup in progress, and both are called back
+    QSS::Address a("localhost", 443);
+    int calls = 0;
+    a.lookUp([&calls](bool success) {
+        QVERIFY(success);
+        ++calls;
+    });
+    a.lookUp([&calls](bool success) {
+        QVERIFY(success);
+        ++calls;
+    });
+    QTRY_COMPARE(calls, 2);
+    QVERIFY(a.isIPValid());
+}
+
 QTEST_MAIN(Address)
 #include "address.moc"
@@ -0,0 +1,98 @@
+#include "util/bufferpool.h"
+#include <QtTest>
+#include <cstring>
+#include <thread>
+
+class BufferPool : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testReuse();
+    void testOversize();
+    void testMove();
+    void testThreads();
+    void benchmarkAcquire();
+};
+
+void BufferPool::testReuse()
+{
+    QSS::BufferPool pool;
+    char *first;
+    {
+        QSS::BufferPool::Buffer buffer = pool.acquire(65536);
+        QCOMPARE(buffer.size(), size_t(65536));
+        first = buffer.data();
+        std::memset(buffer.data(), 0xAB, buffer.size());
+    }
+    QSS::BufferPool::Buffer again = pool.acquire(QSS::BufferPool::SLAB_SIZE);
+    QCOMPARE(again.data(), first);
+
+    const QSS::BufferPool::Stats stats = pool.localStats();
+    QCOMPARE(stats.hits, uint64_t(1));
+    QCOMPARE(stats.misses, uint64_t(1));
+    QCOMPARE(stats.arenas, uint64_t(1));
+}
+
+void BufferPool::testOversize()
+{
+    QSS::BufferPool pool;
+    QSS::BufferPool::Buffer buffer = pool.acquire(QSS::BufferPool::SLAB_SIZE + 1);
+    QVERIFY(!buffer.isNull());
+    std::memset(buffer.data(), 0, buffer.size());
+    QCOMPARE(pool.localStats().misses, uint64_t(1));
+    QCOMPARE(pool.localStats().arenas, uint64_t(0));
+}
+
+void BufferPool::testMove()
+{
+    QSS::BufferPool pool;
+    QSS::BufferPool::Buffer a = pool.acquire(100);
+    char *data = a.data();
+    QSS::BufferPool::Buffer b(std::move(a));
+    QVERIFY(a.isNull());
+    QCOMPARE(b.data(), data);
+
+    // The slab of b is given back before it takes a's
+    a = pool.acquire(100);
+    char *other = a.data();
+    b = std::move(a);
+    QVERIFY(a.isNull());
+    b.reset();
+    QVERIFY(b.isNull());
+    // Most recently released first
+    QSS::BufferPool::Buffer first = pool.acquire(100);
+    QSS::BufferPool::Buffer second = pool.acquire(100);
+    QCOMPARE(first.data(), other);
+    QCOMPARE(second.data(), data);
+}
+
+void BufferPool::testThreads()
+{
+    const QSS::BufferPool::Stats before = QSS::BufferPool::stats();
+    char *mine = QSS::BufferPool::local().acquire(1).data();
+    char *theirs = nullptr;
+    std::thread([&theirs]() {
+        QSS::BufferPool::Buffer buffer = QSS::BufferPool::local().acquire(1);
+        theirs = buffer.data();
+    }).join();
+    QVERIFY(mine != theirs);
+
+    // The exited thread still counts
+    const QSS::BufferPool::Stats after = QSS::BufferPool::stats();
+    QVERIFY(after.hits + after.misses >= before.hits + before.misses + 2);
+}
+
+void BufferPool::benchmarkAcquire()
+{
+    QSS::BufferPool &pool = QSS::BufferPool::local();
+    QBENCHMARK {
+        for (int i = 0; i < 10000; ++i) {
+            QSS::BufferPool::Buffer buffer = pool.acquire(65536 + 256);
+            buffer.data()[0] = static_cast<char>(i);
+        }
+    }
+}
+
+QTEST_MAIN(BufferPool)
+#include "bufferpool.moc"
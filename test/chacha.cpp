@@ -14,6 +14,10 @@ private Q_SLOTS:
     void test8ByteIV();
     void test12ByteIV();
     void referenceTest();
+    void testImplementations_data();
+    void testImplementations();
+    void benchmarkUpdate_data();
+    void benchmarkUpdate();
 
 private:
     std::string key;
@@ -65,5 +69,83 @@ void ChaCha::referenceTest()
              QSS::Common::stringFromHex("76b8e0ada0f13d9040"));
 }
 
+void ChaCha::testImplementations_data()
+{
+    QTest::addColumn<int>("impl");
+    QTest::addColumn<int>("ivLength");
+
+    const std::pair<const char *, int> impls[] = {
+        {"SSE2", QSS::ChaCha::SSE2},
+        {"AVX2", QSS::ChaCha::AVX2},
+        {"AVX512", QSS::ChaCha::AVX512}
+    };
+    for (const auto &impl : impls) {
+        QTest::newRow((QByteArray(impl.first) + " 8-byte IV").constData()) << impl.second << 8;
+        QTest::newRow((QByteArray(impl.first) + " 12-byte IV").constData()) << impl.second << 12;
+    }
+}
+
+void ChaCha::testImplementations()
+{
+    QFETCH(int, impl);
+    QFETCH(int, ivLength);
+
+    const auto implementation = static_cast<QSS::ChaCha::Implementation>(impl);
+    if (!QSS::ChaCha::isSupported(implementation)) {
+        QSKIP("The implementation is not supported by this CPU");
+    }
+
+    const std::string iv = QSS::Cipher::randomIv(ivLength);
+    const std::string data = QSS::Cipher::randomIv(100000);
+    QSS::ChaCha scalar(key, iv, QSS::ChaCha::SCALAR);
+    const std::string expected = scalar.update(data);
+
+    // Feed odd-sized pieces to cross the block and batch boundaries
+    QSS::ChaCha simd(key, iv, implementation);
+    QCOMPARE(simd.implementation(), implementation);
+    std::string result;
+    size_t step = 1;
+    for (size_t pos = 0; pos < data.size(); pos += step, step = step * 3 + 7) {
+        if (step > 5000) {
+            step = 13;
+        }
+        result += simd.update(data.substr(pos, step));
+    }
+    QCOMPARE(result, expected);
+
+    // Whole batches are XORed in place by the kernels
+    QSS::ChaCha inPlace(key, iv, implementation);
+    inPlace.update(reinterpret_cast<const uint8_t *>(result.data()), result.size(),
+                   reinterpret_cast<uint8_t *>(&result[0]));
+    QCOMPARE(result, data);
+}
+
+void ChaCha::benchmarkUpdate_data()
+{
+    QTest::addColumn<int>("impl");
+
+    QTest::newRow("SCALAR") << static_cast<int>(QSS::ChaCha::SCALAR);
+    QTest::newRow("SSE2") << static_cast<int>(QSS::ChaCha::SSE2);
+    QTest::newRow("AVX2") << static_cast<int>(QSS::ChaCha::AVX2);
+    QTest::newRow("AVX512") << static_cast<int>(QSS::ChaCha::AVX512);
+}
+
+void ChaCha::benchmarkUpdate()
+{
+    QFETCH(int, impl);
+
+    const auto implementation = static_cast<QSS::ChaCha::Implementation>(impl);
+    if (!QSS::ChaCha::isSupported(implementation)) {
+        QSKIP("The implementation is not supported by this CPU");
+    }
+
+    QSS::ChaCha chacha(key, QSS::Cipher::randomIv(12), implementation);
+    std::string data(1024 * 1024, '\0');
+    QBENCHMARK {
+        chacha.update(reinterpret_cast<const uint8_t *>(data.data()), data.size(),
+                      reinterpret_cast<uint8_t *>(&data[0]));
+    }
+}
+
 QTEST_MAIN(ChaCha)
 #include "chacha.moc"
@@ -0,0 +1,176 @@
+#include "crypto/cipher.h"
+#include "crypto/chacha20poly1305.h"
+#include "util/common.h"
+#include <QtTest>
+#include <stdexcept>
+
+#ifdef USE_BOTAN2
+#include <botan/cipher_mode.h>
+#endif
+
+class ChaCha20Poly1305 : public QObject
+{
+    Q_OBJECT
+
+public:
+    ChaCha20Poly1305();
+
+private Q_SLOTS:
+    void referenceTest();
+    void testSealOpen();
+    void testTamperedTag();
+    void testChunk();
+    void testPartialChunk();
+#ifdef USE_BOTAN2
+    void testAgainstBotan();
+#endif
+
+private:
+    std::string key;
+};
+
+ChaCha20Poly1305::ChaCha20Poly1305()
+{
+    key = QSS::Cipher::randomIv(32);
+}
+
+void ChaCha20Poly1305::referenceTest()
+{
+    // RFC 8439 2.8.2 key, nonce and plain text without the associated data
+    std::string testKey(32, '\0');
+    for (size_t i = 0; i < testKey.size(); ++i) {
+        testKey[i] = static_cast<char>(0x80 + i);
+    }
+    const std::string nonce = QSS::Common::stringFromHex("070000004041424344454647");
+    const std::string plain("Ladies and Gentlemen of the class of '99: If I could offer you "
+                            "only one tip for the future, sunscreen would be it.");
+    QSS::ChaCha20Poly1305 aead(testKey);
+    std::string sealed(plain.length() + QSS::ChaCha20Poly1305::TAG_LENGTH, '\0');
+    aead.seal(reinterpret_cast<const uint8_t*>(nonce.data()),
+              reinterpret_cast<const uint8_t*>(plain.data()), plain.length(),
+              reinterpret_cast<uint8_t*>(&sealed[0]));
+    QCOMPARE(sealed, QSS::Common::stringFromHex(
+                 "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+                 "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+                 "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+                 "3ff4def08e4b7a9de576d26586cec64b6116"
+                 "6a23a4681fd59456aea1d29f82477216"));
+}
+
+void ChaCha20Poly1305::testSealOpen()
+{
+    QSS::ChaCha20Poly1305 aead(key);
+    const std::string nonce = QSS::Cipher::randomIv(QSS::ChaCha20Poly1305::NONCE_LENGTH);
+    const uint8_t *n = reinterpret_cast<const uint8_t*>(nonce.data());
+
+    // Cover the scalar and SIMD code paths and the partial blocks
+    for (size_t length : {0, 1, 2, 15, 16, 17, 63, 64, 65, 127, 128, 129, 255, 256, 257, 1000, 0x3FFF}) {
+        const std::string plain = QSS::Cipher::randomIv(length);
+        std::string buffer = plain + std::string(QSS::ChaCha20Poly1305::TAG_LENGTH, '\0');
+        uint8_t *data = reinterpret_cast<uint8_t*>(&buffer[0]);
+        aead.seal(n, data, length, data);
+        QVERIFY(length == 0 || buffer.substr(0, length) != plain);
+        aead.open(n, data, buffer.length(), data);
+        QCOMPARE(buffer.substr(0, length), plain);
+    }
+}
+
+void ChaCha20Poly1305::testTamperedTag()
+{
+    QSS::ChaCha20Poly1305 aead(key);
+    const std::string nonce(QSS::ChaCha20Poly1305::NONCE_LENGTH, '\0');
+    const uint8_t *n = reinterpret_cast<const uint8_t*>(nonce.data());
+    const std::string plain("$ is cheaper than £");
+    std::vector<uint8_t> sealed(plain.length() + QSS::ChaCha20Poly1305::TAG_LENGTH);
+    aead.seal(n, reinterpret_cast<const uint8_t*>(plain.data()), plain.length(), sealed.data());
+
+    sealed[3] ^= 1;
+    std::vector<uint8_t> out(plain.length());
+    QVERIFY_EXCEPTION_THROWN(aead.open(n, sealed.data(), sealed.size(), out.data()),
+                             std::runtime_error);
+}
+
+void ChaCha20Poly1305::testChunk()
+{
+    // A chunk must be the same as sealing the two messages separately
+    QSS::ChaCha20Poly1305 aead(key);
+    QSS::ChaCha20Poly1305 reference(key);
+    std::string nonce(QSS::ChaCha20Poly1305::NONCE_LENGTH, '\0');
+    uint8_t *n = reinterpret_cast<uint8_t*>(&nonce[0]);
+    const size_t tagLen = QSS::ChaCha20Poly1305::TAG_LENGTH;
+
+    const std::string payload = QSS::Cipher::randomIv(1000);
+    std::vector<uint8_t> chunk(2 + payload.length() + 2 * tagLen);
+    QCOMPARE(aead.sealChunk(n, reinterpret_cast<const uint8_t*>(payload.data()),
+                            payload.length(), chunk.data()),
+             chunk.size());
+    QCOMPARE(nonce, QSS::Common::stringFromHex("020000000000000000000000"));
+
+    std::vector<uint8_t> expected(chunk.size());
+    std::string refNonce(QSS::ChaCha20Poly1305::NONCE_LENGTH, '\0');
+    const uint8_t rawLength[2] = {0x03, 0xE8};
+    reference.seal(reinterpret_cast<const uint8_t*>(refNonce.data()), rawLength, 2, expected.data());
+    refNonce[0] = 1;
+    reference.seal(reinterpret_cast<const uint8_t*>(refNonce.data()),
+                   reinterpret_cast<const uint8_t*>(payload.data()), payload.length(),
+                   expected.data() + 2 + tagLen);
+    QCOMPARE(chunk, expected);
+
+    nonce = std::string(QSS::ChaCha20Poly1305::NONCE_LENGTH, '\0');
+    std::vector<uint8_t> out(payload.length());
+    uint16_t payloadLength = 0;
+    QCOMPARE(aead.openChunk(n, chunk.data(), chunk.size(), out.data(), &payloadLength), chunk.size());
+    QCOMPARE(payloadLength, static_cast<uint16_t>(payload.length()));
+    QCOMPARE(std::string(out.begin(), out.end()), payload);
+    QCOMPARE(nonce, QSS::Common::stringFromHex("020000000000000000000000"));
+}
+
+void ChaCha20Poly1305::testPartialChunk()
+{
+    QSS::ChaCha20Poly1305 aead(key);
+    std::string nonce(QSS::ChaCha20Poly1305::NONCE_LENGTH, '\0');
+    uint8_t *n = reinterpret_cast<uint8_t*>(&nonce[0]);
+    const size_t tagLen = QSS::ChaCha20Poly1305::TAG_LENGTH;
+
+    const std::string payload = QSS::Cipher::randomIv(100);
+    std::vector<uint8_t> chunk(2 + payload.length() + 2 * tagLen);
+    aead.sealChunk(n, reinterpret_cast<const uint8_t*>(payload.data()), payload.length(), chunk.data());
+
+    // Only the length is opened if the payload isn't all there
+    nonce = std::string(QSS::ChaCha20Poly1305::NONCE_LENGTH, '\0');
+    uint16_t payloadLength = 0;
+    QCOMPARE(aead.openChunk(n, chunk.data(), chunk.size() - 1, nullptr, &payloadLength), 2 + tagLen);
+    QCOMPARE(payloadLength, static_cast<uint16_t>(payload.length()));
+    QCOMPARE(nonce, QSS::Common::stringFromHex("010000000000000000000000"));
+
+    std::vector<uint8_t> out(payload.length());
+    aead.open(n, chunk.data() + 2 + tagLen, payload.length() + tagLen, out.data());
+    QCOMPARE(std::string(out.begin(), out.end()), payload);
+}
+
+#ifdef USE_BOTAN2
+void ChaCha20Poly1305::testAgainstBotan()
+{
+    QSS::ChaCha20Poly1305 aead(key);
+    std::unique_ptr<Botan::Cipher_Mode> botan(
+                Botan::get_cipher_mode("ChaCha20Poly1305", Botan::ENCRYPTION));
+    QVERIFY(botan);
+    botan->set_key(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+
+    for (size_t length = 0; length < 600; length += 7) {
+        const std::string nonce = QSS::Cipher::randomIv(QSS::ChaCha20Poly1305::NONCE_LENGTH);
+        const std::string plain = QSS::Cipher::randomIv(length);
+        std::vector<uint8_t> sealed(length + QSS::ChaCha20Poly1305::TAG_LENGTH);
+        aead.seal(reinterpret_cast<const uint8_t*>(nonce.data()),
+                  reinterpret_cast<const uint8_t*>(plain.data()), length, sealed.data());
+
+        Botan::secure_vector<uint8_t> expected(plain.begin(), plain.end());
+        botan->start(reinterpret_cast<const uint8_t*>(nonce.data()), nonce.size());
+        botan->finish(expected);
+        QVERIFY(std::equal(sealed.begin(), sealed.end(), expected.begin(), expected.end()));
+    }
+}
+#endif
+
+QTEST_MAIN(ChaCha20Poly1305)
+#include "chacha20poly1305.moc"
@@ -2,6 +2,12 @@
 #include "crypto/cipher.h"
 #include "util/common.h"
 
+#ifdef USE_BOTAN2
+#include <botan/key_filt.h>
+#include <botan/lookup.h>
+#include <botan/pipe.h>
+#endif
+
 class Cipher : public QObject
 {
     Q_OBJECT
@@ -13,6 +19,19 @@ private Q_SLOTS:
     // Test md5Hash() function using test cases from
     // http://www.nsrl.nist.gov/testdata/
     void testMd5Hash();
+
+    void testUpdateInPlace();
+
+#ifdef USE_BOTAN2
+    // Per-chunk cost of Cipher against the Botan::Pipe + Keyed_Filter path
+    void benchmarkAeadChunk_data();
+    void benchmarkAeadChunk();
+    void benchmarkAeadChunkPipe_data();
+    void benchmarkAeadChunkPipe();
+    // A whole Shadowsocks chunk (length and payload) per iteration
+    void benchmarkSealChunk_data();
+    void benchmarkSealChunk();
+#endif
 };
 
 void Cipher::testMd5Hash()
@@ -24,5 +43,115 @@ void Cipher::testMd5Hash()
     QCOMPARE(QSS::Cipher::md5Hash(in), QSS::Common::stringFromHex("8215EF0796A20BCAAAE116D3876C664A"));
 }
 
+void Cipher::testUpdateInPlace()
+{
+    for (const std::string& method : QSS::Cipher::supportedMethods()) {
+        const auto cInfo = QSS::Cipher::cipherInfoMap.at(method);
+        const std::string key = QSS::Cipher::randomIv(cInfo.keyLen);
+        const std::string iv = QSS::Cipher::randomIv(method);
+        QSS::Cipher encipher(method, key, iv, true);
+        QSS::Cipher decipher(method, key, iv, false);
+        QSS::Cipher reference(method, key, iv, true);
+
+        const std::string plain("$ is cheaper than £");
+        std::string buffer = plain + std::string(cInfo.tagLen, '\0');
+        uint8_t *data = reinterpret_cast<uint8_t*>(&buffer[0]);
+        QCOMPARE(encipher.update(data, plain.length(), data), plain.length() + cInfo.tagLen);
+        QCOMPARE(buffer, reference.update(plain));
+        QCOMPARE(decipher.update(data, buffer.length(), data), plain.length());
+        QCOMPARE(buffer.substr(0, plain.length()), plain);
+    }
+}
+
+#ifdef USE_BOTAN2
+void Cipher::benchmarkAeadChunk_data()
+{
+    QTest::addColumn<QString>("method");
+    QTest::addColumn<int>("length");
+
+    for (const char* method : {"aes-256-gcm", "chacha20-ietf-poly1305"}) {
+        QTest::newRow((QByteArray(method) + " length").constData()) << QString(method) << 2;
+        QTest::newRow((QByteArray(method) + " payload").constData()) << QString(method) << 0x3FFF;
+    }
+}
+
+void Cipher::benchmarkAeadChunk()
+{
+    QFETCH(QString, method);
+    QFETCH(int, length);
+    const auto cInfo = QSS::Cipher::cipherInfoMap.at(method.toStdString());
+    QSS::Cipher cipher(method.toStdString(),
+                       QSS::Cipher::randomIv(cInfo.keyLen),
+                       std::string(cInfo.ivLen, '\0'),
+                       true);
+    std::vector<uint8_t> in(length, '#');
+    std::vector<uint8_t> out(length + cInfo.tagLen);
+
+    QBENCHMARK {
+        cipher.update(in.data(), in.size(), out.data());
+        cipher.incrementIv();
+    }
+}
+
+void Cipher::benchmarkAeadChunkPipe_data()
+{
+    benchmarkAeadChunk_data();
+}
+
+void Cipher::benchmarkAeadChunkPipe()
+{
+    QFETCH(QString, method);
+    QFETCH(int, length);
+    const auto cInfo = QSS::Cipher::cipherInfoMap.at(method.toStdString());
+    const std::string key = QSS::Cipher::randomIv(cInfo.keyLen);
+    std::vector<uint8_t> nonce(cInfo.ivLen, 0);
+    Botan::Keyed_Filter *filter = Botan::get_cipher(
+                cInfo.internalName,
+                Botan::SymmetricKey(reinterpret_cast<const uint8_t*>(key.data()), key.size()),
+                Botan::InitializationVector(nonce.data(), nonce.size()),
+                Botan::ENCRYPTION);
+    Botan::Pipe pipe(filter);
+    std::vector<uint8_t> in(length, '#');
+
+    QBENCHMARK {
+        pipe.process_msg(in.data(), in.size());
+        Botan::secure_vector<uint8_t> c = pipe.read_all(Botan::Pipe::LAST_MESSAGE);
+        std::string out(reinterpret_cast<const char*>(c.data()), c.size());
+        ++nonce[0];
+        filter->set_iv(Botan::InitializationVector(nonce.data(), nonce.size()));
+    }
+}
+
+void Cipher::benchmarkSealChunk_data()
+{
+    QTest::addColumn<QString>("method");
+    QTest::addColumn<int>("length");
+
+    for (const char* method : {"aes-256-gcm", "chacha20-ietf-poly1305"}) {
+        for (int length : {64, 1024, 0x3FFF}) {
+            QTest::newRow((QByteArray(method) + " " + QByteArray::number(length)).constData())
+                    << QString(method) << length;
+        }
+    }
+}
+
+void Cipher::benchmarkSealChunk()
+{
+    QFETCH(QString, method);
+    QFETCH(int, length);
+    const auto cInfo = QSS::Cipher::cipherInfoMap.at(method.toStdString());
+    QSS::Cipher cipher(method.toStdString(),
+                       QSS::Cipher::randomIv(cInfo.keyLen),
+                       std::string(cInfo.ivLen, '\0'),
+                       true);
+    std::vector<uint8_t> in(length, '#');
+    std::vector<uint8_t> out(length + 2 + 2 * cInfo.tagLen);
+
+    QBENCHMARK {
+        cipher.sealChunk(in.data(), in.size(), out.data());
+    }
+}
+#endif
+
 QTEST_MAIN(Cipher)
 #include "cipher.moc"
@@ -0,0 +1,88 @@
+#include "network/connectionpool.h"
+#include <QtTest>
+#include <QTcpServer>
+
+class ConnectionPool : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void testDisabled();
+    void testRefill();
+    void testExpire();
+
+private:
+    QTcpServer server;
+    std::unique_ptr<QSS::ConnectionPool> pool;
+};
+
+void ConnectionPool::init()
+{
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    pool = std::make_unique<QSS::ConnectionPool>([]() {
+        return new QSS::QtRelaySocket(new QTcpSocket());
+    }, QSS::Address(QHostAddress(QHostAddress::LocalHost), server.serverPort()));
+}
+
+void ConnectionPool::cleanup()
+{
+    pool.reset();
+    server.close();
+}
+
+void ConnectionPool::testDisabled()
+{
+    QVERIFY(!pool->take());
+    QTest::qWait(100);
+    QVERIFY(!server.hasPendingConnections());
+    QCOMPARE(pool->idleCount(), 0);
+}
+
+void ConnectionPool::testRefill()
+{
+    pool->setSize(4);
+    // Both takes land in the first tick
+    pool->setTick(60000, 0.5);
+    // The first one has to be made the usual way, but it's made up for
+    QVERIFY(!pool->take());
+    QTRY_COMPARE(pool->idleCount(), 1);
+
+    std::unique_ptr<QSS::RelaySocket> socket = pool->take();
+    QVERIFY(socket);
+    QCOMPARE(socket->peerPort(), server.serverPort());
+    QCOMPARE(socket->bytesToWrite(), qint64(0));
+    // The pool doesn't hold on to it any more
+    QSignalSpy readSpy(socket.get(), &QSS::RelaySocket::readyRead);
+    QTRY_VERIFY(server.hasPendingConnections());
+    std::unique_ptr<QTcpSocket> peer(server.nextPendingConnection());
+    peer->write("data");
+    QVERIFY(readSpy.wait());
+
+    // Two taken within the tick, so two are kept from now on
+    QTRY_COMPARE(pool->idleCount(), 2);
+}
+
+void ConnectionPool::testExpire()
+{
+    pool->setSize(1);
+    pool->setIdleTimeout(100);
+    // Only the last tick counts, so the rate is gone a tick after the take
+    pool->setTick(50, 0);
+    QVERIFY(!pool->take());
+    QTRY_COMPARE(pool->idleCount(), 1);
+
+    // Expired, and not replaced since nothing is taken any more
+    QTRY_COMPARE(pool->idleCount(), 0);
+    QTest::qWait(100);
+    while (server.hasPendingConnections()) {
+        delete server.nextPendingConnection();
+    }
+    QTest::qWait(200);
+    QVERIFY(!server.hasPendingConnections());
+    QCOMPARE(pool->idleCount(), 0);
+}
+
+QTEST_MAIN(ConnectionPool)
+#include "connectionpool.moc"
@@ -0,0 +1,137 @@
+#include "util/controller.h"
+#include "util/common.h"
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+class Controller : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void testTrafficPerEvent();
+    void testTrafficBatched();
+
+private:
+    QTcpServer target;
+    std::vector<std::unique_ptr<QTcpSocket>> targetSockets;
+
+    /*
+     * Runs a server mode controller with trafficInterval, and sends it
+     * rounds requests of length bytes to the echoing target one by one
+     */
+    void relay(QSS::Controller &controller, uint16_t port, int rounds, int length);
+};
+
+void Controller::init()
+{
+    QVERIFY(target.listen(QHostAddress::LocalHost));
+    connect(&target, &QTcpServer::newConnection, [this]() {
+        QTcpSocket *socket = target.nextPendingConnection();
+        targetSockets.emplace_back(socket);
+        connect(socket, &QTcpSocket::readyRead, [socket]() {
+            socket->write(socket->readAll());
+        });
+    });
+}
+
+void Controller::cleanup()
+{
+    targetSockets.clear();
+    target.close();
+    disconnect(&target, nullptr, nullptr, nullptr);
+}
+
+void Controller::relay(QSS::Controller &controller, uint16_t port, int rounds, int length)
+{
+    QVERIFY(controller.start());
+
+    QSS::Encryptor encryptor("aes-256-cfb", "test");
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(client.waitForConnected());
+    std::string header = QSS::Common::packAddress(QHostAddress::LocalHost, target.serverPort());
+    for (int i = 0; i < rounds; ++i) {
+        // Each echo is a separate read of the remote, and a separate write before it
+        const std::string data = header + std::string(length, 'x');
+        header.clear();
+        QSignalSpy readySpy(&client, &QTcpSocket::readyRead);
+        client.write(QByteArray::fromStdString(encryptor.encrypt(data)));
+        // The controller and the target run on this thread, so the event loop must go on
+        QVERIFY(readySpy.wait());
+        client.readAll();
+    }
+}
+
+void Controller::testTrafficPerEvent()
+{
+    QTcpServer probe;
+    QVERIFY(probe.listen(QHostAddress::LocalHost));
+    const uint16_t port = probe.serverPort();
+    probe.close();
+
+    QSS::Profile profile;
+    profile.setServerAddress("127.0.0.1");
+    profile.setServerPort(port);
+    profile.setMethod("aes-256-cfb");
+    profile.setPassword("test");
+    profile.setTrafficInterval(0);
+    QSS::Controller controller(profile, false, false);
+    QSignalSpy receivedSpy(&controller, &QSS::Controller::newBytesReceived);
+    QSignalSpy sentSpy(&controller, &QSS::Controller::newBytesSent);
+
+    const int rounds = 5;
+    const int length = 100;
+    relay(controller, port, rounds, length);
+
+    // Emitted straight away for every read and write
+    QTRY_COMPARE(receivedSpy.count(), rounds);
+    QTRY_COMPARE(sentSpy.count(), rounds);
+    for (int i = 0; i < rounds; ++i) {
+        QCOMPARE(receivedSpy.at(i).at(0).toULongLong(), quint64(length));
+        QCOMPARE(sentSpy.at(i).at(0).toULongLong(), quint64(length));
+    }
+}
+
+void Controller::testTrafficBatched()
+{
+    QTcpServer probe;
+    QVERIFY(probe.listen(QHostAddress::LocalHost));
+    const uint16_t port = probe.serverPort();
+    probe.close();
+
+    const int interval = 1000;
+    QSS::Profile profile;
+    profile.setServerAddress("127.0.0.1");
+    profile.setServerPort(port);
+    profile.setMethod("aes-256-cfb");
+    profile.setPassword("test");
+    profile.setTrafficInterval(interval);
+    QSS::Controller controller(profile, false, false);
+    QSignalSpy receivedSpy(&controller, &QSS::Controller::newBytesReceived);
+    QSignalSpy totalSpy(&controller, &QSS::Controller::bytesReceivedChanged);
+    QSignalSpy sentSpy(&controller, &QSS::Controller::newBytesSent);
+
+    const int rounds = 5;
+    const int length = 100;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    relay(controller, port, rounds, length);
+
+    // Nothing until the interval is up, and then the rounds added up
+    QTRY_VERIFY_WITH_TIMEOUT(!totalSpy.isEmpty(), 3 * interval);
+    QVERIFY(elapsed.elapsed() >= interval - 50);
+    QTRY_COMPARE(totalSpy.last().at(0).toULongLong(), quint64(rounds * length));
+    QVERIFY(receivedSpy.count() < rounds);
+    QVERIFY(sentSpy.count() < rounds);
+
+    // No change, no signal
+    const int count = receivedSpy.count();
+    QTest::qWait(2 * interval);
+    QCOMPARE(receivedSpy.count(), count);
+}
+
+QTEST_MAIN(Controller)
+#include "controller.moc"
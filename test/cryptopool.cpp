@@ -0,0 +1,101 @@
+#include "crypto/cryptopool.h"
+#include <QtTest>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+class CryptoPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    CryptoPool() = default;
+
+private Q_SLOTS:
+    void testRunAll_data();
+    void testRunAll();
+    void testSlots();
+    void testException();
+    void testLocal();
+};
+
+void CryptoPool::testRunAll_data()
+{
+    QTest::addColumn<int>("workers");
+    QTest::newRow("no workers") << 0;
+    QTest::newRow("1 worker") << 1;
+    QTest::newRow("4 workers") << 4;
+}
+
+void CryptoPool::testRunAll()
+{
+    QFETCH(int, workers);
+    QSS::CryptoPool pool(workers);
+    QCOMPARE(pool.workerCount(), workers);
+
+    // Each index is run exactly once, and all of them are done by return
+    for (size_t count : {0, 1, 2, 7, 100}) {
+        std::vector<int> results(count, 0);
+        pool.run(count, [&results](size_t, size_t index) {
+            results[index] += static_cast<int>(index) + 1;
+        });
+        for (size_t i = 0; i < count; ++i) {
+            QCOMPARE(results[i], static_cast<int>(i) + 1);
+        }
+    }
+}
+
+void CryptoPool::testSlots()
+{
+    const int workers = 3;
+    QSS::CryptoPool pool(workers);
+    std::vector<std::atomic<int>> busy(workers + 1);
+    std::atomic<bool> overlapped(false);
+
+    pool.run(200, [&](size_t slot, size_t) {
+        if (slot > static_cast<size_t>(workers) || busy[slot]++ != 0) {
+            overlapped = true;
+            return;
+        }
+        busy[slot]--;
+    });
+    QVERIFY(!overlapped);
+}
+
+void CryptoPool::testException()
+{
+    QSS::CryptoPool pool(2);
+    QVERIFY_EXCEPTION_THROWN(pool.run(10, [](size_t, size_t index) {
+        if (index == 5) {
+            throw std::runtime_error("failed");
+        }
+    }), std::runtime_error);
+
+    // The pool is still usable afterwards
+    std::atomic<size_t> count(0);
+    pool.run(10, [&count](size_t, size_t) { ++count; });
+    QCOMPARE(count.load(), size_t(10));
+}
+
+void CryptoPool::testLocal()
+{
+    QSS::CryptoPool &pool = QSS::CryptoPool::local(2);
+    QCOMPARE(pool.workerCount(), 2);
+    QCOMPARE(&QSS::CryptoPool::local(2), &pool);
+
+    // Another thread has a pool of its own, so the two never wait for each other
+    QSS::CryptoPool *other = nullptr;
+    std::atomic<size_t> count(0);
+    std::thread thread([&other, &count]() {
+        other = &QSS::CryptoPool::local(2);
+        other->run(10, [&count](size_t, size_t) { ++count; });
+    });
+    thread.join();
+    QVERIFY(other != &pool);
+    QCOMPARE(count.load(), size_t(10));
+
+    QCOMPARE(QSS::CryptoPool::local(3).workerCount(), 3);
+}
+
+QTEST_MAIN(CryptoPool)
+#include "cryptopool.moc"
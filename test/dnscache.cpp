@@ -0,0 +1,142 @@
+#include "util/dnscache.h"
+#include <QtTest>
+
+class DnsCache : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void testHit();
+    void testCoalesce();
+    void testNegative();
+    void testCapacity();
+    void testTtl();
+    void testContextDestroyed();
+};
+
+void DnsCache::init()
+{
+    QSS::DnsCache::setCapacity(1024);
+    QSS::DnsCache::setTtl(60);
+    QSS::DnsCache::clear();
+}
+
+void DnsCache::testHit()
+{
+    QList<QHostAddress> first;
+    bool called = false;
+    QSS::DnsCache::lookUp("localhost", this, [&](const QList<QHostAddress> &addresses) {
+        first = addresses;
+        called = true;
+    });
+    QVERIFY(!called);
+    QTRY_VERIFY(called);
+    QVERIFY(!first.isEmpty());
+
+    // A cached one is passed straight away
+    QList<QHostAddress> second;
+    QSS::DnsCache::lookUp("localhost", this, [&](const QList<QHostAddress> &addresses) {
+        second = addresses;
+    });
+    QCOMPARE(second, first);
+
+    const QSS::DnsCache::Stats stats = QSS::DnsCache::stats();
+    QCOMPARE(stats.misses, uint64_t(1));
+    QCOMPARE(stats.hits, uint64_t(1));
+    QCOMPARE(stats.size, size_t(1));
+}
+
+void DnsCache::testCoalesce()
+{
+    int calls = 0;
+    QList<QHostAddress> first;
+    QList<QHostAddress> second;
+    QSS::DnsCache::lookUp("localhost", this, [&](const QList<QHostAddress> &addresses) {
+        first = addresses;
+        ++calls;
+    });
+    QSS::DnsCache::lookUp("localhost", this, [&](const QList<QHostAddress> &addresses) {
+        second = addresses;
+        ++calls;
+    });
+    QTRY_COMPARE(calls, 2);
+    QCOMPARE(first, second);
+
+    const QSS::DnsCache::Stats stats = QSS::DnsCache::stats();
+    QCOMPARE(stats.misses, uint64_t(1));
+    QCOMPARE(stats.coalesced, uint64_t(1));
+}
+
+void DnsCache::testNegative()
+{
+    bool called = false;
+    QSS::DnsCache::lookUp("nonexistent.invalid", this, [&](const QList<QHostAddress> &addresses) {
+        QVERIFY(addresses.isEmpty());
+        called = true;
+    });
+    QTRY_VERIFY_WITH_TIMEOUT(called, 30000);
+    QCOMPARE(QSS::DnsCache::stats().failures, uint64_t(1));
+
+    called = false;
+    QSS::DnsCache::lookUp("nonexistent.invalid", this, [&](const QList<QHostAddress> &addresses) {
+        QVERIFY(addresses.isEmpty());
+        called = true;
+    });
+    QVERIFY(called);
+    QCOMPARE(QSS::DnsCache::stats().hits, uint64_t(1));
+}
+
+void DnsCache::testCapacity()
+{
+    QSS::DnsCache::setCapacity(1);
+    int calls = 0;
+    auto callback = [&calls](const QList<QHostAddress> &) {
+        ++calls;
+    };
+    QSS::DnsCache::lookUp("localhost", this, callback);
+    QTRY_COMPARE(calls, 1);
+    QSS::DnsCache::lookUp("127.0.0.1", this, callback);
+    QTRY_COMPARE(calls, 2);
+    QCOMPARE(QSS::DnsCache::stats().size, size_t(1));
+
+    // The least recently used one is gone
+    QSS::DnsCache::lookUp("localhost", this, callback);
+    QCOMPARE(calls, 2);
+    QTRY_COMPARE(calls, 3);
+    QCOMPARE(QSS::DnsCache::stats().misses, uint64_t(3));
+}
+
+void DnsCache::testTtl()
+{
+    QSS::DnsCache::setTtl(0);
+    int calls = 0;
+    auto callback = [&calls](const QList<QHostAddress> &) {
+        ++calls;
+    };
+    QSS::DnsCache::lookUp("localhost", this, callback);
+    QTRY_COMPARE(calls, 1);
+    QSS::DnsCache::lookUp("localhost", this, callback);
+    QTRY_COMPARE(calls, 2);
+
+    const QSS::DnsCache::Stats stats = QSS::DnsCache::stats();
+    QCOMPARE(stats.size, size_t(0));
+    QCOMPARE(stats.hits, uint64_t(0));
+    QCOMPARE(stats.misses, uint64_t(2));
+}
+
+void DnsCache::testContextDestroyed()
+{
+    bool called = false;
+    std::unique_ptr<QObject> context(new QObject());
+    QSS::DnsCache::lookUp("localhost", context.get(), [&](const QList<QHostAddress> &) {
+        called = true;
+    });
+    context.reset();
+    QTRY_VERIFY(QSS::DnsCache::stats().size == 1);
+    QTest::qWait(100);
+    QVERIFY(!called);
+}
+
+QTEST_MAIN(DnsCache)
+#include "dnscache.moc"
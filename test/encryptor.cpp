@@ -1,5 +1,6 @@
 #include "crypto/encryptor.h"
 #include <QtTest>
+#include <stdexcept>
 
 namespace {
 const std::string testData = std::string("Hello Shadowsocks");
@@ -13,11 +14,26 @@ public:
 
 private Q_SLOTS:
     void selfTestEncryptDecrypt();
+    void testCallerBuffer();
+    void testEncryptInPlace();
+    void testEncryptSegments_data();
+    void testEncryptSegments();
+    void testSharedContext();
+    // Connection setup (first encrypted packet) per second
+    void benchmarkConnection_data();
+    void benchmarkConnection();
+    void testCryptoPool_data();
+    void testCryptoPool();
+    void benchmarkCryptoPool_data();
+    void benchmarkCryptoPool();
 #ifdef USE_BOTAN2
+    void testAesGcmEncryptInPlace();
     void testAesGcm();
     void testAesGcmUdp();
     void testAesGcmMultiChunks();
     void testAesGcmIncompleteChunks();
+    void testAeadEverySplitPoint_data();
+    void testAeadEverySplitPoint();
 #endif
 };
 
@@ -31,7 +47,106 @@ void Encryptor::selfTestEncryptDecrypt()
     QCOMPARE(decryptor.decrypt(encryptor.encrypt(testData)), testData);
 }
 
+void Encryptor::testCallerBuffer()
+{
+    std::string method("aes-128-cfb");
+    std::string password("test");
+    const auto cInfo = QSS::Cipher::cipherInfoMap.at(method);
+    QSS::Encryptor encryptor(method, password);
+    QSS::Encryptor decryptor(method, password);
+
+    const uint8_t *in = reinterpret_cast<const uint8_t*>(testData.data());
+    QCOMPARE(encryptor.encryptOverhead(testData.length()), cInfo.ivLen);
+    std::string encrypted(testData.length() + encryptor.encryptOverhead(testData.length()), '\0');
+    encrypted.resize(encryptor.encrypt(in, testData.length(), reinterpret_cast<uint8_t*>(&encrypted[0])));
+    QCOMPARE(encrypted.length(), cInfo.ivLen + testData.length());
+    QCOMPARE(encryptor.encryptOverhead(testData.length()), size_t(0));
+
+    std::string decrypted(decryptor.maxDecryptedSize(encrypted.length()), '\0');
+    decrypted.resize(decryptor.decrypt(reinterpret_cast<const uint8_t*>(encrypted.data()),
+                                       encrypted.length(),
+                                       reinterpret_cast<uint8_t*>(&decrypted[0])));
+    QCOMPARE(decrypted, testData);
+}
+
+void Encryptor::testEncryptInPlace()
+{
+    std::string method("aes-128-cfb");
+    std::string password("test");
+    QSS::Encryptor encryptor(method, password);
+    QSS::Encryptor decryptor(method, password);
+
+    for (int i = 0; i < 2; ++i) {
+        const size_t headroom = encryptor.encryptOverhead(testData.length());
+        std::string buffer = std::string(headroom, '\0') + testData;
+        buffer.resize(encryptor.encryptInPlace(reinterpret_cast<uint8_t*>(&buffer[0]),
+                                               headroom,
+                                               testData.length()));
+        QCOMPARE(decryptor.decrypt(buffer), testData);
+    }
+}
+
+void Encryptor::testEncryptSegments_data()
+{
+    QTest::addColumn<QString>("method");
+    QTest::newRow("aes-128-cfb") << QString("aes-128-cfb");
+#ifdef USE_BOTAN2
+    QTest::newRow("aes-256-gcm") << QString("aes-256-gcm");
+    QTest::newRow("chacha20-ietf-poly1305") << QString("chacha20-ietf-poly1305");
+#endif
+}
+
+void Encryptor::testEncryptSegments()
+{
+    QFETCH(QString, method);
+    const auto context = std::make_shared<const QSS::EncryptorContext>(method.toStdString(), "test");
+    QSS::Encryptor encryptor(context);
+    QSS::Encryptor decryptor(context);
+
+    // A whole relay read spans several AEAD chunks
+    for (size_t length : {65536, 1, 0x3FFF, 0x4000}) {
+        const std::string plain = QSS::Cipher::randomIv(length);
+        std::string data = plain;
+        const auto &segments = encryptor.encryptSegments(reinterpret_cast<uint8_t*>(&data[0]), length);
+        std::string encrypted;
+        for (const auto &segment : segments) {
+            QVERIFY(segment.length > 0);
+            encrypted.append(reinterpret_cast<const char*>(segment.data), segment.length);
+        }
+        QCOMPARE(decryptor.decrypt(encrypted), plain);
+    }
+}
+
 #ifdef USE_BOTAN2
+void Encryptor::testAesGcmEncryptInPlace()
+{
+    const std::string method("aes-256-gcm");
+    const std::string password("test");
+    QSS::Encryptor encryptor(method, password);
+    QSS::Encryptor decryptor(method, password);
+
+    // Large enough to be split into multiple chunks
+    std::string plain;
+    for (int i = 0; i < 40000; ++i) {
+        plain.push_back(static_cast<char>(i));
+    }
+    for (int i = 0; i < 2; ++i) {
+        // Reserve more headroom than required
+        const size_t headroom = encryptor.encryptOverhead(plain.length()) + 7;
+        std::string buffer = std::string(headroom, '\0') + plain;
+        buffer.resize(encryptor.encryptInPlace(reinterpret_cast<uint8_t*>(&buffer[0]),
+                                               headroom,
+                                               plain.length()));
+        QCOMPARE(decryptor.decrypt(buffer), plain);
+    }
+
+    std::string buffer = plain;
+    QVERIFY_EXCEPTION_THROWN(encryptor.encryptInPlace(reinterpret_cast<uint8_t*>(&buffer[0]),
+                                                      0,
+                                                      buffer.length()),
+                             std::length_error);
+}
+
 void Encryptor::testAesGcm()
 {
     const std::string method("aes-256-gcm");
@@ -114,7 +229,147 @@ void Encryptor::testAesGcmIncompleteChunks()
     decrypted += decryptor.decrypt(encrypted.substr(2));
     QCOMPARE(decrypted, testData);
 }
+
+void Encryptor::testAeadEverySplitPoint_data()
+{
+    QTest::addColumn<QString>("method");
+    QTest::newRow("aes-256-gcm") << QString("aes-256-gcm");
+    QTest::newRow("chacha20-ietf-poly1305") << QString("chacha20-ietf-poly1305");
+}
+
+void Encryptor::testAeadEverySplitPoint()
+{
+    QFETCH(QString, method);
+    const auto context = std::make_shared<const QSS::EncryptorContext>(method.toStdString(), "test");
+    QSS::Encryptor encryptor(context);
+
+    // Salt plus chunks of various sizes, including one of the maximum size
+    std::string plain;
+    std::string encrypted;
+    for (size_t length : {5, 300, 1, 0x3FFF, 2}) {
+        const std::string data = QSS::Cipher::randomIv(length);
+        plain += data;
+        encrypted += encryptor.encrypt(data);
+    }
+
+    for (size_t split = 0; split <= encrypted.size(); ++split) {
+        QSS::Encryptor decryptor(context);
+        std::string decrypted = decryptor.decrypt(encrypted.substr(0, split));
+        decrypted += decryptor.decrypt(encrypted.substr(split));
+        if (decrypted != plain) {
+            QFAIL(qPrintable(QString("Decryption failed when split at %1").arg(split)));
+        }
+    }
+
+    // One byte at a time
+    QSS::Encryptor decryptor(context);
+    std::string decrypted;
+    for (char c : encrypted) {
+        decrypted += decryptor.decrypt(std::string(1, c));
+    }
+    QCOMPARE(decrypted, plain);
+}
 #endif
 
+void Encryptor::testSharedContext()
+{
+    const auto context = std::make_shared<const QSS::EncryptorContext>("aes-128-cfb", "test");
+    QCOMPARE(context->method(), std::string("aes-128-cfb"));
+    QCOMPARE(context->cipherInfo().keyLen, size_t(16));
+    QVERIFY(context->backend() == QSS::Cipher::Backend::BOTAN);
+
+    QSS::Encryptor encryptor(context);
+    QSS::Encryptor decryptor(context);
+    QSS::Encryptor passwordDecryptor("aes-128-cfb", "test");
+    const std::string encrypted = encryptor.encrypt(testData);
+    QCOMPARE(decryptor.decrypt(encrypted), testData);
+    QCOMPARE(passwordDecryptor.decrypt(encrypted), testData);
+}
+
+void Encryptor::benchmarkConnection_data()
+{
+    QTest::addColumn<QString>("method");
+    QTest::addColumn<bool>("shared");
+
+    for (const char* method : {"aes-256-cfb", "chacha20-ietf-poly1305"}) {
+        if (!QSS::Cipher::isSupported(method)) {
+            continue;
+        }
+        QTest::newRow((QByteArray(method) + " password").constData()) << QString(method) << false;
+        QTest::newRow((QByteArray(method) + " context").constData()) << QString(method) << true;
+    }
+}
+
+void Encryptor::benchmarkConnection()
+{
+    QFETCH(QString, method);
+    QFETCH(bool, shared);
+    const std::string password("benchmark");
+    const auto context = std::make_shared<const QSS::EncryptorContext>(method.toStdString(), password);
+
+    QBENCHMARK {
+        std::unique_ptr<QSS::Encryptor> encryptor = shared
+                ? std::make_unique<QSS::Encryptor>(context)
+                : std::make_unique<QSS::Encryptor>(method.toStdString(), password);
+        encryptor->encrypt(testData);
+    }
+}
+
+void Encryptor::testCryptoPool_data()
+{
+    testEncryptSegments_data();
+}
+
+void Encryptor::testCryptoPool()
+{
+    QFETCH(QString, method);
+    const auto context = std::make_shared<const QSS::EncryptorContext>(
+                method.toStdString(), "test", 3);
+    QSS::Encryptor encryptor(context);
+    QSS::Encryptor decryptor(context);
+
+    // Parallel and serial sealing must carry on the same nonce sequence
+    for (size_t length : {1000000, 1, 65536, 0x3FFF, 0x4000, 100}) {
+        const std::string plain = QSS::Cipher::randomIv(length);
+        std::string data = plain;
+        std::string encrypted;
+        for (const auto &segment : encryptor.encryptSegments(reinterpret_cast<uint8_t*>(&data[0]), length)) {
+            encrypted.append(reinterpret_cast<const char*>(segment.data), segment.length);
+        }
+        QCOMPARE(decryptor.decrypt(encrypted), plain);
+    }
+}
+
+void Encryptor::benchmarkCryptoPool_data()
+{
+    QTest::addColumn<QString>("method");
+    QTest::addColumn<int>("workers");
+
+    for (const char* method : {"aes-256-gcm", "chacha20-ietf-poly1305"}) {
+        if (!QSS::Cipher::isSupported(method)) {
+            continue;
+        }
+        for (int workers : {0, 1, 2, 4}) {
+            QTest::newRow(QString("%1 %2 workers").arg(method).arg(workers).toLatin1().constData())
+                    << QString(method) << workers;
+        }
+    }
+}
+
+void Encryptor::benchmarkCryptoPool()
+{
+    QFETCH(QString, method);
+    QFETCH(int, workers);
+    const auto context = std::make_shared<const QSS::EncryptorContext>(
+                method.toStdString(), "benchmark", workers);
+    QSS::Encryptor encryptor(context);
+
+    // The throughput of a single bulk flow
+    std::string data(1024 * 1024, 'x');
+    QBENCHMARK {
+        encryptor.encryptSegments(reinterpret_cast<uint8_t*>(&data[0]), data.length());
+    }
+}
+
 QTEST_MAIN(Encryptor)
 #include "encryptor.moc"
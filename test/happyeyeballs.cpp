@@ -0,0 +1,131 @@
+#include "network/happyeyeballs.h"
+#include <QtTest>
+#include <QTcpServer>
+
+namespace {
+
+// Records whether Fast Open is asked for, which the factory turns on
+class FastOpenSocket : public QSS::QtRelaySocket
+{
+public:
+    FastOpenSocket() : QSS::QtRelaySocket(new QTcpSocket()), fastOpen(true) {}
+
+    bool setFastOpen(bool enabled) override
+    {
+        fastOpen = enabled;
+        return true;
+    }
+
+    bool fastOpen;
+};
+
+}  // namespace
+
+class HappyEyeballs : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void testInterleave();
+    void testFallback();
+    void testAttemptDelay();
+    void testAllFailed();
+    void testNoFastOpen();
+
+private:
+    QTcpServer server;
+    std::unique_ptr<QSS::HappyEyeballs> eyeballs;
+};
+
+void HappyEyeballs::init()
+{
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    eyeballs = std::make_unique<QSS::HappyEyeballs>([]() {
+        return new QSS::QtRelaySocket(new QTcpSocket());
+    });
+}
+
+void HappyEyeballs::cleanup()
+{
+    eyeballs.reset();
+    server.close();
+}
+
+void HappyEyeballs::testInterleave()
+{
+    const QHostAddress v4a("192.0.2.1");
+    const QHostAddress v4b("192.0.2.2");
+    const QHostAddress v4c("192.0.2.3");
+    const QHostAddress v6a("2001:db8::1");
+    const QHostAddress v6b("2001:db8::2");
+
+    std::vector<QHostAddress> expected { v6a, v4a, v6b, v4b, v4c };
+    QCOMPARE(QSS::HappyEyeballs::interleave({ v6a, v6b, v4a, v4b, v4c }), expected);
+    expected = { v4a, v6a, v4b, v6b, v4c };
+    QCOMPARE(QSS::HappyEyeballs::interleave({ v4a, v4b, v4c, v6a, v6b }), expected);
+    QVERIFY(QSS::HappyEyeballs::interleave({}).empty());
+}
+
+void HappyEyeballs::testFallback()
+{
+    // Nothing listens on the IPv6 loopback, so that one is refused
+    QSignalSpy connectedSpy(eyeballs.get(), &QSS::HappyEyeballs::connected);
+    eyeballs->setAttemptDelay(10000);
+    eyeballs->connectToHost({ QHostAddress(QHostAddress::LocalHostIPv6),
+                              QHostAddress(QHostAddress::LocalHost) },
+                            server.serverPort());
+    QVERIFY(connectedSpy.wait());
+    QCOMPARE(eyeballs->address(), QHostAddress(QHostAddress::LocalHost));
+
+    std::unique_ptr<QSS::RelaySocket> socket = eyeballs->takeSocket();
+    QVERIFY(socket);
+    QCOMPARE(socket->peerPort(), server.serverPort());
+}
+
+void HappyEyeballs::testAttemptDelay()
+{
+    // TEST-NET-1 either never answers or is unreachable, and loses either way
+    QSignalSpy connectedSpy(eyeballs.get(), &QSS::HappyEyeballs::connected);
+    eyeballs->setAttemptDelay(50);
+    eyeballs->connectToHost({ QHostAddress("192.0.2.1"), QHostAddress(QHostAddress::LocalHost) },
+                            server.serverPort());
+    QVERIFY(connectedSpy.wait(5000));
+    QCOMPARE(eyeballs->address(), QHostAddress(QHostAddress::LocalHost));
+}
+
+void HappyEyeballs::testAllFailed()
+{
+    const quint16 port = server.serverPort();
+    server.close();
+    QSignalSpy failedSpy(eyeballs.get(), &QSS::HappyEyeballs::failed);
+    QSignalSpy connectedSpy(eyeballs.get(), &QSS::HappyEyeballs::connected);
+    eyeballs->connectToHost({ QHostAddress(QHostAddress::LocalHostIPv6),
+                              QHostAddress(QHostAddress::LocalHost) },
+                            port);
+    QVERIFY(failedSpy.wait());
+    QCOMPARE(failedSpy.count(), 1);
+    QCOMPARE(connectedSpy.count(), 0);
+    QVERIFY(!eyeballs->takeSocket());
+}
+
+void HappyEyeballs::testNoFastOpen()
+{
+    // Fast Open would connect every attempt at once, leaving nothing to race
+    eyeballs = std::make_unique<QSS::HappyEyeballs>([]() {
+        return new FastOpenSocket();
+    });
+    QSignalSpy connectedSpy(eyeballs.get(), &QSS::HappyEyeballs::connected);
+    eyeballs->connectToHost({ QHostAddress(QHostAddress::LocalHostIPv6),
+                              QHostAddress(QHostAddress::LocalHost) },
+                            server.serverPort());
+    QVERIFY(connectedSpy.wait());
+
+    std::unique_ptr<QSS::RelaySocket> socket = eyeballs->takeSocket();
+    QVERIFY(socket);
+    QVERIFY(!static_cast<FastOpenSocket *>(socket.get())->fastOpen);
+}
+
+QTEST_MAIN(HappyEyeballs)
+#include "happyeyeballs.moc"
@@ -0,0 +1,256 @@
+#include "network/muxsession.h"
+#include <QtTest>
+#include <QTcpServer>
+
+namespace {
+
+const std::string method("chacha20-ietf-poly1305");
+const std::string password("test");
+
+// Reads whatever stream has got into received
+void readAll(QSS::RelaySocket *stream, std::string &received)
+{
+    char buffer[65536];
+    qint64 n;
+    while ((n = stream->read(buffer, sizeof(buffer))) > 0) {
+        received.append(buffer, n);
+    }
+}
+
+}  // namespace
+
+class MuxSession : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void testStreams();
+    void testClose();
+    void testFlowControl();
+    void testCarrierClosed();
+    void testIdle();
+    void testMaxStreams();
+
+private:
+    QSS::TimingWheel wheel { 10 };
+    QTcpServer listener;
+    std::unique_ptr<QSS::MuxSession> client;
+    std::unique_ptr<QSS::MuxSession> server;
+    // The streams the server got, owned by the test the same as by relays
+    std::vector<std::unique_ptr<QSS::MuxStreamSocket>> incoming;
+    QSS::RelaySocket *carrier;
+
+    // Connects a client session to a server one, which ends up in server
+    void startSessions(int idleTimeout);
+    // Opens a stream on the client, and waits for the server to get it
+    void openStream(std::unique_ptr<QSS::MuxStreamSocket> &result);
+};
+
+void MuxSession::init()
+{
+    QVERIFY(listener.listen(QHostAddress::LocalHost));
+    startSessions(0);
+}
+
+void MuxSession::startSessions(int idleTimeout)
+{
+    client = std::make_unique<QSS::MuxSession>(QSS::MuxSession::Role::CLIENT,
+                                               new QSS::QtRelaySocket(new QTcpSocket()),
+                                               std::make_unique<QSS::Encryptor>(method, password),
+                                               &wheel,
+                                               idleTimeout);
+    client->connectToServer(QSS::Address(QHostAddress(QHostAddress::LocalHost),
+                                         listener.serverPort()));
+    QTRY_VERIFY(listener.hasPendingConnections());
+    QTcpSocket *accepted = listener.nextPendingConnection();
+    accepted->setParent(nullptr);
+    carrier = new QSS::QtRelaySocket(accepted);
+
+    // Reads the preamble, which is what TcpRelayServer does
+    std::string received;
+    connect(carrier, &QSS::RelaySocket::readyRead, this, [this, &received]() {
+        readAll(carrier, received);
+    });
+    QTRY_VERIFY(!received.empty());
+    carrier->disconnect(this);
+    auto encryptor = std::make_unique<QSS::Encryptor>(method, password);
+    const std::string plain = encryptor->decrypt(received);
+    QCOMPARE(plain.size(), size_t(2));
+    QCOMPARE(uint8_t(plain[0]), QSS::MuxSession::PREAMBLE);
+    QCOMPARE(uint8_t(plain[1]), QSS::MuxSession::VERSION);
+
+    server = std::make_unique<QSS::MuxSession>(QSS::MuxSession::Role::SERVER,
+                                               carrier,
+                                               std::move(encryptor),
+                                               &wheel,
+                                               idleTimeout);
+    connect(server.get(), &QSS::MuxSession::incomingStream, [this](QSS::MuxStreamSocket *s) {
+        incoming.emplace_back(s);
+    });
+    server->start(plain.substr(2));
+}
+
+void MuxSession::cleanup()
+{
+    incoming.clear();
+    client.reset();
+    server.reset();
+    listener.close();
+}
+
+void MuxSession::openStream(std::unique_ptr<QSS::MuxStreamSocket> &result)
+{
+    std::unique_ptr<QSS::MuxStreamSocket> stream(client->createStream());
+    const size_t count = incoming.size();
+    QSignalSpy connectedSpy(stream.get(), &QSS::RelaySocket::connected);
+    stream->connectToHost(QHostAddress(), 0);
+    QVERIFY(connectedSpy.wait());
+    QTRY_COMPARE(incoming.size(), count + 1);
+    result = std::move(stream);
+}
+
+void MuxSession::testStreams()
+{
+    std::unique_ptr<QSS::MuxStreamSocket> first;
+    std::unique_ptr<QSS::MuxStreamSocket> second;
+    openStream(first);
+    openStream(second);
+    QVERIFY(first && second);
+    QCOMPARE(client->streamCount(), 2);
+    QCOMPARE(server->streamCount(), 2);
+
+    std::string firstReceived;
+    std::string secondReceived;
+    connect(incoming[0].get(), &QSS::RelaySocket::readyRead, [&]() {
+        readAll(incoming[0].get(), firstReceived);
+    });
+    connect(incoming[1].get(), &QSS::RelaySocket::readyRead, [&]() {
+        readAll(incoming[1].get(), secondReceived);
+    });
+    QCOMPARE(first->write(QByteArray("first")), qint64(5));
+    QCOMPARE(second->write(QByteArray("second")), qint64(6));
+    QTRY_COMPARE(firstReceived, std::string("first"));
+    QTRY_COMPARE(secondReceived, std::string("second"));
+
+    std::string echoed;
+    connect(second.get(), &QSS::RelaySocket::readyRead, [&]() {
+        readAll(second.get(), echoed);
+    });
+    incoming[1]->write(QByteArray("echo"));
+    QTRY_COMPARE(echoed, std::string("echo"));
+    QCOMPARE(second->peerPort(), listener.serverPort());
+}
+
+void MuxSession::testClose()
+{
+    std::unique_ptr<QSS::MuxStreamSocket> stream;
+    openStream(stream);
+    QVERIFY(stream);
+    std::string received;
+    connect(incoming[0].get(), &QSS::RelaySocket::readyRead, [&]() {
+        readAll(incoming[0].get(), received);
+    });
+    QSignalSpy disconnectedSpy(incoming[0].get(), &QSS::RelaySocket::disconnected);
+
+    // What's written before closing still gets through, ahead of FIN
+    stream->write(QByteArray("bye"));
+    stream->close();
+    stream.reset();
+    QTRY_COMPARE(disconnectedSpy.count(), 1);
+    QCOMPARE(received, std::string("bye"));
+    QCOMPARE(client->streamCount(), 0);
+
+    incoming.clear();
+    QCOMPARE(server->streamCount(), 0);
+    QVERIFY(!client->isClosed());
+}
+
+void MuxSession::testFlowControl()
+{
+    const int length = 4 * 1024 * 1024;
+    std::unique_ptr<QSS::MuxStreamSocket> stream;
+    openStream(stream);
+    QVERIFY(stream);
+    QSS::MuxStreamSocket *peer = incoming[0].get();
+    peer->setReadPaused(true);
+
+    QCOMPARE(stream->write(QByteArray(length, 'a')), qint64(length));
+    // The window holds the rest back while the peer isn't reading
+    QTest::qWait(200);
+    QVERIFY(stream->bytesToWrite() >= length - qint64(QSS::MuxSession::WINDOW));
+
+    std::string received;
+    connect(peer, &QSS::RelaySocket::readyRead, [&]() {
+        readAll(peer, received);
+    });
+    peer->setReadPaused(false);
+    QTRY_COMPARE_WITH_TIMEOUT(received.size(), size_t(length), 10000);
+    QCOMPARE(received, std::string(length, 'a'));
+    QTRY_COMPARE(stream->bytesToWrite(), qint64(0));
+}
+
+void MuxSession::testCarrierClosed()
+{
+    std::unique_ptr<QSS::MuxStreamSocket> stream;
+    openStream(stream);
+    QVERIFY(stream);
+    QSignalSpy errorSpy(stream.get(), &QSS::RelaySocket::errorOccurred);
+    QSignalSpy finishedSpy(client.get(), &QSS::MuxSession::finished);
+
+    carrier->close();
+    QTRY_COMPARE(finishedSpy.count(), 1);
+    QTRY_COMPARE(errorSpy.count(), 1);
+    QVERIFY(client->isClosed());
+    QVERIFY(!client->isAvailable());
+    QCOMPARE(stream->write(QByteArray("late")), qint64(-1));
+}
+
+void MuxSession::testIdle()
+{
+    incoming.clear();
+    client.reset();
+    server.reset();
+    startSessions(50);
+    QVERIFY(server);
+    QSignalSpy clientSpy(client.get(), &QSS::MuxSession::finished);
+    QSignalSpy serverSpy(server.get(), &QSS::MuxSession::finished);
+
+    // A quiet stream keeps the session, which is pinged all along
+    std::unique_ptr<QSS::MuxStreamSocket> stream;
+    openStream(stream);
+    QVERIFY(stream);
+    QTest::qWait(500);
+    QVERIFY(!client->isClosed());
+    QVERIFY(!server->isClosed());
+
+    // Without streams, the client closes it and so does the server
+    stream.reset();
+    incoming.clear();
+    QTRY_COMPARE(clientSpy.count(), 1);
+    QTRY_COMPARE(serverSpy.count(), 1);
+}
+
+void MuxSession::testMaxStreams()
+{
+    std::vector<std::unique_ptr<QSS::MuxStreamSocket>> streams;
+    for (int i = 0; i < QSS::MuxSession::MAX_STREAMS; ++i) {
+        QVERIFY(client->isAvailable());
+        streams.emplace_back(client->createStream());
+    }
+    QCOMPARE(client->streamCount(), QSS::MuxSession::MAX_STREAMS);
+    QVERIFY(!client->isAvailable());
+
+    std::unique_ptr<QSS::MuxStreamSocket> extra(client->createStream());
+    QSignalSpy errorSpy(extra.get(), &QSS::RelaySocket::errorOccurred);
+    QVERIFY(errorSpy.wait());
+    QCOMPARE(extra->error(), QAbstractSocket::SocketResourceError);
+    QVERIFY(!client->isClosed());
+
+    streams.pop_back();
+    QVERIFY(client->isAvailable());
+}
+
+QTEST_MAIN(MuxSession)
+#include "muxsession.moc"
@@ -30,6 +30,23 @@ void Profile::testConstructorEmpty()
     QCOMPARE(600, p.timeout());
     QVERIFY(!p.debug());
     QVERIFY(!p.httpProxy());
+    QCOMPARE(0, p.cryptoWorkers());
+    QCOMPARE(0, p.workers());
+    QVERIFY(!p.reusePort());
+    QVERIFY(!p.incomingCpu());
+    QVERIFY(!p.epollEngine());
+    QVERIFY(!p.ioUring());
+    QCOMPARE(1024 * 1024, p.highWatermark());
+    QCOMPARE(256 * 1024, p.lowWatermark());
+    QCOMPARE(256 * 1024, p.readBudget());
+    QCOMPARE(10, p.connectTimeout());
+    QCOMPARE(30, p.handshakeTimeout());
+    QCOMPARE(250, p.trafficInterval());
+    QVERIFY(!p.mux());
+    QCOMPARE(4, p.muxConnections());
+    QCOMPARE(0, p.poolSize());
+    QCOMPARE(10, p.poolIdleTimeout());
+    QVERIFY(!p.fastOpen());
 }
 
 void Profile::testFromUri()
@@ -0,0 +1,115 @@
+#include "crypto/randompool.h"
+#include <QtTest>
+#include <QThread>
+
+#ifdef Q_OS_UNIX
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+class SaltThread : public QThread
+{
+public:
+    std::string salt;
+
+protected:
+    void run() override
+    {
+        salt = QSS::RandomPool::bytes(32);
+    }
+};
+
+class RandomPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    RandomPool() = default;
+
+private Q_SLOTS:
+    void testBytes();
+    void testStats();
+    void testThreads();
+    void testFork();
+    void benchmarkSalt();
+};
+
+void RandomPool::testBytes()
+{
+    QVERIFY(QSS::RandomPool::bytes(0).empty());
+
+    const std::string a = QSS::RandomPool::bytes(32);
+    const std::string b = QSS::RandomPool::bytes(32);
+    QCOMPARE(a.size(), size_t(32));
+    QVERIFY(a != b);
+
+    // Larger than a block
+    const std::string c = QSS::RandomPool::bytes(QSS::RandomPool::BLOCK_SIZE * 2 + 7);
+    QCOMPARE(c.size(), QSS::RandomPool::BLOCK_SIZE * 2 + 7);
+    QVERIFY(c.find(std::string(64, '\0')) == std::string::npos);
+}
+
+void RandomPool::testStats()
+{
+    const QSS::RandomPool::Stats before = QSS::RandomPool::stats();
+    QSS::RandomPool::bytes(QSS::RandomPool::BLOCK_SIZE + 1);
+    const QSS::RandomPool::Stats after = QSS::RandomPool::stats();
+    QCOMPARE(after.bytesServed - before.bytesServed, uint64_t(QSS::RandomPool::BLOCK_SIZE + 1));
+    QVERIFY(after.refills - before.refills >= 1);
+    QVERIFY(after.refills - before.refills <= 2);
+}
+
+void RandomPool::testThreads()
+{
+    const QSS::RandomPool::Stats before = QSS::RandomPool::stats();
+    SaltThread thread;
+    thread.start();
+    QVERIFY(thread.wait(5000));
+
+    // The new thread seeds its own RNG
+    QCOMPARE(QSS::RandomPool::stats().reseeds - before.reseeds, uint64_t(1));
+    QCOMPARE(thread.salt.size(), size_t(32));
+    QVERIFY(thread.salt != QSS::RandomPool::bytes(32));
+}
+
+void RandomPool::testFork()
+{
+#ifdef Q_OS_UNIX
+    // Leave bytes generated ahead in the pool of this thread
+    QSS::RandomPool::bytes(32);
+
+    int fds[2];
+    QCOMPARE(pipe(fds), 0);
+    const pid_t pid = fork();
+    QVERIFY(pid != -1);
+    if (pid == 0) {
+        close(fds[0]);
+        const std::string salt = QSS::RandomPool::bytes(32);
+        const bool ok = write(fds[1], salt.data(), salt.size()) == ssize_t(salt.size());
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    std::string childSalt(32, '\0');
+    const ssize_t n = read(fds[0], &childSalt[0], childSalt.size());
+    close(fds[0]);
+    int status = 0;
+    QCOMPARE(waitpid(pid, &status, 0), pid);
+    QVERIFY(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    QCOMPARE(n, ssize_t(32));
+
+    // The child reseeded instead of handing out the same bytes
+    QVERIFY(childSalt != QSS::RandomPool::bytes(32));
+#else
+    QSKIP("fork() is unavailable");
+#endif
+}
+
+void RandomPool::benchmarkSalt()
+{
+    QBENCHMARK {
+        QSS::RandomPool::bytes(32);
+    }
+}
+
+QTEST_MAIN(RandomPool)
+#include "randompool.moc"
@@ -0,0 +1,103 @@
+#include "util/registry.h"
+#include <QtTest>
+#include <set>
+#include <string>
+
+class Registry : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testAddFind();
+    void testStaleId();
+    void testForEach();
+    void testTag();
+    void benchmarkChurn();
+};
+
+void Registry::testAddFind()
+{
+    QSS::Registry<std::string> registry;
+    const auto a = registry.add(std::make_unique<std::string>("a"));
+    const auto b = registry.add(std::make_unique<std::string>("b"));
+    QVERIFY(a != 0 && b != 0 && a != b);
+    QCOMPARE(registry.size(), size_t(2));
+    QCOMPARE(*registry.find(a), std::string("a"));
+    QCOMPARE(*registry.find(b), std::string("b"));
+    QVERIFY(registry.find(0) == nullptr);
+
+    QVERIFY(registry.remove(a));
+    QVERIFY(!registry.remove(a));
+    QVERIFY(registry.find(a) == nullptr);
+    QCOMPARE(registry.size(), size_t(1));
+}
+
+void Registry::testStaleId()
+{
+    QSS::Registry<std::string> registry;
+    const auto a = registry.add(std::make_unique<std::string>("a"));
+    registry.remove(a);
+    // The slot is reused, but under a new generation
+    const auto c = registry.add(std::make_unique<std::string>("c"));
+    QCOMPARE(static_cast<uint32_t>(c), static_cast<uint32_t>(a));
+    QVERIFY(c != a);
+    QVERIFY(registry.find(a) == nullptr);
+    QVERIFY(!registry.remove(a));
+    QCOMPARE(*registry.find(c), std::string("c"));
+}
+
+void Registry::testForEach()
+{
+    QSS::Registry<int> registry;
+    std::set<QSS::Registry<int>::Id> ids;
+    for (int i = 0; i < 10; ++i) {
+        ids.insert(registry.add(std::make_unique<int>(i)));
+    }
+    registry.remove(*ids.begin());
+    ids.erase(ids.begin());
+
+    std::set<QSS::Registry<int>::Id> visited;
+    int sum = 0;
+    registry.forEach([&](QSS::Registry<int>::Id id, int *value) {
+        visited.insert(id);
+        QCOMPARE(registry.find(id), value);
+        sum += *value;
+    });
+    QVERIFY(visited == ids);
+    // The first ID is the one of 0
+    QCOMPARE(sum, 45);
+}
+
+void Registry::testTag()
+{
+    QSS::Registry<int> first(1);
+    QSS::Registry<int> second(2);
+    const auto a = first.add(std::make_unique<int>(1));
+    const auto b = second.add(std::make_unique<int>(2));
+    // The same slot and generation in either, but told apart by the tag
+    QCOMPARE(static_cast<uint32_t>(a), static_cast<uint32_t>(b));
+    QVERIFY(a != b);
+    QCOMPARE(QSS::Registry<int>::tagOf(a), uint32_t(1));
+    QCOMPARE(QSS::Registry<int>::tagOf(b), uint32_t(2));
+    QVERIFY(second.find(a) == nullptr);
+    QVERIFY(!second.remove(a));
+    QCOMPARE(*first.find(a), 1);
+}
+
+void Registry::benchmarkChurn()
+{
+    QSS::Registry<int> registry;
+    std::vector<QSS::Registry<int>::Id> ids;
+    for (int i = 0; i < 50000; ++i) {
+        ids.push_back(registry.add(std::make_unique<int>(i)));
+    }
+    size_t next = 0;
+    QBENCHMARK {
+        registry.remove(ids[next]);
+        ids[next] = registry.add(std::make_unique<int>(0));
+        next = (next * 7919 + 1) % ids.size();
+    }
+}
+
+QTEST_MAIN(Registry)
+#include "registry.moc"
@@ -0,0 +1,382 @@
+#include "network/relaysocket.h"
+#include "network/epollengine.h"
+#include "network/iouringengine.h"
+#include <QtTest>
+#include <QTcpServer>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#ifdef Q_OS_UNIX
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Hands out the descriptors of accepted connections, the same as TcpWorker gets
+class DescriptorServer : public QTcpServer
+{
+public:
+    std::vector<qintptr> descriptors;
+    std::function<void(qintptr)> onIncoming;
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override
+    {
+        if (onIncoming) {
+            onIncoming(socketDescriptor);
+        } else {
+            descriptors.push_back(socketDescriptor);
+        }
+    }
+};
+
+#ifdef Q_OS_UNIX
+// Connects to port with a blocking socket, sends length bytes and closes it
+void sendBlocking(uint16_t port, size_t length)
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+        const std::vector<char> chunk(65536, 'x');
+        while (length > 0) {
+            const ssize_t n = ::send(fd, chunk.data(), std::min(length, chunk.size()), 0);
+            if (n <= 0) {
+                break;
+            }
+            length -= n;
+        }
+    }
+    ::close(fd);
+}
+#endif
+
+}  // namespace
+
+class RelaySocket : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testConnectAndEcho_data();
+    void testConnectAndEcho();
+    void testLargeTransfer_data();
+    void testLargeTransfer();
+    void testReadPaused_data();
+    void testReadPaused();
+    void testCloseWithBacklog_data();
+    void testCloseWithBacklog();
+    void testWrittenDirectly_data();
+    void testWrittenDirectly();
+#ifdef Q_OS_UNIX
+    void benchmarkThroughput_data();
+    void benchmarkThroughput();
+    void benchmarkConnections_data();
+    void benchmarkConnections();
+#endif
+
+private:
+#ifdef Q_OS_LINUX
+    QSS::EpollEngine epoll;
+    // Created on demand since its constructor throws if io_uring is unusable
+    std::unique_ptr<QSS::IoUringEngine> ring;
+#endif
+
+    void addEngines();
+    std::unique_ptr<QSS::RelaySocket> create(qintptr socketDescriptor = -1);
+};
+
+void RelaySocket::addEngines()
+{
+    QTest::addColumn<QString>("engine");
+    QTest::newRow("qt") << QString("qt");
+#ifdef Q_OS_LINUX
+    QTest::newRow("epoll") << QString("epoll");
+    if (QSS::IoUringEngine::isSupported()) {
+        QTest::newRow("io_uring") << QString("io_uring");
+    }
+#endif
+}
+
+std::unique_ptr<QSS::RelaySocket> RelaySocket::create(qintptr socketDescriptor)
+{
+    QFETCH(QString, engine);
+#ifdef Q_OS_LINUX
+    if (engine == "epoll") {
+        return std::make_unique<QSS::EpollRelaySocket>(&epoll, socketDescriptor);
+    }
+    if (engine == "io_uring") {
+        if (!ring) {
+            ring = std::make_unique<QSS::IoUringEngine>();
+        }
+        return std::make_unique<QSS::IoUringRelaySocket>(ring.get(), socketDescriptor);
+    }
+#else
+    Q_UNUSED(engine)
+#endif
+    auto socket = new QTcpSocket();
+    if (socketDescriptor != -1) {
+        socket->setSocketDescriptor(socketDescriptor);
+    }
+    return std::make_unique<QSS::QtRelaySocket>(socket);
+}
+
+void RelaySocket::testWrittenDirectly_data()
+{
+    addEngines();
+}
+
+void RelaySocket::testWrittenDirectly()
+{
+    QFETCH(QString, engine);
+    auto socket = create();
+    // Only epoll finds out about errors of writes that bypass it
+    QCOMPARE(socket->canWriteDirectly(), engine == "epoll");
+
+    // bytesWritten comes after the writer has returned to the event loop
+    QSignalSpy writtenSpy(socket.get(), &QSS::RelaySocket::bytesWritten);
+    socket->writtenDirectly(10);
+    QCOMPARE(writtenSpy.count(), 0);
+    QVERIFY(writtenSpy.wait());
+    QCOMPARE(writtenSpy.at(0).at(0).toLongLong(), qint64(10));
+}
+
+void RelaySocket::testConnectAndEcho_data()
+{
+    addEngines();
+}
+
+void RelaySocket::testConnectAndEcho()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    auto socket = create();
+    QSignalSpy connectedSpy(socket.get(), &QSS::RelaySocket::connected);
+    QSignalSpy disconnectedSpy(socket.get(), &QSS::RelaySocket::disconnected);
+    std::string received;
+    connect(socket.get(), &QSS::RelaySocket::readyRead, [&socket, &received]() {
+        char buffer[4096];
+        qint64 n;
+        while ((n = socket->read(buffer, sizeof(buffer))) > 0) {
+            received.append(buffer, n);
+        }
+    });
+
+    socket->connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QTRY_COMPARE(connectedSpy.count(), 1);
+    QTRY_VERIFY(server.hasPendingConnections());
+    std::unique_ptr<QTcpSocket> peer(server.nextPendingConnection());
+    QCOMPARE(socket->peerPort(), server.serverPort());
+    QCOMPARE(socket->localPort(), peer->peerPort());
+
+    QCOMPARE(socket->write(QByteArray("ping")), qint64(4));
+    QTRY_COMPARE(peer->bytesAvailable(), qint64(4));
+    QCOMPARE(peer->readAll(), QByteArray("ping"));
+
+    peer->write("pong");
+    QTRY_COMPARE(received, std::string("pong"));
+
+    peer->close();
+    QTRY_COMPARE(disconnectedSpy.count(), 1);
+}
+
+void RelaySocket::testLargeTransfer_data()
+{
+    addEngines();
+}
+
+void RelaySocket::testLargeTransfer()
+{
+    // More than the kernel buffers take, so that both sides have to wait
+    const size_t length = 16 * 1024 * 1024;
+    DescriptorServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QTcpSocket peer;
+    peer.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(peer.waitForConnected());
+    QTRY_COMPARE(server.descriptors.size(), size_t(1));
+
+    auto socket = create(server.descriptors.front());
+    size_t received = 0;
+    connect(socket.get(), &QSS::RelaySocket::readyRead, [&socket, &received]() {
+        char buffer[65536];
+        qint64 n;
+        while ((n = socket->read(buffer, sizeof(buffer))) > 0) {
+            received += n;
+        }
+    });
+    qint64 written = 0;
+    connect(socket.get(), &QSS::RelaySocket::bytesWritten, [&written](qint64 bytes) {
+        written += bytes;
+    });
+
+    const QByteArray data(length, 'a');
+    QCOMPARE(socket->write(data), qint64(length));
+    QByteArray echoed;
+    QTRY_VERIFY_WITH_TIMEOUT((echoed += peer.readAll()).size() == int(length), 10000);
+    QCOMPARE(echoed, data);
+    QTRY_COMPARE(written, qint64(length));
+    QCOMPARE(socket->bytesToWrite(), qint64(0));
+
+    peer.write(data);
+    QTRY_COMPARE_WITH_TIMEOUT(received, length, 10000);
+}
+
+void RelaySocket::testReadPaused_data()
+{
+    addEngines();
+}
+
+void RelaySocket::testReadPaused()
+{
+    DescriptorServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QTcpSocket peer;
+    peer.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(peer.waitForConnected());
+    QTRY_COMPARE(server.descriptors.size(), size_t(1));
+
+    auto socket = create(server.descriptors.front());
+    socket->setReadBufferSize(65536);
+    QSignalSpy readyReadSpy(socket.get(), &QSS::RelaySocket::readyRead);
+    size_t received = 0;
+    connect(socket.get(), &QSS::RelaySocket::readyRead, [&socket, &received]() {
+        char buffer[65536];
+        qint64 n;
+        while ((n = socket->read(buffer, sizeof(buffer))) > 0) {
+            received += n;
+        }
+    });
+
+    socket->setReadPaused(true);
+    const size_t length = 1024 * 1024;
+    peer.write(QByteArray(length, 'a'));
+    QTest::qWait(200);
+    QCOMPARE(readyReadSpy.count(), 0);
+
+    socket->setReadPaused(false);
+    QTRY_COMPARE_WITH_TIMEOUT(received, length, 10000);
+}
+
+void RelaySocket::testCloseWithBacklog_data()
+{
+    QTest::addColumn<QString>("engine");
+    QTest::addColumn<bool>("deleted");
+    QTest::newRow("qt") << QString("qt") << false;
+    QTest::newRow("qt deleted") << QString("qt") << true;
+#ifdef Q_OS_LINUX
+    QTest::newRow("epoll") << QString("epoll") << false;
+    QTest::newRow("epoll deleted") << QString("epoll") << true;
+    if (QSS::IoUringEngine::isSupported()) {
+        QTest::newRow("io_uring") << QString("io_uring") << false;
+        QTest::newRow("io_uring deleted") << QString("io_uring") << true;
+    }
+#endif
+}
+
+void RelaySocket::testCloseWithBacklog()
+{
+    QFETCH(bool, deleted);
+    const int length = 16 * 1024 * 1024;
+    DescriptorServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QTcpSocket peer;
+    peer.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(peer.waitForConnected());
+    QTRY_COMPARE(server.descriptors.size(), size_t(1));
+
+    // Closed, and perhaps deleted, long before the kernel could take all of it
+    auto socket = create(server.descriptors.front());
+    const QByteArray data(length, 'a');
+    QCOMPARE(socket->write(data), qint64(length));
+    socket->close();
+    if (deleted) {
+        socket.reset();
+    }
+
+    QByteArray received;
+    QTRY_VERIFY_WITH_TIMEOUT((received += peer.readAll()).size() == length
+                             && peer.state() == QAbstractSocket::UnconnectedState, 10000);
+    QCOMPARE(received, data);
+}
+
+#ifdef Q_OS_UNIX
+void RelaySocket::benchmarkThroughput_data()
+{
+    addEngines();
+}
+
+void RelaySocket::benchmarkThroughput()
+{
+    // Received by one socket from a blocking writer on another thread
+    const size_t length = 256 * 1024 * 1024;
+    QBENCHMARK {
+        DescriptorServer server;
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+        std::thread writer(sendBlocking, server.serverPort(), length);
+        QTRY_COMPARE(server.descriptors.size(), size_t(1));
+
+        auto socket = create(server.descriptors.front());
+        socket->setReadBufferSize(65536);
+        size_t received = 0;
+        bool done = false;
+        std::vector<char> buffer(65536);
+        connect(socket.get(), &QSS::RelaySocket::readyRead, [&]() {
+            received += std::max<qint64>(socket->read(buffer.data(), buffer.size()), 0);
+        });
+        connect(socket.get(), &QSS::RelaySocket::disconnected, [&done]() {
+            done = true;
+        });
+        QTRY_VERIFY_WITH_TIMEOUT(done, 60000);
+        writer.join();
+        QCOMPARE(received, length);
+    }
+}
+
+void RelaySocket::benchmarkConnections_data()
+{
+    addEngines();
+}
+
+void RelaySocket::benchmarkConnections()
+{
+    // Short connections served on this thread, i.e. connections per core
+    const int connections = 500;
+    QBENCHMARK {
+        DescriptorServer server;
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+        std::vector<std::unique_ptr<QSS::RelaySocket> > sockets;
+        int finished = 0;
+        char buffer[4096];
+        server.onIncoming = [&](qintptr socketDescriptor) {
+            sockets.push_back(create(socketDescriptor));
+            QSS::RelaySocket *socket = sockets.back().get();
+            connect(socket, &QSS::RelaySocket::readyRead, [socket, &buffer]() {
+                socket->read(buffer, sizeof(buffer));
+            });
+            connect(socket, &QSS::RelaySocket::disconnected, [&finished]() {
+                ++finished;
+            });
+        };
+
+        std::thread clients([&server]() {
+            for (int i = 0; i < connections; ++i) {
+                sendBlocking(server.serverPort(), 1024);
+            }
+        });
+        QTRY_COMPARE_WITH_TIMEOUT(finished, connections, 60000);
+        clients.join();
+    }
+}
+#endif
+
+QTEST_MAIN(RelaySocket)
+#include "relaysocket.moc"
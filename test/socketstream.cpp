@@ -0,0 +1,127 @@
+#include "network/socketstream.h"
+#include <QtTest>
+#include <QNetworkProxy>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#ifdef Q_OS_LINUX
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+class SocketStream : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testStream();
+    void testLargeTransfer();
+    void testHalfCloseTimeout();
+
+private:
+    QTcpServer server;
+
+    // Connects client to the server and returns the accepted socket
+    std::unique_ptr<QTcpSocket> connectPair(QTcpSocket &client);
+};
+
+std::unique_ptr<QTcpSocket> SocketStream::connectPair(QTcpSocket &client)
+{
+    if (!server.isListening()) {
+        server.listen(QHostAddress::LocalHost);
+    }
+    client.setProxy(QNetworkProxy::NoProxy);
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    if (!client.waitForConnected() || !server.waitForNewConnection(3000)) {
+        return nullptr;
+    }
+    return std::unique_ptr<QTcpSocket>(server.nextPendingConnection());
+}
+
+void SocketStream::testStream()
+{
+    QTcpSocket clientA;
+    QTcpSocket clientB;
+    auto a = connectPair(clientA);
+    auto b = connectPair(clientB);
+    QVERIFY(a && b);
+
+    // Buffered before the stream is set up
+    clientA.write("early");
+    QTRY_VERIFY(a->bytesAvailable() > 0);
+
+    QSS::SocketStream stream(a.get(), b.get());
+    QSignalSpy finishedSpy(&stream, &QSS::SocketStream::finished);
+    QByteArray received;
+    QTRY_VERIFY((received += clientB.readAll()) == "early");
+
+    clientB.write("pong");
+    QTRY_COMPARE(clientA.readAll(), QByteArray("pong"));
+#ifdef Q_OS_LINUX
+    QTRY_VERIFY(stream.isSpliced());
+#endif
+    clientA.write("ping");
+    QTRY_COMPARE(clientB.readAll(), QByteArray("ping"));
+
+    if (stream.isSpliced()) {
+        // The end of each direction is passed on separately
+        clientA.disconnectFromHost();
+        QTRY_COMPARE(clientB.state(), QAbstractSocket::UnconnectedState);
+        QTRY_COMPARE(finishedSpy.count(), 1);
+    }
+}
+
+void SocketStream::testLargeTransfer()
+{
+    const QByteArray data(8 * 1024 * 1024, 'a');
+    QTcpSocket clientA;
+    QTcpSocket clientB;
+    auto a = connectPair(clientA);
+    auto b = connectPair(clientB);
+    QVERIFY(a && b);
+
+    QSS::SocketStream stream(a.get(), b.get());
+    clientA.write(data);
+    clientB.write(data);
+    QByteArray receivedA;
+    QByteArray receivedB;
+    QTRY_VERIFY_WITH_TIMEOUT((receivedA += clientA.readAll()).size() == data.size()
+                             && (receivedB += clientB.readAll()).size() == data.size(), 10000);
+    QCOMPARE(receivedA, data);
+    QCOMPARE(receivedB, data);
+}
+
+void SocketStream::testHalfCloseTimeout()
+{
+#ifndef Q_OS_LINUX
+    QSKIP("Only a spliced stream waits for both directions");
+#else
+    QTcpSocket clientA;
+    auto a = connectPair(clientA);
+    QVERIFY(a);
+    // A peer that neither sends nor closes, which QTcpSocket can't be
+    const int clientB = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.serverPort());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    QCOMPARE(::connect(clientB, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+    QVERIFY(server.waitForNewConnection(3000));
+    std::unique_ptr<QTcpSocket> b(server.nextPendingConnection());
+
+    QSS::SocketStream stream(a.get(), b.get());
+    stream.setHalfCloseTimeout(100);
+    QSignalSpy finishedSpy(&stream, &QSS::SocketStream::finished);
+    QTRY_VERIFY(stream.isSpliced());
+
+    clientA.disconnectFromHost();
+    QTRY_COMPARE(finishedSpy.count(), 1);
+    QVERIFY(!stream.isSpliced());
+    ::close(clientB);
+#endif
+}
+
+QTEST_MAIN(SocketStream)
+#include "socketstream.moc"
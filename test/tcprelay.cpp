@@ -0,0 +1,171 @@
+#include "network/tcprelay.h"
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Reads come from input, and writes are taken in full straight away
+class FakeSocket : public QSS::RelaySocket
+{
+public:
+    std::string input;
+
+    qint64 read(char *data, qint64 maxSize) override
+    {
+        const size_t length = std::min<size_t>(maxSize, input.size());
+        std::memcpy(data, input.data(), length);
+        input.erase(0, length);
+        return length;
+    }
+
+    qint64 write(const char *, qint64 size) override { return size; }
+    qint64 bytesToWrite() const override { return 0; }
+    qintptr socketDescriptor() const override { return -1; }
+    void connectToHost(const QHostAddress &, uint16_t) override {}
+    void close() override {}
+    void setReadBufferSize(qint64) override {}
+    void setSocketOption(QAbstractSocket::SocketOption, const QVariant &) override {}
+    void setReadPaused(bool) override {}
+    QHostAddress localAddress() const override { return QHostAddress(); }
+    uint16_t localPort() const override { return 0; }
+    QHostAddress peerAddress() const override { return QHostAddress(); }
+    uint16_t peerPort() const override { return 0; }
+    QAbstractSocket::SocketError error() const override
+    {
+        return QAbstractSocket::UnknownSocketError;
+    }
+    QString errorString() const override { return QString(); }
+};
+
+// Counts what's read from the local socket
+class CountingRelay : public QSS::TcpRelay
+{
+public:
+    using QSS::TcpRelay::TcpRelay;
+
+    size_t localHandled = 0;
+
+protected:
+    void handleStageAddr(std::string &) override {}
+    void handleLocalTcpData(uint8_t *, size_t, size_t length) override
+    {
+        localHandled += length;
+    }
+    void handleRemoteTcpData(uint8_t *, size_t, size_t) override {}
+};
+
+// The most that's read at once, i.e. TcpRelay::RemoteRecvSize
+const size_t READ_SIZE = 65536;
+
+}  // namespace
+
+class TcpRelay : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void testReadBudget();
+    void testNoReadBudget();
+    void testReadBudgetQtSocket();
+
+private:
+    QSS::TimingWheel wheel;
+    FakeSocket *local;
+    std::unique_ptr<CountingRelay> relay;
+};
+
+void TcpRelay::init()
+{
+    local = new FakeSocket();
+    relay = std::make_unique<CountingRelay>(local, new FakeSocket(), &wheel, 60000,
+                                            QSS::Address(), []() {
+        return std::unique_ptr<QSS::Encryptor>();
+    });
+    local->input = std::string(16 * READ_SIZE, 'x');
+}
+
+void TcpRelay::cleanup()
+{
+    relay.reset();
+}
+
+void TcpRelay::testReadBudget()
+{
+    relay->setReadBudget(2 * READ_SIZE);
+    bool otherEventRan = false;
+    QTimer::singleShot(0, [&otherEventRan]() {
+        otherEventRan = true;
+    });
+
+    // The rest is left until the events queued in the meantime have run
+    emit local->readyRead();
+    QCOMPARE(relay->localHandled, 2 * READ_SIZE);
+    QVERIFY(!otherEventRan);
+
+    QTRY_COMPARE(relay->localHandled, 16 * READ_SIZE);
+    QVERIFY(otherEventRan);
+    QVERIFY(local->input.empty());
+}
+
+void TcpRelay::testNoReadBudget()
+{
+    // Reads once per readyRead, and doesn't carry on by itself
+    emit local->readyRead();
+    QCOMPARE(relay->localHandled, READ_SIZE);
+    QTest::qWait(50);
+    QCOMPARE(relay->localHandled, READ_SIZE);
+
+    emit local->readyRead();
+    QCOMPARE(relay->localHandled, 2 * READ_SIZE);
+}
+
+void TcpRelay::testReadBudgetQtSocket()
+{
+#ifndef Q_OS_UNIX
+    QSKIP("QtRelaySocket reads once per readyRead on this platform");
+#endif
+    const size_t length = 8 * READ_SIZE;
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(client.waitForConnected());
+    // Everything waits in the kernel before the relay gets the socket
+    client.write(QByteArray(length, 'x'));
+    while (client.bytesToWrite() > 0) {
+        QVERIFY(client.waitForBytesWritten(5000));
+    }
+    QVERIFY(server.waitForNewConnection(5000));
+    QTcpSocket *accepted = server.nextPendingConnection();
+    accepted->setParent(nullptr);
+
+    auto socket = new QSS::QtRelaySocket(accepted);
+    // Around the slot of the relay, which is connected in between
+    size_t before = 0;
+    size_t most = 0;
+    std::unique_ptr<CountingRelay> qtRelay;
+    connect(socket, &QSS::RelaySocket::readyRead, [&]() {
+        before = qtRelay->localHandled;
+    });
+    qtRelay = std::make_unique<CountingRelay>(socket, new FakeSocket(), &wheel, 60000,
+                                              QSS::Address(), []() {
+        return std::unique_ptr<QSS::Encryptor>();
+    });
+    qtRelay->setReadBudget(2 * READ_SIZE);
+    connect(socket, &QSS::RelaySocket::readyRead, [&]() {
+        most = std::max(most, qtRelay->localHandled - before);
+    });
+
+    QTRY_COMPARE(qtRelay->localHandled, length);
+    // More than QTcpSocket's buffer, but no more than the budget
+    QVERIFY(most > READ_SIZE);
+    QVERIFY(most <= 2 * READ_SIZE);
+}
+
+QTEST_MAIN(TcpRelay)
+#include "tcprelay.moc"
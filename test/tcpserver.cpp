@@ -0,0 +1,185 @@
+#include "network/reuseport.h"
+#include "network/tcprelay.h"
+#include "network/tcpserver.h"
+#include "util/common.h"
+#include "util/registry.h"
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <set>
+
+class TcpServer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testShardedSpread();
+    void testConnectionIds();
+    void testInPlaceWorker();
+    void testFastOpenCounters_data();
+    void testFastOpenCounters();
+};
+
+void TcpServer::testShardedSpread()
+{
+    if (!QSS::ReusePort::isSupported()) {
+        QSKIP("SO_REUSEPORT is unsupported");
+    }
+
+    // The shards must share a port, so find a free one first
+    QTcpServer probe;
+    QVERIFY(probe.listen(QHostAddress::LocalHost));
+    const quint16 port = probe.serverPort();
+    probe.close();
+
+    const int workers = 4;
+    QSS::TcpServer server([]() {
+        return std::make_unique<QSS::Encryptor>("aes-256-cfb", "test");
+    }, 60, false, false, QSS::Address("127.0.0.1", port), workers);
+    QVERIFY(server.listenSharded(QHostAddress::LocalHost, port, false));
+    QVERIFY(server.isSharded());
+    QVERIFY(server.isListeningAll());
+    // The server itself doesn't listen, only its workers do
+    QVERIFY(!server.isListening());
+
+    // The kernel hashes each connection to one of the shards
+    const int connections = 64;
+    std::vector<std::unique_ptr<QTcpSocket>> clients;
+    for (int i = 0; i < connections; ++i) {
+        clients.push_back(std::make_unique<QTcpSocket>());
+        clients.back()->connectToHost(QHostAddress::LocalHost, port);
+        QVERIFY(clients.back()->waitForConnected());
+    }
+
+    auto total = [&server]() {
+        int count = 0;
+        for (int i = 0; i < server.workerCount(); ++i) {
+            count += server.connectionCount(i);
+        }
+        return count;
+    };
+    QTRY_COMPARE(total(), connections);
+    int busyWorkers = 0;
+    for (int i = 0; i < workers; ++i) {
+        if (server.connectionCount(i) > 0) {
+            ++busyWorkers;
+        }
+    }
+    QVERIFY2(busyWorkers > 1, "All connections were accepted by one worker");
+
+    server.closeAll();
+    QVERIFY(!server.isListeningAll());
+    QTcpSocket refused;
+    refused.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(!refused.waitForConnected(1000));
+}
+
+void TcpServer::testConnectionIds()
+{
+    QSS::TcpServer server([]() {
+        return std::make_unique<QSS::Encryptor>("aes-256-cfb", "test");
+    }, 60, false, false, QSS::Address(), 2);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    // Spread over both workers by the least connections dispatch
+    const int connections = 4;
+    std::vector<std::unique_ptr<QTcpSocket>> clients;
+    for (int i = 0; i < connections; ++i) {
+        clients.push_back(std::make_unique<QTcpSocket>());
+        clients.back()->connectToHost(QHostAddress::LocalHost, server.serverPort());
+        QVERIFY(clients.back()->waitForConnected());
+    }
+    QTRY_COMPARE(server.connectionIds().size(), connections);
+
+    const QVector<quint64> ids = server.connectionIds();
+    std::set<quint64> unique(ids.begin(), ids.end());
+    QCOMPARE(unique.size(), size_t(connections));
+    std::set<uint32_t> workers;
+    for (quint64 id : ids) {
+        workers.insert(QSS::Registry<QSS::TcpRelay>::tagOf(id));
+    }
+    QCOMPARE(workers, (std::set<uint32_t> { 0, 1 }));
+
+    QVERIFY(server.closeConnection(ids.front()));
+    auto disconnected = [&clients]() {
+        int count = 0;
+        for (const auto &client : clients) {
+            if (client->state() == QAbstractSocket::UnconnectedState) {
+                ++count;
+            }
+        }
+        return count;
+    };
+    QTRY_COMPARE(disconnected(), 1);
+    QTRY_COMPARE(server.connectionIds().size(), connections - 1);
+    QVERIFY(!server.connectionIds().contains(ids.front()));
+    QVERIFY(!server.closeConnection(ids.front()));
+}
+
+void TcpServer::testInPlaceWorker()
+{
+    QSS::TcpServer server([]() {
+        return std::make_unique<QSS::Encryptor>("aes-256-cfb", "test");
+    }, 60, false, false, QSS::Address(), 0);
+    QCOMPARE(server.workerCount(), 1);
+    QCOMPARE(server.workerThread(0), server.thread());
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(client.waitForConnected());
+    QTRY_COMPARE(server.connectionCount(0), 1);
+}
+
+void TcpServer::testFastOpenCounters_data()
+{
+    QTest::addColumn<bool>("fastOpen");
+    QTest::newRow("enabled") << true;
+    QTest::newRow("disabled") << false;
+}
+
+void TcpServer::testFastOpenCounters()
+{
+    QFETCH(bool, fastOpen);
+
+    QTcpServer target;
+    QVERIFY(target.listen(QHostAddress::LocalHost));
+    std::vector<std::unique_ptr<QTcpSocket>> targetSockets;
+    connect(&target, &QTcpServer::newConnection, [&]() {
+        QTcpSocket *socket = target.nextPendingConnection();
+        targetSockets.emplace_back(socket);
+        connect(socket, &QTcpSocket::readyRead, [socket]() {
+            socket->write(socket->readAll());
+        });
+    });
+
+    QSS::TcpServer server([]() {
+        return std::make_unique<QSS::Encryptor>("aes-256-cfb", "test");
+    }, 60, false, false, QSS::Address());
+    if (!server.setEpollEngine(true)) {
+        QSKIP("The epoll engine is unsupported");
+    }
+    server.setFastOpen(fastOpen);
+    QVERIFY(server.listenSingle(QHostAddress::LocalHost, 0));
+
+    // Whether the kernel takes Fast Open or not, each reply counts once
+    const int connections = 3;
+    for (int i = 0; i < connections; ++i) {
+        QSS::Encryptor encryptor("aes-256-cfb", "test");
+        QTcpSocket client;
+        client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+        QVERIFY(client.waitForConnected());
+        const std::string data = QSS::Common::packAddress(QHostAddress::LocalHost,
+                                                          target.serverPort())
+                + std::string(100, 'x');
+        QSignalSpy readySpy(&client, &QTcpSocket::readyRead);
+        client.write(QByteArray::fromStdString(encryptor.encrypt(data)));
+        // The server runs on this thread, so the event loop must go on
+        QVERIFY(readySpy.wait());
+    }
+    const quint64 expected = fastOpen ? connections : 0;
+    QTRY_COMPARE(server.fastOpenAccepted() + server.fastOpenFallbacks(), expected);
+}
+
+QTEST_MAIN(TcpServer)
+#include "tcpserver.moc"
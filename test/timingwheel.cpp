@@ -0,0 +1,100 @@
+#include "util/timingwheel.h"
+#include <QtTest>
+#include <memory>
+#include <vector>
+
+class TimingWheel : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testExpire();
+    void testIdle();
+    void testStop();
+    void testLongTimeout();
+    void testDestroyOnExpiry();
+};
+
+void TimingWheel::testExpire()
+{
+    QSS::TimingWheel wheel(10);
+    int expired = 0;
+    QSS::TimingWheel::Timer timer(&wheel, [&expired]() { ++expired; });
+    QElapsedTimer elapsed;
+    elapsed.start();
+    timer.start(100);
+    QCOMPARE(wheel.count(), 1);
+    // Touching doesn't postpone a timer that isn't idle
+    timer.touch();
+    QTRY_COMPARE(expired, 1);
+    QVERIFY(elapsed.elapsed() >= 100);
+    QVERIFY(!timer.isActive());
+    QCOMPARE(wheel.count(), 0);
+}
+
+void TimingWheel::testIdle()
+{
+    QSS::TimingWheel wheel(10);
+    int expired = 0;
+    QSS::TimingWheel::Timer timer(&wheel, [&expired]() { ++expired; });
+    timer.start(100, true);
+    for (int i = 0; i < 10; ++i) {
+        QTest::qWait(30);
+        timer.touch();
+    }
+    QCOMPARE(expired, 0);
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QTRY_COMPARE(expired, 1);
+    QVERIFY(elapsed.elapsed() >= 80);
+}
+
+void TimingWheel::testStop()
+{
+    QSS::TimingWheel wheel(10);
+    int expired = 0;
+    QSS::TimingWheel::Timer timer(&wheel, [&expired]() { ++expired; });
+    timer.start(50);
+    timer.stop();
+    QCOMPARE(wheel.count(), 0);
+    // A timeout of 0 disables the timer
+    timer.start(0);
+    QVERIFY(!timer.isActive());
+    QTest::qWait(100);
+    QCOMPARE(expired, 0);
+}
+
+void TimingWheel::testLongTimeout()
+{
+    // Longer than a round of the wheel
+    QSS::TimingWheel wheel(1);
+    int expired = 0;
+    QSS::TimingWheel::Timer timer(&wheel, [&expired]() { ++expired; });
+    QElapsedTimer elapsed;
+    elapsed.start();
+    timer.start(QSS::TimingWheel::SLOTS * 2 + 100);
+    QTRY_COMPARE_WITH_TIMEOUT(expired, 1, 5000);
+    QVERIFY(elapsed.elapsed() >= qint64(QSS::TimingWheel::SLOTS * 2 + 100));
+}
+
+void TimingWheel::testDestroyOnExpiry()
+{
+    QSS::TimingWheel wheel(10);
+    std::vector<std::unique_ptr<QSS::TimingWheel::Timer> > timers;
+    int expired = 0;
+    for (int i = 0; i < 5; ++i) {
+        // The first to expire destroys all of them
+        timers.emplace_back(new QSS::TimingWheel::Timer(&wheel, [&]() {
+            ++expired;
+            timers.clear();
+        }));
+        timers.back()->start(50);
+    }
+    QCOMPARE(wheel.count(), 5);
+    QTRY_VERIFY(timers.empty());
+    QCOMPARE(expired, 1);
+    QCOMPARE(wheel.count(), 0);
+}
+
+QTEST_MAIN(TimingWheel)
+#include "timingwheel.moc"